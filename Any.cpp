@@ -1,10 +1,14 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <new>
 
 #include "Any.h"
 #include "error.h"
 #include "Stmt.h"
+#include "Memory.h"
 
 using std::cout, std::endl, std::string, std::stringstream;
 
@@ -37,96 +41,356 @@ std::string TypeToString(Type type)
         PROCESS_VAL(STRUCT)
         PROCESS_VAL(FUNCTION)
 
+        PROCESS_VAL(TO_INFER)
+
         PROCESS_VAL(UNKNOWN)
     }
 #undef PROCESS_VAL
     return std::string(s);
 }
 
+bool isIntegerType(Type type)
+{
+    switch (type) {
+        case(Type::CHAR):
+        case(Type::INT):
+        case(Type::NUMBER):
+        case(Type::S64):
+        case(Type::S32):
+        case(Type::S16):
+        case(Type::S8):
+        case(Type::U64):
+        case(Type::U32):
+        case(Type::U16):
+        case(Type::U8): return true;
+        default: return false;
+    }
+}
 
 ImprovedType::ImprovedType(Type t, TypeFlags f) : base(t), flags(f)
 {
 
 }
 
-MyStruct::MyStruct(Struct* d) : defn(d)
+// Every info pointer that ever got into an Any, they live as long as the program
+static vector<void*>& infoTable()
 {
-    int count = d->memberPositions.size();
-    members.reserve(count);
+    static vector<void*> infos = { nullptr };
+    return infos;
+}
+
+AnyType::AnyType(Type t, TypeFlags f) : base(t), flags(f) {}
+
+AnyType::AnyType(const ImprovedType& type) : base(type.base), flags(type.flags)
+{
+    if (!type.info) return;
+
+    static unordered_map<void*, unsigned int> indices;
+
+    auto found = indices.find(type.info);
+    if (found != indices.end()) {
+        infoIndex = found->second;
+        return;
+    }
 
+    infoIndex = infoTable().size();
+    infoTable().push_back(type.info);
+    indices[type.info] = infoIndex;
+}
+
+AnyType::operator ImprovedType() const
+{
+    ImprovedType type(base, flags);
+    type.info = info();
+    return type;
+}
+
+void* AnyType::info() const
+{
+    return infoIndex ? infoTable()[infoIndex] : nullptr;
+}
+
+int packedWidth(Type type)
+{
+    switch (type) {
+        case(Type::BOOL):
+        case(Type::CHAR):
+        case(Type::S8):
+        case(Type::U8):     return 1;
+        case(Type::S16):
+        case(Type::U16):    return 2;
+        case(Type::S32):
+        case(Type::U32):
+        case(Type::FLOAT):  return 4;
+        case(Type::INT):
+        case(Type::NUMBER):
+        case(Type::S64):
+        case(Type::U64):
+        case(Type::DOUBLE): return 8;
+        default:            return 0;
+    }
+}
+
+// Boxes the unboxed value at at
+static Any loadPacked(const ImprovedType& type, const unsigned char* at)
+{
+    Any any;
+    any.type = type;
+    switch (type.base) {
+        case(Type::BOOL):   any.value.Bool  = *(bool*) at; break;
+        case(Type::CHAR):
+        case(Type::U8):     any.value.Int   = *(uint8_t*) at; break;
+        case(Type::S8):     any.value.Int   = *(int8_t*) at; break;
+        case(Type::U16):    any.value.Int   = *(uint16_t*) at; break;
+        case(Type::S16):    any.value.Int   = *(int16_t*) at; break;
+        case(Type::U32):    any.value.Int   = *(uint32_t*) at; break;
+        case(Type::S32):    any.value.Int   = *(int32_t*) at; break;
+        case(Type::FLOAT):  any.value.Float = *(float*) at; break;
+        case(Type::DOUBLE): any.value.Float = *(double*) at; break;
+        default:            any.value.Int   = *(long long*) at; break;
+    }
+    return any;
+}
+
+// Whatever comes in becomes type, like it would in a typed variable
+static void storePacked(Type type, unsigned char* at, const Any& any)
+{
+    bool isFloat = any.type.base == Type::FLOAT || any.type.base == Type::DOUBLE;
+    long long i = isFloat ? (long long) any.value.Float : any.type.base == Type::BOOL ? any.value.Bool : any.value.Int;
+    double d = isFloat ? any.value.Float : (double) i;
+
+    switch (type) {
+        case(Type::BOOL):   *(bool*) at = isFloat ? d != 0 : i != 0; break;
+        case(Type::CHAR):
+        case(Type::U8):
+        case(Type::S8):     *(uint8_t*) at = i; break;
+        case(Type::U16):
+        case(Type::S16):    *(uint16_t*) at = i; break;
+        case(Type::U32):
+        case(Type::S32):    *(uint32_t*) at = i; break;
+        case(Type::FLOAT):  *(float*) at = d; break;
+        case(Type::DOUBLE): *(double*) at = d; break;
+        default:            *(long long*) at = i; break;
+    }
+}
+
+MyStruct::MyStruct(Struct* d, unsigned short site) : HeapObject(Kind::STRUCT, site), defn(d)
+{
+    int count = d->memberPositions.size();
     for (int i = 0; i < count; i++) {
-        Any any;
-        any.type = d->memberTypes[i];
-        any.value.Int = 0; //CLEANUP Strings are currently not initialised;
-        members.push_back(any);
+        if (d->memberWidths[i]) continue;
+
+        Any* any = new (boxed(i)) Any();
+        any->type = d->memberTypes[i];
+        any->value.Int = 0; //CLEANUP Strings are currently not initialised;
     }
+    Heap::add(this);
 }
 
-Any MyStruct::get(string name)
+MyStruct* MyStruct::make(Struct* defn)
 {
-    if (!defn->memberPositions.contains(name)) error("Struct member not defined.(reading)");
+    if (defn->size < 0) defn->layOut();
 
-    int index = defn->memberPositions[name];
+    // The unboxed members start out as 0
+    void* memory = ::operator new(sizeof(MyStruct) + defn->size);
+    memset((char*) memory + sizeof(MyStruct), 0, defn->size);
+    return new (memory) MyStruct(defn, Memory::site(MemoryKind::STRUCTS));
+}
 
-    return members[index];
+void MyStruct::destroy(MyStruct* st)
+{
+    for (int index : st->defn->boxedMembers) st->boxed(index)->~Any();
+    st->~MyStruct();
+    ::operator delete(st);
 }
 
-void MyStruct::set(string name, Any& any)
+Any* MyStruct::boxed(int index)
 {
-    if (!defn->memberPositions.contains(name)) error("Struct member not defined.(writing)");
+    return (Any*) (data() + defn->memberOffsets[index]);
+}
 
-    int index = defn->memberPositions[name];
+Any MyStruct::get(int index)
+{
+    if (!defn->memberWidths[index]) return *boxed(index);
+    return loadPacked(defn->memberTypes[index], data() + defn->memberOffsets[index]);
+}
 
-    members[index] = any;
+void MyStruct::set(int index, Any any)
+{
+    if (!defn->memberWidths[index]) *boxed(index) = std::move(any);
+    else storePacked(defn->memberTypes[index].base, data() + defn->memberOffsets[index], any);
 }
 
+Any MyStruct::get(const string& name, MemberCache* cache)
+{
+    return get(position(name, cache, "Struct member not defined.(reading)"));
+}
 
-MyArray::MyArray(ImprovedType t, int size) : type(t)
+void MyStruct::set(const string& name, Any any, MemberCache* cache)
 {
-    values.reserve(size);
-    for (int i = 0; i < size; i++) {
-        Any any;
-        any.type = t;
-        any.value.Int = 0;
-        values.push_back(any);
-        // CLEANUP: Right now Strings wouldn't have a default value in the Array
+    set(position(name, cache, "Struct member not defined.(writing)"), std::move(any));
+}
+
+// Only looks at the name when the cache saw a different kind of struct, and then only once
+int MyStruct::position(const string& name, MemberCache* cache, const char* message)
+{
+    if (cache && cache->defn == defn) return cache->index;
+
+    auto found = defn->memberPositions.find(name);
+    if (found == defn->memberPositions.end()) error(message);
+
+    if (cache) {
+        cache->defn = defn;
+        cache->index = found->second;
+    }
+    return found->second;
+}
+
+MyArray::MyArray(ImprovedType t, int s) : HeapObject(Kind::ARRAY, Memory::site(MemoryKind::ARRAYS)), type(t), size(s), width(packedWidth(t.base))
+{
+    if (size < 0) error("Arrays can't have a negative size");
+
+    if (width) {
+        data.resize((size_t) size * width);
+    } else {
+        values.reserve(size);
+        for (int i = 0; i < size; i++) {
+            Any any;
+            any.type = t;
+            any.value.Int = 0;
+            values.push_back(std::move(any));
+            // CLEANUP: Right now Strings wouldn't have a default value in the Array
+        }
     }
+    Heap::add(this);
 }
 
 Any MyArray::get(int index)
 {
-    if (index >= values.size()) error("ARRAY INDEX OUT OF BOUNDS EXCEPTION (reading)");
+    if (index < 0 || index >= size) error("ARRAY INDEX OUT OF BOUNDS EXCEPTION (reading)");
 
-    return values[index];
+    if (!width) return values[index];
+    return loadPacked(type, &data[(size_t) index * width]);
 }
 
-void MyArray::set(int index, Any& any)
+void MyArray::set(int index, Any any)
 {
-    if (index >= values.size()) error("ARRAY INDEX OUT OF BOUNDS EXCEPTION (writing)");
+    if (index < 0 || index >= size) error("ARRAY INDEX OUT OF BOUNDS EXCEPTION (writing)");
 
-    values[index] = any;
+    if (!width) values[index] = std::move(any);
+    else storePacked(type.base, &data[(size_t) index * width], any);
 }
 
 Value::Value() : Int(0) {
 
 }
 
+JaiString::JaiString(string t, bool i) : text(std::move(t)), interned(i)
+{
+}
+
+JaiString* JaiString::intern(const string& text)
+{
+    static unordered_map<string, JaiString*> table;
+
+    auto found = table.find(text);
+    if (found != table.end()) return found->second;
+
+    JaiString* str = new JaiString(text, true);
+    str->site = Memory::site(MemoryKind::STRINGS);
+    str->recount();
+    table.emplace(text, str);
+    return str;
+}
+
+vector<JaiString*> JaiString::spares;
+
+JaiString* JaiString::make()
+{
+    JaiString* str;
+    if (spares.empty()) {
+        str = new JaiString("");
+    } else {
+        str = spares.back();
+        spares.pop_back();
+        str->refs = 1;
+        Memory::reused++;
+    }
+    str->site = Memory::site(MemoryKind::STRINGS);
+    str->counted = sizeof(JaiString) + str->text.capacity();
+    Memory::allocated(str->site, str->counted);
+    return str;
+}
+
+void JaiString::recount()
+{
+    size_t now = sizeof(JaiString) + text.capacity();
+    if (counted) Memory::resized(site, counted, now);
+    else Memory::allocated(site, now);
+    counted = now;
+}
+
+void JaiString::free(JaiString* str)
+{
+    Memory::freed(str->site, str->counted);
+
+    if (spares.size() >= maxSpares || str->text.capacity() > maxSpareCapacity) {
+        delete str;
+        return;
+    }
+    str->text.clear();
+    spares.push_back(str);
+}
+
+// Copies just share the string, the last one to let go deletes it
+static JaiString* copyString(JaiString* str)
+{
+    if (str && !str->interned) str->refs++;
+    return str;
+}
+
+static void releaseString(JaiString* str)
+{
+    if (str && !str->interned && --str->refs == 0) JaiString::free(str);
+}
+
+HeapObject* Any::object() const
+{
+    if (type.flags & Flags::ARRAY) return (MyArray*) value.Ptr;
+    if (type.base == Type::STRUCT) return (MyStruct*) value.Ptr;
+    return nullptr;
+}
+
+// An array of strings is an array first
+static bool holdsString(const Any& any)
+{
+    return any.type.base == Type::STRING && !(any.type.flags & Flags::ARRAY);
+}
+
+// Objects don't go away when they lose their last ref, that's up to the Heap
+static void retain(HeapObject* object)
+{
+    if (object) object->refs++;
+}
+
+static void release(HeapObject* object)
+{
+    if (object) object->refs--;
+}
+
 Any::~Any()
 {
-    //cout << "DESTRUCTOR CALLED" << endl;
-    anyCount;
-    //TODO Figure out how to do this!
-    if (this->type.base == Type::STRING) delete this->value.String;
+    if (holdsString(*this)) releaseString(this->value.String);
+    else release(object());
 }
 
 Any::Any() : type(Type::UNKNOWN, 0), value() {
-    //cout << "NORMAL CONSTRUCTOR CALLED" << endl;
-    anyCount++;
+    Memory::anys++;
 }
 
 
 Any::Any(Any&& other) : type(other.type) {
-    //cout << "MOVE CONSTRUCTOR CALLED" << endl;
+    Memory::moves++;
     value = other.value;
 
     other.value.String = nullptr;
@@ -134,40 +398,73 @@ Any::Any(Any&& other) : type(other.type) {
 
 Any::Any(const Any& other) : type(other.type)
 {
-    anyCount++;
-    //cout << "COPY CONSTRUCTOR CALLED" << endl;
-    if (type.base == Type::STRING) {
-        value.String = new string(*other.value.String);
+    Memory::copies++;
+    if (holdsString(*this)) {
+        value.String = copyString(other.value.String);
     }  else {
         value = other.value;
+        retain(object());
     }
 }
 
 Any& Any::operator=(const Any& other)
 {
-    //cout << "Assignment Called"  << endl;
+    if (this == &other) return *this;
+    Memory::copies++;
+
+    // Take the new one before letting go of the old one, they can be the same
+    if (holdsString(other)) copyString(other.value.String);
+    else retain(other.object());
+    if (holdsString(*this)) releaseString(this->value.String);
+    else release(object());
+
     this->type = other.type;
+    this->value = other.value;
+    return *this;
+}
 
-    if (this->type.base == Type::STRING) delete this->value.String;
+Any& Any::operator=(Any&& other)
+{
+    if (this == &other) return *this;
+    Memory::moves++;
 
-    
-    if(other.type.base == Type::STRING) {
-        string* newString = new string(*other.value.String);
-        
-        this->value.String = newString;
-    } else {
-        this->value = other.value;
-    }
+    if (holdsString(*this)) releaseString(this->value.String);
+    else release(object());
+
+    this->type = other.type;
+    this->value = other.value;
+
+    other.value.String = nullptr;
     return *this;
 }
 
-#define DO_BASIC_MATH(left, op, right) \
+static bool isFloating(const Any& any)
+{
+    return any.type.base == Type::FLOAT || any.type.base == Type::DOUBLE;
+}
+
+// A float and an int meet: the other side gets converted instead of its bits being read as the wrong kind
+// Like the hardware, dividing by 0 or LLONG_MIN by -1 traps
+static long long divide(long long a, long long b) { return a / b; }
+
+static double floatOf(const Any& any)
+{
+    return isFloating(any) ? any.value.Float : (double) any.value.Int;
+}
+
+static long long intOf(const Any& any)
+{
+    return isFloating(any) ? (long long) any.value.Float : any.value.Int;
+}
+
+// The result takes the type of the left side
+#define DO_BASIC_MATH(left, op, intOp, right) \
     Any any; \
     any.type = left->type; \
     switch (left->type.base) { \
         case(Type::FLOAT): \
         case(Type::DOUBLE): { \
-            any.value.Float = left->value.Float op right.value.Float;  \
+            any.value.Float = left->value.Float op floatOf(right);  \
         } break; \
         case(Type::CHAR): \
         case(Type::INT): \
@@ -180,7 +477,7 @@ Any& Any::operator=(const Any& other)
         case(Type::U32): \
         case(Type::U16): \
         case(Type::U8): { \
-            any.value.Int = left->value.Int op right.value.Int; \
+            any.value.Int = intOp(left->value.Int, intOf(right)); \
         } break; \
         default: { \
             error("Wrong Arguments for binary Math Operator"); \
@@ -188,13 +485,18 @@ Any& Any::operator=(const Any& other)
     } \
     return any;
 
+// Compares as doubles when either side is a float
 #define DO_BASIC_BOOL(left, op, right) \
     Any any; \
     any.type.base = Type::BOOL; \
+    if (isFloating(right) && !isFloating(*left) && isIntegerType(left->type.base)) { \
+        any.value.Bool = floatOf(*left) op right.value.Float; \
+        return any; \
+    } \
     switch (left->type.base) { \
         case(Type::FLOAT): \
         case(Type::DOUBLE): { \
-            any.value.Bool = left->value.Float op right.value.Float;  \
+            any.value.Bool = left->value.Float op floatOf(right);  \
         } break; \
         case(Type::CHAR): \
         case(Type::INT): \
@@ -218,7 +520,7 @@ Any& Any::operator=(const Any& other)
 string Any::toString() const
 {
     switch (this->type.base) {
-        case(Type::STRING): return *this->value.String;
+        case(Type::STRING): return this->value.String ? this->value.String->text : "";
         case(Type::CHAR): return string(1, this->value.Char);
         case(Type::BOOL): return this->value.Bool ? "true" : "false";
         case(Type::FLOAT):
@@ -246,31 +548,99 @@ string Any::toString() const
     return "";
 }
 
-Any Any::add(const Any& other) 
+Any Any::add(const Any& other)
 {
     
     if (this->type.base == Type::STRING) {
         Any any;
         any.type = this->type;
-        any.value.String = new string(*this->value.String + other.toString());
+        JaiString* str = JaiString::make();
+        if (this->value.String) str->text = this->value.String->text;
+        if (other.type.base == Type::STRING) {
+            if (other.value.String) str->text += other.value.String->text;
+        } else {
+            str->text += other.toString();
+        }
+        str->recount();
+        any.value.String = str;
         return any;
     }
-    DO_BASIC_MATH(this, +, other);
+    DO_BASIC_MATH(this, +, wrapAdd, other);
+}
+
+Any Any::append(const Any& other)
+{
+    JaiString* str = this->value.String;
+    if (this->type.base != Type::STRING || !str || str->interned || str->refs != 1) return add(other);
+
+    if (other.type.base == Type::STRING) {
+        if (other.value.String) str->text += other.value.String->text;
+    } else {
+        str->text += other.toString();
+    }
+    str->recount();
+    return std::move(*this);
+}
+
+Any Any::concat(const Any* parts, int count)
+{
+    ASSERT(count > 0 && parts[0].type.base == Type::STRING);
+
+    // Everything that isn't a string yet has to become one before we know how long the result is,
+    // the usual short chain does that without going to the heap for the list
+    string small[8];
+    vector<string> big;
+    string* texts = small;
+    if (count > 8) {
+        big.resize(count);
+        texts = big.data();
+    }
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        if (parts[i].type.base == Type::STRING) {
+            if (parts[i].value.String) length += parts[i].value.String->text.size();
+        } else {
+            texts[i] = parts[i].toString();
+            length += texts[i].size();
+        }
+    }
+
+    JaiString* str = JaiString::make();
+    str->text.reserve(length);
+    for (int i = 0; i < count; i++) {
+        if (parts[i].type.base != Type::STRING) str->text += texts[i];
+        else if (parts[i].value.String) str->text += parts[i].value.String->text;
+    }
+    str->recount();
+
+    Any any;
+    any.type = parts[0].type;
+    any.value.String = str;
+    return any;
 }
 
 Any Any::sub(const Any& other) 
 {
-    DO_BASIC_MATH(this, -, other)
+    DO_BASIC_MATH(this, -, wrapSub, other)
 }
 
 Any Any::mul(const Any& other) 
 {
-    DO_BASIC_MATH(this, *, other)
+    DO_BASIC_MATH(this, *, wrapMul, other)
 }
 
 Any Any::div(const Any& other) 
 {
-    DO_BASIC_MATH(this, /, other)
+    DO_BASIC_MATH(this, /, divide, other)
+}
+
+// Two interned strings are only the same text if they're the same string
+static bool sameString(JaiString* a, JaiString* b)
+{
+    if (a == b) return true;
+    if (!a || !b) return (a ? a->text : "") == (b ? b->text : "");
+    if (a->interned && b->interned) return false;
+    return a->text == b->text;
 }
 
 Any Any::equal(const Any& other) 
@@ -278,7 +648,7 @@ Any Any::equal(const Any& other)
     if (this->type.base == Type::STRING) {
         Any any;
         any.type.base = Type::BOOL;
-        any.value.Bool = *this->value.String == *other.value.String;
+        any.value.Bool = sameString(this->value.String, other.value.String);
         return any;
     }
     DO_BASIC_BOOL(this, ==, other)    
@@ -286,10 +656,10 @@ Any Any::equal(const Any& other)
 
 Any Any::notEqual(const Any& other) 
 {
-    if (this->type.base != Type::STRING) {
+    if (this->type.base == Type::STRING) {
         Any any;
         any.type.base = Type::BOOL;
-        any.value.Bool = *this->value.String == *other.value.String;
+        any.value.Bool = !sameString(this->value.String, other.value.String);
         return any;
     }
     DO_BASIC_BOOL(this, !=, other)
@@ -345,7 +715,7 @@ Any Any::neg()
         case(Type::U32): 
         case(Type::U16): 
         case(Type::U8): { 
-            any.value.Int = - this->value.Int;
+            any.value.Int = wrapSub(0, this->value.Int);
         } break; 
         default: { 
             error("Wrong Arguments for Unary Neg Operator"); 
@@ -379,31 +749,31 @@ Any Any::getArrayMember(int index)
     return array->get(index);
 }
 
-void Any::setArrayMember(int index, Any& any)
+void Any::setArrayMember(int index, Any any)
 {
     if (!(type.flags & Flags::ARRAY)) error("tryed to index something that isn't an Array (writing)");
 
     MyArray* array = (MyArray*) value.Ptr;
 
-    array->set(index, any);
+    array->set(index, std::move(any));
 }
 
-Any Any::getStructMember(string name)
+Any Any::getStructMember(const string& name, MemberCache* cache)
 {
     if (type.base != Type::STRUCT) error("tried to index something that isn't a Struct (reading)");
 
     MyStruct* st = (MyStruct*) value.Ptr;
 
-    return st->get(name);
+    return st->get(name, cache);
 }
 
-void Any::setStructMember(string name, Any& any)
+void Any::setStructMember(const string& name, Any any, MemberCache* cache)
 {
     if (type.base != Type::STRUCT) error("tried to index something that isn't a Struct (writing)");
 
     MyStruct* st = (MyStruct*) value.Ptr;
 
-    return st->set(name, any);
+    return st->set(name, std::move(any), cache);
 }
 
 Any Any::getEnumValue(string name)
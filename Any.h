@@ -3,8 +3,12 @@
 #include <string>
 #include <vector>
 #include <tuple>
+#include <iostream>
+
+#include "Heap.h"
 
 struct Struct;
+struct JaiString;
 
 namespace Flags {
     const int POINTER = 1;
@@ -17,14 +21,19 @@ union Value {
         double Float;
         bool Bool;
         char Char;
-        std::string* String;
+        JaiString* String;
         void* Ptr;
         Value();
 };
 
 typedef int TypeFlags;
 
-enum class Type {
+// Ints wrap around like in the jit and the native backends, signed overflow in C++ is undefined so it goes through unsigned
+inline long long wrapAdd(long long a, long long b) { return (long long) ((unsigned long long) a + (unsigned long long) b); }
+inline long long wrapSub(long long a, long long b) { return (long long) ((unsigned long long) a - (unsigned long long) b); }
+inline long long wrapMul(long long a, long long b) { return (long long) ((unsigned long long) a * (unsigned long long) b); }
+
+enum class Type : unsigned char {
     NUMBER,
     STRING,
     FLOAT,
@@ -53,32 +62,89 @@ enum class Type {
 
 std::string TypeToString(Type type);
 
+// All the Types that keep their value in Value::Int
+bool isIntegerType(Type type);
+
 // CLEANUP: This system will have problems with arrays of pointers or pointers to arrays
 struct ImprovedType {
     Type base = Type::UNKNOWN;
     TypeFlags flags = 0;
-    void* info;
+    void* info = nullptr;
 
     ImprovedType(Type t, TypeFlags f = 0);
 };
 
+// The type an Any carries around, half the size of an ImprovedType so an Any fits into 16 bytes.
+// Only declarations need the info pointer, so it lives in a side table and this keeps its index.
+struct AnyType {
+    Type base = Type::UNKNOWN;
+    unsigned char flags = 0;
+    unsigned int infoIndex = 0;     // 0 is no info
+
+    AnyType(Type t = Type::UNKNOWN, TypeFlags f = 0);
+    AnyType(const ImprovedType& type);
+
+    operator ImprovedType() const;
+    void* info() const;
+};
+
+// The runtime string, copies of an Any share it and count how many they are (refs).
+// It only changes when refs is 1, everything else copies it first (see Any::append).
+// std::string keeps short text in its own inline buffer, so a small one is a single allocation.
+// Literals and identifiers get interned: one per distinct text that lives as long as the program,
+// they don't count refs and two of them are equal only if they're the same pointer.
+// The ones the program makes while it runs are mostly temporaries that die in the same statement,
+// so when one goes away it's kept as a spare and the next make hands it out again, buffer and all.
+struct JaiString {
+    std::string text;
+    const bool interned;
+    int refs = 1;
+
+    JaiString(std::string text, bool interned = false);
+
+    unsigned short site = 0;    // where Memory counts it
+    size_t counted = 0;         // and with how many bytes
+
+    static JaiString* intern(const std::string& text);
+
+    // An empty string with refs 1, a spare one if there is
+    static JaiString* make();
+    // Tells Memory how big it is now, after the text changed
+    void recount();
+    // For when refs got to 0
+    static void free(JaiString* str);
+
+    static std::vector<JaiString*> spares;
+    static const size_t maxSpares = 256;
+    static const size_t maxSpareCapacity = 4096;   // bigger buffers go back to the allocator
+};
+
+// Where a member was in the kind of struct the access saw last (a monomorphic inline cache).
+// As long as the next one is the same kind, finding the member is a pointer compare.
+struct MemberCache {
+    Struct* defn = nullptr;
+    int index = -1;
+};
+
 struct Any {
-    ImprovedType type;
+    AnyType type;
     Value value;
 
-    //CLEANUP remove this
-    static int anyCount; 
-
     Any();
     Any(Any&& other);
     Any(const Any& other);
     ~Any();
 
     Any& operator=(const Any& other);
+    Any& operator=(Any&& other);
 
     std::string toString() const;
 
     Any add(const Any& other);
+    // add for a left side that's a temporary, a string only it holds grows in place
+    Any append(const Any& other);
+    // parts[0] + parts[1] + ... when parts[0] is a string, with a single allocation
+    static Any concat(const Any* parts, int count);
     Any sub(const Any& other);
     Any mul(const Any& other);
     Any div(const Any& other);
@@ -98,31 +164,55 @@ struct Any {
 
     // Functions for when its an Array
     Any  getArrayMember(int index);
-    void setArrayMember(int index, Any& any);
+    void setArrayMember(int index, Any any);
     // Functions for when its a Struct
 
-    Any getStructMember(std::string name);
-    void setStructMember(std::string name, Any& any);
+    Any getStructMember(const std::string& name, MemberCache* cache = nullptr);
+    void setStructMember(const std::string& name, Any any, MemberCache* cache = nullptr);
 
     Any getEnumValue(std::string name);
+
+    // The struct or array it points at, if it does
+    HeapObject* object() const;
 };
 
-struct MyStruct {
+// How many bytes a value of type takes unboxed in an array or struct, 0 if it has to stay an Any
+int packedWidth(Type type);
+
+// A struct is one allocation: the members come right after it, where defn->layOut put them.
+// Numbers, chars and bools are unboxed like in MyArray, the other members are Anys.
+// Make them with make and get rid of them with destroy, not new and delete.
+struct MyStruct : HeapObject {
     Struct* defn;
-    std::vector<Any> members;
 
-    MyStruct(Struct* d);
+    static MyStruct* make(Struct* defn);
+    static void destroy(MyStruct* st);
 
-    Any  get(std::string name);
-    void set(std::string name, Any& any);
+    unsigned char* data() { return (unsigned char*) (this + 1); }
+    // Where a member that stays an Any is
+    Any* boxed(int index);
+
+    Any  get(int index);
+    void set(int index, Any any);
+    Any  get(const std::string& name, MemberCache* cache = nullptr);
+    void set(const std::string& name, Any any, MemberCache* cache = nullptr);
+    int  position(const std::string& name, MemberCache* cache, const char* message);
+
+    MyStruct(Struct* d, unsigned short site);
 };
 
-struct MyArray {
+// Numbers, chars and bools sit unboxed in data, as many bytes each as their type takes (width),
+// a u8[1000000] is a megabyte. get and set box and unbox them.
+// Everything else, like strings and structs, stays an Any in values.
+struct MyArray : HeapObject {
     ImprovedType type;
+    int size;
+    int width;
+    std::vector<unsigned char> data;
     std::vector<Any> values;
 
     MyArray(ImprovedType type, int size);
-    
+
     Any  get(int index);
-    void set(int index, Any& any);
+    void set(int index, Any any);
 };
\ No newline at end of file
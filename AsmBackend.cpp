@@ -0,0 +1,991 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "AsmBackend.h"
+#include "error.h"
+
+using namespace std;
+
+// Goes in front of every program. The heap only grows, so everything on it starts out zeroed
+static const char* runtime = R"RT(    .section .bss
+    .align 8
+jai_heap:       .skip 8
+jai_heap_end:   .skip 8
+jai_out_used:   .skip 8
+jai_out:        .skip 65536
+
+    .section .rodata
+jai_true:       .asciz "true"
+jai_false:      .asciz "false"
+jai_empty:      .asciz ""
+jai_prompt:     .ascii "> "
+jai_newline:    .ascii "\n"
+jai_banner:     .ascii "------------------------- ERROR: -------------------------\n"
+    .set jai_banner_length, . - jai_banner
+jai_no_memory:  .asciz "Out of memory"
+jai_reading:    .asciz "ARRAY INDEX OUT OF BOUNDS EXCEPTION (reading)"
+jai_writing:    .asciz "ARRAY INDEX OUT OF BOUNDS EXCEPTION (writing)"
+
+    .text
+    .globl _start
+_start:
+    # 1 GB of stack, deep recursion like sum(1000000) doesn't fit into the usual 8 MB
+    mov $9, %eax
+    xor %edi, %edi
+    mov $0x40000000, %esi
+    mov $3, %edx                    # PROT_READ | PROT_WRITE
+    mov $0x4022, %r10d              # MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+    mov $-1, %r8
+    xor %r9d, %r9d
+    syscall
+    cmp $-4096, %rax
+    ja jai_out_of_memory
+    lea 0x40000000(%rax), %rsp
+
+    # and 4 GB of heap
+    mov $9, %eax
+    xor %edi, %edi
+    movabs $0x100000000, %rsi
+    mov $3, %edx
+    mov $0x4022, %r10d
+    mov $-1, %r8
+    xor %r9d, %r9d
+    syscall
+    cmp $-4096, %rax
+    ja jai_out_of_memory
+    mov %rax, jai_heap(%rip)
+    movabs $0x100000000, %rcx
+    add %rcx, %rax
+    mov %rax, jai_heap_end(%rip)
+
+    call f_main
+    xor %edi, %edi
+    jmp jai_exit
+
+# rdi = exit code
+jai_exit:
+    push %rdi
+    call jai_flush
+    pop %rdi
+    mov $60, %eax
+    syscall
+
+jai_flush:
+    mov jai_out_used(%rip), %rdx
+    lea jai_out(%rip), %rsi
+1:
+    test %rdx, %rdx
+    jz 2f
+    mov $1, %eax
+    mov $1, %edi
+    syscall
+    test %rax, %rax
+    jle 2f
+    add %rax, %rsi
+    sub %rax, %rdx
+    jmp 1b
+2:
+    movq $0, jai_out_used(%rip)
+    ret
+
+# rdi = text, rsi = length
+jai_write:
+    test %rsi, %rsi
+    jz 2f
+    mov jai_out_used(%rip), %rax
+    cmp $65536, %rax
+    jb 1f
+    push %rdi
+    push %rsi
+    call jai_flush
+    pop %rsi
+    pop %rdi
+    xor %eax, %eax
+1:
+    lea jai_out(%rip), %rcx
+    movzbl (%rdi), %edx
+    mov %dl, (%rcx,%rax)
+    inc %rax
+    mov %rax, jai_out_used(%rip)
+    inc %rdi
+    dec %rsi
+    jmp jai_write
+2:
+    ret
+
+# rdi = message, doesn't come back
+jai_error:
+    push %rdi
+    lea jai_banner(%rip), %rdi
+    mov $jai_banner_length, %esi
+    call jai_write
+    mov (%rsp), %rdi
+    call jai_strlen
+    pop %rdi
+    mov %rax, %rsi
+    call jai_write
+    lea jai_newline(%rip), %rdi
+    mov $1, %esi
+    call jai_write
+    mov $255, %edi
+    jmp jai_exit
+
+jai_out_of_memory:
+    lea jai_no_memory(%rip), %rdi
+    jmp jai_error
+
+jai_bounds_reading:
+    lea jai_reading(%rip), %rdi
+    jmp jai_error
+
+jai_bounds_writing:
+    lea jai_writing(%rip), %rdi
+    jmp jai_error
+
+# rdi = bytes
+jai_alloc:
+    add $7, %rdi
+    and $-8, %rdi
+    mov jai_heap(%rip), %rax
+    mov %rax, %rcx
+    add %rdi, %rcx
+    jc jai_out_of_memory
+    cmp jai_heap_end(%rip), %rcx
+    ja jai_out_of_memory
+    mov %rcx, jai_heap(%rip)
+    ret
+
+# rdi = count, the count goes in front of the elements
+jai_new_array:
+    mov %rdi, %rax
+    shr $40, %rax
+    jnz jai_out_of_memory
+    push %rdi
+    lea 8(,%rdi,8), %rdi
+    call jai_alloc
+    pop %rdi
+    mov %rdi, (%rax)
+    ret
+
+# rdi = string
+jai_strlen:
+    xor %eax, %eax
+    test %rdi, %rdi
+    jz 2f
+1:
+    cmpb $0, (%rdi,%rax)
+    je 2f
+    inc %rax
+    jmp 1b
+2:
+    ret
+
+# rdi = left, rsi = right
+jai_concat:
+    push %rbx
+    push %r12
+    push %r13
+    push %r14
+    mov %rdi, %rbx
+    mov %rsi, %r12
+    call jai_strlen
+    mov %rax, %r13
+    mov %r12, %rdi
+    call jai_strlen
+    mov %rax, %r14
+    lea 1(%r13,%r14), %rdi
+    call jai_alloc
+    mov %rax, %rdx
+    mov %rax, %rdi
+    mov %rbx, %rsi
+    mov %r13, %rcx
+    rep movsb
+    mov %r12, %rsi
+    mov %r14, %rcx
+    rep movsb
+    mov %rdx, %rax
+    pop %r14
+    pop %r13
+    pop %r12
+    pop %rbx
+    ret
+
+# rdi = left, rsi = right, rax = 1 if they're the same
+jai_equal:
+    lea jai_empty(%rip), %rax
+    test %rdi, %rdi
+    cmovz %rax, %rdi
+    test %rsi, %rsi
+    cmovz %rax, %rsi
+1:
+    movzbl (%rdi), %eax
+    movzbl (%rsi), %ecx
+    cmp %ecx, %eax
+    jne 2f
+    test %eax, %eax
+    jz 3f
+    inc %rdi
+    inc %rsi
+    jmp 1b
+2:
+    xor %eax, %eax
+    ret
+3:
+    mov $1, %eax
+    ret
+
+# rdi = value, the digits get written backwards into the stack
+jai_from_int:
+    sub $32, %rsp
+    lea 31(%rsp), %rsi
+    movb $0, (%rsi)
+    mov %rdi, %rax
+    mov %rdi, %r8
+    test %rax, %rax
+    jns 1f
+    neg %rax
+1:
+    mov $10, %ecx
+2:
+    xor %edx, %edx
+    div %rcx
+    add $48, %dl
+    dec %rsi
+    mov %dl, (%rsi)
+    test %rax, %rax
+    jnz 2b
+    test %r8, %r8
+    jns 3f
+    dec %rsi
+    movb $45, (%rsi)
+3:
+    mov %rsi, %rdi
+    xor %esi, %esi
+    call jai_concat
+    add $32, %rsp
+    ret
+
+# rdi = char
+jai_from_char:
+    push %rdi
+    mov $2, %edi
+    call jai_alloc
+    pop %rdi
+    mov %dil, (%rax)
+    ret
+
+# rdi = bool
+jai_from_bool:
+    lea jai_true(%rip), %rax
+    test %rdi, %rdi
+    jnz 1f
+    lea jai_false(%rip), %rax
+1:
+    ret
+
+# rdi = string
+jai_printf:
+    push %rdi
+    lea jai_prompt(%rip), %rdi
+    mov $2, %esi
+    call jai_write
+    mov (%rsp), %rdi
+    call jai_strlen
+    pop %rdi
+    mov %rax, %rsi
+    call jai_write
+    lea jai_newline(%rip), %rdi
+    mov $1, %esi
+    jmp jai_write
+
+)RT";
+
+static bool isInt(ImprovedType type)
+{
+    return !type.flags && (isIntegerType(type.base) || type.base == Type::ENUM);
+}
+
+static bool isString(ImprovedType type)
+{
+    return !type.flags && type.base == Type::STRING;
+}
+
+static bool isBool(ImprovedType type)
+{
+    return !type.flags && type.base == Type::BOOL;
+}
+
+// The lowest byte of the registers we use
+static string low(const string& reg)
+{
+    if (reg == "%rax") return "%al";
+    if (reg == "%rcx") return "%cl";
+    if (reg == "%rdx") return "%dl";
+    if (reg == "%rsi") return "%sil";
+    return "%dil";
+}
+
+// The 16 and 32 bit names of %rcx and %rdx
+static string word(const string& reg)   { return reg == "%rcx" ? "%cx" : "%dx"; }
+static string dword(const string& reg)  { return reg == "%rcx" ? "%ecx" : "%edx"; }
+
+AsmBackend::AsmBackend(IRModule* m, unordered_map<string, Struct*>& s, unordered_map<string, Enum*>& e)
+    : module(m), structs(s), enums(e) {}
+
+void AsmBackend::fail(const string& what)
+{
+    if (unsupported.empty()) unsupported = what;
+}
+
+string AsmBackend::compile(IRFunction* main)
+{
+    if (!main) {
+        fail("programs without main");
+        return "";
+    }
+
+    for (auto f : module->functions) byName[f->name] = f;
+
+    vector<IRFunction*> order;
+    unordered_set<IRFunction*> seen;
+    collectFunctions(main, order, seen);
+
+    inferTypes(order);
+
+    stringstream file;
+    file << runtime;
+
+    for (auto f : order) function(f);
+    file << out.str();
+
+    file << "    .section .rodata\n";
+    for (int i = 0; i < strings.size(); i++) {
+        file << ".Lstring" << i << ": .asciz \"";
+        for (unsigned char c : strings[i]) {
+            if (c == '"' || c == '\\') file << '\\' << c;
+            else if (c < 32 || c > 126) file << '\\' << oct << setw(3) << setfill('0') << (int) c << dec;
+            else file << c;
+        }
+        file << "\"\n";
+    }
+
+    file << "    .section .note.GNU-stack,\"\",@progbits\n";
+
+    if (!unsupported.empty()) return "";
+    return file.str();
+}
+
+// Only what main can reach, functions that never run can't stop us
+void AsmBackend::collectFunctions(IRFunction* fn, vector<IRFunction*>& order, unordered_set<IRFunction*>& seen)
+{
+    if (seen.contains(fn)) return;
+    seen.insert(fn);
+    order.push_back(fn);
+
+    for (auto block : fn->blocks) {
+        for (auto inst : block->insts) {
+            if (inst->op != IROp::CALL || inst->name == "printf") continue;
+
+            if (!byName.contains(inst->name)) fail("calls to " + inst->name);
+            else collectFunctions(byName[inst->name], order, seen);
+        }
+    }
+}
+
+// The IR doesn't know what fields and inferred return types are, we need that for strings.
+// Like IRBuilder::inferTypes a value only ever goes from unknown to known, until nothing changes.
+void AsmBackend::inferTypes(vector<IRFunction*>& order)
+{
+    for (auto f : order) {
+        for (auto block : f->blocks) {
+            for (auto inst : block->insts) types.insert({ inst, resolve(inst->type) });
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (auto f : order) {
+            for (auto block : f->blocks) {
+                for (auto inst : block->insts) {
+                    if (typeOf(inst).base != Type::UNKNOWN) continue;
+
+                    ImprovedType type(Type::UNKNOWN);
+                    switch(inst->op) {
+                        case (IROp::PHI): {
+                            for (auto arg : inst->args) {
+                                if (typeOf(arg).base != Type::UNKNOWN) {
+                                    type = typeOf(arg);
+                                    break;
+                                }
+                            }
+                        } break;
+
+                        case (IROp::ADD):
+                        case (IROp::SUB):
+                        case (IROp::MUL):
+                        case (IROp::DIV):
+                        case (IROp::NEG): if (!inst->args.empty()) type = typeOf(inst->args[0]); break;
+
+                        case (IROp::GET_FIELD): {
+                            IRValue* object = inst->args[0];
+                            if (object->op == IROp::LOAD_GLOBAL && enums.contains(object->name)) {
+                                type = ImprovedType(Type::INT);
+                                break;
+                            }
+
+                            int index = memberIndex(inst);
+                            if (index >= 0) type = resolve(structs[*(string*) typeOf(object).info]->memberTypes[index]);
+                        } break;
+
+                        case (IROp::GET_INDEX): {
+                            type = typeOf(inst->args[0]);
+                            if (type.flags == Flags::ARRAY) type.flags = 0;
+                            else type = ImprovedType(Type::UNKNOWN);
+                        } break;
+
+                        // -> Vector2 doesn't keep the name of the struct, so it comes from the returns
+                        case (IROp::CALL): {
+                            if (!byName.contains(inst->name)) break;
+
+                            for (auto calleeBlock : byName[inst->name]->blocks) {
+                                IRValue* ret = calleeBlock->terminator();
+                                if (ret && ret->op == IROp::RETURN && !ret->args.empty() && typeOf(ret->args[0]).base != Type::UNKNOWN) {
+                                    type = typeOf(ret->args[0]);
+                                    break;
+                                }
+                            }
+                        } break;
+
+                        default: break;
+                    }
+
+                    if (type.base == Type::UNKNOWN) continue;
+                    types.insert_or_assign(inst, type);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+ImprovedType AsmBackend::resolve(ImprovedType type)
+{
+    type.flags &= ~Flags::CONSTANT;
+
+    if (type.base == Type::TO_INFER && type.info) {
+        string* name = (string*) type.info;
+        if (structs.contains(*name)) type.base = Type::STRUCT;
+        else if (enums.contains(*name)) type.base = Type::ENUM;
+    }
+    if (type.base == Type::TO_INFER) type.base = Type::UNKNOWN;
+    return type;
+}
+
+ImprovedType AsmBackend::typeOf(IRValue* value)
+{
+    auto found = types.find(value);
+    if (found == types.end()) return resolve(value->type);
+    return found->second;
+}
+
+// Where a member the Resolver couldn't figure out sits in its struct, -1 if we can't either
+int AsmBackend::memberIndex(IRValue* inst)
+{
+    ImprovedType type = typeOf(inst->args[0]);
+    if (type.base != Type::STRUCT || type.flags || !type.info || !structs.contains(*(string*) type.info)) return -1;
+
+    Struct* s = structs[*(string*) type.info];
+    if (!s->memberPositions.contains(inst->name)) return -1;
+    return s->memberPositions[inst->name];
+}
+
+void AsmBackend::line(const string& text)
+{
+    out << "    " << text << "\n";
+}
+
+// Params stay where the caller pushed them, above the return address and the saved rbp
+string AsmBackend::slot(IRValue* value)
+{
+    if (value->op == IROp::PARAM) return to_string(16 + 8 * value->index) + "(%rbp)";
+    return to_string(-8 * (slots[value] + 1)) + "(%rbp)";
+}
+
+string AsmBackend::label(IRBlock* block)
+{
+    return ".L" + fn->name + "." + to_string(block->id);
+}
+
+void AsmBackend::load(IRValue* value, const string& reg)
+{
+    if (value->op == IROp::LOAD_GLOBAL) {
+        fail(fn->name + " using " + value->name + ", it's a variable of the caller");
+        return;
+    }
+
+    if (value->op != IROp::CONST) {
+        line("mov " + slot(value) + ", " + reg);
+        return;
+    }
+
+    Any& any = value->constant;
+    long long number = 0;
+
+    switch(any.type.base) {
+        case (Type::STRING): {
+            line("lea .Lstring" + to_string(strings.size()) + "(%rip), " + reg);
+            strings.push_back(any.value.String->text);
+            return;
+        }
+        case (Type::BOOL):  number = any.value.Bool; break;
+        case (Type::CHAR):  number = any.value.Char; break;
+        case (Type::FLOAT):
+        case (Type::DOUBLE): {
+            fail("floats");
+            return;
+        }
+        default: {
+            if (!isIntegerType(any.type.base) && any.type.base != Type::ENUM) {
+                fail("constants of type " + TypeToString(any.type.base));
+                return;
+            }
+            number = any.value.Int;
+        }
+    }
+
+    if (number >= INT32_MIN && number <= INT32_MAX) line("mov $" + to_string(number) + ", " + reg);
+    else line("movabs $" + to_string(number) + ", " + reg);
+}
+
+void AsmBackend::store(IRValue* value, const string& reg)
+{
+    line("mov " + reg + ", " + slot(value));
+}
+
+// 0 or 1 in reg, like Interpreter::isTruthy everything that isn't a number or a bool is false
+// Elements and members keep 8 bytes each here, but they wrap around at the width the Interpreter keeps them in
+void AsmBackend::narrow(Type type, const string& reg)
+{
+    switch(type) {
+        case (Type::CHAR):
+        case (Type::U8):    line("movzbq " + low(reg) + ", " + reg); break;
+        case (Type::S8):    line("movsbq " + low(reg) + ", " + reg); break;
+        case (Type::U16):   line("movzwq " + word(reg) + ", " + reg); break;
+        case (Type::S16):   line("movswq " + word(reg) + ", " + reg); break;
+        case (Type::U32):   line("mov " + dword(reg) + ", " + dword(reg)); break;
+        case (Type::S32):   line("movslq " + dword(reg) + ", " + reg); break;
+        default: break;
+    }
+}
+
+void AsmBackend::truthy(IRValue* value, const string& reg)
+{
+    ImprovedType type = typeOf(value);
+
+    if (isBool(type)) {
+        load(value, reg);
+    } else if (isInt(type)) {
+        load(value, reg);
+        line("test " + reg + ", " + reg);
+        line("setne " + low(reg));
+        line("movzbq " + low(reg) + ", " + reg);
+    } else {
+        line("xor " + reg + ", " + reg);
+    }
+}
+
+// The string for the right side of a string +, in rax
+void AsmBackend::toString(IRValue* value)
+{
+    ImprovedType type = typeOf(value);
+
+    if (isString(type)) {
+        load(value, "%rax");
+        return;
+    }
+
+    const char* convert = nullptr;
+    if (isBool(type)) convert = "jai_from_bool";
+    else if (!type.flags && type.base == Type::CHAR) convert = "jai_from_char";
+    else if (isInt(type)) convert = "jai_from_int";
+
+    if (!convert) {
+        fail("adding a " + TypeToString(type.base) + " to a string in " + fn->name);
+        return;
+    }
+
+    load(value, "%rdi");
+    line("call " + string(convert));
+}
+
+// Phis of a block can use each other, so all the values get read before any is written
+void AsmBackend::moveToPhis(IRBlock* from, IRBlock* to)
+{
+    int pred = 0;
+    while (pred < to->preds.size() && to->preds[pred] != from) pred++;
+    ASSERT(pred < to->preds.size());
+
+    vector<IRValue*> phis;
+    for (auto inst : to->insts) {
+        if (inst->op != IROp::PHI) break;
+        phis.push_back(inst);
+    }
+
+    if (phis.size() == 1) {
+        load(phis[0]->args[pred], "%rax");
+        store(phis[0]);
+        return;
+    }
+
+    for (auto phi : phis) {
+        load(phi->args[pred], "%rax");
+        line("push %rax");
+    }
+    for (int i = phis.size() - 1; i >= 0; i--) {
+        line("pop %rax");
+        store(phis[i]);
+    }
+}
+
+static bool hasPhis(IRBlock* block)
+{
+    return !block->insts.empty() && block->insts[0]->op == IROp::PHI;
+}
+
+void AsmBackend::function(IRFunction* fn)
+{
+    this->fn = fn;
+
+    // Deep recursion is what needs the stack, so constants don't get a slot
+    slots.clear();
+    for (auto block : fn->blocks) {
+        for (auto inst : block->insts) {
+            if (inst->hasResult() && inst->op != IROp::CONST && inst->op != IROp::PARAM) {
+                int next = slots.size();
+                slots[inst] = next;
+            }
+        }
+    }
+
+    int frame = (8 * slots.size() + 15) / 16 * 16;
+
+    out << "\nf_" << fn->name << ":\n";
+    line("push %rbp");
+    line("mov %rsp, %rbp");
+    if (frame) line("sub $" + to_string(frame) + ", %rsp");
+
+    for (int i = 0; i < fn->blocks.size(); i++) {
+        IRBlock* block = fn->blocks[i];
+        IRBlock* next = i + 1 < fn->blocks.size() ? fn->blocks[i + 1] : nullptr;
+
+        out << label(block) << ":\n";
+        for (auto inst : block->insts) this->inst(inst, next);
+    }
+}
+
+void AsmBackend::inst(IRValue* inst, IRBlock* next)
+{
+    auto& args = inst->args;
+
+    // The cases below index args without looking
+    int expected = arity(inst->op);
+    if (expected >= 0 && args.size() != expected) {
+        fail("an instruction with the wrong number of arguments in " + fn->name);
+        return;
+    }
+
+    switch(inst->op) {
+        // Constants get loaded where they're used, params are already in their slots and phis get written by the jumps
+        case (IROp::CONST):
+        case (IROp::PARAM):
+        case (IROp::PHI):
+        case (IROp::LOAD_GLOBAL): break;
+
+        case (IROp::STORE_GLOBAL): fail(fn->name + " setting " + inst->name + ", it's a variable of the caller"); break;
+
+        case (IROp::ADD):
+        case (IROp::SUB):
+        case (IROp::MUL):
+        case (IROp::DIV): {
+            ImprovedType type = typeOf(args[0]);
+
+            if (inst->op == IROp::ADD && isString(type)) {
+                toString(args[1]);
+                line("mov %rax, %rsi");
+                load(args[0], "%rdi");
+                line("call jai_concat");
+                store(inst);
+                break;
+            }
+
+            if (!isInt(type) || !isInt(typeOf(args[1]))) {
+                fail("math on " + TypeToString(type.base) + " in " + fn->name);
+                break;
+            }
+
+            load(args[0], "%rax");
+            load(args[1], "%rcx");
+            if (inst->op == IROp::ADD) line("add %rcx, %rax");
+            else if (inst->op == IROp::SUB) line("sub %rcx, %rax");
+            else if (inst->op == IROp::MUL) line("imul %rcx, %rax");
+            else {
+                line("cqo");
+                line("idiv %rcx");
+            }
+            if (type.base == Type::CHAR) line("movsbq %al, %rax");
+            store(inst);
+        } break;
+
+        case (IROp::EQ):
+        case (IROp::NE):
+        case (IROp::LT):
+        case (IROp::LE):
+        case (IROp::GT):
+        case (IROp::GE): {
+            ImprovedType left = typeOf(args[0]);
+            ImprovedType right = typeOf(args[1]);
+            bool equality = inst->op == IROp::EQ || inst->op == IROp::NE;
+
+            if (equality && isString(left) && isString(right)) {
+                load(args[0], "%rdi");
+                load(args[1], "%rsi");
+                line("call jai_equal");
+                if (inst->op == IROp::NE) line("xor $1, %rax");
+                store(inst);
+                break;
+            }
+
+            bool numbers = isInt(left) && isInt(right);
+            bool bools = equality && isBool(left) && isBool(right);
+            if (!numbers && !bools) {
+                fail("comparing " + TypeToString(left.base) + " and " + TypeToString(right.base) + " in " + fn->name);
+                break;
+            }
+
+            const char* set = "sete";
+            switch(inst->op) {
+                case (IROp::NE): set = "setne"; break;
+                case (IROp::LT): set = "setl"; break;
+                case (IROp::LE): set = "setle"; break;
+                case (IROp::GT): set = "setg"; break;
+                case (IROp::GE): set = "setge"; break;
+                default: break;
+            }
+
+            load(args[0], "%rax");
+            load(args[1], "%rcx");
+            line("cmp %rcx, %rax");
+            line(string(set) + " %al");
+            line("movzbq %al, %rax");
+            store(inst);
+        } break;
+
+        // Both sides already got evaluated, the Interpreter doesn't short circuit either
+        case (IROp::AND):
+        case (IROp::OR): {
+            truthy(args[0], "%rax");
+            truthy(args[1], "%rcx");
+            line(inst->op == IROp::AND ? "and %rcx, %rax" : "or %rcx, %rax");
+            store(inst);
+        } break;
+
+        case (IROp::NOT): {
+            if (!isBool(typeOf(args[0]))) fail("! on something that isn't a bool in " + fn->name);
+            load(args[0], "%rax");
+            line("xor $1, %rax");
+            store(inst);
+        } break;
+
+        case (IROp::NEG): {
+            ImprovedType type = typeOf(args[0]);
+            if (!isInt(type)) fail("- on " + TypeToString(type.base) + " in " + fn->name);
+            load(args[0], "%rax");
+            line("neg %rax");
+            if (type.base == Type::CHAR) line("movsbq %al, %rax");
+            store(inst);
+        } break;
+
+        case (IROp::CALL): call(inst); break;
+
+        case (IROp::NEW_STRUCT): {
+            int size = 8 * max((int) inst->defn->memberTypes.size(), 1);
+            line("mov $" + to_string(size) + ", %edi");
+            line("call jai_alloc");
+            store(inst);
+        } break;
+
+        case (IROp::GET_MEMBER):
+        case (IROp::GET_FIELD): {
+            IRValue* object = args[0];
+
+            // Color.WHITE is known before running
+            if (inst->op == IROp::GET_FIELD && object->op == IROp::LOAD_GLOBAL && enums.contains(object->name)) {
+                Enum* e = enums[object->name];
+                if (!e->values.contains(inst->name)) fail(inst->name + " isn't in " + e->name);
+
+                line("mov $" + to_string(e->values[inst->name]) + ", %rax");
+                store(inst);
+                break;
+            }
+
+            int index = inst->op == IROp::GET_MEMBER ? inst->index : memberIndex(inst);
+            if (index < 0) {
+                fail("the member " + inst->name + " in " + fn->name);
+                break;
+            }
+
+            load(object, "%rax");
+            line("mov " + to_string(8 * index) + "(%rax), %rax");
+            store(inst);
+        } break;
+
+        case (IROp::SET_MEMBER):
+        case (IROp::SET_FIELD): {
+            int index = inst->op == IROp::SET_MEMBER ? inst->index : memberIndex(inst);
+            if (index < 0) {
+                fail("the member " + inst->name + " in " + fn->name);
+                break;
+            }
+
+            load(args[0], "%rax");
+            load(args[1], "%rcx");
+            Struct* defn = inst->op == IROp::SET_MEMBER ? inst->defn : structs[*(string*) typeOf(args[0]).info];
+            if (defn && index < defn->memberTypes.size()) narrow(resolve(defn->memberTypes[index]).base, "%rcx");
+            line("mov %rcx, " + to_string(8 * index) + "(%rax)");
+        } break;
+
+        case (IROp::NEW_ARRAY): {
+            if (!isInt(typeOf(args[0]))) fail("arrays with a size that isn't an int");
+            load(args[0], "%rdi");
+            line("call jai_new_array");
+            store(inst);
+        } break;
+
+        // The count sits in front of the elements, negative indices fail the unsigned compare too
+        case (IROp::GET_INDEX): {
+            if (typeOf(args[0]).flags != Flags::ARRAY || !isInt(typeOf(args[1]))) {
+                fail("indexing something that isn't an array in " + fn->name);
+                break;
+            }
+
+            load(args[0], "%rax");
+            load(args[1], "%rcx");
+            line("cmp (%rax), %rcx");
+            line("jae jai_bounds_reading");
+            line("mov 8(%rax,%rcx,8), %rax");
+            store(inst);
+        } break;
+
+        case (IROp::SET_INDEX): {
+            if (typeOf(args[0]).flags != Flags::ARRAY || !isInt(typeOf(args[1]))) {
+                fail("indexing something that isn't an array in " + fn->name);
+                break;
+            }
+
+            load(args[0], "%rax");
+            load(args[1], "%rcx");
+            load(args[2], "%rdx");
+            narrow(typeOf(args[0]).base, "%rdx");
+            line("cmp (%rax), %rcx");
+            line("jae jai_bounds_writing");
+            line("mov %rdx, 8(%rax,%rcx,8)");
+        } break;
+
+        case (IROp::JUMP): {
+            IRBlock* target = inst->targets[0];
+            if (hasPhis(target)) moveToPhis(inst->block, target);
+            if (target != next) line("jmp " + label(target));
+        } break;
+
+        case (IROp::BRANCH): {
+            IRBlock* ifTrue = inst->targets[0];
+            IRBlock* ifFalse = inst->targets[1];
+
+            truthy(args[0], "%rax");
+            line("test %rax, %rax");
+
+            if (!hasPhis(ifTrue) && !hasPhis(ifFalse)) {
+                if (ifTrue == next) {
+                    line("jz " + label(ifFalse));
+                } else {
+                    line("jnz " + label(ifTrue));
+                    if (ifFalse != next) line("jmp " + label(ifFalse));
+                }
+                break;
+            }
+
+            // Every edge writes its own phis
+            string otherwise = label(inst->block) + ".false";
+            line("jz " + otherwise);
+            if (hasPhis(ifTrue)) moveToPhis(inst->block, ifTrue);
+            line("jmp " + label(ifTrue));
+            out << otherwise << ":\n";
+            if (hasPhis(ifFalse)) moveToPhis(inst->block, ifFalse);
+            if (ifFalse != next) line("jmp " + label(ifFalse));
+        } break;
+
+        case (IROp::RETURN): {
+            if (!args.empty() && fn->returnType.base != Type::VOID) load(args[0], "%rax");
+            line("leave");
+            line("ret");
+        } break;
+    }
+}
+
+void AsmBackend::call(IRValue* inst)
+{
+    auto& args = inst->args;
+
+    if (inst->name == "printf") {
+        if (args.size() != 1 || !isString(typeOf(args[0]))) {
+            fail("printf with something that isn't a string in " + fn->name);
+            return;
+        }
+
+        load(args[0], "%rdi");
+        line("call jai_printf");
+        return;
+    }
+
+    if (!byName.contains(inst->name)) {
+        fail("calls to " + inst->name);
+        return;
+    }
+
+    IRFunction* callee = byName[inst->name];
+    if (callee->params.size() != args.size()) fail("calling " + inst->name + " with the wrong number of arguments");
+
+    for (int i = args.size() - 1; i >= 0; i--) {
+        load(args[i], "%rax");
+        line("push %rax");
+    }
+    line("call f_" + callee->name);
+    if (!args.empty()) line("add $" + to_string(8 * args.size()) + ", %rsp");
+
+    if (inst->hasResult()) store(inst);
+}
+
+bool buildStatic(const string& source, const string& asmPath, const string& exePath)
+{
+    ofstream file(asmPath);
+    if (!file) return false;
+    file << source;
+    file.close();
+
+    const char* as = getenv("AS");
+    const char* ld = getenv("LD");
+    string object = exePath + ".o";
+
+    string assemble = string(as ? as : "as") + " -o \"" + object + "\" \"" + asmPath + "\"";
+    if (system(assemble.c_str()) != 0) return false;
+
+    string link = string(ld ? ld : "ld") + " -static -o \"" + exePath + "\" \"" + object + "\"";
+    bool linked = system(link.c_str()) == 0;
+    remove(object.c_str());
+    return linked;
+}
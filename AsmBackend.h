@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "IR.h"
+
+using namespace std;
+
+// Turns the IR into GNU assembler x86-64 for Linux, with its own small runtime on top of syscalls,
+// so as and ld make a static binary without a C compiler or libc.
+// Jai functions use their own calling convention: the caller pushes the args from right to left
+// and pops them again, the result comes back in rax. Every IR value that isn't a constant has its own 8 byte stack slot,
+// params are read right where the caller put them. Ints, chars, bools and enums are 64 bit,
+// strings are pointers to zero terminated bytes (null is ""), structs and arrays live on the heap.
+// The runtime routines keep rbx, rbp and r12 to r15 like the System V ABI.
+struct AsmBackend {
+    IRModule* module;
+    unordered_map<string, Struct*>& structs;
+    unordered_map<string, Enum*>& enums;
+
+    // What we can't do in assembly, like floats. Empty if everything went fine
+    string unsupported;
+
+    unordered_map<string, IRFunction*> byName;
+    unordered_map<IRValue*, ImprovedType> types;
+    vector<string> strings;
+
+    // The function we're in
+    IRFunction* fn = nullptr;
+    stringstream out;
+    unordered_map<IRValue*, int> slots;
+
+    AsmBackend(IRModule* m, unordered_map<string, Struct*>& s, unordered_map<string, Enum*>& e);
+
+    // The whole program, starting at main
+    string compile(IRFunction* main);
+
+    void fail(const string& what);
+    void collectFunctions(IRFunction* fn, vector<IRFunction*>& order, unordered_set<IRFunction*>& seen);
+    void inferTypes(vector<IRFunction*>& order);
+    ImprovedType resolve(ImprovedType type);
+    ImprovedType typeOf(IRValue* value);
+    int memberIndex(IRValue* inst);
+
+    void line(const string& text);
+    string slot(IRValue* value);
+    string label(IRBlock* block);
+    void load(IRValue* value, const string& reg);
+    void store(IRValue* value, const string& reg = "%rax");
+    void truthy(IRValue* value, const string& reg);
+    void narrow(Type type, const string& reg);
+    void toString(IRValue* value);
+    void moveToPhis(IRBlock* from, IRBlock* to);
+
+    void function(IRFunction* fn);
+    void inst(IRValue* inst, IRBlock* next);
+    void call(IRValue* inst);
+};
+
+// Writes the source to asmPath and builds a static exePath out of it with as and ld, or $AS and $LD if those are set
+bool buildStatic(const string& source, const string& asmPath, const string& exePath);
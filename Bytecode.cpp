@@ -0,0 +1,730 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Bytecode.h"
+#include "Superinstructions.h"
+#include "error.h"
+
+using namespace std;
+
+std::string OPCODEtoString(OPCODE op)
+{
+    const char *s = 0;
+#define PROCESS_VAL(p) case (OPCODE::p): s = #p; break;
+
+    switch (op)
+    {
+        PROCESS_VAL(CONST)
+        PROCESS_VAL(LOAD)
+        PROCESS_VAL(STORE)
+        PROCESS_VAL(LOAD_NAME)
+        PROCESS_VAL(STORE_NAME)
+        PROCESS_VAL(POP)
+        PROCESS_VAL(DUP)
+
+        PROCESS_VAL(ADD)
+        PROCESS_VAL(SUB)
+        PROCESS_VAL(MUL)
+        PROCESS_VAL(DIV)
+        PROCESS_VAL(EQ)
+        PROCESS_VAL(NE)
+        PROCESS_VAL(LT)
+        PROCESS_VAL(LE)
+        PROCESS_VAL(GT)
+        PROCESS_VAL(GE)
+        PROCESS_VAL(AND)
+        PROCESS_VAL(OR)
+        PROCESS_VAL(NEG)
+        PROCESS_VAL(NOT)
+        PROCESS_VAL(CONCAT)
+
+        PROCESS_VAL(JUMP)
+        PROCESS_VAL(JUMP_IF_FALSE)
+        PROCESS_VAL(JUMP_IF_TRUE)
+
+        PROCESS_VAL(CALL)
+        PROCESS_VAL(TAIL_CALL)
+        PROCESS_VAL(PRINTF)
+        PROCESS_VAL(RETURN)
+
+        PROCESS_VAL(NEW_STRUCT)
+        PROCESS_VAL(NEW_ARRAY)
+        PROCESS_VAL(GET)
+        PROCESS_VAL(SET)
+        PROCESS_VAL(GET_MEMBER)
+        PROCESS_VAL(SET_MEMBER)
+
+        PROCESS_VAL(FOR_CHECK)
+        PROCESS_VAL(FOR_NEXT)
+
+        PROCESS_VAL(CLEAR_DEFERS)
+        PROCESS_VAL(MARK_DEFER)
+        PROCESS_VAL(TEST_DEFER)
+
+        PROCESS_VAL(NOP)
+
+#define SUPERINSTRUCTION(name, ops, body) PROCESS_VAL(name)
+#include "Superinstructions.inc"
+#undef SUPERINSTRUCTION
+    }
+#undef PROCESS_VAL
+
+    return std::string(s);
+}
+
+bool isSuperinstruction(OPCODE op)
+{
+    return op > OPCODE::NOP;
+}
+
+// How many of a, b and c the instruction uses
+int operandCount(OPCODE op)
+{
+    switch (op) {
+        case (OPCODE::CONST):
+        case (OPCODE::LOAD):
+        case (OPCODE::STORE):
+        case (OPCODE::LOAD_NAME):
+        case (OPCODE::STORE_NAME):
+        case (OPCODE::JUMP):
+        case (OPCODE::JUMP_IF_FALSE):
+        case (OPCODE::JUMP_IF_TRUE):
+        case (OPCODE::TAIL_CALL):
+        case (OPCODE::NEW_ARRAY):
+        case (OPCODE::CONCAT):
+        case (OPCODE::GET_MEMBER):
+        case (OPCODE::SET_MEMBER):
+        case (OPCODE::CLEAR_DEFERS):    return 1;
+        case (OPCODE::CALL):
+        case (OPCODE::NEW_STRUCT):
+        case (OPCODE::FOR_CHECK):
+        case (OPCODE::FOR_NEXT):
+        case (OPCODE::MARK_DEFER):
+        case (OPCODE::TEST_DEFER):      return 2;
+        default: break;
+    }
+
+    if (isSuperinstruction(op)) return 3;
+    return 0;
+}
+
+// Which operand is a jump target, 0 for a and 1 for b, -1 if the instruction doesn't jump
+int jumpOperand(OPCODE op)
+{
+    switch (op) {
+        case (OPCODE::JUMP):
+        case (OPCODE::JUMP_IF_FALSE):
+        case (OPCODE::JUMP_IF_TRUE):    return 0;
+        case (OPCODE::FOR_CHECK):
+        case (OPCODE::FOR_NEXT):        return 1;
+        default:                        return -1;
+    }
+}
+
+BytecodeFunction::BytecodeFunction(Func* f) : name(f->name), func(f) {}
+
+ostream& operator<<(ostream& out, const BytecodeFunction* fn)
+{
+    out << "func " << fn->name << " (" << fn->params << " params, " << fn->slots << " slots)" << endl;
+
+    for (int i = 0; i < fn->code.size(); i++) {
+        const Instruction& inst = fn->code[i];
+        out << "    " << i << ": " << OPCODEtoString(inst.op);
+
+        switch (inst.op) {
+            case (OPCODE::CONST): {
+                const Any& any = fn->constants[inst.a];
+                if (any.type.base == Type::STRING) out << " \"" << any.value.String->text << "\"";
+                else if (any.type.base == Type::UNKNOWN) out << " <nothing>";
+                else out << " " << any.toString();
+            } break;
+            case (OPCODE::LOAD_NAME):
+            case (OPCODE::STORE_NAME):  out << " " << fn->names[inst.a]; break;
+            case (OPCODE::CALL):        out << " #" << inst.a << " " << inst.b; break;
+            case (OPCODE::NEW_STRUCT):  out << " " << fn->structs[inst.a]->name; break;
+            case (OPCODE::GET_MEMBER):
+            case (OPCODE::SET_MEMBER): {
+                const MemberRef& ref = fn->members[inst.a];
+                out << " " << ref.defn->name << "." << ref.name << "[" << ref.index << "]";
+            } break;
+            case (OPCODE::LOAD):
+            case (OPCODE::STORE):
+            case (OPCODE::JUMP):
+            case (OPCODE::JUMP_IF_FALSE):
+            case (OPCODE::JUMP_IF_TRUE):
+            case (OPCODE::TAIL_CALL):
+            case (OPCODE::NEW_ARRAY):
+            case (OPCODE::CONCAT):
+            case (OPCODE::CLEAR_DEFERS):    out << " " << inst.a; break;
+            case (OPCODE::FOR_CHECK):
+            case (OPCODE::FOR_NEXT):
+            case (OPCODE::MARK_DEFER):
+            case (OPCODE::TEST_DEFER):      out << " " << inst.a << " " << inst.b; break;
+            default: {
+                if (isSuperinstruction(inst.op)) out << " " << inst.a << " " << inst.b << " " << inst.c;
+            } break;
+        }
+        out << endl;
+    }
+
+    return out;
+}
+
+ostream& operator<<(ostream& out, const BytecodeProgram* program)
+{
+    for (int i = 0; i < program->functions.size(); i++) {
+        out << "#" << i << " " << program->functions[i] << endl;
+    }
+    return out;
+}
+
+BytecodeCompiler::BytecodeCompiler(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s)
+    : functions(f), constants(c), structs(s) {}
+
+BytecodeProgram* BytecodeCompiler::compile(vector<Stmt*>& stmts)
+{
+    program = new BytecodeProgram();
+
+    vector<Func*> funcs;
+    for (auto stmt : stmts) collectFunctions(stmt, funcs);
+
+    for (auto func : funcs) {
+        program->indexOf[func] = program->functions.size();
+        program->functions.push_back(new BytecodeFunction(func));
+    }
+
+    for (auto function : program->functions) {
+        compileFunction(function);
+        if (function->name == "main") program->main = function;
+    }
+
+    if (!program->main) error("No main function");
+
+    return program;
+}
+
+void BytecodeCompiler::collectFunctions(Stmt* stmt, vector<Func*>& funcs)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (!func->body) return;
+            funcs.push_back(func);
+            collectFunctions(func->body, funcs);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectFunctions(s, funcs);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectFunctions(i->ifBody, funcs);
+            collectFunctions(i->elseBody, funcs);
+        } break;
+        case (ST::FOR):     collectFunctions(asFor(stmt)->body, funcs); break;
+        case (ST::WHILE):   collectFunctions(asWhile(stmt)->body, funcs); break;
+        case (ST::DEFER):   collectFunctions(asDefer(stmt)->block, funcs); break;
+        default: break;
+    }
+}
+
+void BytecodeCompiler::collectLocals(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (!decl->isConstant()) addSlot(decl->name);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectLocals(s);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectLocals(i->ifBody);
+            collectLocals(i->elseBody);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            addSlot(forLoop->it);
+            for (auto decl : forLoop->invariants) addSlot(decl->name);
+            collectLocals(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) addSlot(decl->name);
+            for (auto decl : whileLoop->invariants) addSlot(decl->name);
+            collectLocals(whileLoop->body);
+        } break;
+        case (ST::DEFER):   collectLocals(asDefer(stmt)->block); break;
+        default: break;
+    }
+}
+
+int BytecodeCompiler::addSlot(const string& name)
+{
+    if (fn->slotOf.contains(name)) return fn->slotOf[name];
+    return fn->slotOf[name] = fn->slots++;
+}
+
+// Slots for loop counters and the like, nobody can find them by name
+int BytecodeCompiler::hiddenSlot()
+{
+    return fn->slots++;
+}
+
+void BytecodeCompiler::compileFunction(BytecodeFunction* function)
+{
+    fn = function;
+    deferScopes.clear();
+    loops.clear();
+    sharedSlots.clear();
+
+    Func* func = fn->func;
+    fn->params = func->params.size();
+    for (auto param : func->params) addSlot(param->name);
+    collectLocals(func->body);
+
+    compileBlock(func->body);
+
+    // Falling off the end returns nothing
+    Any nothing;
+    emitConst(nothing);
+    emit(OPCODE::RETURN);
+
+    if (fuse) fuseSuperinstructions(fn);
+}
+
+int BytecodeCompiler::emit(OPCODE op, int a, int b)
+{
+    fn->code.push_back({ op, a, b });
+    return fn->code.size() - 1;
+}
+
+void BytecodeCompiler::patch(int at, int target)
+{
+    Instruction& inst = fn->code[at];
+    if (inst.op == OPCODE::FOR_CHECK) inst.b = target;
+    else inst.a = target;
+}
+
+int BytecodeCompiler::here()
+{
+    return fn->code.size();
+}
+
+void BytecodeCompiler::emitConst(Any& any)
+{
+    fn->constants.push_back(any);
+    emit(OPCODE::CONST, fn->constants.size() - 1);
+}
+
+// Like the Interpreter, names the function doesn't declare itself belong to a caller
+void BytecodeCompiler::emitLoad(const string& name)
+{
+    if (fn->slotOf.contains(name)) {
+        emit(OPCODE::LOAD, fn->slotOf[name]);
+    } else if (constants.contains(name)) {
+        emitConst(constants[name]);
+    } else {
+        fn->names.push_back(name);
+        emit(OPCODE::LOAD_NAME, fn->names.size() - 1);
+    }
+}
+
+void BytecodeCompiler::emitStore(const string& name)
+{
+    if (fn->slotOf.contains(name)) {
+        emit(OPCODE::STORE, fn->slotOf[name]);
+    } else {
+        fn->names.push_back(name);
+        emit(OPCODE::STORE_NAME, fn->names.size() - 1);
+    }
+}
+
+void BytecodeCompiler::pushDeferScope()
+{
+    deferScopes.push_back({ {}, emit(OPCODE::NOP) });
+}
+
+void BytecodeCompiler::popDeferScope()
+{
+    deferScopes.pop_back();
+}
+
+void BytecodeCompiler::emitDefers(int downTo)
+{
+    for (int i = deferScopes.size() - 1; i >= downTo; i--) emitScopeDefers(i);
+}
+
+void BytecodeCompiler::emitScopeDefers(int scope)
+{
+    // Copy, a deferred statement could add to the scope while we compile it
+    vector<DeferEntry> defers = deferScopes[scope].defers;
+    int slot = deferScopes[scope].slot;
+
+    for (auto& entry : defers) {
+        if (entry.bit < 0) {
+            compileStmt(entry.stmt, true);
+            continue;
+        }
+
+        emit(OPCODE::TEST_DEFER, slot, entry.bit);
+        int skip = emit(OPCODE::JUMP_IF_FALSE);
+        compileStmt(entry.stmt, true);
+        patch(skip, here());
+    }
+}
+
+void BytecodeCompiler::compileStmt(Stmt* stmt, bool direct)
+{
+    switch(stmt->kind) {
+        case (ST::DECL):    compileDecl(asDecl(stmt)); break;
+        case (ST::BLOCK):   compileBlock(asBlock(stmt)); break;
+        case (ST::IF):      compileIf(asIf(stmt)); break;
+        case (ST::FOR):     compileFor(asFor(stmt)); break;
+        case (ST::WHILE):   compileWhile(asWhile(stmt)); break;
+        case (ST::RETURN):  compileReturn(asReturn(stmt)); break;
+        case (ST::SET):     compileSet(asSet(stmt)); break;
+        case (ST::DEFER):   compileDefer(asDefer(stmt), direct); break;
+
+        // Declared at the top level, they don't run
+        case (ST::STRUCT):
+        case (ST::ENUM):
+        case (ST::FUNC):    break;
+
+        case (ST::EXPRSTMT): {
+            compileExpr(asExprStmt(stmt)->expr);
+            emit(OPCODE::POP);
+        } break;
+
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            compileExpr(assign->right);
+            emitStore(asIdent(assign->left)->name);
+        } break;
+
+        case (ST::CONTINUE): {
+            if (loops.empty()) error("continue outside of a loop", stmt->tk);
+            emitDefers(loops.back().deferDepth);
+            loops.back().continues.push_back(emit(OPCODE::JUMP));
+        } break;
+
+        case (ST::BREAK): {
+            if (loops.empty()) error("break outside of a loop", stmt->tk);
+            emitDefers(loops.back().deferDepth);
+            loops.back().breaks.push_back(emit(OPCODE::JUMP));
+        } break;
+
+        default: INTERNAL_ERROR("Stmt not supported by the BytecodeCompiler");
+    }
+}
+
+void BytecodeCompiler::compileBlock(Block* block)
+{
+    pushDeferScope();
+
+    for (auto stmt : block->stmts) {
+        compileStmt(stmt, true);
+
+        // Everything after these is dead
+        if (isReturn(stmt) || isBreak(stmt) || isContinue(stmt)) {
+            popDeferScope();
+            return;
+        }
+    }
+
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void BytecodeCompiler::compileDecl(Decl* decl)
+{
+    if (decl->isConstant()) return;
+
+    if (decl->isDeclArray()) {
+        compileExpr(decl->expr);
+        fn->types.push_back(decl->type);
+        emit(OPCODE::NEW_ARRAY, fn->types.size() - 1);
+    } else if (decl->expr) {
+        compileExpr(decl->expr);
+    } else if (decl->type.base == Type::STRUCT) {
+        string* name = (string*) decl->type.info;
+        if (!structs.contains(*name)) error("Struct not defined");
+
+        fn->structs.push_back(structs[*name]);
+        fn->types.push_back(decl->type);
+        emit(OPCODE::NEW_STRUCT, fn->structs.size() - 1, fn->types.size() - 1);
+    } else {
+        Any any;
+        any.type = decl->type;
+        if (decl->type.base == Type::ENUM) any.type = Type::INT;
+        if (decl->type.base == Type::STRING) any.value.String = JaiString::intern("");
+        emitConst(any);
+    }
+
+    emit(OPCODE::STORE, fn->slotOf[decl->name]);
+}
+
+void BytecodeCompiler::compileIf(If* i)
+{
+    compileExpr(i->condition);
+    int skipThen = emit(OPCODE::JUMP_IF_FALSE);
+
+    compileStmt(i->ifBody, false);
+
+    if (i->elseBody) {
+        int skipElse = emit(OPCODE::JUMP);
+        patch(skipThen, here());
+        compileStmt(i->elseBody, false);
+        patch(skipElse, here());
+    } else {
+        patch(skipThen, here());
+    }
+}
+
+// Loops are rotated, the check before the first iteration skips the invariants as well.
+void BytecodeCompiler::compileFor(For* forLoop)
+{
+    if (!forLoop->end) {
+        unsupported = "for over arrays";
+        return;
+    }
+
+    pushDeferScope();
+    int deferDepth = deferScopes.size();
+
+    // The Interpreter counts with its own copy of the index, the body can change it without affecting the loop
+    int index = hiddenSlot();
+    int end = hiddenSlot();
+
+    compileExpr(forLoop->start);
+    emit(OPCODE::STORE, index);
+    compileExpr(forLoop->end);
+    emit(OPCODE::STORE, end);
+
+    int check = emit(OPCODE::FOR_CHECK, index);
+
+    for (auto decl : forLoop->invariants) compileDecl(decl);
+
+    int body = here();
+    emit(OPCODE::LOAD, index);
+    emit(OPCODE::STORE, fn->slotOf[forLoop->it]);
+
+    loops.push_back({ {}, {}, deferDepth });
+    compileStmt(forLoop->body, false);
+    LoopTargets targets = loops.back();
+    loops.pop_back();
+
+    for (auto at : targets.continues) patch(at, here());
+    emit(OPCODE::FOR_NEXT, index, body);
+
+    patch(check, here());
+    for (auto at : targets.breaks) patch(at, here());
+
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void BytecodeCompiler::compileWhile(While* whileLoop)
+{
+    pushDeferScope();
+    int deferDepth = deferScopes.size();
+
+    for (auto decl : whileLoop->conditionInvariants) compileDecl(decl);
+
+    compileExpr(whileLoop->condition);
+    int check = emit(OPCODE::JUMP_IF_FALSE);
+
+    for (auto decl : whileLoop->invariants) compileDecl(decl);
+
+    int body = here();
+    loops.push_back({ {}, {}, deferDepth });
+    compileStmt(whileLoop->body, false);
+    LoopTargets targets = loops.back();
+    loops.pop_back();
+
+    for (auto at : targets.continues) patch(at, here());
+    compileExpr(whileLoop->condition);
+    emit(OPCODE::JUMP_IF_TRUE, body);
+
+    patch(check, here());
+    for (auto at : targets.breaks) patch(at, here());
+
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void BytecodeCompiler::compileReturn(Return* ret)
+{
+    // Only a call that is the whole return value can reuse the frame,
+    // for the ones nested in Binarys the VM just keeps calling, its stack lives on the heap.
+    if (ret->tailCall && isCall(ret->expr)) {
+        Call* call = asCall(ret->expr);
+        for (auto arg : call->args) compileExpr(arg);
+        emit(OPCODE::TAIL_CALL, call->args.size());
+        return;
+    }
+
+    if (ret->expr) {
+        compileExpr(ret->expr);
+    } else {
+        Any nothing;
+        emitConst(nothing);
+    }
+
+    emitDefers(0);
+    emit(OPCODE::RETURN);
+}
+
+void BytecodeCompiler::compileSet(Set* set)
+{
+    compileExpr(set->expr);
+
+    if (set->defn) {
+        compileExpr(set->value);
+        fn->members.push_back({ set->defn, set->index, asConst(set->access)->any.value.String->text, nullptr });
+        emit(OPCODE::SET_MEMBER, fn->members.size() - 1);
+        return;
+    }
+
+    compileExpr(set->access);
+    compileExpr(set->value);
+    emit(OPCODE::SET);
+}
+
+// A defer we always go through is just remembered, one we might skip sets
+// a bit in its scope's slot that decides if it runs at the end.
+void BytecodeCompiler::compileDefer(Defer* defer, bool direct)
+{
+    DeferScope& scope = deferScopes.back();
+
+    if (direct) {
+        scope.defers.push_back({ defer->block, -1 });
+        return;
+    }
+
+    if (scope.slot < 0) {
+        scope.slot = hiddenSlot();
+        fn->code[scope.entry] = { OPCODE::CLEAR_DEFERS, scope.slot };
+    }
+
+    int bit = 0;
+    for (auto& entry : scope.defers) if (entry.bit >= 0) bit++;
+    if (bit >= 64) {
+        unsupported = "more than 64 conditional defers in one scope";
+        return;
+    }
+
+    emit(OPCODE::MARK_DEFER, scope.slot, bit);
+    scope.defers.push_back({ defer->block, bit });
+}
+
+void BytecodeCompiler::compileExpr(Expr* expr)
+{
+    switch(expr->kind) {
+        case (ET::CONST):   emitConst(asConst(expr)->any); break;
+        case (ET::IDENT):   emitLoad(asIdent(expr)->name); break;
+        case (ET::CALL):    compileCall(asCall(expr)); break;
+
+        case (ET::BINARY): {
+            Binary* binary = asBinary(expr);
+
+            vector<Expr*> parts = concatParts(binary);
+            if (!parts.empty()) {
+                for (auto part : parts) compileExpr(part);
+                emit(OPCODE::CONCAT, parts.size());
+                break;
+            }
+
+            compileExpr(binary->left);
+            compileExpr(binary->right);
+
+            switch(binary->op) {
+                case (OP::EQUAL):           emit(OPCODE::EQ); break;
+                case (OP::NOT_EQUAL):       emit(OPCODE::NE); break;
+                case (OP::AND):             emit(OPCODE::AND); break;
+                case (OP::OR):              emit(OPCODE::OR); break;
+                case (OP::GREATER):         emit(OPCODE::GT); break;
+                case (OP::GREATER_EQUAL):   emit(OPCODE::GE); break;
+                case (OP::LESS):            emit(OPCODE::LT); break;
+                case (OP::LESS_EQUAL):      emit(OPCODE::LE); break;
+                case (OP::MINUS):           emit(OPCODE::SUB); break;
+                case (OP::PLUS):            emit(OPCODE::ADD); break;
+                case (OP::MULTIPLY):        emit(OPCODE::MUL); break;
+                case (OP::DIVIDE):          emit(OPCODE::DIV); break;
+                default: INTERNAL_ERROR("Wrong Binary Operators shouldn't get parsed");
+            }
+        } break;
+
+        case (ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            compileExpr(unary->expr);
+
+            switch(unary->op) {
+                case (OP::NOT):     emit(OPCODE::NOT); break;
+                case (OP::NEGATE):  emit(OPCODE::NEG); break;
+                default: INTERNAL_ERROR("Wrong Unary Operators shouldn't get parsed");
+            }
+        } break;
+
+        case (ET::GET): {
+            Get* get = asGet(expr);
+            compileExpr(get->expr);
+            compileExpr(get->access);
+            emit(OPCODE::GET);
+        } break;
+
+        case (ET::MEMBER): {
+            Member* member = asMember(expr);
+            compileExpr(member->expr);
+            fn->members.push_back({ member->defn, member->index, member->name, member });
+            emit(OPCODE::GET_MEMBER, fn->members.size() - 1);
+        } break;
+
+        // There is no control flow inside an expression, so the first Shared we compile is the one that runs first
+        case (ET::SHARED): {
+            Shared* shared = asShared(expr);
+            if (sharedSlots.contains(shared)) {
+                emit(OPCODE::LOAD, sharedSlots[shared]);
+            } else {
+                compileExpr(shared->expr);
+                emit(OPCODE::DUP);
+                emit(OPCODE::STORE, sharedSlots[shared] = hiddenSlot());
+            }
+        } break;
+
+        case (ET::SHARED_SCOPE): {
+            // A while condition gets compiled twice, the second copy can't use the slots of the first
+            sharedSlots.clear();
+            compileExpr(asSharedScope(expr)->expr);
+            sharedSlots.clear();
+        } break;
+
+        default: INTERNAL_ERROR("Expr not supported by the BytecodeCompiler");
+    }
+}
+
+void BytecodeCompiler::compileCall(Call* call)
+{
+    Ident* ident = asIdent(call->name);
+
+    if (!functions.contains(ident->name)) error("Fucntion not defined");
+    Func* defn = functions[ident->name];
+
+    if (defn->params.size() != call->args.size()) error("Wrong number of arguments");
+
+    for (auto arg : call->args) compileExpr(arg);
+
+    if (!defn->body) {
+        emit(OPCODE::PRINTF);
+        return;
+    }
+
+    emit(OPCODE::CALL, program->indexOf[defn], call->args.size());
+}
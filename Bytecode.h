@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Any.h"
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Instructions for the stack VM, see VM.
+// Operands are pushed on the value stack and instructions pop them off again.
+enum class OPCODE {
+    CONST,          // a: constant          -> value
+    LOAD,           // a: slot              -> value
+    STORE,          // a: slot              value ->
+    LOAD_NAME,      // a: name              -> value    variable of a caller
+    STORE_NAME,     // a: name              value ->
+    POP,            //                      value ->
+    DUP,            //                      value -> value value
+
+    ADD,            //                      left right -> result
+    SUB,
+    MUL,
+    DIV,
+    EQ,
+    NE,
+    LT,
+    LE,
+    GT,
+    GE,
+    AND,
+    OR,
+    NEG,            //                      value -> result
+    NOT,
+    CONCAT,         // a: count             parts -> string     a chain of string + (see concatParts)
+
+    JUMP,           // a: target
+    JUMP_IF_FALSE,  // a: target            condition ->
+    JUMP_IF_TRUE,   // a: target            condition ->
+
+    CALL,           // a: function, b: args args -> result
+    TAIL_CALL,      // a: args              args ->     rebinds the params and starts over
+    PRINTF,         //                      text -> nothing
+    RETURN,         //                      result ->
+
+    NEW_STRUCT,     // a: struct            -> struct
+    NEW_ARRAY,      // a: type              size -> array
+    GET,            //                      object access -> value
+    SET,            //                      object access value ->
+    GET_MEMBER,     // a: member            object -> value
+    SET_MEMBER,     // a: member            object value ->
+
+    FOR_CHECK,      // a: index slot (end is in a + 1), b: target   jumps to b if the loop is done
+    FOR_NEXT,       // a: index slot, b: target                     counts up and jumps to b if it isn't
+
+    CLEAR_DEFERS,   // a: slot              no conditional defer of the scope ran yet
+    MARK_DEFER,     // a: slot, b: bit
+    TEST_DEFER,     // a: slot, b: bit      -> bool
+
+    NOP,
+
+    // Fused sequences of the instructions above, see Superinstructions.
+    // The operands of the parts go into a, b and c in order.
+#define SUPERINSTRUCTION(name, ops, body) name,
+#include "Superinstructions.inc"
+#undef SUPERINSTRUCTION
+};
+
+std::string OPCODEtoString(OPCODE op);
+
+bool isSuperinstruction(OPCODE op);
+int  operandCount(OPCODE op);
+int  jumpOperand(OPCODE op);
+
+struct Instruction {
+    OPCODE op;
+    int a = 0;
+    int b = 0;
+    int c = 0;
+};
+
+// A member access the Resolver figured out, with the name in case the struct turns out to be different
+struct MemberRef {
+    Struct* defn;
+    int index;
+    string name;
+    Member* member;
+    MemberCache cache;      // for the structs that aren't defn
+};
+
+struct BytecodeFunction {
+    string name;
+    Func* func;
+    int params = 0;
+    int slots = 0;
+
+    vector<Instruction> code;
+    vector<Any> constants;
+    vector<string> names;
+    vector<Struct*> structs;
+    vector<ImprovedType> types;
+    vector<MemberRef> members;
+
+    // Every name the function declares gets a slot, so callees can still find it by name
+    unordered_map<string, int> slotOf;
+
+    BytecodeFunction(Func* f);
+};
+
+struct BytecodeProgram {
+    vector<BytecodeFunction*> functions;
+    unordered_map<Func*, int> indexOf;
+    BytecodeFunction* main = nullptr;
+};
+
+ostream& operator<<(ostream& out, const BytecodeFunction* fn);
+ostream& operator<<(ostream& out, const BytecodeProgram* program);
+
+// Compiles every function into bytecode for the VM.
+// Defers get compiled into every exit of their scope, like the IRBuilder does.
+// If something can't be compiled, unsupported says what and the caller should
+// fall back to the Interpreter.
+struct BytecodeCompiler {
+    unordered_map<string, Func*>& functions;
+    unordered_map<string, Any>& constants;
+    unordered_map<string, Struct*>& structs;
+
+    BytecodeProgram* program = nullptr;
+    BytecodeFunction* fn = nullptr;
+    string unsupported;
+    bool fuse = true;       // turn sequences into superinstructions, off when profiling
+
+    struct DeferEntry {
+        Stmt* stmt;
+        int bit;            // -1 when the defer always runs
+    };
+    struct DeferScope {
+        vector<DeferEntry> defers;
+        int entry;          // NOP that becomes CLEAR_DEFERS once the scope has a conditional defer
+        int slot = -1;
+    };
+    vector<DeferScope> deferScopes;
+
+    struct LoopTargets {
+        vector<int> breaks;
+        vector<int> continues;
+        int deferDepth;
+    };
+    vector<LoopTargets> loops;
+
+    unordered_map<Shared*, int> sharedSlots;
+
+    BytecodeCompiler(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s);
+
+    BytecodeProgram* compile(vector<Stmt*>& stmts);
+
+    void collectFunctions(Stmt* stmt, vector<Func*>& funcs);
+    void collectLocals(Stmt* stmt);
+    int  addSlot(const string& name);
+    int  hiddenSlot();
+    void compileFunction(BytecodeFunction* function);
+
+    int  emit(OPCODE op, int a = 0, int b = 0);
+    void patch(int at, int target);
+    int  here();
+    void emitConst(Any& any);
+    void emitLoad(const string& name);
+    void emitStore(const string& name);
+
+    void pushDeferScope();
+    void popDeferScope();
+    void emitDefers(int downTo);
+    void emitScopeDefers(int scope);
+
+    void compileStmt(Stmt* stmt, bool direct);
+    void compileBlock(Block* block);
+    void compileDecl(Decl* decl);
+    void compileIf(If* i);
+    void compileFor(For* forLoop);
+    void compileWhile(While* whileLoop);
+    void compileReturn(Return* ret);
+    void compileSet(Set* set);
+    void compileDefer(Defer* defer, bool direct);
+
+    void compileExpr(Expr* expr);
+    void compileCall(Call* call);
+};
@@ -0,0 +1,1159 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+
+#include "CBackend.h"
+#include "error.h"
+
+using namespace std;
+
+// Goes in front of every program. Strings are never freed, the program is over soon enough.
+static const char* runtime = R"RT(#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <signal.h>
+
+typedef const char* jai_string;
+
+typedef struct {
+    long long count;
+    long long size;
+    char* data;
+} jai_array;
+
+static void jai_error(const char* message)
+{
+    printf("------------------------- ERROR: -------------------------\n%s\n", message);
+    exit(-1);
+}
+
+static void* jai_new(size_t size)
+{
+    void* memory = calloc(1, size);
+    if (!memory) jai_error("Out of memory");
+    return memory;
+}
+
+static jai_array* jai_array_new(long long count, long long size)
+{
+    jai_array* array = (jai_array*) jai_new(sizeof(jai_array));
+    array->count = count;
+    array->size = size;
+    array->data = (char*) jai_new(count * size + 1);
+    return array;
+}
+
+static void* jai_at(jai_array* array, long long index, const char* how)
+{
+    if ((unsigned long long) index >= (unsigned long long) array->count) {
+        char message[64];
+        snprintf(message, sizeof(message), "ARRAY INDEX OUT OF BOUNDS EXCEPTION (%s)", how);
+        jai_error(message);
+    }
+    return array->data + index * array->size;
+}
+
+// The other engines end up in an idiv, which traps on 0 and on the smallest long long / -1.
+// C would make that undefined, so this traps the same way, after what got printed so far is out.
+static long long jai_div(long long a, long long b)
+{
+    if (b == 0 || (b == -1 && a == LLONG_MIN)) {
+        fflush(stdout);
+        raise(SIGFPE);
+    }
+    return a / b;
+}
+
+static jai_string jai_copy(const char* text)
+{
+    char* copy = (char*) jai_new(strlen(text) + 1);
+    strcpy(copy, text);
+    return copy;
+}
+
+static jai_string jai_concat(jai_string a, jai_string b)
+{
+    if (!a) a = "";
+    if (!b) b = "";
+    size_t left = strlen(a), right = strlen(b);
+    char* result = (char*) jai_new(left + right + 1);
+    memcpy(result, a, left);
+    memcpy(result + left, b, right);
+    return result;
+}
+
+static bool jai_equal(jai_string a, jai_string b)
+{
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static jai_string jai_from_int(long long i)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%lld", i);
+    return jai_copy(text);
+}
+
+static jai_string jai_from_float(double d)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "%g", d);
+    return jai_copy(text);
+}
+
+static jai_string jai_from_char(char c)
+{
+    char text[2] = { c, 0 };
+    return jai_copy(text);
+}
+
+static jai_string jai_from_bool(bool b)
+{
+    return b ? "true" : "false";
+}
+
+static void jai_printf(jai_string text)
+{
+    printf("> %s\n", text ? text : "");
+}
+
+)RT";
+
+// Everything of the program gets a prefix or suffix, so nothing clashes with C or the runtime
+static string cName(const string& name)         { return name + "_"; }
+static string cFunction(const string& name)     { return "f_" + name; }
+static string cStruct(const string& name)       { return "s_" + name; }
+
+static bool sameType(ImprovedType a, ImprovedType b)
+{
+    if (a.base != b.base || a.flags != b.flags) return false;
+    if (a.base != Type::STRUCT) return true;
+    return a.info && b.info && *(string*) a.info == *(string*) b.info;
+}
+
+static bool isNumber(Type type)
+{
+    return isIntegerType(type) || type == Type::ENUM || type == Type::FLOAT || type == Type::DOUBLE;
+}
+
+CBackend::CBackend(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s, unordered_map<string, Enum*>& e)
+    : functions(f), constants(c), structs(s), enums(e) {}
+
+void CBackend::fail(const string& what)
+{
+    if (unsupported.empty()) unsupported = what;
+}
+
+string CBackend::compile(Func* main)
+{
+    if (!main) {
+        fail("programs without main");
+        return "";
+    }
+
+    vector<Func*> order;
+    unordered_set<Func*> seen;
+    collectFunctions(main, order, seen);
+
+    stringstream file;
+    file << runtime;
+
+    // Declared first, so they can point to each other
+    vector<string> names;
+    for (auto& [name, s] : structs) names.push_back(name);
+    sort(names.begin(), names.end());
+
+    for (auto& name : names) file << "typedef struct " << cStruct(name) << " " << cStruct(name) << ";\n";
+    file << "\n";
+
+    for (auto& name : names) {
+        Struct* s = structs[name];
+
+        vector<string> members(s->memberTypes.size());
+        for (auto& [member, index] : s->memberPositions) members[index] = member;
+
+        file << "struct " << cStruct(name) << " {\n";
+        for (int i = 0; i < members.size(); i++) file << "    " << storageType(resolve(s->memberTypes[i])) << " " << cName(members[i]) << ";\n";
+        if (members.empty()) file << "    char unused;\n";
+        file << "};\n\n";
+    }
+
+    for (auto f : order) file << "static " << signature(f) << ";\n";
+    file << "\n";
+
+    for (auto f : order) function(f, file);
+
+    file << "int main(void)\n{\n    " << cFunction(main->name) << "();\n    return 0;\n}\n";
+
+    if (!unsupported.empty()) return "";
+    return file.str();
+}
+
+// Only what main can reach, functions that never run can't stop us
+void CBackend::collectFunctions(Func* func, vector<Func*>& order, unordered_set<Func*>& seen)
+{
+    if (seen.contains(func)) return;
+    seen.insert(func);
+    order.push_back(func);
+
+    vector<Func*> calls;
+    collectCalls(func->body, calls);
+    for (auto callee : calls) collectFunctions(callee, order, seen);
+}
+
+void CBackend::collectCalls(Stmt* stmt, vector<Func*>& calls)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->expr && !decl->isConstant()) collectCalls(decl->expr, calls);
+        } break;
+        case (ST::BLOCK):   for (auto s : asBlock(stmt)->stmts) collectCalls(s, calls); break;
+        case (ST::RETURN):  if (asReturn(stmt)->expr) collectCalls(asReturn(stmt)->expr, calls); break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectCalls(i->condition, calls);
+            collectCalls(i->ifBody, calls);
+            collectCalls(i->elseBody, calls);
+        } break;
+        case (ST::EXPRSTMT): collectCalls(asExprStmt(stmt)->expr, calls); break;
+        case (ST::DEFER):   collectCalls(asDefer(stmt)->block, calls); break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            collectCalls(forLoop->start, calls);
+            if (forLoop->end) collectCalls(forLoop->end, calls);
+            for (auto decl : forLoop->invariants) collectCalls(decl, calls);
+            collectCalls(forLoop->body, calls);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) collectCalls(decl, calls);
+            for (auto decl : whileLoop->invariants) collectCalls(decl, calls);
+            collectCalls(whileLoop->condition, calls);
+            collectCalls(whileLoop->body, calls);
+        } break;
+        case (ST::ASSIGN):  collectCalls(asAssign(stmt)->right, calls); break;
+        case (ST::SET): {
+            Set* set = asSet(stmt);
+            collectCalls(set->expr, calls);
+            collectCalls(set->access, calls);
+            collectCalls(set->value, calls);
+        } break;
+        default: break;
+    }
+}
+
+void CBackend::collectCalls(Expr* expr, vector<Func*>& calls)
+{
+    switch(expr->kind) {
+        case (ET::BINARY): {
+            collectCalls(asBinary(expr)->left, calls);
+            collectCalls(asBinary(expr)->right, calls);
+        } break;
+        case (ET::UNARY):   collectCalls(asUnary(expr)->expr, calls); break;
+        case (ET::CALL): {
+            Call* call = asCall(expr);
+            for (auto arg : call->args) collectCalls(arg, calls);
+
+            if (!isIdent(call->name)) {
+                fail("calls that aren't just a name");
+                break;
+            }
+
+            string name = asIdent(call->name)->name;
+            if (!functions.contains(name)) fail("calls to " + name + ", it isn't defined");
+            else if (functions[name]->body) calls.push_back(functions[name]);
+        } break;
+        case (ET::GET): {
+            collectCalls(asGet(expr)->expr, calls);
+            collectCalls(asGet(expr)->access, calls);
+        } break;
+        case (ET::MEMBER):          collectCalls(asMember(expr)->expr, calls); break;
+        case (ET::SHARED):          collectCalls(asShared(expr)->expr, calls); break;
+        case (ET::SHARED_SCOPE):    collectCalls(asSharedScope(expr)->expr, calls); break;
+        default: break;
+    }
+}
+
+// The Interpreter keeps every variable of a function in one place no matter where it got declared,
+// so they all become locals at the top of the C function
+void CBackend::collectLocals(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->isConstant()) return;
+
+            ImprovedType type = resolve(decl->type);
+            if (type.base == Type::UNKNOWN && decl->expr) type = typeOf(decl->expr);
+            if (type.base == Type::UNKNOWN) fail("the type of " + decl->name + " in " + func->name);
+
+            declareLocal(decl->name, type);
+        } break;
+        case (ST::BLOCK):   for (auto s : asBlock(stmt)->stmts) collectLocals(s); break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectLocals(i->ifBody);
+            collectLocals(i->elseBody);
+        } break;
+        case (ST::DEFER):   collectLocals(asDefer(stmt)->block); break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            if (!forLoop->end) {
+                fail("for over arrays");
+                return;
+            }
+
+            ImprovedType type = typeOf(forLoop->start);
+            if (!isIntegerType(type.base) || !isIntegerType(typeOf(forLoop->end).base)) fail("for loops that don't count integers");
+            declareLocal(forLoop->it, type);
+
+            for (auto decl : forLoop->invariants) collectLocals(decl);
+            collectLocals(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) collectLocals(decl);
+            for (auto decl : whileLoop->invariants) collectLocals(decl);
+            collectLocals(whileLoop->body);
+        } break;
+        default: break;
+    }
+}
+
+void CBackend::declareLocal(const string& name, ImprovedType type)
+{
+    if (locals.contains(name)) {
+        if (!sameType(locals.at(name), type)) fail(name + " having two different types in " + func->name);
+        return;
+    }
+
+    locals.insert({ name, type });
+    localOrder.push_back(name);
+}
+
+// The defers that end up in the scope of stmt, the ones in Blocks below it have their own
+void CBackend::collectDefers(Stmt* stmt, vector<Defer*>& defers)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DEFER):   defers.push_back(asDefer(stmt)); break;
+        case (ST::IF): {
+            collectDefers(asIf(stmt)->ifBody, defers);
+            collectDefers(asIf(stmt)->elseBody, defers);
+        } break;
+        default: break;
+    }
+}
+
+ImprovedType CBackend::resolve(ImprovedType type)
+{
+    type.flags &= ~Flags::CONSTANT;
+
+    if (type.base == Type::TO_INFER && type.info) {
+        string* name = (string*) type.info;
+        if (structs.contains(*name)) type.base = Type::STRUCT;
+        else if (enums.contains(*name)) type.base = Type::ENUM;
+    }
+    return type;
+}
+
+ImprovedType CBackend::typeOf(Expr* expr)
+{
+    switch(expr->kind) {
+        case (ET::CONST):   return resolve(asConst(expr)->any.type);
+
+        case (ET::IDENT): {
+            const string& name = asIdent(expr)->name;
+            if (locals.contains(name)) return locals.at(name);
+            if (constants.contains(name)) return resolve(constants[name].type);
+            return ImprovedType(Type::UNKNOWN);
+        }
+
+        case (ET::BINARY): {
+            switch(asBinary(expr)->op) {
+                case (OP::PLUS):
+                case (OP::MINUS):
+                case (OP::MULTIPLY):
+                case (OP::DIVIDE):  return typeOf(asBinary(expr)->left);
+                default:            return ImprovedType(Type::BOOL);
+            }
+        }
+
+        case (ET::UNARY): {
+            if (asUnary(expr)->op == OP::NOT) return ImprovedType(Type::BOOL);
+            return typeOf(asUnary(expr)->expr);
+        }
+
+        case (ET::CALL): {
+            Call* call = asCall(expr);
+            if (!isIdent(call->name) || !functions.contains(asIdent(call->name)->name)) return ImprovedType(Type::UNKNOWN);
+            return returnTypeOf(functions[asIdent(call->name)->name]);
+        }
+
+        case (ET::GET): {
+            Get* get = asGet(expr);
+            if (isIdent(get->expr) && enums.contains(asIdent(get->expr)->name) && !locals.contains(asIdent(get->expr)->name)) {
+                return ImprovedType(Type::INT);
+            }
+
+            ImprovedType type = typeOf(get->expr);
+            if (type.flags & Flags::ARRAY) {
+                type.flags &= ~Flags::ARRAY;
+                return type;
+            }
+
+            if (type.base == Type::STRUCT && isConst(get->access) && structs.contains(*(string*) type.info)) {
+                Struct* s = structs[*(string*) type.info];
+                const string* member = &asConst(get->access)->any.value.String->text;
+                if (s->memberPositions.contains(*member)) return resolve(s->memberTypes[s->memberPositions[*member]]);
+            }
+            return ImprovedType(Type::UNKNOWN);
+        }
+
+        case (ET::MEMBER): {
+            Member* member = asMember(expr);
+            if (member->index >= member->defn->memberTypes.size()) return ImprovedType(Type::UNKNOWN);
+            return resolve(member->defn->memberTypes[member->index]);
+        }
+
+        case (ET::SHARED):          return typeOf(asShared(expr)->expr);
+        case (ET::SHARED_SCOPE):    return typeOf(asSharedScope(expr)->expr);
+
+        default: return ImprovedType(Type::UNKNOWN);
+    }
+}
+
+ImprovedType CBackend::returnTypeOf(Func* f)
+{
+    ImprovedType type = resolve(f->returnType);
+    if (type.base != Type::TO_INFER) return type;
+
+    if (returnTypes.contains(f)) return returnTypes.at(f);
+    if (inferring.contains(f)) return ImprovedType(Type::UNKNOWN);
+
+    // Looks at the function like we were compiling it
+    inferring.insert(f);
+    Func* outerFunc = func;
+    auto outerLocals = locals;
+    auto outerOrder = localOrder;
+
+    func = f;
+    locals.clear();
+    localOrder.clear();
+    for (auto param : f->params) declareLocal(param->name, resolve(param->type));
+    collectLocals(f->body);
+
+    type = ImprovedType(Type::UNKNOWN);
+    findReturnType(f->body, type);
+
+    func = outerFunc;
+    locals = outerLocals;
+    localOrder = outerOrder;
+    inferring.erase(f);
+
+    if (type.base == Type::UNKNOWN) fail("the return type of " + f->name);
+    returnTypes.insert_or_assign(f, type);
+    return type;
+}
+
+void CBackend::findReturnType(Stmt* stmt, ImprovedType& type)
+{
+    if (!stmt || type.base != Type::UNKNOWN) return;
+
+    switch(stmt->kind) {
+        case (ST::RETURN):  if (asReturn(stmt)->expr) type = typeOf(asReturn(stmt)->expr); break;
+        case (ST::BLOCK):   for (auto s : asBlock(stmt)->stmts) findReturnType(s, type); break;
+        case (ST::IF): {
+            findReturnType(asIf(stmt)->ifBody, type);
+            findReturnType(asIf(stmt)->elseBody, type);
+        } break;
+        case (ST::FOR):     findReturnType(asFor(stmt)->body, type); break;
+        case (ST::WHILE):   findReturnType(asWhile(stmt)->body, type); break;
+        default: break;
+    }
+}
+
+string CBackend::cType(ImprovedType type)
+{
+    if (type.flags & Flags::POINTER) {
+        fail("pointers");
+        return "void*";
+    }
+    if (type.flags & Flags::ARRAY) return "jai_array*";
+
+    switch(type.base) {
+        case (Type::FLOAT):
+        case (Type::DOUBLE):    return "double";
+        case (Type::CHAR):      return "char";
+        case (Type::BOOL):      return "bool";
+        case (Type::STRING):    return "jai_string";
+        case (Type::VOID):      return "void";
+        case (Type::ENUM):      return "long long";
+        case (Type::STRUCT):    return cStruct(*(string*) type.info) + "*";
+        default: break;
+    }
+
+    if (isIntegerType(type.base)) return "long long";
+
+    fail("values of type " + TypeToString(type.base));
+    return "long long";
+}
+
+// What array elements and struct members are kept as: as wide as the Interpreter keeps them unboxed
+// (see packedWidth), so storing 300 into a u8 wraps around the same way
+string CBackend::storageType(ImprovedType type)
+{
+    if (type.flags) return cType(type);
+
+    switch(type.base) {
+        case (Type::CHAR):
+        case (Type::U8):    return "unsigned char";
+        case (Type::S8):    return "signed char";
+        case (Type::U16):   return "unsigned short";
+        case (Type::S16):   return "short";
+        case (Type::U32):   return "unsigned int";
+        case (Type::S32):   return "int";
+        case (Type::FLOAT): return "float";
+        default:            return cType(type);
+    }
+}
+
+string CBackend::zero(ImprovedType type)
+{
+    switch(type.base) {
+        case (Type::FLOAT):
+        case (Type::DOUBLE):    return "0.0";
+        case (Type::BOOL):      return "false";
+        case (Type::STRING):    return "\"\"";
+        case (Type::STRUCT):    return "(" + cType(type) + ") jai_new(sizeof(" + cStruct(*(string*) type.info) + "))";
+        default:                return "0";
+    }
+}
+
+string CBackend::literal(const Any& any)
+{
+    switch(any.type.base) {
+        case (Type::FLOAT):
+        case (Type::DOUBLE): {
+            double d = any.value.Float;
+            if (isnan(d)) return "(0.0 / 0.0)";
+            if (isinf(d)) return d > 0 ? "(1.0 / 0.0)" : "(-1.0 / 0.0)";
+
+            stringstream s;
+            s << setprecision(17) << d;
+            string text = s.str();
+            if (text.find_first_of(".e") == string::npos) text += ".0";
+            return text;
+        }
+        case (Type::CHAR):  return "((char) " + to_string((int) any.value.Char) + ")";
+        case (Type::BOOL):  return any.value.Bool ? "true" : "false";
+
+        case (Type::STRING): {
+            stringstream s;
+            s << '"';
+            for (unsigned char c : any.value.String->text) {
+                if (c == '"' || c == '\\' || c == '?') s << '\\' << c;
+                else if (c < 32 || c > 126) s << '\\' << oct << setw(3) << setfill('0') << (int) c << dec;
+                else s << c;
+            }
+            s << '"';
+            return s.str();
+        }
+        default: break;
+    }
+
+    if (isIntegerType(any.type.base)) {
+        if (any.value.Int == LLONG_MIN) return "(-9223372036854775807LL - 1)";
+        return to_string(any.value.Int) + "LL";
+    }
+
+    fail("constants of type " + TypeToString(any.type.base));
+    return "0";
+}
+
+// A C expression for expr. Calls in it already got evaluated into temporaries in front of the statement
+string CBackend::expr(Expr* expr)
+{
+    switch(expr->kind) {
+        case (ET::CONST): return literal(asConst(expr)->any);
+
+        case (ET::IDENT): {
+            const string& name = asIdent(expr)->name;
+            if (locals.contains(name)) return cName(name);
+            if (constants.contains(name)) return literal(constants[name]);
+
+            fail(func->name + " using " + name + ", C can't see the variables of the caller");
+            return "0";
+        }
+
+        case (ET::BINARY): return binary(asBinary(expr));
+
+        case (ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            string operand = this->expr(unary->expr);
+            if (unary->op == OP::NOT) return "(!" + operand + ")";
+            if (unary->op == OP::NEGATE) return "(-(" + operand + "))";
+            fail("unary operators other than ! and -");
+            return "0";
+        }
+
+        case (ET::CALL): return call(asCall(expr));
+
+        case (ET::GET): {
+            Get* get = asGet(expr);
+
+            // Enum values are known before running
+            if (isIdent(get->expr) && enums.contains(asIdent(get->expr)->name) && !locals.contains(asIdent(get->expr)->name)) {
+                Enum* e = enums[asIdent(get->expr)->name];
+                const string* name = isConst(get->access) ? &asConst(get->access)->any.value.String->text : nullptr;
+                if (!name || !e->values.contains(*name)) {
+                    fail("this enum access in " + func->name);
+                    return "0";
+                }
+                return to_string(e->values[*name]) + "LL";
+            }
+
+            ImprovedType type = typeOf(get->expr);
+            string object = this->expr(get->expr);
+
+            if (type.flags & Flags::ARRAY) {
+                string index = this->expr(get->access);
+                type.flags &= ~Flags::ARRAY;
+                return "((" + cType(type) + ") *(" + storageType(type) + "*) jai_at(" + object + ", " + index + ", \"reading\"))";
+            }
+
+            if (typeOf(expr).base == Type::UNKNOWN) {
+                fail("this kind of indexing in " + func->name);
+                return "0";
+            }
+            return "(" + object + ")->" + cName(asConst(get->access)->any.value.String->text);
+        }
+
+        case (ET::MEMBER): {
+            Member* member = asMember(expr);
+            ImprovedType type = typeOf(member->expr);
+            if (type.base != Type::STRUCT || *(string*) type.info != member->defn->name) fail("member access on something that isn't a " + member->defn->name);
+
+            return "(" + this->expr(member->expr) + ")->" + cName(member->name);
+        }
+
+        // C evaluates the same thing twice just as fast, the compiler finds the common parts itself
+        case (ET::SHARED): {
+            Shared* shared = asShared(expr);
+            if (sharedTemps[shared->slot].empty()) {
+                string value = this->expr(shared->expr);
+                sharedTemps[shared->slot] = temp(typeOf(shared->expr), value);
+            }
+            return sharedTemps[shared->slot];
+        }
+
+        case (ET::SHARED_SCOPE): {
+            SharedScope* scope = asSharedScope(expr);
+            vector<string> outer = std::move(sharedTemps);
+            sharedTemps.assign(scope->slots, "");
+            string result = this->expr(scope->expr);
+            sharedTemps = std::move(outer);
+            return result;
+        }
+
+        default: break;
+    }
+
+    fail("this kind of expression in " + func->name);
+    return "0";
+}
+
+// Math takes the type of the left side, like Any does
+string CBackend::binary(Binary* binary)
+{
+    ImprovedType left = typeOf(binary->left);
+    ImprovedType right = typeOf(binary->right);
+
+    string l = expr(binary->left);
+
+    if (left.base == Type::STRING && !left.flags) {
+        switch(binary->op) {
+            case (OP::PLUS):        return "jai_concat(" + l + ", " + toString(binary->right) + ")";
+            case (OP::EQUAL):       return "jai_equal(" + l + ", " + expr(binary->right) + ")";
+            case (OP::NOT_EQUAL):   return "(!jai_equal(" + l + ", " + expr(binary->right) + "))";
+            default: {
+                fail(OPtoString(binary->op) + " on strings");
+                return "0";
+            }
+        }
+    }
+
+    string r = expr(binary->right);
+
+    const char* op = "";
+    switch(binary->op) {
+        case (OP::EQUAL):           op = "=="; break;
+        case (OP::NOT_EQUAL):       op = "!="; break;
+        case (OP::AND):             op = "&&"; break;
+        case (OP::OR):              op = "||"; break;
+        case (OP::GREATER):         op = ">"; break;
+        case (OP::GREATER_EQUAL):   op = ">="; break;
+        case (OP::LESS):            op = "<"; break;
+        case (OP::LESS_EQUAL):      op = "<="; break;
+
+        case (OP::PLUS):
+        case (OP::MINUS):
+        case (OP::MULTIPLY):
+        case (OP::DIVIDE): {
+            if (!isNumber(left.base) || left.flags) fail(OPtoString(binary->op) + " on " + TypeToString(left.base) + " in " + func->name);
+            if (!sameType(left, right)) r = "(" + cType(left) + ") " + r;
+
+            if (binary->op == OP::DIVIDE && isIntegerType(left.base)) return "((" + cType(left) + ") jai_div(" + l + ", " + r + "))";
+
+            if (binary->op == OP::PLUS) op = "+";
+            else if (binary->op == OP::MINUS) op = "-";
+            else if (binary->op == OP::MULTIPLY) op = "*";
+            else op = "/";
+        } break;
+
+        default: fail("the operator " + OPtoString(binary->op));
+    }
+
+    return "(" + l + " " + op + " " + r + ")";
+}
+
+string CBackend::call(Call* call, bool statement)
+{
+    if (!isIdent(call->name) || !functions.contains(asIdent(call->name)->name)) {
+        fail("this call in " + func->name);
+        return "0";
+    }
+
+    Func* callee = functions[asIdent(call->name)->name];
+    if (callee->params.size() != call->args.size()) fail("calling " + callee->name + " with the wrong number of arguments");
+
+    string args;
+    for (int i = 0; i < call->args.size(); i++) {
+        if (i) args += ", ";
+        args += expr(call->args[i]);
+    }
+
+    string text = (callee->body ? cFunction(callee->name) : "jai_" + callee->name) + "(" + args + ")";
+    if (statement) return text;
+
+    ImprovedType type = returnTypeOf(callee);
+    if (type.base == Type::VOID) {
+        fail("using the value of " + callee->name + ", it doesn't return one");
+        return "0";
+    }
+    return temp(type, text);
+}
+
+// Whatever isn't a number or a bool is false, like in Interpreter::isTruthy
+string CBackend::condition(Expr* expr)
+{
+    ImprovedType type = typeOf(expr);
+    string value = this->expr(expr);
+
+    if (type.flags) return "false";
+    if (type.base == Type::BOOL) return value;
+    if (isNumber(type.base)) return "(" + value + " != 0)";
+    return "false";
+}
+
+// Like Any::toString, for the right side of a string +
+string CBackend::toString(Expr* expr)
+{
+    ImprovedType type = typeOf(expr);
+    string value = this->expr(expr);
+
+    if (type.flags) return "\"\"";
+
+    switch(type.base) {
+        case (Type::STRING):    return value;
+        case (Type::CHAR):      return "jai_from_char(" + value + ")";
+        case (Type::BOOL):      return "jai_from_bool(" + value + ")";
+        case (Type::FLOAT):
+        case (Type::DOUBLE):    return "jai_from_float(" + value + ")";
+        case (Type::ENUM):      return "jai_from_int(" + value + ")";
+        default: break;
+    }
+
+    if (isIntegerType(type.base)) return "jai_from_int(" + value + ")";
+    return "\"\"";
+}
+
+string CBackend::temp(ImprovedType type, const string& value)
+{
+    string name = "_t" + to_string(temps++);
+    line(cType(type) + " " + name + " = " + value + ";");
+    return name;
+}
+
+void CBackend::line(const string& text)
+{
+    for (int i = 0; i < indent; i++) out << "    ";
+    out << text << "\n";
+}
+
+void CBackend::stmt(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): decl(asDecl(stmt)); break;
+
+        case (ST::BLOCK): {
+            line("{");
+            indent++;
+            openScope(stmt, false);
+            for (auto s : asBlock(stmt)->stmts) this->stmt(s);
+            closeScope();
+            indent--;
+            line("}");
+        } break;
+
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            string c = condition(i->condition);
+
+            line("if (" + c + ") {");
+            indent++;
+            this->stmt(i->ifBody);
+            indent--;
+
+            if (i->elseBody) {
+                line("} else {");
+                indent++;
+                this->stmt(i->elseBody);
+                indent--;
+            }
+            line("}");
+        } break;
+
+        case (ST::EXPRSTMT): {
+            Expr* e = asExprStmt(stmt)->expr;
+
+            // A call CSE wrapped into a SharedScope is still a statement, printf doesn't have a value
+            if (isSharedScope(e) && isCall(asSharedScope(e)->expr)) {
+                vector<string> outer = std::move(sharedTemps);
+                sharedTemps.assign(asSharedScope(e)->slots, "");
+                line(call(asCall(asSharedScope(e)->expr), true) + ";");
+                sharedTemps = std::move(outer);
+            }
+            else if (isCall(e)) line(call(asCall(e), true) + ";");
+            else line("(void) " + expr(e) + ";");
+        } break;
+
+        case (ST::DEFER): line("_d" + to_string(deferIds[asDefer(stmt)]) + "++;"); break;
+
+        case (ST::FOR):     forLoop(asFor(stmt)); break;
+        case (ST::WHILE):   whileLoop(asWhile(stmt)); break;
+
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            if (!isIdent(assign->left) || !locals.contains(asIdent(assign->left)->name)) {
+                fail("assigning to something that isn't a variable of " + func->name);
+                break;
+            }
+
+            string value = expr(assign->right);
+            line(cName(asIdent(assign->left)->name) + " = " + value + ";");
+        } break;
+
+        case (ST::SET): set(asSet(stmt)); break;
+
+        // The value is evaluated before the deferred statements run
+        case (ST::RETURN): {
+            Return* ret = asReturn(stmt);
+            ImprovedType type = returnTypeOf(func);
+
+            if (!ret->expr || type.base == Type::VOID) {
+                if (ret->expr) line("(void) " + expr(ret->expr) + ";");
+                cleanup(0);
+                line("return;");
+                break;
+            }
+
+            string value = expr(ret->expr);
+            if (!isIdent(ret->expr) && !isConst(ret->expr)) value = temp(type, value);
+            cleanup(0);
+            line("return " + value + ";");
+        } break;
+
+        case (ST::CONTINUE):
+        case (ST::BREAK): {
+            int loop = scopes.size() - 1;
+            while (loop >= 0 && !scopes[loop].loop) loop--;
+            if (loop < 0) {
+                fail("break or continue outside of a loop");
+                break;
+            }
+
+            cleanup(loop + 1);
+            line(isBreak(stmt) ? "break;" : "continue;");
+        } break;
+
+        default: break;
+    }
+}
+
+void CBackend::decl(Decl* decl)
+{
+    if (decl->isConstant()) return;
+
+    ImprovedType type = locals.at(decl->name);
+    string name = cName(decl->name);
+
+    // For arrays the expr is the size
+    if (type.flags & Flags::ARRAY) {
+        string size = expr(decl->expr);
+        ImprovedType element = type;
+        element.flags &= ~Flags::ARRAY;
+        line(name + " = jai_array_new(" + size + ", sizeof(" + storageType(element) + "));");
+        return;
+    }
+
+    string value = decl->expr ? expr(decl->expr) : zero(type);
+    line(name + " = " + value + ";");
+}
+
+// Every Block, for and while collects defers like Interpreter::pushDefers
+void CBackend::openScope(Stmt* stmt, bool loop)
+{
+    Scope scope;
+    scope.loop = loop;
+
+    if (isBlock(stmt)) for (auto s : asBlock(stmt)->stmts) collectDefers(s, scope.defers);
+    else if (isFor(stmt)) collectDefers(asFor(stmt)->body, scope.defers);
+    else if (isWhile(stmt)) collectDefers(asWhile(stmt)->body, scope.defers);
+
+    for (auto defer : scope.defers) line("_d" + to_string(deferIds[defer]) + " = 0;");
+    scopes.push_back(scope);
+}
+
+void CBackend::closeScope()
+{
+    cleanup(scopes.size() - 1);
+    scopes.pop_back();
+}
+
+// Runs what the scopes down to downTo deferred, the innermost first
+void CBackend::cleanup(int downTo)
+{
+    for (int i = scopes.size() - 1; i >= downTo; i--) {
+        vector<Defer*> defers = scopes[i].defers;
+        for (auto defer : defers) {
+            string counter = "_d" + to_string(deferIds[defer]);
+            line("while (" + counter + " > 0) {");
+            indent++;
+            line(counter + "--;");
+            stmt(defer->block);
+            indent--;
+            line("}");
+        }
+    }
+}
+
+// Counts with a hidden index like Interpreter::runCountedFor, so the body can change it freely
+void CBackend::forLoop(For* forLoop)
+{
+    int id = temps++;
+    string index = "_i" + to_string(id);
+    string end = "_e" + to_string(id);
+
+    line("{");
+    indent++;
+    openScope(forLoop, true);
+
+    string start = expr(forLoop->start);
+    line("long long " + index + " = " + start + ";");
+    string last = expr(forLoop->end);
+    line("long long " + end + " = " + last + ";");
+
+    if (!forLoop->invariants.empty()) {
+        line("if (" + index + " < " + end + ") {");
+        indent++;
+        for (auto decl : forLoop->invariants) this->decl(decl);
+        indent--;
+        line("}");
+    }
+
+    line("for (; " + index + " < " + end + "; " + index + "++) {");
+    indent++;
+    line(cName(forLoop->it) + " = " + index + ";");
+    stmt(forLoop->body);
+    indent--;
+    line("}");
+
+    closeScope();
+    indent--;
+    line("}");
+}
+
+// The condition goes inside the loop, so the calls in it run again every time
+void CBackend::whileLoop(While* whileLoop)
+{
+    int id = temps++;
+    string first = "_f" + to_string(id);
+
+    line("{");
+    indent++;
+    openScope(whileLoop, true);
+
+    for (auto decl : whileLoop->conditionInvariants) this->decl(decl);
+    if (!whileLoop->invariants.empty()) line("bool " + first + " = true;");
+
+    line("for (;;) {");
+    indent++;
+
+    string c = condition(whileLoop->condition);
+    line("if (!(" + c + ")) break;");
+
+    if (!whileLoop->invariants.empty()) {
+        line("if (" + first + ") {");
+        indent++;
+        line(first + " = false;");
+        for (auto decl : whileLoop->invariants) this->decl(decl);
+        indent--;
+        line("}");
+    }
+
+    stmt(whileLoop->body);
+    indent--;
+    line("}");
+
+    closeScope();
+    indent--;
+    line("}");
+}
+
+void CBackend::set(Set* set)
+{
+    ImprovedType type = typeOf(set->expr);
+    string object = expr(set->expr);
+
+    if (type.flags & Flags::ARRAY) {
+        string index = expr(set->access);
+        string value = expr(set->value);
+        type.flags &= ~Flags::ARRAY;
+        string storage = storageType(type);
+        line("*(" + storage + "*) jai_at(" + object + ", " + index + ", \"writing\") = (" + storage + ") " + value + ";");
+        return;
+    }
+
+    if (type.base == Type::STRUCT && isConst(set->access) && asConst(set->access)->any.type.base == Type::STRING) {
+        Struct* s = structs[*(string*) type.info];
+        string member = asConst(set->access)->any.value.String->text;
+        if (!s->memberPositions.contains(member)) fail(member + " isn't a member of " + s->name);
+
+        string value = expr(set->value);
+        string storage = storageType(resolve(s->memberTypes[s->memberPositions[member]]));
+        line("(" + object + ")->" + cName(member) + " = (" + storage + ") " + value + ";");
+        return;
+    }
+
+    fail("setting something that isn't an array or struct in " + func->name);
+}
+
+string CBackend::signature(Func* f)
+{
+    Func* outer = func;
+    func = f;
+
+    string params;
+    for (int i = 0; i < f->params.size(); i++) {
+        if (i) params += ", ";
+        params += cType(resolve(f->params[i]->type)) + " " + cName(f->params[i]->name);
+    }
+    if (params.empty()) params = "void";
+
+    string text = cType(returnTypeOf(f)) + " " + cFunction(f->name) + "(" + params + ")";
+    func = outer;
+    return text;
+}
+
+void CBackend::function(Func* f, stringstream& file)
+{
+    func = f;
+    locals.clear();
+    localOrder.clear();
+    deferIds.clear();
+    scopes.clear();
+    temps = 0;
+    indent = 1;
+    out.str("");
+
+    for (auto param : f->params) {
+        ImprovedType type = resolve(param->type);
+        if (type.base == Type::UNKNOWN || type.base == Type::TO_INFER) fail("the type of the parameter " + param->name + " of " + f->name);
+        declareLocal(param->name, type);
+    }
+    collectLocals(f->body);
+
+    // Deferred statements can't leave their scope in C or defer more themselves
+    vector<Defer*> defers;
+    vector<Stmt*> work = { f->body };
+    while (!work.empty()) {
+        Stmt* s = work.back();
+        work.pop_back();
+        if (!s) continue;
+
+        switch(s->kind) {
+            case (ST::DEFER):   defers.push_back(asDefer(s)); break;
+            case (ST::BLOCK):   for (auto child : asBlock(s)->stmts) work.push_back(child); break;
+            case (ST::IF):      work.push_back(asIf(s)->ifBody); work.push_back(asIf(s)->elseBody); break;
+            case (ST::FOR):     work.push_back(asFor(s)->body); break;
+            case (ST::WHILE):   work.push_back(asWhile(s)->body); break;
+            default: break;
+        }
+    }
+    for (auto defer : defers) {
+        int id = deferIds.size();
+        deferIds[defer] = id;
+
+        vector<Stmt*> inside = { defer->block };
+        while (!inside.empty()) {
+            Stmt* s = inside.back();
+            inside.pop_back();
+            if (!s) continue;
+
+            if (isReturn(s) || isBreak(s) || isContinue(s) || isDefer(s)) fail("return, break, continue or defer inside a defer");
+            else if (isBlock(s)) for (auto child : asBlock(s)->stmts) inside.push_back(child);
+            else if (isIf(s)) { inside.push_back(asIf(s)->ifBody); inside.push_back(asIf(s)->elseBody); }
+            else if (isFor(s)) inside.push_back(asFor(s)->body);
+            else if (isWhile(s)) inside.push_back(asWhile(s)->body);
+        }
+    }
+
+    stmt(f->body);
+
+    file << "static " << signature(f) << "\n{\n";
+    for (auto& name : localOrder) {
+        bool param = false;
+        for (auto p : f->params) if (p->name == name) param = true;
+        if (!param) file << "    " << cType(locals.at(name)) << " " << cName(name) << ";\n";
+    }
+    for (int i = 0; i < deferIds.size(); i++) file << "    int _d" << i << " = 0;\n";
+    file << out.str() << "}\n\n";
+}
+
+bool buildNative(const string& source, const string& cPath, const string& exePath)
+{
+    ofstream file(cPath);
+    if (!file) return false;
+    file << source;
+    file.close();
+
+    const char* cc = getenv("CC");
+    string command = string(cc ? cc : "cc") + " -O2 -fwrapv -o \"" + exePath + "\" \"" + cPath + "\"";
+    return system(command.c_str()) == 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Any.h"
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Turns the checked program into one C file that only needs libc, so cc can make a native binary out of it.
+// Everything gets the type the program declared or the one its expression has, there are no Anys at runtime:
+// ints are long long, floats double, strings char pointers, structs and arrays live on the heap
+// and get passed around by pointer like in the Interpreter.
+// Calls are evaluated left to right into temporaries first, the way the Interpreter does it.
+// A defer counts up a counter of its scope, and every way out of the scope runs the deferred statements whose counter is up.
+struct CBackend {
+    unordered_map<string, Func*>& functions;
+    unordered_map<string, Any>& constants;
+    unordered_map<string, Struct*>& structs;
+    unordered_map<string, Enum*>& enums;
+
+    // What we can't do in C, like a function using a variable of its caller. Empty if everything went fine
+    string unsupported;
+
+    // The function we're in
+    Func* func = nullptr;
+    stringstream out;
+    int indent = 0;
+    int temps = 0;
+    unordered_map<string, ImprovedType> locals;
+    vector<string> localOrder;
+    unordered_map<Defer*, int> deferIds;
+    // The temporaries of the SharedScope we're in, by slot, empty until the first use computes them
+    vector<string> sharedTemps;
+
+    // -> Vector2 doesn't keep the name of the struct, so those come from the return statements
+    unordered_map<Func*, ImprovedType> returnTypes;
+    unordered_set<Func*> inferring;
+
+    struct Scope {
+        vector<Defer*> defers;
+        bool loop = false;
+    };
+    vector<Scope> scopes;
+
+    CBackend(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s, unordered_map<string, Enum*>& e);
+
+    // The whole translation unit, starting at main
+    string compile(Func* main);
+
+    void fail(const string& what);
+    void collectFunctions(Func* func, vector<Func*>& order, unordered_set<Func*>& seen);
+    void collectCalls(Stmt* stmt, vector<Func*>& calls);
+    void collectCalls(Expr* expr, vector<Func*>& calls);
+    void collectLocals(Stmt* stmt);
+    void declareLocal(const string& name, ImprovedType type);
+    void collectDefers(Stmt* stmt, vector<Defer*>& defers);
+
+    ImprovedType resolve(ImprovedType type);
+    ImprovedType typeOf(Expr* expr);
+    ImprovedType returnTypeOf(Func* func);
+    void findReturnType(Stmt* stmt, ImprovedType& type);
+    string cType(ImprovedType type);
+    string storageType(ImprovedType type);
+    string zero(ImprovedType type);
+    string literal(const Any& any);
+
+    string expr(Expr* expr);
+    string binary(Binary* binary);
+    string call(Call* call, bool statement = false);
+    string condition(Expr* expr);
+    string toString(Expr* expr);
+    string temp(ImprovedType type, const string& value);
+
+    void line(const string& text);
+    void stmt(Stmt* stmt);
+    void decl(Decl* decl);
+    void openScope(Stmt* stmt, bool loop);
+    void closeScope();
+    void cleanup(int downTo);
+    void forLoop(For* forLoop);
+    void whileLoop(While* whileLoop);
+    void set(Set* set);
+    string signature(Func* func);
+    void function(Func* func, stringstream& file);
+};
+
+// Writes the source to cPath and builds exePath out of it with cc -O2, or $CC if that's set
+bool buildNative(const string& source, const string& cPath, const string& exePath);
@@ -0,0 +1,384 @@
+#include <vector>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "CSE.h"
+#include "Stmt.h"
+#include "Expr.h"
+#include "error.h"
+
+using namespace std;
+
+CSE::CSE(unordered_map<string, Func*>& f) : functions(f) {}
+
+void CSE::optimize(vector<Stmt*>& stmts)
+{
+    findPureFunctions(stmts);
+
+    for (auto stmt : stmts) optimizeStmt(stmt);
+}
+
+void CSE::collectFunctions(Stmt* stmt, vector<Func*>& funcs)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (!func->body) return;
+            funcs.push_back(func);
+            collectFunctions(func->body, funcs);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectFunctions(s, funcs);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectFunctions(i->ifBody, funcs);
+            collectFunctions(i->elseBody, funcs);
+        } break;
+        case (ST::FOR):     collectFunctions(asFor(stmt)->body, funcs); break;
+        case (ST::WHILE):   collectFunctions(asWhile(stmt)->body, funcs); break;
+        case (ST::DEFER):   collectFunctions(asDefer(stmt)->block, funcs); break;
+        default: break;
+    }
+}
+
+// Start by assuming every function is pure and throw out the ones that aren't until nothing changes.
+void CSE::findPureFunctions(vector<Stmt*>& stmts)
+{
+    vector<Func*> funcs;
+    for (auto stmt : stmts) collectFunctions(stmt, funcs);
+
+    for (auto func : funcs) pure[func] = {};
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (auto func : funcs) {
+            if (!pure.contains(func)) continue;
+
+            unordered_set<string> writes;
+            for (auto param : func->params) writes.insert(param->name);
+
+            if (!isPure(func->body, writes)) {
+                pure.erase(func);
+                changed = true;
+            } else if (writes.size() != pure[func].size()) {
+                pure[func] = writes;
+                changed = true;
+            }
+        }
+    }
+}
+
+Func* CSE::callee(Call* call)
+{
+    if (!isIdent(call->name)) return nullptr;
+
+    auto found = functions.find(asIdent(call->name)->name);
+    return found == functions.end() ? nullptr : found->second;
+}
+
+bool CSE::isPure(Stmt* stmt, unordered_set<string>& writes)
+{
+    if (!stmt) return true;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->isConstant()) return true;
+
+            // Every call would hand out a new struct or array, sharing them would be noticeable
+            if (decl->type.base == Type::STRUCT || decl->isDeclArray()) return false;
+
+            writes.insert(decl->name);
+            return !decl->expr || isPure(decl->expr, writes);
+        }
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) if (!isPure(s, writes)) return false;
+            return true;
+        }
+        case (ST::RETURN):      return isPure(asReturn(stmt)->expr, writes);
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            return isPure(i->condition, writes) && isPure(i->ifBody, writes) && isPure(i->elseBody, writes);
+        }
+        case (ST::EXPRSTMT):    return isPure(asExprStmt(stmt)->expr, writes);
+        case (ST::DEFER):       return isPure(asDefer(stmt)->block, writes);
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            writes.insert(forLoop->it);
+            for (auto decl : forLoop->invariants) if (!isPure(decl, writes)) return false;
+            return isPure(forLoop->start, writes) && (!forLoop->end || isPure(forLoop->end, writes)) && isPure(forLoop->body, writes);
+        }
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) if (!isPure(decl, writes)) return false;
+            for (auto decl : whileLoop->invariants) if (!isPure(decl, writes)) return false;
+            return isPure(whileLoop->condition, writes) && isPure(whileLoop->body, writes);
+        }
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            writes.insert(asIdent(assign->left)->name);
+            return isPure(assign->right, writes);
+        }
+        case (ST::SET):         return false;
+        default:                return true;
+    }
+}
+
+bool CSE::isPure(Expr* expr, unordered_set<string>& writes)
+{
+    switch(expr->kind) {
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            return isPure(binary->left, writes) && isPure(binary->right, writes);
+        }
+        case(ET::UNARY):        return isPure(asUnary(expr)->expr, writes);
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            return isPure(get->expr, writes) && isPure(get->access, writes);
+        }
+        case(ET::MEMBER):       return isPure(asMember(expr)->expr, writes);
+        case(ET::SHARED):       return isPure(asShared(expr)->expr, writes);
+        case(ET::SHARED_SCOPE): return isPure(asSharedScope(expr)->expr, writes);
+        case(ET::CALL): {
+            Call* call = asCall(expr);
+            Func* defn = callee(call);
+            if (!defn || !pure.contains(defn)) return false;
+
+            writes.insert(pure[defn].begin(), pure[defn].end());
+
+            for (auto arg : call->args) if (!isPure(arg, writes)) return false;
+            return true;
+        }
+        default:                return true;
+    }
+}
+
+void CSE::optimizeStmt(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->expr && !decl->isConstant()) decl->expr = optimizeExpr(decl->expr);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) optimizeStmt(s);
+        } break;
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (func->body) optimizeStmt(func->body);
+        } break;
+        case (ST::RETURN): {
+            // Tail calls pick their expression apart, so we leave those alone
+            Return* r = asReturn(stmt);
+            if (!r->tailCall) r->expr = optimizeExpr(r->expr);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            i->condition = optimizeExpr(i->condition);
+            optimizeStmt(i->ifBody);
+            optimizeStmt(i->elseBody);
+        } break;
+        case (ST::EXPRSTMT): {
+            ExprStmt* exprStmt = asExprStmt(stmt);
+            exprStmt->expr = optimizeExpr(exprStmt->expr);
+        } break;
+        case (ST::DEFER):   optimizeStmt(asDefer(stmt)->block); break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            optimizeStmt(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            whileLoop->condition = optimizeExpr(whileLoop->condition);
+            optimizeStmt(whileLoop->body);
+        } break;
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            assign->right = optimizeExpr(assign->right);
+        } break;
+        case (ST::SET): {
+            Set* set = asSet(stmt);
+            set->value = optimizeExpr(set->value);
+        } break;
+        default: break;
+    }
+}
+
+Expr* CSE::optimizeExpr(Expr* expr)
+{
+    ids.clear();
+    counts.clear();
+    shared.clear();
+    clobbered.clear();
+    slots = 0;
+
+    // A call that isn't pure may still be the root, it only runs once all its arguments are done.
+    // Anywhere else it could change what the other occurrences see.
+    if (isCall(expr) && !isPure(expr, clobbered)) {
+        clobbered.clear();
+        for (auto arg : asCall(expr)->args) if (!isPure(arg, clobbered)) return expr;
+    } else if (!isPure(expr, clobbered)) {
+        return expr;
+    }
+
+    number(expr);
+    count(expr);
+
+    Expr* result = rewrite(expr);
+    if (slots == 0) return expr;
+
+    return new SharedScope(result, slots);
+}
+
+// Hash-consing: equal trees get the same number
+int CSE::number(Expr* expr)
+{
+    stringstream key;
+    switch(expr->kind) {
+        case(ET::CONST): {
+            Any& any = asConst(expr)->any;
+            key << "C" << (int) any.type.base << ":";
+            if (any.type.base == Type::STRING) key << any.value.String->text;
+            else key << any.value.Int;
+        } break;
+        case(ET::IDENT):        key << "I" << asIdent(expr)->name; break;
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            key << "B" << (int) binary->op << "," << number(binary->left) << "," << number(binary->right);
+        } break;
+        case(ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            key << "U" << (int) unary->op << "," << number(unary->expr);
+        } break;
+        case(ET::CALL): {
+            Call* call = asCall(expr);
+            key << "F" << number(call->name);
+            for (auto arg : call->args) key << "," << number(arg);
+        } break;
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            key << "G" << number(get->expr) << "," << number(get->access);
+        } break;
+        case(ET::MEMBER): {
+            Member* member = asMember(expr);
+            key << "M" << member->defn << "," << member->index << "," << number(member->expr);
+        } break;
+        default:                key << "X" << expr; break;
+    }
+
+    auto [found, inserted] = table.emplace(key.str(), table.size());
+    ids[expr] = found->second;
+    return found->second;
+}
+
+// We don't look inside repeated trees, since only the first one will be evaluated
+void CSE::count(Expr* expr)
+{
+    if (counts[ids[expr]]++ > 0) return;
+
+    switch(expr->kind) {
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            count(binary->left);
+            count(binary->right);
+        } break;
+        case(ET::UNARY):    count(asUnary(expr)->expr); break;
+        case(ET::CALL): {
+            for (auto arg : asCall(expr)->args) count(arg);
+        } break;
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            count(get->expr);
+            count(get->access);
+        } break;
+        case(ET::MEMBER):   count(asMember(expr)->expr); break;
+        default: break;
+    }
+}
+
+bool CSE::readsClobbered(Expr* expr)
+{
+    switch(expr->kind) {
+        case(ET::IDENT):    return clobbered.contains(asIdent(expr)->name);
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            return readsClobbered(binary->left) || readsClobbered(binary->right);
+        }
+        case(ET::UNARY):    return readsClobbered(asUnary(expr)->expr);
+        case(ET::CALL): {
+            for (auto arg : asCall(expr)->args) if (readsClobbered(arg)) return true;
+            return false;
+        }
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            return readsClobbered(get->expr) || readsClobbered(get->access);
+        }
+        case(ET::MEMBER):   return readsClobbered(asMember(expr)->expr);
+        default:            return false;
+    }
+}
+
+bool CSE::canShare(Expr* expr)
+{
+    switch(expr->kind) {
+        case(ET::BINARY):
+        case(ET::UNARY):
+        case(ET::GET):
+        case(ET::MEMBER):   return !readsClobbered(expr);
+        case(ET::CALL): {
+            Func* defn = callee(asCall(expr));
+            return defn && pure.contains(defn) && !readsClobbered(expr);
+        }
+        // Constants and variables are already as cheap as a lookup in the shared slots
+        default:            return false;
+    }
+}
+
+Expr* CSE::rewrite(Expr* expr)
+{
+    int id = ids[expr];
+
+    Shared* s = nullptr;
+    if (counts[id] > 1 && canShare(expr)) {
+        if (shared.contains(id)) return shared[id];
+
+        s = new Shared(expr, slots++);
+        shared[id] = s;
+    }
+
+    switch(expr->kind) {
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            binary->left  = rewrite(binary->left);
+            binary->right = rewrite(binary->right);
+        } break;
+        case(ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            unary->expr = rewrite(unary->expr);
+        } break;
+        case(ET::CALL): {
+            for (auto& arg : asCall(expr)->args) arg = rewrite(arg);
+        } break;
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            get->expr   = rewrite(get->expr);
+            get->access = rewrite(get->access);
+        } break;
+        case(ET::MEMBER): {
+            Member* member = asMember(expr);
+            member->expr = rewrite(member->expr);
+        } break;
+        default: break;
+    }
+
+    return s ? s : expr;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Common subexpression elimination.
+// Every Expr gets a number from a hash-consing table, so structurally equal trees share one.
+// Trees that show up more than once in a statement get replaced by a Shared node,
+// which only evaluates the first time it is reached inside its SharedScope.
+struct CSE {
+    unordered_map<string, Func*>& functions;
+
+    // Functions that don't print, don't write into structs or arrays and only call other pure functions.
+    // Because functions see their callers variables, we still have to know which names they write.
+    unordered_map<Func*, unordered_set<string>> pure;
+
+    unordered_map<string, int> table;
+    unordered_map<Expr*, int> ids;
+    unordered_map<int, int> counts;
+    unordered_map<int, Shared*> shared;
+    unordered_set<string> clobbered;
+    int slots = 0;
+
+    CSE(unordered_map<string, Func*>& f);
+
+    void optimize(vector<Stmt*>& stmts);
+
+    void findPureFunctions(vector<Stmt*>& stmts);
+    void collectFunctions(Stmt* stmt, vector<Func*>& funcs);
+    bool isPure(Stmt* stmt, unordered_set<string>& writes);
+    bool isPure(Expr* expr, unordered_set<string>& writes);
+    Func* callee(Call* call);
+
+    void optimizeStmt(Stmt* stmt);
+    Expr* optimizeExpr(Expr* expr);
+
+    int number(Expr* expr);
+    void count(Expr* expr);
+    bool canShare(Expr* expr);
+    bool readsClobbered(Expr* expr);
+    Expr* rewrite(Expr* expr);
+};
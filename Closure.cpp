@@ -0,0 +1,807 @@
+#include <vector>
+#include <string>
+
+#include "Closure.h"
+#include "error.h"
+
+using namespace std;
+
+ClosureFunction::ClosureFunction(Func* f) : name(f->name), func(f) {}
+
+ClosureRuntime::ClosureRuntime(Interpreter& i) : interp(i) {}
+
+Any ClosureRuntime::call(ClosureFunction* fn, int base)
+{
+    ClosureFrame frame = { fn, base };
+    frames.push_back(&frame);
+    size_t pendingBase = pendingOps.size();
+    const string* caller = Memory::function;
+    Memory::function = &fn->name;
+
+    while (fn->body(frame) == Flow::TAIL_CALL);
+
+    frames.pop_back();
+    Memory::function = caller;
+
+    Any result = frame.result;
+    while (pendingOps.size() > pendingBase) {
+        auto& [op, left] = pendingOps.back();
+        result = interp.applyBinary(op, left, result);
+        pendingOps.pop_back();
+    }
+    return result;
+}
+
+// Variables of the callers, the newest one wins like in the Interpreter's variables
+Any* ClosureRuntime::findName(const string& name)
+{
+    for (int i = frames.size() - 2; i >= 0; i--) {
+        auto& slotOf = frames[i]->fn->slotOf;
+        auto it = slotOf.find(name);
+        if (it != slotOf.end()) return &stack[frames[i]->base + it->second];
+    }
+
+    if (interp.variables.contains(name)) return &interp.variables[name];
+
+    return nullptr;
+}
+
+Any ClosureRuntime::loadName(const string& name)
+{
+    Any* any = findName(name);
+    if (any) return *any;
+    if (interp.constants.contains(name)) return interp.constants[name];
+
+    error("Undefined Variable");
+    return Any();
+}
+
+// In the order they were deferred, a deferred statement can defer more of its own
+void ClosureRuntime::runDefers(ClosureFrame& frame, int mark)
+{
+    for (int i = mark; i < defers.size(); i++) {
+        shared_ptr<StmtFn> defer = defers[i];
+        (*defer)(frame);
+    }
+    defers.resize(mark);
+}
+
+static Any intAny(long long i)
+{
+    Any any;
+    any.type.base = Type::INT;
+    any.value.Int = i;
+    return any;
+}
+
+static Any boolAny(bool b)
+{
+    Any any;
+    any.type.base = Type::BOOL;
+    any.value.Bool = b;
+    return any;
+}
+
+ClosureCompiler::ClosureCompiler(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s, ClosureRuntime* r)
+    : functions(f), constants(c), structs(s), rt(r) {}
+
+// All functions first, so calls can point at the ones we haven't compiled yet
+ClosureFunction* ClosureCompiler::compile(vector<Stmt*>& stmts)
+{
+    vector<Func*> funcs;
+    for (auto stmt : stmts) collectFunctions(stmt, funcs);
+
+    for (auto func : funcs) compiled[func] = new ClosureFunction(func);
+
+    for (auto func : funcs) {
+        fn = compiled[func];
+        deferScopes.clear();
+        sharedSlots.clear();
+
+        fn->params = func->params.size();
+        for (auto param : func->params) addSlot(param->name);
+        collectLocals(func->body);
+
+        StmtFn body = compileBlock(func->body);
+
+        // Falling off the end returns nothing
+        fn->body = [body](ClosureFrame& f) {
+            Flow flow = body(f);
+            if (flow != Flow::RETURN && flow != Flow::TAIL_CALL) f.result = Any();
+            return flow;
+        };
+
+        if (fn->name == "main") main = fn;
+    }
+
+    if (!main) error("No main function");
+
+    return main;
+}
+
+void ClosureCompiler::collectFunctions(Stmt* stmt, vector<Func*>& funcs)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (!func->body) return;
+            funcs.push_back(func);
+            collectFunctions(func->body, funcs);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectFunctions(s, funcs);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectFunctions(i->ifBody, funcs);
+            collectFunctions(i->elseBody, funcs);
+        } break;
+        case (ST::FOR):     collectFunctions(asFor(stmt)->body, funcs); break;
+        case (ST::WHILE):   collectFunctions(asWhile(stmt)->body, funcs); break;
+        case (ST::DEFER):   collectFunctions(asDefer(stmt)->block, funcs); break;
+        default: break;
+    }
+}
+
+void ClosureCompiler::collectLocals(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (!decl->isConstant()) addSlot(decl->name);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectLocals(s);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectLocals(i->ifBody);
+            collectLocals(i->elseBody);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            addSlot(forLoop->it);
+            for (auto decl : forLoop->invariants) addSlot(decl->name);
+            collectLocals(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) addSlot(decl->name);
+            for (auto decl : whileLoop->invariants) addSlot(decl->name);
+            collectLocals(whileLoop->body);
+        } break;
+        case (ST::DEFER):   collectLocals(asDefer(stmt)->block); break;
+        default: break;
+    }
+}
+
+int ClosureCompiler::addSlot(const string& name)
+{
+    if (fn->slotOf.contains(name)) return fn->slotOf[name];
+    return fn->slotOf[name] = fn->slots++;
+}
+
+int ClosureCompiler::hiddenSlot()
+{
+    return fn->slots++;
+}
+
+// The slot if the expr is just a variable of this function, -1 otherwise
+int ClosureCompiler::slotOf(Expr* expr)
+{
+    if (!isIdent(expr)) return -1;
+
+    auto it = fn->slotOf.find(asIdent(expr)->name);
+    return it == fn->slotOf.end() ? -1 : it->second;
+}
+
+StmtFn ClosureCompiler::compileStmt(Stmt* stmt)
+{
+    switch(stmt->kind) {
+        case (ST::DECL):    return compileDecl(asDecl(stmt));
+        case (ST::BLOCK):   return compileBlock(asBlock(stmt));
+        case (ST::IF):      return compileIf(asIf(stmt));
+        case (ST::FOR):     return compileFor(asFor(stmt));
+        case (ST::WHILE):   return compileWhile(asWhile(stmt));
+        case (ST::RETURN):  return compileReturn(asReturn(stmt));
+        case (ST::SET):     return compileSet(asSet(stmt));
+
+        // Declared at the top level, they don't run
+        case (ST::STRUCT):
+        case (ST::ENUM):
+        case (ST::FUNC):    return [](ClosureFrame& f) { return Flow::NEXT; };
+
+        case (ST::EXPRSTMT): {
+            ExprFn expr = compileExpr(asExprStmt(stmt)->expr);
+            return [expr](ClosureFrame& f) {
+                expr(f);
+                return Flow::NEXT;
+            };
+        }
+
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            return compileStore(asIdent(assign->left)->name, compileExpr(assign->right));
+        }
+
+        case (ST::DEFER): {
+            auto block = make_shared<StmtFn>(compileStmt(asDefer(stmt)->block));
+            deferScopes.back() = true;
+
+            ClosureRuntime* rt = this->rt;
+            return [rt, block](ClosureFrame& f) {
+                rt->defers.push_back(block);
+                return Flow::NEXT;
+            };
+        }
+
+        case (ST::CONTINUE):    return [](ClosureFrame& f) { return Flow::CONTINUE; };
+        case (ST::BREAK):       return [](ClosureFrame& f) { return Flow::BREAK; };
+
+        default: INTERNAL_ERROR("Stmt not supported by the ClosureCompiler");
+    }
+    return nullptr;
+}
+
+// Only scopes something defers into have to remember where their defers start
+StmtFn ClosureCompiler::withDefers(StmtFn body)
+{
+    if (!deferScopes.back()) return body;
+
+    ClosureRuntime* rt = this->rt;
+    return [rt, body](ClosureFrame& f) {
+        int mark = rt->defers.size();
+        Flow flow = body(f);
+        rt->runDefers(f, mark);
+        return flow;
+    };
+}
+
+StmtFn ClosureCompiler::compileBlock(Block* block)
+{
+    deferScopes.push_back(false);
+
+    vector<StmtFn> stmts;
+    for (auto stmt : block->stmts) {
+        stmts.push_back(compileStmt(stmt));
+
+        // Everything after these is dead
+        if (isReturn(stmt) || isBreak(stmt) || isContinue(stmt)) break;
+    }
+
+    StmtFn body;
+    if (stmts.size() == 1) {
+        body = stmts[0];
+    } else {
+        body = [stmts](ClosureFrame& f) {
+            for (auto& stmt : stmts) {
+                Flow flow = stmt(f);
+                if (flow != Flow::NEXT) return flow;
+            }
+            return Flow::NEXT;
+        };
+    }
+
+    body = withDefers(body);
+    deferScopes.pop_back();
+    return body;
+}
+
+StmtFn ClosureCompiler::compileDecl(Decl* decl)
+{
+    if (decl->isConstant()) return [](ClosureFrame& f) { return Flow::NEXT; };
+
+    ClosureRuntime* rt = this->rt;
+    int slot = fn->slotOf[decl->name];
+    ImprovedType type = decl->type;
+
+    if (decl->isDeclArray()) {
+        ExprFn size = compileExpr(decl->expr);
+        return [rt, slot, type, size](ClosureFrame& f) {
+            Any any;
+            any.type = type;
+            any.value.Ptr = new MyArray(ImprovedType(type.base, 0), size(f).value.Int);
+            rt->stack[f.base + slot] = any;
+            return Flow::NEXT;
+        };
+    }
+
+    if (decl->expr) return compileStore(decl->name, compileExpr(decl->expr));
+
+    if (type.base == Type::STRUCT) {
+        string* name = (string*) type.info;
+        if (!structs.contains(*name)) error("Struct not defined");
+        Struct* defn = structs[*name];
+
+        return [rt, slot, type, defn](ClosureFrame& f) {
+            Any any;
+            any.type = type;
+            any.value.Ptr = MyStruct::make(defn);
+            rt->stack[f.base + slot] = any;
+            return Flow::NEXT;
+        };
+    }
+
+    Any initial;
+    initial.type = type;
+    if (type.base == Type::ENUM) initial.type = Type::INT;
+    if (type.base == Type::STRING) initial.value.String = JaiString::intern("");
+
+    return [rt, slot, initial](ClosureFrame& f) {
+        rt->stack[f.base + slot] = initial;
+        return Flow::NEXT;
+    };
+}
+
+StmtFn ClosureCompiler::compileDecls(vector<Decl*>& decls)
+{
+    if (decls.empty()) return nullptr;
+
+    vector<StmtFn> fns;
+    for (auto decl : decls) fns.push_back(compileDecl(decl));
+
+    return [fns](ClosureFrame& f) {
+        for (auto& decl : fns) decl(f);
+        return Flow::NEXT;
+    };
+}
+
+// Like the Interpreter, names the function doesn't declare itself belong to a caller
+StmtFn ClosureCompiler::compileStore(const string& name, ExprFn value)
+{
+    ClosureRuntime* rt = this->rt;
+
+    if (fn->slotOf.contains(name)) {
+        int slot = fn->slotOf[name];
+        return [rt, slot, value](ClosureFrame& f) {
+            // A call in the value can grow the stack, so not straight into the slot
+            Any any = value(f);
+            rt->stack[f.base + slot] = any;
+            return Flow::NEXT;
+        };
+    }
+
+    return [rt, name, value](ClosureFrame& f) {
+        Any any = value(f);
+        Any* variable = rt->findName(name);
+        if (!variable) error("Undefined Variable");
+        *variable = any;
+        return Flow::NEXT;
+    };
+}
+
+StmtFn ClosureCompiler::compileIf(If* i)
+{
+    ClosureRuntime* rt = this->rt;
+    ExprFn condition = compileExpr(i->condition);
+    StmtFn then = compileStmt(i->ifBody);
+
+    if (!i->elseBody) {
+        return [rt, condition, then](ClosureFrame& f) {
+            if (rt->interp.isTruthy(condition(f))) return then(f);
+            return Flow::NEXT;
+        };
+    }
+
+    StmtFn otherwise = compileStmt(i->elseBody);
+    return [rt, condition, then, otherwise](ClosureFrame& f) {
+        if (rt->interp.isTruthy(condition(f))) return then(f);
+        return otherwise(f);
+    };
+}
+
+// The invariants only run if the body does, see LoopOptimizer
+StmtFn ClosureCompiler::compileFor(For* forLoop)
+{
+    if (!forLoop->end) {
+        unsupported = "for over arrays";
+        return nullptr;
+    }
+
+    deferScopes.push_back(false);
+
+    ClosureRuntime* rt = this->rt;
+    int it = fn->slotOf[forLoop->it];
+    ExprFn start = compileExpr(forLoop->start);
+    ExprFn end = compileExpr(forLoop->end);
+    StmtFn invariants = compileDecls(forLoop->invariants);
+    StmtFn body = compileStmt(forLoop->body);
+
+    StmtFn loop = [rt, it, start, end, invariants, body](ClosureFrame& f) {
+        Any index = start(f);
+        Any last = end(f);
+        rt->stack[f.base + it] = index;
+
+        // Counting with a native int, like the Interpreter's runCountedFor
+        if (isIntegerType(index.type.base) && isIntegerType(last.type.base)) {
+            long long first = index.value.Int;
+            long long stop = last.value.Int;
+
+            if (first < stop && invariants) invariants(f);
+
+            for (long long i = first; i < stop; i++) {
+                index.value.Int = i;
+                rt->stack[f.base + it] = index;
+
+                Flow flow = body(f);
+                if (flow == Flow::BREAK) break;
+                if (flow == Flow::RETURN || flow == Flow::TAIL_CALL) return flow;
+            }
+            return Flow::NEXT;
+        }
+
+        Any one = intAny(1);
+        bool firstTime = true;
+        while (rt->interp.isTruthy(index.less(last))) {
+            if (firstTime && invariants) invariants(f);
+            firstTime = false;
+
+            Flow flow = body(f);
+            if (flow == Flow::BREAK) break;
+            if (flow == Flow::RETURN || flow == Flow::TAIL_CALL) return flow;
+
+            index = index.add(one);
+            rt->stack[f.base + it] = index;
+        }
+        return Flow::NEXT;
+    };
+
+    loop = withDefers(loop);
+    deferScopes.pop_back();
+    return loop;
+}
+
+StmtFn ClosureCompiler::compileWhile(While* whileLoop)
+{
+    deferScopes.push_back(false);
+
+    ClosureRuntime* rt = this->rt;
+    StmtFn conditionInvariants = compileDecls(whileLoop->conditionInvariants);
+    ExprFn condition = compileExpr(whileLoop->condition);
+    StmtFn invariants = compileDecls(whileLoop->invariants);
+    StmtFn body = compileStmt(whileLoop->body);
+
+    StmtFn loop = [rt, conditionInvariants, condition, invariants, body](ClosureFrame& f) {
+        if (conditionInvariants) conditionInvariants(f);
+
+        bool firstTime = true;
+        while (rt->interp.isTruthy(condition(f))) {
+            if (firstTime && invariants) invariants(f);
+            firstTime = false;
+
+            Flow flow = body(f);
+            if (flow == Flow::BREAK) break;
+            if (flow == Flow::RETURN || flow == Flow::TAIL_CALL) return flow;
+        }
+        return Flow::NEXT;
+    };
+
+    loop = withDefers(loop);
+    deferScopes.pop_back();
+    return loop;
+}
+
+StmtFn ClosureCompiler::compileReturn(Return* ret)
+{
+    ClosureRuntime* rt = this->rt;
+
+    // Like the Interpreter, the left sides of Binarys around the call wait in pendingOps
+    // until the last call returns, so deep recursion like n + sum(n - 1) doesn't need the C++ stack
+    if (ret->tailCall) {
+        vector<pair<OP, ExprFn>> lefts;
+        Expr* expr = ret->expr;
+        while (isBinary(expr)) {
+            Binary* binary = asBinary(expr);
+            lefts.push_back({ binary->op, compileExpr(binary->left) });
+            expr = binary->right;
+        }
+
+        vector<ExprFn> args;
+        for (auto arg : asCall(expr)->args) args.push_back(compileExpr(arg));
+
+        return [rt, lefts, args](ClosureFrame& f) {
+            for (auto& [op, left] : lefts) rt->pendingOps.push_back({ op, left(f) });
+
+            vector<Any> values;
+            values.reserve(args.size());
+            for (auto& arg : args) values.push_back(arg(f));
+
+            for (int i = 0; i < values.size(); i++) rt->stack[f.base + i] = values[i];
+            return Flow::TAIL_CALL;
+        };
+    }
+
+    if (!ret->expr) {
+        return [](ClosureFrame& f) {
+            f.result = Any();
+            return Flow::RETURN;
+        };
+    }
+
+    ExprFn value = compileExpr(ret->expr);
+    return [value](ClosureFrame& f) {
+        f.result = value(f);
+        return Flow::RETURN;
+    };
+}
+
+StmtFn ClosureCompiler::compileSet(Set* set)
+{
+    ClosureRuntime* rt = this->rt;
+    ExprFn object = compileExpr(set->expr);
+    ExprFn value = compileExpr(set->value);
+
+    if (set->defn) {
+        Struct* defn = set->defn;
+        int index = set->index;
+        string name = asConst(set->access)->any.value.String->text;
+        MemberCache* cache = &set->cache;
+
+        return [rt, object, value, defn, index, name, cache](ClosureFrame& f) {
+            Any any = object(f);
+            Any v = value(f);
+
+            if (any.type.base == Type::STRUCT && ((MyStruct*) any.value.Ptr)->defn == defn) {
+                ((MyStruct*) any.value.Ptr)->set(index, std::move(v));
+            } else if (any.type.base == Type::STRUCT && !(any.type.flags & Flags::ARRAY)) {
+                any.setStructMember(name, std::move(v), cache);
+            } else {
+                Any access;
+                access.type.base = Type::STRING;
+                access.value.String = JaiString::intern(name);
+                rt->interp.setAccess(any, access, std::move(v));
+            }
+            return Flow::NEXT;
+        };
+    }
+
+    ExprFn access = compileExpr(set->access);
+    MemberCache* cache = &set->cache;
+    return [rt, object, access, value, cache](ClosureFrame& f) {
+        Any any = object(f);
+        Any a = access(f);
+        Any v = value(f);
+        rt->interp.setAccess(any, a, std::move(v), cache);
+        return Flow::NEXT;
+    };
+}
+
+ExprFn ClosureCompiler::compileExpr(Expr* expr)
+{
+    ClosureRuntime* rt = this->rt;
+
+    switch(expr->kind) {
+        case (ET::CONST): {
+            Any any = asConst(expr)->any;
+            return [any](ClosureFrame& f) { return any; };
+        }
+
+        case (ET::IDENT): {
+            const string& name = asIdent(expr)->name;
+
+            int slot = slotOf(expr);
+            if (slot >= 0) return [rt, slot](ClosureFrame& f) { return rt->stack[f.base + slot]; };
+
+            if (constants.contains(name)) {
+                Any any = constants[name];
+                return [any](ClosureFrame& f) { return any; };
+            }
+
+            return [rt, name](ClosureFrame& f) { return rt->loadName(name); };
+        }
+
+        case (ET::BINARY):  return compileBinary(asBinary(expr));
+        case (ET::CALL):    return compileCall(asCall(expr));
+
+        case (ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            ExprFn operand = compileExpr(unary->expr);
+
+            switch(unary->op) {
+                case (OP::NOT):     return [operand](ClosureFrame& f) { return operand(f).Not(); };
+                case (OP::NEGATE):  return [operand](ClosureFrame& f) { return operand(f).neg(); };
+                default: INTERNAL_ERROR("Wrong Unary Operators shouldn't get parsed");
+            }
+        } break;
+
+        case (ET::GET): {
+            Get* get = asGet(expr);
+            ExprFn object = compileExpr(get->expr);
+            ExprFn access = compileExpr(get->access);
+            MemberCache* cache = &get->cache;
+
+            // A member the Resolver couldn't figure out, the name doesn't have to be copied for a struct
+            if (isConst(get->access) && asConst(get->access)->any.type.base == Type::STRING) {
+                const string* name = &asConst(get->access)->any.value.String->text;
+
+                return [rt, object, access, name, cache](ClosureFrame& f) {
+                    Any any = object(f);
+                    if (any.type.base == Type::STRUCT && !(any.type.flags & Flags::ARRAY)) return any.getStructMember(*name, cache);
+
+                    Any a = access(f);
+                    return rt->interp.getAccess(any, a, cache);
+                };
+            }
+
+            return [rt, object, access, cache](ClosureFrame& f) {
+                Any any = object(f);
+                Any a = access(f);
+                return rt->interp.getAccess(any, a, cache);
+            };
+        }
+
+        case (ET::MEMBER): {
+            Member* member = asMember(expr);
+            ExprFn object = compileExpr(member->expr);
+
+            return [rt, object, member](ClosureFrame& f) {
+                Any any = object(f);
+                return rt->interp.getMember(any, member);
+            };
+        }
+
+        // There is no control flow inside an expression, so the first Shared we compile is the one that runs first
+        case (ET::SHARED): {
+            Shared* shared = asShared(expr);
+
+            if (sharedSlots.contains(shared)) {
+                int slot = sharedSlots[shared];
+                return [rt, slot](ClosureFrame& f) { return rt->stack[f.base + slot]; };
+            }
+
+            ExprFn value = compileExpr(shared->expr);
+            int slot = sharedSlots[shared] = hiddenSlot();
+            return [rt, slot, value](ClosureFrame& f) {
+                Any any = value(f);
+                rt->stack[f.base + slot] = any;
+                return any;
+            };
+        }
+
+        case (ET::SHARED_SCOPE): {
+            // A while condition gets compiled twice, the second copy can't use the slots of the first
+            sharedSlots.clear();
+            ExprFn value = compileExpr(asSharedScope(expr)->expr);
+            sharedSlots.clear();
+            return value;
+        }
+
+        default: INTERNAL_ERROR("Expr not supported by the ClosureCompiler");
+    }
+    return nullptr;
+}
+
+// Ints get done right here, anything else goes through applyBinary like in the Interpreter.
+// A variable or constant operand gets read directly instead of through another closure.
+template <typename F>
+ExprFn ClosureCompiler::intBinary(OP op, Expr* left, Expr* right, F apply)
+{
+    ClosureRuntime* rt = this->rt;
+    int leftSlot = slotOf(left);
+    int rightSlot = slotOf(right);
+
+    if (leftSlot >= 0 && isConst(right) && asConst(right)->any.type.base == Type::INT) {
+        Any constant = asConst(right)->any;
+        long long k = constant.value.Int;
+
+        return [rt, op, leftSlot, constant, k, apply](ClosureFrame& f) {
+            Any& a = rt->stack[f.base + leftSlot];
+            if (a.type.base == Type::INT) return apply(a.value.Int, k);
+
+            Any b = constant;
+            return rt->interp.applyBinary(op, a, b);
+        };
+    }
+
+    if (leftSlot >= 0 && rightSlot >= 0) {
+        return [rt, op, leftSlot, rightSlot, apply](ClosureFrame& f) {
+            Any& a = rt->stack[f.base + leftSlot];
+            Any& b = rt->stack[f.base + rightSlot];
+            if (a.type.base == Type::INT && b.type.base == Type::INT) return apply(a.value.Int, b.value.Int);
+            return rt->interp.applyBinary(op, a, b);
+        };
+    }
+
+    ExprFn l = compileExpr(left);
+    ExprFn r = compileExpr(right);
+    return [rt, op, l, r, apply](ClosureFrame& f) {
+        Any a = l(f);
+        Any b = r(f);
+        if (a.type.base == Type::INT && b.type.base == Type::INT) return apply(a.value.Int, b.value.Int);
+        if (op == OP::PLUS && a.type.base == Type::STRING) return a.append(b);
+        return rt->interp.applyBinary(op, a, b);
+    };
+}
+
+ExprFn ClosureCompiler::compileBinary(Binary* binary)
+{
+    Expr* l = binary->left;
+    Expr* r = binary->right;
+
+    vector<Expr*> parts = concatParts(binary);
+    if (!parts.empty()) {
+        vector<ExprFn> fns;
+        for (auto part : parts) fns.push_back(compileExpr(part));
+
+        return [fns](ClosureFrame& f) {
+            vector<Any> values;
+            values.reserve(fns.size());
+            for (auto& fn : fns) values.push_back(fn(f));
+            return Any::concat(values.data(), values.size());
+        };
+    }
+
+    switch(binary->op) {
+        case (OP::PLUS):            return intBinary(OP::PLUS, l, r, [](long long a, long long b) { return intAny(wrapAdd(a, b)); });
+        case (OP::MINUS):           return intBinary(OP::MINUS, l, r, [](long long a, long long b) { return intAny(wrapSub(a, b)); });
+        case (OP::MULTIPLY):        return intBinary(OP::MULTIPLY, l, r, [](long long a, long long b) { return intAny(wrapMul(a, b)); });
+        case (OP::EQUAL):           return intBinary(OP::EQUAL, l, r, [](long long a, long long b) { return boolAny(a == b); });
+        case (OP::NOT_EQUAL):       return intBinary(OP::NOT_EQUAL, l, r, [](long long a, long long b) { return boolAny(a != b); });
+        case (OP::LESS):            return intBinary(OP::LESS, l, r, [](long long a, long long b) { return boolAny(a < b); });
+        case (OP::LESS_EQUAL):      return intBinary(OP::LESS_EQUAL, l, r, [](long long a, long long b) { return boolAny(a <= b); });
+        case (OP::GREATER):         return intBinary(OP::GREATER, l, r, [](long long a, long long b) { return boolAny(a > b); });
+        case (OP::GREATER_EQUAL):   return intBinary(OP::GREATER_EQUAL, l, r, [](long long a, long long b) { return boolAny(a >= b); });
+
+        case (OP::DIVIDE):
+        case (OP::AND):
+        case (OP::OR): {
+            ClosureRuntime* rt = this->rt;
+            OP op = binary->op;
+            ExprFn left = compileExpr(l);
+            ExprFn right = compileExpr(r);
+
+            return [rt, op, left, right](ClosureFrame& f) {
+                Any a = left(f);
+                Any b = right(f);
+                return rt->interp.applyBinary(op, a, b);
+            };
+        }
+
+        default: INTERNAL_ERROR("Wrong Binary Operators shouldn't get parsed");
+    }
+    return nullptr;
+}
+
+// The callee's slots go on top of the stack, the args straight into its params
+ExprFn ClosureCompiler::compileCall(Call* call)
+{
+    Ident* ident = asIdent(call->name);
+
+    if (!functions.contains(ident->name)) error("Fucntion not defined");
+    Func* defn = functions[ident->name];
+
+    if (defn->params.size() != call->args.size()) error("Wrong number of arguments");
+
+    vector<ExprFn> args;
+    for (auto arg : call->args) args.push_back(compileExpr(arg));
+
+    ClosureRuntime* rt = this->rt;
+
+    if (!defn->body) {
+        ExprFn text = args[0];
+        return [rt, text](ClosureFrame& f) {
+            Any any = text(f);
+            rt->interp.callPrintf(any);
+            return Any();
+        };
+    }
+
+    ClosureFunction* callee = compiled[defn];
+    return [rt, callee, args](ClosureFrame& f) {
+        int base = rt->stack.size();
+        rt->stack.resize(base + callee->slots);
+
+        for (int i = 0; i < args.size(); i++) {
+            Any value = args[i](f);
+            rt->stack[base + i] = value;
+        }
+
+        Any result = rt->call(callee, base);
+        rt->stack.resize(base);
+        return result;
+    };
+}
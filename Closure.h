@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include "Any.h"
+#include "Stmt.h"
+#include "Expr.h"
+#include "Interpreter.h"
+
+using namespace std;
+
+// Every Stmt and Expr gets compiled once into a C++ lambda that already knows its slots,
+// constants and children, so running doesn't switch on kinds anymore.
+// Frames work like in the VM: a function's slots live in one stack and names it doesn't
+// declare belong to a caller.
+
+struct ClosureFunction;
+
+struct ClosureFrame {
+    ClosureFunction* fn;
+    int base;
+    Any result;
+};
+
+// What a statement tells the ones around it
+enum class Flow {
+    NEXT,
+    BREAK,
+    CONTINUE,
+    RETURN,
+    TAIL_CALL,      // the params got their new values, run the body again
+};
+
+typedef function<Any(ClosureFrame&)> ExprFn;
+typedef function<Flow(ClosureFrame&)> StmtFn;
+
+struct ClosureFunction {
+    string name;
+    Func* func;
+    int params = 0;
+    int slots = 0;
+    unordered_map<string, int> slotOf;
+    StmtFn body;
+
+    ClosureFunction(Func* f);
+};
+
+struct ClosureRuntime {
+    Interpreter& interp;
+    vector<Any> stack;
+    vector<ClosureFrame*> frames;
+    vector<shared_ptr<StmtFn>> defers;
+
+    // The left sides of the Binarys a tail call was nested in, like the Interpreter's
+    vector<pair<OP, Any>> pendingOps;
+
+    ClosureRuntime(Interpreter& i);
+
+    Any  call(ClosureFunction* fn, int base);
+    Any* findName(const string& name);
+    Any  loadName(const string& name);
+    void runDefers(ClosureFrame& frame, int mark);
+};
+
+struct ClosureCompiler {
+    unordered_map<string, Func*>& functions;
+    unordered_map<string, Any>& constants;
+    unordered_map<string, Struct*>& structs;
+    ClosureRuntime* rt;
+
+    unordered_map<Func*, ClosureFunction*> compiled;
+    ClosureFunction* fn = nullptr;
+    ClosureFunction* main = nullptr;
+    string unsupported;
+
+    vector<bool> deferScopes;   // if something defers into the scope
+    unordered_map<Shared*, int> sharedSlots;
+
+    ClosureCompiler(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s, ClosureRuntime* r);
+
+    ClosureFunction* compile(vector<Stmt*>& stmts);
+
+    void collectFunctions(Stmt* stmt, vector<Func*>& funcs);
+    void collectLocals(Stmt* stmt);
+    int  addSlot(const string& name);
+    int  hiddenSlot();
+    int  slotOf(Expr* expr);
+
+    StmtFn compileStmt(Stmt* stmt);
+    StmtFn compileBlock(Block* block);
+    StmtFn compileDecl(Decl* decl);
+    StmtFn compileIf(If* i);
+    StmtFn compileFor(For* forLoop);
+    StmtFn compileWhile(While* whileLoop);
+    StmtFn compileReturn(Return* ret);
+    StmtFn compileSet(Set* set);
+    StmtFn compileStore(const string& name, ExprFn value);
+    StmtFn compileDecls(vector<Decl*>& decls);
+    StmtFn withDefers(StmtFn body);
+
+    ExprFn compileExpr(Expr* expr);
+    ExprFn compileBinary(Binary* binary);
+    ExprFn compileCall(Call* call);
+
+    template <typename F>
+    ExprFn intBinary(OP op, Expr* left, Expr* right, F apply);
+};
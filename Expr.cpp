@@ -25,6 +25,9 @@ ostream& operator<<(ostream& out, const ET kind)
         PROCESS_VAL(IDENT)
         PROCESS_VAL(CALL)
         PROCESS_VAL(GET)
+        PROCESS_VAL(MEMBER)
+        PROCESS_VAL(SHARED)
+        PROCESS_VAL(SHARED_SCOPE)
     }
 #undef PROCESS_VAL
 
@@ -110,6 +113,12 @@ ostream &operator<<(ostream &out, const Expr *expr)
         return out << (Call *)expr;
     case ET::GET:
         return out << (Get *)expr;
+    case ET::MEMBER:
+        return out << (Member *)expr;
+    case ET::SHARED:
+        return out << (Shared *)expr;
+    case ET::SHARED_SCOPE:
+        return out << (SharedScope *)expr;
     }
     return out << "UNKNOWN Expr!";
 }
@@ -118,6 +127,17 @@ Expr::Expr(Type t, TypeFlags f) : type(t, f) {
     debugCount = count++;
 }
 
+void* Expr::operator new(size_t size)
+{
+    Memory::allocated(Memory::site(MemoryKind::AST), size);
+    return ::operator new(size);
+}
+
+void Expr::operator delete(void* memory)
+{
+    ::operator delete(memory);
+}
+
 Const::Const() : Expr(Type::UNKNOWN)
 {
     kind = ET::CONST;
@@ -150,7 +170,8 @@ Const::Const(bool b) : Const()
 Const::Const(std::string* str) : Const()
 {
     type = Type::STRING;
-    any.value.String = str;
+    any.value.String = JaiString::intern(*str);
+    delete str;
     any.type.base = Type::STRING;
 }
 Const::Const(void *p, Type t) : Const()
@@ -172,7 +193,7 @@ ostream &operator<<(ostream &out, const Const *expr)
     switch (expr->any.type.base)
     {
     case Type::STRING:
-        val << "\"" << *v.String << "\"";
+        val << "\"" << v.String->text << "\"";
         break;
     case Type::DOUBLE:
     case Type::FLOAT:
@@ -223,6 +244,19 @@ ostream &operator<<(ostream &out, const Binary *expr)
     return out << expr->left << " " << expr->op << " " << expr->right;
 }
 
+vector<Expr*> concatParts(Expr* expr)
+{
+    vector<Expr*> parts;
+    while (isBinary(expr) && asBinary(expr)->op == OP::PLUS) {
+        parts.push_back(asBinary(expr)->right);
+        expr = asBinary(expr)->left;
+    }
+    if (parts.size() < 2 || !isConst(expr) || asConst(expr)->any.type.base != Type::STRING) return {};
+
+    parts.push_back(expr);
+    return vector<Expr*>(parts.rbegin(), parts.rend());
+}
+
 Unary::Unary(OP o, Expr *e) :  Expr(Type::UNKNOWN), expr(e), op(o) {
     type = getType(o);
     kind = ET::UNARY;
@@ -264,4 +298,31 @@ Get::Get(Expr *e, Expr* v) : Expr(Type::UNKNOWN), expr(e), access(v) {
 ostream &operator<<(ostream &out, const Get *expr)
 {
     return out << expr->expr << "." << expr->access;
+}
+
+Member::Member(Expr *e, string n, Struct* d, int i) : Expr(Type::UNKNOWN), expr(e), name(n), defn(d), index(i) {
+    kind = ET::MEMBER;
+}
+
+ostream &operator<<(ostream &out, const Member *expr)
+{
+    return out << expr->expr << "." << expr->name << "[" << expr->index << "]";
+}
+
+Shared::Shared(Expr *e, int s) : Expr(Type::UNKNOWN), expr(e), slot(s) {
+    kind = ET::SHARED;
+}
+
+ostream &operator<<(ostream &out, const Shared *expr)
+{
+    return out << "$" << expr->slot << "(" << expr->expr << ")";
+}
+
+SharedScope::SharedScope(Expr *e, int s) : Expr(Type::UNKNOWN), expr(e), slots(s) {
+    kind = ET::SHARED_SCOPE;
+}
+
+ostream &operator<<(ostream &out, const SharedScope *expr)
+{
+    return out << expr->expr;
 }
\ No newline at end of file
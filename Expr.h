@@ -5,6 +5,7 @@
 
 #include "error.h"
 #include "Any.h"
+#include "Memory.h"
 
 using namespace std;
 
@@ -45,6 +46,9 @@ enum class ET {
     IDENT,
     CALL,
     GET,
+    MEMBER,
+    SHARED,
+    SHARED_SCOPE,
 };
 typedef ET ExprType;
 
@@ -58,6 +62,10 @@ struct Expr {
     ImprovedType type;
 
     Expr(Type t, TypeFlags f = 0);
+
+    // So Memory sees every node, nodes never get deleted
+    static void* operator new(size_t size);
+    static void operator delete(void* memory);
 };
 
 ostream& operator<<(ostream& out, const Expr* expr);
@@ -76,17 +84,59 @@ struct Const : Expr {
 
 ostream& operator<<(ostream& out, const Const* expr);
 
+// What the Interpreter rewrote a Binary into after it saw the types of its operands (quickening).
+// The types it saw are the guard, anything else goes through the Any operations again.
+enum class Quick : unsigned char {
+    NONE,       // didn't run yet
+    GENERIC,    // saw types we have nothing special for, or too many different ones
+
+    INT_ADD,
+    INT_SUB,
+    INT_MUL,
+    INT_DIV,
+    INT_EQ,
+    INT_NE,
+    INT_LT,
+    INT_LE,
+    INT_GT,
+    INT_GE,
+
+    FLOAT_ADD,
+    FLOAT_SUB,
+    FLOAT_MUL,
+    FLOAT_DIV,
+    FLOAT_EQ,
+    FLOAT_NE,
+    FLOAT_LT,
+    FLOAT_LE,
+    FLOAT_GT,
+    FLOAT_GE,
+
+    CONCAT      // a chain of string +, see concatParts
+};
+
 struct Binary : Expr {
     Expr* left;
     Expr* right;
     OP op;
 
+    Quick quick = Quick::NONE;
+    Type quickLeft = Type::UNKNOWN;
+    Type quickRight = Type::UNKNOWN;
+    int misses = 0;
+    vector<Expr*> parts;    // for Quick::CONCAT
+
     Binary(Expr* l, OP o, Expr* r);
 
 };
 
 ostream& operator<<(ostream& out, const Binary* expr);
 
+// A chain like "Factorial of " + n + " = " + f(n) that starts with a string literal is all string concatenation,
+// so it can be built in one go instead of one + at a time. Returns the parts from left to right,
+// or nothing if expr isn't such a chain or just a single +.
+vector<Expr*> concatParts(Expr* expr);
+
 struct Unary : Expr {
     Expr* expr;
     OP op;
@@ -120,10 +170,47 @@ struct Get : Expr {
     Expr* expr;
     Expr* access;
 
+    // For the struct members the Resolver couldn't figure out
+    MemberCache cache;
+
     Get(Expr* e, Expr* v);
 };
 
 ostream& operator<<(ostream& out, const Get* expr);
+
+// A struct member access whose field index was resolved before running.
+// The name is kept around in case the value turns out to be a different struct.
+struct Member : Expr {
+    Expr* expr;
+    string name;
+    Struct* defn;
+    int index;
+    MemberCache cache;      // for when it isn't defn
+
+    Member(Expr* e, string n, Struct* d, int i);
+};
+
+ostream& operator<<(ostream& out, const Member* expr);
+
+// A subexpression that appears more than once in a statement, see CSE.
+// It's evaluated once and the result is kept in slot of the enclosing SharedScope.
+struct Shared : Expr {
+    Expr* expr;
+    int slot;
+
+    Shared(Expr* e, int s);
+};
+
+ostream& operator<<(ostream& out, const Shared* expr);
+
+struct SharedScope : Expr {
+    Expr* expr;
+    int slots;
+
+    SharedScope(Expr* e, int s);
+};
+
+ostream& operator<<(ostream& out, const SharedScope* expr);
     
 template <typename T>
 T errorExpr(Expr* expr, const char* file, int line) {
@@ -140,6 +227,9 @@ T errorExpr(Expr* expr, const char* file, int line) {
 #define isIdent(expr)       (expr->kind == ET::IDENT)
 #define isCall(expr)        (expr->kind == ET::CALL)
 #define isGet(expr)         (expr->kind == ET::GET)
+#define isMember(expr)      (expr->kind == ET::MEMBER)
+#define isShared(expr)      (expr->kind == ET::SHARED)
+#define isSharedScope(expr) (expr->kind == ET::SHARED_SCOPE)
 
 #define asConst(expr)       (isConst(expr)  ? (Const*)expr  : errorExpr<Const*>(expr, __FILE__, __LINE__))   
 #define asBinary(expr)      (isBinary(expr) ? (Binary*)expr : errorExpr<Binary*>(expr, __FILE__, __LINE__))  
@@ -147,4 +237,7 @@ T errorExpr(Expr* expr, const char* file, int line) {
 #define asIdent(expr)       (isIdent(expr)  ? (Ident*)expr  : errorExpr<Ident*>(expr, __FILE__, __LINE__))   
 #define asCall(expr)        (isCall(expr)   ? (Call*)expr   : errorExpr<Call*>(expr, __FILE__, __LINE__))    
 #define asArray(expr)       (isArray(expr)  ? (Array*)expr  : errorExpr<Array*>(expr, __FILE__, __LINE__))   
-#define asGet(expr)         (isGet(expr)    ? (Get*)expr    : errorExpr<Get*>(expr, __FILE__, __LINE__)) 
\ No newline at end of file
+#define asGet(expr)         (isGet(expr)    ? (Get*)expr    : errorExpr<Get*>(expr, __FILE__, __LINE__)) 
+#define asMember(expr)      (isMember(expr) ? (Member*)expr : errorExpr<Member*>(expr, __FILE__, __LINE__))
+#define asShared(expr)      (isShared(expr) ? (Shared*)expr : errorExpr<Shared*>(expr, __FILE__, __LINE__))
+#define asSharedScope(expr) (isSharedScope(expr) ? (SharedScope*)expr : errorExpr<SharedScope*>(expr, __FILE__, __LINE__))
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <chrono>
+
+#include "Heap.h"
+#include "Any.h"
+#include "Stmt.h"
+#include "Memory.h"
+
+using std::vector, std::endl;
+
+HeapObject::HeapObject(Kind k, unsigned short s) : kind(k), site(s) {}
+
+vector<HeapObject*> Heap::objects;
+size_t Heap::bytes = 0;
+size_t Heap::minimum = 8 * 1024 * 1024;
+size_t Heap::limit = Heap::minimum;
+
+long long Heap::collections = 0;
+long long Heap::freed = 0;
+double Heap::totalPause = 0;
+double Heap::maxPause = 0;
+
+// Calls f with every Any inside the object, the unboxed values can't point anywhere
+template<typename F>
+static void eachAny(HeapObject* object, F f)
+{
+    if (object->kind == HeapObject::Kind::ARRAY) {
+        for (auto& any : ((MyArray*) object)->values) f(any);
+        return;
+    }
+    MyStruct* st = (MyStruct*) object;
+    for (int index : st->defn->boxedMembers) f(*st->boxed(index));
+}
+
+static size_t sizeOf(HeapObject* object)
+{
+    if (object->kind == HeapObject::Kind::STRUCT) return sizeof(MyStruct) + ((MyStruct*) object)->defn->size;
+
+    MyArray* array = (MyArray*) object;
+    return sizeof(MyArray) + array->values.capacity() * sizeof(Any) + array->data.capacity();
+}
+
+void Heap::add(HeapObject* object)
+{
+    size_t size = sizeOf(object);
+    if (bytes + size > limit) collect();
+
+    objects.push_back(object);
+    bytes += size;
+    Memory::allocated(object->site, size);
+}
+
+void Heap::collect()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto object : objects) {
+        object->marked = false;
+        object->inner = 0;
+    }
+    for (auto object : objects) {
+        eachAny(object, [](Any& any) {
+            if (HeapObject* child = any.object()) child->inner++;
+        });
+    }
+
+    vector<HeapObject*> work;
+    for (auto object : objects) {
+        if (object->refs > object->inner) {
+            object->marked = true;
+            work.push_back(object);
+        }
+    }
+    while (!work.empty()) {
+        HeapObject* object = work.back();
+        work.pop_back();
+
+        eachAny(object, [&](Any& any) {
+            HeapObject* child = any.object();
+            if (child && !child->marked) {
+                child->marked = true;
+                work.push_back(child);
+            }
+        });
+    }
+
+    // The garbage lets go of what survives, pointers between garbage just get forgotten
+    // so deleting one doesn't touch another that's already gone
+    vector<HeapObject*> live;
+    vector<HeapObject*> dead;
+    for (auto object : objects) {
+        if (object->marked) {
+            live.push_back(object);
+            continue;
+        }
+        dead.push_back(object);
+
+        eachAny(object, [](Any& any) {
+            HeapObject* child = any.object();
+            if (!child) return;
+            if (child->marked) child->refs--;
+            any.value.Ptr = nullptr;
+        });
+    }
+
+    for (auto object : dead) {
+        size_t size = sizeOf(object);
+        bytes -= size;
+        Memory::freed(object->site, size);
+        if (object->kind == HeapObject::Kind::STRUCT) MyStruct::destroy((MyStruct*) object);
+        else delete (MyArray*) object;
+    }
+
+    objects = std::move(live);
+    limit = std::max(minimum, 2 * bytes);
+
+    std::chrono::duration<double, std::milli> pause = std::chrono::steady_clock::now() - start;
+    collections++;
+    freed += dead.size();
+    totalPause += pause.count();
+    maxPause = std::max(maxPause, pause.count());
+}
+
+void Heap::print(std::ostream& out)
+{
+    out << "Heap: " << objects.size() << " objects in " << bytes / 1024 << " kb, limit " << limit / 1024 << " kb" << endl;
+    out << "GC: " << collections << " collections freed " << freed << " objects, ";
+    out << totalPause << " ms paused, longest " << maxPause << " ms" << endl;
+}
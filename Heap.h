@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+
+// What structs and arrays have in common, so the collector can find them.
+// refs counts every Any that points here, the ones inside other objects too.
+struct HeapObject {
+    enum class Kind : unsigned char { STRUCT, ARRAY };
+
+    Kind kind;
+    bool marked = false;
+    int refs = 1;       // the Any it gets made for
+    int inner = 0;      // refs from other objects, only while collecting
+    unsigned short site;    // where Memory counts it
+
+    HeapObject(Kind k, unsigned short site);
+};
+
+// A mark-sweep collector for structs and arrays.
+// The engines keep their Anys all over the place (variables, VM stacks, registers, C++ temporaries),
+// so instead of walking them it works the roots out: an object with more refs than the other objects
+// account for is held from outside the heap. Everything those reach survives, the rest gets deleted.
+// It collects when a new object would take the heap over its limit, after that the limit is twice what survived.
+struct Heap {
+    static std::vector<HeapObject*> objects;
+    static size_t bytes;        // roughly what the objects take
+    static size_t limit;
+    static size_t minimum;      // the limit never goes below this, -gc=kb
+
+    static long long collections;
+    static long long freed;
+    static double totalPause;   // in ms
+    static double maxPause;
+
+    // Called by the objects when they're made, it may collect first
+    static void add(HeapObject* object);
+    static void collect();
+
+    static void print(std::ostream& out);
+};
@@ -0,0 +1,344 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <sstream>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "IR.h"
+#include "error.h"
+
+using namespace std;
+
+std::string IROpToString(IROp op)
+{
+    const char *s = 0;
+#define PROCESS_VAL(p, name) case (IROp::p): s = name; break;
+
+    switch (op)
+    {
+        PROCESS_VAL(CONST,          "const")
+        PROCESS_VAL(PARAM,          "param")
+        PROCESS_VAL(PHI,            "phi")
+        PROCESS_VAL(LOAD_GLOBAL,    "load_global")
+        PROCESS_VAL(STORE_GLOBAL,   "store_global")
+        PROCESS_VAL(ADD,            "add")
+        PROCESS_VAL(SUB,            "sub")
+        PROCESS_VAL(MUL,            "mul")
+        PROCESS_VAL(DIV,            "div")
+        PROCESS_VAL(EQ,             "eq")
+        PROCESS_VAL(NE,             "ne")
+        PROCESS_VAL(LT,             "lt")
+        PROCESS_VAL(LE,             "le")
+        PROCESS_VAL(GT,             "gt")
+        PROCESS_VAL(GE,             "ge")
+        PROCESS_VAL(AND,            "and")
+        PROCESS_VAL(OR,             "or")
+        PROCESS_VAL(NEG,            "neg")
+        PROCESS_VAL(NOT,            "not")
+        PROCESS_VAL(CALL,           "call")
+        PROCESS_VAL(NEW_STRUCT,     "new_struct")
+        PROCESS_VAL(GET_MEMBER,     "get_member")
+        PROCESS_VAL(SET_MEMBER,     "set_member")
+        PROCESS_VAL(GET_FIELD,      "get_field")
+        PROCESS_VAL(SET_FIELD,      "set_field")
+        PROCESS_VAL(NEW_ARRAY,      "new_array")
+        PROCESS_VAL(GET_INDEX,      "get_index")
+        PROCESS_VAL(SET_INDEX,      "set_index")
+        PROCESS_VAL(JUMP,           "jump")
+        PROCESS_VAL(BRANCH,         "branch")
+        PROCESS_VAL(RETURN,         "ret")
+    }
+#undef PROCESS_VAL
+
+    return std::string(s);
+}
+
+IRValue::IRValue(int i, IROp o, ImprovedType t) : id(i), op(o), type(t) {}
+
+bool IRValue::isTerminator()
+{
+    return op == IROp::JUMP || op == IROp::BRANCH || op == IROp::RETURN;
+}
+
+bool IRValue::hasResult()
+{
+    switch (op) {
+        case (IROp::STORE_GLOBAL):
+        case (IROp::SET_MEMBER):
+        case (IROp::SET_FIELD):
+        case (IROp::SET_INDEX):
+        case (IROp::JUMP):
+        case (IROp::BRANCH):
+        case (IROp::RETURN): return false;
+        case (IROp::CALL):   return type.base != Type::VOID;
+        default:             return true;
+    }
+}
+
+IRBlock::IRBlock(int i) : id(i) {}
+
+IRValue* IRBlock::terminator()
+{
+    if (insts.empty() || !insts.back()->isTerminator()) return nullptr;
+    return insts.back();
+}
+
+IRFunction::IRFunction(string n, Func* f) : name(n), func(f), returnType(f->returnType) {}
+
+IRBlock* IRFunction::newBlock()
+{
+    IRBlock* block = new IRBlock(blockCount++);
+    blocks.push_back(block);
+    return block;
+}
+
+IRValue* IRFunction::newValue(IROp op, ImprovedType type)
+{
+    return new IRValue(valueCount++, op, type);
+}
+
+IRFunction* IRModule::find(Func* func)
+{
+    auto found = byFunc.find(func);
+    return found == byFunc.end() ? nullptr : found->second;
+}
+
+static string typeName(const ImprovedType& type)
+{
+    string name = TypeToString(type.base);
+    for (auto& c : name) c = tolower(c);
+    if (type.base == Type::STRUCT && type.info) name = *(string*) type.info;
+    if (type.flags & Flags::ARRAY) name = "[]" + name;
+    if (type.flags & Flags::POINTER) name = "*" + name;
+    return name;
+}
+
+ostream& operator<<(ostream& out, const IRValue* value)
+{
+    IRValue* v = (IRValue*) value;
+    if (v->hasResult()) out << "%" << v->id << ": " << typeName(v->type) << " = ";
+
+    out << IROpToString(v->op);
+
+    switch (v->op) {
+        case (IROp::CONST): {
+            if (v->constant.type.base == Type::STRING) out << " \"" << v->constant.value.String->text << "\"";
+            else out << " " << v->constant.toString();
+        } break;
+        case (IROp::PARAM):         out << " " << v->index << " " << v->name; break;
+        case (IROp::LOAD_GLOBAL):
+        case (IROp::STORE_GLOBAL):
+        case (IROp::CALL):
+        case (IROp::GET_FIELD):
+        case (IROp::SET_FIELD):     out << " " << v->name; break;
+        case (IROp::NEW_STRUCT):    out << " " << v->defn->name; break;
+        case (IROp::GET_MEMBER):
+        case (IROp::SET_MEMBER):    out << " " << v->defn->name << "." << v->name << "[" << v->index << "]"; break;
+        default: break;
+    }
+
+    for (int i = 0; i < v->args.size(); i++) {
+        out << (i == 0 ? " " : ", ") << "%" << v->args[i]->id;
+        if (v->op == IROp::PHI) out << " from b" << v->block->preds[i]->id;
+    }
+
+    for (int i = 0; i < v->targets.size(); i++) {
+        out << ((i == 0 && v->args.empty()) ? " " : ", ") << "b" << v->targets[i]->id;
+    }
+
+    return out;
+}
+
+ostream& operator<<(ostream& out, const IRBlock* block)
+{
+    out << "b" << block->id << ":";
+    if (!block->preds.empty()) {
+        out << "    ; preds:";
+        for (auto pred : block->preds) out << " b" << pred->id;
+    }
+    out << "\n";
+
+    for (auto inst : block->insts) out << "    " << inst << "\n";
+    return out;
+}
+
+ostream& operator<<(ostream& out, const IRFunction* fn)
+{
+    out << "func " << fn->name << "(";
+    for (int i = 0; i < fn->params.size(); i++) {
+        if (i > 0) out << ", ";
+        out << "%" << fn->params[i]->id << ": " << typeName(fn->params[i]->type);
+    }
+    out << ") -> " << typeName(fn->returnType) << " {\n";
+
+    for (auto block : fn->blocks) out << block;
+
+    return out << "}\n";
+}
+
+ostream& operator<<(ostream& out, const IRModule* module)
+{
+    for (auto fn : module->functions) out << fn << "\n";
+    return out;
+}
+
+int arity(IROp op)
+{
+    switch (op) {
+        case (IROp::ADD):
+        case (IROp::SUB):
+        case (IROp::MUL):
+        case (IROp::DIV):
+        case (IROp::EQ):
+        case (IROp::NE):
+        case (IROp::LT):
+        case (IROp::LE):
+        case (IROp::GT):
+        case (IROp::GE):
+        case (IROp::AND):
+        case (IROp::OR):    return 2;
+        case (IROp::NEG):
+        case (IROp::NOT):   return 1;
+        default:            return -1;
+    }
+}
+
+vector<string> verifyIR(IRFunction* fn)
+{
+    vector<string> errors;
+    auto fail = [&](IRBlock* block, IRValue* value, string message) {
+        stringstream s;
+        s << fn->name << ": b" << block->id;
+        if (value) s << ": '" << value << "'";
+        s << ": " << message;
+        errors.push_back(s.str());
+    };
+
+    if (fn->blocks.empty()) {
+        errors.push_back(fn->name + ": has no blocks");
+        return errors;
+    }
+
+    unordered_set<IRBlock*> blocks(fn->blocks.begin(), fn->blocks.end());
+    unordered_set<IRValue*> defined;
+    unordered_map<IRValue*, int> position;
+
+    // Structure
+    for (auto block : fn->blocks) {
+        if (!block->terminator()) fail(block, nullptr, "doesn't end in a terminator");
+
+        bool phisDone = false;
+        for (int i = 0; i < block->insts.size(); i++) {
+            IRValue* inst = block->insts[i];
+
+            if (inst->block != block) fail(block, inst, "thinks it lives in another block");
+            if (inst->isTerminator() && i != block->insts.size() - 1) fail(block, inst, "terminator in the middle of a block");
+            if (inst->replacement) fail(block, inst, "replaced phi is still in the block");
+
+            if (inst->op == IROp::PHI) {
+                if (phisDone) fail(block, inst, "phi after a normal instruction");
+                if (inst->args.size() != block->preds.size()) fail(block, inst, "phi needs exactly one argument per predecessor");
+            } else {
+                phisDone = true;
+            }
+
+            int expected = arity(inst->op);
+            if (expected >= 0 && inst->args.size() != expected) fail(block, inst, "needs exactly " + to_string(expected) + (expected == 1 ? " argument" : " arguments"));
+
+            if (defined.contains(inst)) fail(block, inst, "defined twice");
+            defined.insert(inst);
+            position[inst] = i;
+        }
+
+        IRValue* terminator = block->terminator();
+        if (terminator) {
+            int expected = terminator->op == IROp::JUMP ? 1 : terminator->op == IROp::BRANCH ? 2 : 0;
+            if (terminator->targets.size() != expected) fail(block, terminator, "has the wrong number of targets");
+            if (terminator->targets != block->succs) fail(block, terminator, "targets don't match the successors");
+            if (terminator->op == IROp::BRANCH && terminator->args.size() != 1) fail(block, terminator, "branch needs a condition");
+        }
+
+        for (auto succ : block->succs) {
+            if (!blocks.contains(succ)) fail(block, nullptr, "jumps to a block outside of the function");
+            else if (find(succ->preds.begin(), succ->preds.end(), block) == succ->preds.end()) fail(block, nullptr, "is missing from the predecessors of a successor");
+        }
+        for (auto pred : block->preds) {
+            if (find(pred->succs.begin(), pred->succs.end(), block) == pred->succs.end()) fail(block, nullptr, "has a predecessor that doesn't jump here");
+        }
+    }
+
+    if (!fn->blocks[0]->preds.empty()) fail(fn->blocks[0], nullptr, "entry block can't have predecessors");
+
+    // Dominators, the simple iterative way. Blocks are in creation order, which is good enough to converge quickly.
+    int count = fn->blocks.size();
+    unordered_map<IRBlock*, int> index;
+    for (int i = 0; i < count; i++) index[fn->blocks[i]] = i;
+
+    vector<vector<bool>> dom(count, vector<bool>(count, true));
+    dom[0] = vector<bool>(count, false);
+    dom[0][0] = true;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = 1; b < count; b++) {
+            IRBlock* block = fn->blocks[b];
+            vector<bool> result(count, !block->preds.empty());
+            for (auto pred : block->preds) {
+                if (!index.contains(pred)) continue;
+                auto& other = dom[index[pred]];
+                for (int i = 0; i < count; i++) result[i] = result[i] && other[i];
+            }
+            result[b] = true;
+            if (result != dom[b]) {
+                dom[b] = result;
+                changed = true;
+            }
+        }
+    }
+
+    for (int b = 1; b < count; b++) {
+        if (fn->blocks[b]->preds.empty()) fail(fn->blocks[b], nullptr, "is unreachable");
+    }
+
+    auto dominates = [&](IRValue* def, IRBlock* block, int pos) {
+        if (!def->block || !index.contains(def->block)) return false;
+        if (def->block == block) return position[def] < pos;
+        return (bool) dom[index[block]][index[def->block]];
+    };
+
+    // Uses
+    for (auto block : fn->blocks) {
+        for (int i = 0; i < block->insts.size(); i++) {
+            IRValue* inst = block->insts[i];
+
+            for (int a = 0; a < inst->args.size(); a++) {
+                IRValue* arg = inst->args[a];
+
+                if (!arg) { fail(block, inst, "has an empty argument"); continue; }
+                if (!defined.contains(arg)) { fail(block, inst, "uses a value that isn't in any block"); continue; }
+                if (!arg->hasResult()) fail(block, inst, "uses something that doesn't produce a value");
+
+                if (inst->op == IROp::PHI) {
+                    if (a < block->preds.size()) {
+                        IRBlock* pred = block->preds[a];
+                        if (!dominates(arg, pred, pred->insts.size())) fail(block, inst, "phi argument doesn't dominate its predecessor");
+                    }
+                } else if (!dominates(arg, block, i)) {
+                    fail(block, inst, "uses a value that doesn't dominate it");
+                }
+            }
+
+            if (inst->op == IROp::BRANCH && !inst->args.empty()) {
+                Type t = inst->args[0]->type.base;
+                if (t != Type::BOOL && t != Type::UNKNOWN && !isIntegerType(t) && t != Type::FLOAT && t != Type::DOUBLE) {
+                    fail(block, inst, "branches on something that can't be true or false");
+                }
+            }
+        }
+    }
+
+    return errors;
+}
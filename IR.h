@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <unordered_map>
+
+#include "Any.h"
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Mid-level IR in SSA form, built from the AST after the semantic passes ran (see IRBuilder).
+// Every instruction is also the value it produces, blocks end in exactly one terminator
+// and phis sit at the start of their block with one argument per predecessor.
+enum class IROp {
+    CONST,
+    PARAM,
+    PHI,
+
+    // Variables that aren't local to the function, functions see the variables of their callers
+    LOAD_GLOBAL,
+    STORE_GLOBAL,
+
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+
+    EQ,
+    NE,
+    LT,
+    LE,
+    GT,
+    GE,
+    AND,
+    OR,
+
+    NEG,
+    NOT,
+
+    CALL,
+
+    NEW_STRUCT,
+    GET_MEMBER,     // by index, resolved by the Resolver
+    SET_MEMBER,
+    GET_FIELD,      // by name, for everything the Resolver couldn't figure out
+    SET_FIELD,
+    NEW_ARRAY,
+    GET_INDEX,
+    SET_INDEX,
+
+    JUMP,
+    BRANCH,
+    RETURN
+};
+
+std::string IROpToString(IROp op);
+
+struct IRBlock;
+struct IRFunction;
+
+struct IRValue {
+    int id;
+    IROp op;
+    ImprovedType type;
+    vector<IRValue*> args;
+    IRBlock* block = nullptr;
+
+    Any constant;               // CONST
+    string name;                // PARAM, LOAD_GLOBAL, STORE_GLOBAL, CALL, GET_FIELD, SET_FIELD, *_MEMBER
+    int index = -1;             // PARAM, GET_MEMBER, SET_MEMBER
+    Struct* defn = nullptr;     // NEW_STRUCT, GET_MEMBER, SET_MEMBER
+    vector<IRBlock*> targets;   // JUMP, BRANCH: true target first
+
+    // Phis that turned out to be trivial point to the value they stand for
+    IRValue* replacement = nullptr;
+
+    IRValue(int i, IROp o, ImprovedType t);
+
+    bool isTerminator();
+    bool hasResult();
+};
+
+struct IRBlock {
+    int id;
+    vector<IRValue*> insts;
+    vector<IRBlock*> preds;
+    vector<IRBlock*> succs;
+
+    IRBlock(int i);
+
+    IRValue* terminator();
+};
+
+struct IRFunction {
+    string name;
+    Func* func;
+    ImprovedType returnType;
+    vector<IRValue*> params;
+    vector<IRBlock*> blocks;
+    int valueCount = 0;
+    int blockCount = 0;
+
+    IRFunction(string n, Func* f);
+
+    IRBlock* newBlock();
+    IRValue* newValue(IROp op, ImprovedType type);
+};
+
+struct IRModule {
+    vector<IRFunction*> functions;
+    unordered_map<Func*, IRFunction*> byFunc;
+
+    IRFunction* find(Func* func);
+};
+
+ostream& operator<<(ostream& out, const IRValue* value);
+ostream& operator<<(ostream& out, const IRBlock* block);
+ostream& operator<<(ostream& out, const IRFunction* fn);
+ostream& operator<<(ostream& out, const IRModule* module);
+
+// How many args the arithmetic and logic ops take, -1 for the ones that vary or aren't checked
+int arity(IROp op);
+
+// Checks the structural rules above and that every definition dominates its uses.
+// Returns the problems it found, so an empty vector means the function is fine.
+vector<string> verifyIR(IRFunction* fn);
@@ -0,0 +1,894 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "IRBuilder.h"
+#include "error.h"
+
+using namespace std;
+
+IRBuilder::IRBuilder(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s)
+    : functions(f), constants(c), structs(s) {}
+
+IRModule* IRBuilder::build(vector<Stmt*>& stmts)
+{
+    module = new IRModule();
+
+    vector<Func*> funcs;
+    for (auto stmt : stmts) collectFunctions(stmt, funcs);
+
+    // Nested functions can share a name, the IR needs them to be unique
+    unordered_map<string, int> seen;
+    for (auto func : funcs) {
+        string name = func->name;
+        int count = seen[name]++;
+        if (count > 0) name += "." + to_string(count);
+
+        IRFunction* irFunction = new IRFunction(name, func);
+        module->functions.push_back(irFunction);
+        module->byFunc[func] = irFunction;
+    }
+
+    for (auto irFunction : module->functions) buildFunction(irFunction);
+
+    return module;
+}
+
+void IRBuilder::collectFunctions(Stmt* stmt, vector<Func*>& funcs)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (!func->body) return;
+            funcs.push_back(func);
+            collectFunctions(func->body, funcs);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectFunctions(s, funcs);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectFunctions(i->ifBody, funcs);
+            collectFunctions(i->elseBody, funcs);
+        } break;
+        case (ST::FOR):     collectFunctions(asFor(stmt)->body, funcs); break;
+        case (ST::WHILE):   collectFunctions(asWhile(stmt)->body, funcs); break;
+        case (ST::DEFER):   collectFunctions(asDefer(stmt)->block, funcs); break;
+        default: break;
+    }
+}
+
+// Everything the function declares itself lives in SSA values, everything else is a global
+void IRBuilder::collectLocals(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (!decl->isConstant()) locals.insert(decl->name);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectLocals(s);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectLocals(i->ifBody);
+            collectLocals(i->elseBody);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            locals.insert(forLoop->it);
+            for (auto decl : forLoop->invariants) locals.insert(decl->name);
+            collectLocals(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) locals.insert(decl->name);
+            for (auto decl : whileLoop->invariants) locals.insert(decl->name);
+            collectLocals(whileLoop->body);
+        } break;
+        case (ST::DEFER):   collectLocals(asDefer(stmt)->block); break;
+        default: break;
+    }
+}
+
+void IRBuilder::buildFunction(IRFunction* irFunction)
+{
+    fn = irFunction;
+    locals.clear();
+    defs.clear();
+    incompletePhis.clear();
+    sealed.clear();
+    deferScopes.clear();
+    loops.clear();
+    sharedValues.clear();
+
+    Func* func = fn->func;
+    for (auto param : func->params) locals.insert(param->name);
+    collectLocals(func->body);
+
+    IRBlock* entry = fn->newBlock();
+    sealBlock(entry);
+    current = entry;
+
+    for (int i = 0; i < func->params.size(); i++) {
+        Decl* param = func->params[i];
+        IRValue* value = emit(IROp::PARAM, param->type);
+        value->index = i;
+        value->name = param->name;
+        fn->params.push_back(value);
+        writeVariable(param->name, entry, value);
+    }
+
+    lowerBlock(func->body);
+
+    if (current) {
+        emit(IROp::RETURN, fn->returnType);
+        current = nullptr;
+    }
+
+    finish();
+}
+
+IRValue* IRBuilder::resolve(IRValue* value)
+{
+    while (value->replacement) value = value->replacement;
+    return value;
+}
+
+// Points every use past the phis that were removed, removes the trivial phis that
+// only showed up after their operands were replaced, and puts the blocks in reverse postorder.
+void IRBuilder::finish()
+{
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (auto block : fn->blocks) {
+            for (auto inst : block->insts) {
+                for (auto& arg : inst->args) arg = resolve(arg);
+            }
+
+            for (int i = 0; i < block->insts.size(); i++) {
+                IRValue* phi = block->insts[i];
+                if (phi->op != IROp::PHI) break;
+
+                IRValue* same = nullptr;
+                bool trivial = true;
+                for (auto arg : phi->args) {
+                    if (arg == phi || arg == same) continue;
+                    if (same) {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+                if (!trivial || !same) continue;
+
+                phi->replacement = same;
+                block->insts.erase(block->insts.begin() + i);
+                i--;
+                changed = true;
+            }
+        }
+    }
+
+    inferTypes();
+
+    vector<IRBlock*> order;
+    unordered_set<IRBlock*> visited;
+    function<void(IRBlock*)> visit = [&](IRBlock* block) {
+        visited.insert(block);
+        // Backwards, so the true side of a branch comes first once the order is flipped
+        for (int i = block->succs.size() - 1; i >= 0; i--) {
+            if (!visited.contains(block->succs[i])) visit(block->succs[i]);
+        }
+        order.push_back(block);
+    };
+    visit(fn->blocks[0]);
+    reverse(order.begin(), order.end());
+
+    fn->blocks = order;
+    fn->blockCount = 0;
+    fn->valueCount = 0;
+    for (auto block : fn->blocks) {
+        block->id = fn->blockCount++;
+        for (auto inst : block->insts) inst->id = inst->hasResult() ? fn->valueCount++ : -1;
+    }
+}
+
+// Phis and arithmetic in loops depend on each other, so types get found optimistically:
+// everything starts out undecided and only becomes unknown when two different types meet.
+void IRBuilder::inferTypes()
+{
+    enum State { UNDECIDED, KNOWN, CONFLICT };
+    unordered_map<IRValue*, State> state;
+
+    auto inferred = [](IRValue* inst) {
+        switch (inst->op) {
+            case (IROp::PHI):
+            case (IROp::ADD):
+            case (IROp::SUB):
+            case (IROp::MUL):
+            case (IROp::DIV):
+            case (IROp::NEG): return inst->type.base == Type::UNKNOWN;
+            default: return false;
+        }
+    };
+
+    for (auto block : fn->blocks) {
+        for (auto inst : block->insts) {
+            if (inferred(inst)) state[inst] = UNDECIDED;
+            else state[inst] = inst->type.base == Type::UNKNOWN ? CONFLICT : KNOWN;
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (auto block : fn->blocks) {
+            for (auto inst : block->insts) {
+                if (!inferred(inst) || state[inst] == CONFLICT) continue;
+
+                State next = UNDECIDED;
+                ImprovedType type = inst->type;
+
+                // Math takes the type of the left side, like Any does
+                vector<IRValue*> sources = inst->op == IROp::PHI ? inst->args : vector<IRValue*>{ inst->args[0] };
+                for (auto source : sources) {
+                    if (source == inst || state[source] == UNDECIDED) continue;
+
+                    if (state[source] == CONFLICT) {
+                        next = CONFLICT;
+                    } else if (next == UNDECIDED) {
+                        next = KNOWN;
+                        type = source->type;
+                    } else if (next == KNOWN && (source->type.base != type.base || source->type.flags != type.flags)) {
+                        next = CONFLICT;
+                    }
+                }
+
+                if (next == state[inst] && (next != KNOWN || type.base == inst->type.base)) continue;
+
+                state[inst] = next;
+                inst->type = next == KNOWN ? type : ImprovedType(Type::UNKNOWN);
+                changed = true;
+            }
+        }
+    }
+}
+
+IRValue* IRBuilder::emit(IROp op, ImprovedType type, vector<IRValue*> args)
+{
+    ASSERT(current);
+
+    IRValue* value = fn->newValue(op, type);
+    value->args = args;
+    value->block = current;
+    current->insts.push_back(value);
+    return value;
+}
+
+IRValue* IRBuilder::constant(Any& any)
+{
+    IRValue* value = emit(IROp::CONST, any.type);
+    value->type.flags &= ~Flags::CONSTANT;
+    value->constant = any;
+    return value;
+}
+
+IRValue* IRBuilder::constant(long long int value, Type type)
+{
+    Any any;
+    any.type.base = type;
+    if (type == Type::BOOL) any.value.Bool = value;
+    else any.value.Int = value;
+    return constant(any);
+}
+
+void IRBuilder::addEdge(IRBlock* from, IRBlock* to)
+{
+    from->succs.push_back(to);
+    to->preds.push_back(from);
+}
+
+void IRBuilder::jump(IRBlock* target)
+{
+    IRValue* inst = emit(IROp::JUMP, Type::VOID);
+    inst->targets = { target };
+    addEdge(current, target);
+    current = nullptr;
+}
+
+void IRBuilder::branch(IRValue* condition, IRBlock* ifTrue, IRBlock* ifFalse)
+{
+    IRValue* inst = emit(IROp::BRANCH, Type::VOID, { condition });
+    inst->targets = { ifTrue, ifFalse };
+    addEdge(current, ifTrue);
+    addEdge(current, ifFalse);
+    current = nullptr;
+}
+
+// Only for blocks nothing jumps to, so nothing can have used them yet
+void IRBuilder::removeBlock(IRBlock* block)
+{
+    ASSERT(block->preds.empty() && block->insts.empty());
+    fn->blocks.erase(find(fn->blocks.begin(), fn->blocks.end(), block));
+}
+
+void IRBuilder::writeVariable(const string& name, IRBlock* block, IRValue* value)
+{
+    defs[block][name] = value;
+}
+
+IRValue* IRBuilder::readVariable(const string& name, IRBlock* block)
+{
+    auto& blockDefs = defs[block];
+    if (blockDefs.contains(name)) return resolve(blockDefs[name]);
+    return readVariableRecursive(name, block);
+}
+
+IRValue* IRBuilder::readVariableRecursive(const string& name, IRBlock* block)
+{
+    IRValue* value;
+
+    if (!sealed.contains(block)) {
+        // We don't know all the predecessors yet, the operands get filled in by sealBlock
+        value = newPhi(block);
+        incompletePhis[block].push_back({ name, value });
+    } else if (block->preds.empty()) {
+        // Nothing in the function wrote it yet, so it's whatever the caller had
+        value = loadAtEntry(name);
+    } else if (block->preds.size() == 1) {
+        value = readVariable(name, block->preds[0]);
+    } else {
+        // Break cycles in loops with an operandless phi
+        value = newPhi(block);
+        writeVariable(name, block, value);
+        value = addPhiOperands(name, value);
+    }
+
+    writeVariable(name, block, value);
+    return value;
+}
+
+IRValue* IRBuilder::newPhi(IRBlock* block)
+{
+    IRValue* phi = fn->newValue(IROp::PHI, Type::UNKNOWN);
+    phi->block = block;
+
+    int i = 0;
+    while (i < block->insts.size() && block->insts[i]->op == IROp::PHI) i++;
+    block->insts.insert(block->insts.begin() + i, phi);
+
+    return phi;
+}
+
+IRValue* IRBuilder::addPhiOperands(const string& name, IRValue* phi)
+{
+    for (auto pred : phi->block->preds) {
+        phi->args.push_back(readVariable(name, pred));
+    }
+    return tryRemoveTrivialPhi(name, phi);
+}
+
+IRValue* IRBuilder::tryRemoveTrivialPhi(const string& name, IRValue* phi)
+{
+    IRValue* same = nullptr;
+    for (auto arg : phi->args) {
+        arg = resolve(arg);
+        if (arg == same || arg == phi) continue;
+        if (same) return phi;
+        same = arg;
+    }
+
+    // Only reachable through itself, which can't happen once the entry block is sealed
+    if (!same) same = loadAtEntry(name);
+
+    IRBlock* block = phi->block;
+    block->insts.erase(find(block->insts.begin(), block->insts.end(), phi));
+    phi->replacement = same;
+
+    // Users of the phi get fixed up in finish
+    return same;
+}
+
+// Loads go right after the params so they dominate everything in the function
+IRValue* IRBuilder::loadAtEntry(const string& name)
+{
+    IRBlock* entry = fn->blocks[0];
+
+    IRValue* load = fn->newValue(IROp::LOAD_GLOBAL, Type::UNKNOWN);
+    load->name = name;
+    load->block = entry;
+
+    int i = 0;
+    while (i < entry->insts.size() && entry->insts[i]->op == IROp::PARAM) i++;
+    entry->insts.insert(entry->insts.begin() + i, load);
+
+    return load;
+}
+
+void IRBuilder::sealBlock(IRBlock* block)
+{
+    for (auto& [name, phi] : incompletePhis[block]) addPhiOperands(name, phi);
+    incompletePhis.erase(block);
+    sealed.insert(block);
+}
+
+void IRBuilder::pushDeferScope()
+{
+    deferScopes.push_back({ {}, current });
+}
+
+void IRBuilder::popDeferScope()
+{
+    deferScopes.pop_back();
+}
+
+// Runs the defers of every scope from the innermost one down to (and including) downTo,
+// for the ways out of a scope that skip its end.
+void IRBuilder::emitDefers(int downTo)
+{
+    for (int i = deferScopes.size() - 1; i >= downTo && current; i--) emitScopeDefers(i);
+}
+
+void IRBuilder::emitScopeDefers(int scope)
+{
+    // Copy, a deferred statement could add to the scope while we lower it
+    vector<DeferEntry> defers = deferScopes[scope].defers;
+
+    for (auto& entry : defers) {
+        if (!current) return;
+
+        if (entry.flag.empty()) {
+            lowerStmt(entry.stmt, true);
+            continue;
+        }
+
+        IRBlock* run = fn->newBlock();
+        IRBlock* join = fn->newBlock();
+
+        branch(readVariable(entry.flag, current), run, join);
+        sealBlock(run);
+
+        current = run;
+        lowerStmt(entry.stmt, true);
+        if (current) jump(join);
+
+        sealBlock(join);
+        current = join;
+    }
+}
+
+void IRBuilder::lowerStmt(Stmt* stmt, bool direct)
+{
+    if (!current) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL):    lowerDecl(asDecl(stmt)); break;
+        case (ST::BLOCK):   lowerBlock(asBlock(stmt)); break;
+        case (ST::IF):      lowerIf(asIf(stmt)); break;
+        case (ST::FOR):     lowerFor(asFor(stmt)); break;
+        case (ST::WHILE):   lowerWhile(asWhile(stmt)); break;
+        case (ST::SET):     lowerSet(asSet(stmt)); break;
+        case (ST::DEFER):   lowerDefer(asDefer(stmt), direct); break;
+
+        // Declared at the top level, they don't run
+        case (ST::STRUCT):
+        case (ST::ENUM):
+        case (ST::FUNC):    break;
+
+        case (ST::EXPRSTMT): lowerExpr(asExprStmt(stmt)->expr); break;
+
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            string name = asIdent(assign->left)->name;
+            IRValue* value = lowerExpr(assign->right);
+
+            if (locals.contains(name)) {
+                writeVariable(name, current, value);
+            } else {
+                IRValue* store = emit(IROp::STORE_GLOBAL, Type::VOID, { value });
+                store->name = name;
+            }
+        } break;
+
+        case (ST::RETURN): {
+            Return* ret = asReturn(stmt);
+            vector<IRValue*> args;
+            if (ret->expr) args.push_back(lowerExpr(ret->expr));
+
+            emitDefers(0);
+            if (current) emit(IROp::RETURN, fn->returnType, args);
+            current = nullptr;
+        } break;
+
+        case (ST::CONTINUE): {
+            if (loops.empty()) error("continue outside of a loop", stmt->tk);
+            emitDefers(loops.back().deferDepth);
+            if (current) jump(loops.back().continueTo);
+        } break;
+
+        case (ST::BREAK): {
+            if (loops.empty()) error("break outside of a loop", stmt->tk);
+            emitDefers(loops.back().deferDepth);
+            if (current) jump(loops.back().breakTo);
+        } break;
+
+        default: INTERNAL_ERROR("Stmt not supported by the IRBuilder");
+    }
+}
+
+void IRBuilder::lowerBlock(Block* block)
+{
+    pushDeferScope();
+
+    for (auto stmt : block->stmts) {
+        if (!current) break;
+        lowerStmt(stmt, true);
+    }
+
+    if (current) emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void IRBuilder::lowerDecl(Decl* decl)
+{
+    if (decl->isConstant()) return;
+
+    IRValue* value;
+    if (decl->isDeclArray()) {
+        IRValue* size = lowerExpr(decl->expr);
+        value = emit(IROp::NEW_ARRAY, decl->type, { size });
+    } else if (decl->expr) {
+        value = lowerExpr(decl->expr);
+    } else if (decl->type.base == Type::STRUCT) {
+        string* name = (string*) decl->type.info;
+        if (!structs.contains(*name)) error("Struct not defined", decl->tk);
+
+        value = emit(IROp::NEW_STRUCT, decl->type);
+        value->defn = structs[*name];
+    } else if (decl->type.base == Type::STRING) {
+        Any any;
+        any.type.base = Type::STRING;
+        any.value.String = JaiString::intern("");
+        value = constant(any);
+    } else if (decl->type.base == Type::ENUM) {
+        value = constant(0, Type::INT);
+    } else {
+        value = constant(0, decl->type.base);
+    }
+
+    writeVariable(decl->name, current, value);
+}
+
+void IRBuilder::lowerIf(If* i)
+{
+    IRValue* condition = lowerExpr(i->condition);
+
+    IRBlock* thenBlock = fn->newBlock();
+    IRBlock* elseBlock = i->elseBody ? fn->newBlock() : nullptr;
+    IRBlock* join = fn->newBlock();
+
+    branch(condition, thenBlock, elseBlock ? elseBlock : join);
+
+    sealBlock(thenBlock);
+    current = thenBlock;
+    lowerStmt(i->ifBody, false);
+    if (current) jump(join);
+
+    if (elseBlock) {
+        sealBlock(elseBlock);
+        current = elseBlock;
+        lowerStmt(i->elseBody, false);
+        if (current) jump(join);
+    }
+
+    sealBlock(join);
+    if (join->preds.empty()) {
+        removeBlock(join);
+        current = nullptr;
+    } else {
+        current = join;
+    }
+}
+
+// Loops are rotated: check once before, then the check sits at the bottom.
+// The preheader only runs if the body runs at least once, which is where the invariants go.
+void IRBuilder::lowerFor(For* forLoop)
+{
+    if (!forLoop->end) error("For over arrays is not supported by the IRBuilder", forLoop->tk);
+
+    pushDeferScope();
+    int deferDepth = deferScopes.size();
+
+    IRValue* start = lowerExpr(forLoop->start);
+    IRValue* end = lowerExpr(forLoop->end);
+
+    // The Interpreter counts with its own copy of the index, the body can change it without affecting the loop
+    string index = "$index" + to_string(tempCount++);
+    locals.insert(index);
+    writeVariable(index, current, start);
+
+    IRBlock* preheader = fn->newBlock();
+    IRBlock* body = fn->newBlock();
+    IRBlock* latch = fn->newBlock();
+    IRBlock* exit = fn->newBlock();
+
+    branch(emit(IROp::LT, Type::BOOL, { start, end }), preheader, exit);
+
+    sealBlock(preheader);
+    current = preheader;
+    for (auto decl : forLoop->invariants) lowerDecl(decl);
+    jump(body);
+
+    current = body;
+    writeVariable(forLoop->it, body, readVariable(index, body));
+
+    loops.push_back({ latch, exit, deferDepth });
+    lowerStmt(forLoop->body, false);
+    if (current) jump(latch);
+    loops.pop_back();
+
+    sealBlock(latch);
+    if (latch->preds.empty()) {
+        removeBlock(latch);
+    } else {
+        current = latch;
+        Type counter = isIntegerType(start->type.base) ? start->type.base : Type::INT;
+        IRValue* one = constant(1, counter);
+        IRValue* next = emit(IROp::ADD, counter, { readVariable(index, latch), one });
+        writeVariable(index, latch, next);
+        branch(emit(IROp::LT, Type::BOOL, { next, end }), body, exit);
+    }
+    sealBlock(body);
+
+    sealBlock(exit);
+    current = exit;
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void IRBuilder::lowerWhile(While* whileLoop)
+{
+    pushDeferScope();
+    int deferDepth = deferScopes.size();
+
+    for (auto decl : whileLoop->conditionInvariants) lowerDecl(decl);
+
+    IRBlock* preheader = fn->newBlock();
+    IRBlock* body = fn->newBlock();
+    IRBlock* latch = fn->newBlock();
+    IRBlock* exit = fn->newBlock();
+
+    branch(lowerExpr(whileLoop->condition), preheader, exit);
+
+    sealBlock(preheader);
+    current = preheader;
+    for (auto decl : whileLoop->invariants) lowerDecl(decl);
+    jump(body);
+
+    current = body;
+    loops.push_back({ latch, exit, deferDepth });
+    lowerStmt(whileLoop->body, false);
+    if (current) jump(latch);
+    loops.pop_back();
+
+    sealBlock(latch);
+    if (latch->preds.empty()) {
+        removeBlock(latch);
+    } else {
+        current = latch;
+        branch(lowerExpr(whileLoop->condition), body, exit);
+    }
+    sealBlock(body);
+
+    sealBlock(exit);
+    current = exit;
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void IRBuilder::lowerSet(Set* set)
+{
+    IRValue* object = lowerExpr(set->expr);
+
+    if (set->defn) {
+        IRValue* value = lowerExpr(set->value);
+        IRValue* inst = emit(IROp::SET_MEMBER, Type::VOID, { object, value });
+        inst->defn = set->defn;
+        inst->index = set->index;
+        inst->name = asConst(set->access)->any.value.String->text;
+    } else if (isConst(set->access) && asConst(set->access)->any.type.base == Type::STRING) {
+        IRValue* value = lowerExpr(set->value);
+        IRValue* inst = emit(IROp::SET_FIELD, Type::VOID, { object, value });
+        inst->name = asConst(set->access)->any.value.String->text;
+    } else {
+        IRValue* index = lowerExpr(set->access);
+        IRValue* value = lowerExpr(set->value);
+        emit(IROp::SET_INDEX, Type::VOID, { object, index, value });
+    }
+}
+
+// A defer we always go through is just remembered, one we might skip gets a flag
+// that is false at the start of its scope and true once we went past it.
+void IRBuilder::lowerDefer(Defer* defer, bool direct)
+{
+    DeferScope& scope = deferScopes.back();
+
+    if (direct) {
+        scope.defers.push_back({ defer->block, "" });
+        return;
+    }
+
+    string flag = "$defer" + to_string(tempCount++);
+    locals.insert(flag);
+
+    IRBlock* entry = scope.entry;
+    IRValue* notYet = fn->newValue(IROp::CONST, Type::BOOL);
+    notYet->constant.type.base = Type::BOOL;
+    notYet->constant.value.Bool = false;
+    notYet->block = entry;
+
+    auto position = entry->terminator() ? entry->insts.end() - 1 : entry->insts.end();
+    entry->insts.insert(position, notYet);
+    if (!defs[entry].contains(flag)) writeVariable(flag, entry, notYet);
+
+    writeVariable(flag, current, constant(1, Type::BOOL));
+    scope.defers.push_back({ defer->block, flag });
+}
+
+IROp IRBuilder::toIROp(OP op)
+{
+    switch(op) {
+        case (OP::EQUAL):           return IROp::EQ;
+        case (OP::NOT_EQUAL):       return IROp::NE;
+        case (OP::AND):             return IROp::AND;
+        case (OP::OR):              return IROp::OR;
+        case (OP::GREATER):         return IROp::GT;
+        case (OP::GREATER_EQUAL):   return IROp::GE;
+        case (OP::LESS):            return IROp::LT;
+        case (OP::LESS_EQUAL):      return IROp::LE;
+        case (OP::MINUS):           return IROp::SUB;
+        case (OP::PLUS):            return IROp::ADD;
+        case (OP::MULTIPLY):        return IROp::MUL;
+        case (OP::DIVIDE):          return IROp::DIV;
+        case (OP::NOT):             return IROp::NOT;
+        case (OP::NEGATE):          return IROp::NEG;
+        default: break;
+    }
+
+    INTERNAL_ERROR("OP has no IROp");
+    return IROp::CONST;
+}
+
+ImprovedType IRBuilder::binaryType(IROp op, IRValue* left, IRValue* right)
+{
+    switch(op) {
+        case (IROp::EQ):
+        case (IROp::NE):
+        case (IROp::LT):
+        case (IROp::LE):
+        case (IROp::GT):
+        case (IROp::GE):
+        case (IROp::AND):
+        case (IROp::OR):    return Type::BOOL;
+        default: break;
+    }
+
+    // Any takes the type of the left side
+    if (left->type.flags & ~Flags::CONSTANT) return Type::UNKNOWN;
+    return left->type.base;
+}
+
+IRValue* IRBuilder::lowerExpr(Expr* expr)
+{
+    switch(expr->kind) {
+        case (ET::CONST): return constant(asConst(expr)->any);
+
+        case (ET::IDENT): {
+            string& name = asIdent(expr)->name;
+
+            if (constants.contains(name)) return constant(constants[name]);
+            if (locals.contains(name)) return readVariable(name, current);
+
+            IRValue* load = emit(IROp::LOAD_GLOBAL, Type::UNKNOWN);
+            load->name = name;
+            return load;
+        }
+
+        case (ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            IRValue* left = lowerExpr(binary->left);
+            IRValue* right = lowerExpr(binary->right);
+
+            IROp op = toIROp(binary->op);
+            return emit(op, binaryType(op, left, right), { left, right });
+        }
+
+        case (ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            IRValue* operand = lowerExpr(unary->expr);
+            IROp op = toIROp(unary->op);
+            ImprovedType type = op == IROp::NOT ? ImprovedType(Type::BOOL) : operand->type;
+            return emit(op, type, { operand });
+        }
+
+        case (ET::CALL): return lowerCall(asCall(expr));
+
+        case (ET::GET): {
+            Get* get = asGet(expr);
+            IRValue* object = lowerExpr(get->expr);
+
+            if (isConst(get->access) && asConst(get->access)->any.type.base == Type::STRING) {
+                IRValue* field = emit(IROp::GET_FIELD, Type::UNKNOWN, { object });
+                field->name = asConst(get->access)->any.value.String->text;
+                return field;
+            }
+
+            IRValue* index = lowerExpr(get->access);
+            ImprovedType type = Type::UNKNOWN;
+            if (object->type.flags == Flags::ARRAY) type = object->type.base;
+            return emit(IROp::GET_INDEX, type, { object, index });
+        }
+
+        case (ET::MEMBER): {
+            Member* member = asMember(expr);
+            IRValue* object = lowerExpr(member->expr);
+
+            ImprovedType type = Type::UNKNOWN;
+            if (member->index < member->defn->memberTypes.size()) type = member->defn->memberTypes[member->index];
+
+            IRValue* inst = emit(IROp::GET_MEMBER, type, { object });
+            inst->defn = member->defn;
+            inst->index = member->index;
+            inst->name = member->name;
+            return inst;
+        }
+
+        case (ET::SHARED): {
+            Shared* shared = asShared(expr);
+            if (!sharedValues.contains(shared)) sharedValues[shared] = lowerExpr(shared->expr);
+            return sharedValues[shared];
+        }
+
+        case (ET::SHARED_SCOPE): {
+            // The values only live as long as the statement, and a condition gets lowered twice
+            sharedValues.clear();
+            IRValue* value = lowerExpr(asSharedScope(expr)->expr);
+            sharedValues.clear();
+            return value;
+        }
+
+        default: break;
+    }
+
+    INTERNAL_ERROR("Expr not supported by the IRBuilder");
+    return nullptr;
+}
+
+IRValue* IRBuilder::lowerCall(Call* call)
+{
+    string name = asIdent(call->name)->name;
+    if (!functions.contains(name)) error("Fucntion not defined");
+    Func* defn = functions[name];
+
+    vector<IRValue*> args;
+    for (auto arg : call->args) args.push_back(lowerExpr(arg));
+
+    ImprovedType type = defn->returnType;
+    if (type.base == Type::TO_INFER) type = Type::UNKNOWN;
+
+    IRValue* inst = emit(IROp::CALL, type, args);
+    IRFunction* target = module->find(defn);
+    inst->name = target ? target->name : name;
+    return inst;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "IR.h"
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Lowers the AST into the SSA IR, one IRFunction per Func.
+// SSA gets built on the fly, following "Simple and Efficient Construction of SSA Form" (Braun et al.).
+// Defers are lowered explicitly: every way out of a scope gets a copy of its deferred statements,
+// in the order the Interpreter runs them.
+struct IRBuilder {
+    unordered_map<string, Func*>& functions;
+    unordered_map<string, Any>& constants;
+    unordered_map<string, Struct*>& structs;
+
+    IRModule* module = nullptr;
+    IRFunction* fn = nullptr;
+    IRBlock* current = nullptr;
+
+    // SSA construction
+    unordered_set<string> locals;
+    unordered_map<IRBlock*, unordered_map<string, IRValue*>> defs;
+    unordered_map<IRBlock*, vector<pair<string, IRValue*>>> incompletePhis;
+    unordered_set<IRBlock*> sealed;
+
+    // A defer that only runs if we went through it gets a flag variable
+    struct DeferEntry {
+        Stmt* stmt;
+        string flag;
+    };
+    struct DeferScope {
+        vector<DeferEntry> defers;
+        IRBlock* entry;
+    };
+    vector<DeferScope> deferScopes;
+
+    struct LoopTargets {
+        IRBlock* continueTo;
+        IRBlock* breakTo;
+        int deferDepth;
+    };
+    vector<LoopTargets> loops;
+
+    unordered_map<Shared*, IRValue*> sharedValues;
+    int tempCount = 0;
+
+    IRBuilder(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s);
+
+    IRModule* build(vector<Stmt*>& stmts);
+
+    void collectFunctions(Stmt* stmt, vector<Func*>& funcs);
+    void collectLocals(Stmt* stmt);
+    void buildFunction(IRFunction* irFunction);
+    void finish();
+    void inferTypes();
+
+    IRValue* emit(IROp op, ImprovedType type, vector<IRValue*> args = {});
+    IRValue* constant(Any& any);
+    IRValue* constant(long long int value, Type type);
+    void addEdge(IRBlock* from, IRBlock* to);
+    void jump(IRBlock* target);
+    void branch(IRValue* condition, IRBlock* ifTrue, IRBlock* ifFalse);
+    void removeBlock(IRBlock* block);
+
+    void writeVariable(const string& name, IRBlock* block, IRValue* value);
+    IRValue* readVariable(const string& name, IRBlock* block);
+    IRValue* readVariableRecursive(const string& name, IRBlock* block);
+    IRValue* newPhi(IRBlock* block);
+    IRValue* addPhiOperands(const string& name, IRValue* phi);
+    IRValue* tryRemoveTrivialPhi(const string& name, IRValue* phi);
+    IRValue* resolve(IRValue* value);
+    IRValue* loadAtEntry(const string& name);
+    void sealBlock(IRBlock* block);
+
+    void pushDeferScope();
+    void popDeferScope();
+    void emitDefers(int downTo);
+    void emitScopeDefers(int scope);
+
+    void lowerStmt(Stmt* stmt, bool direct);
+    void lowerBlock(Block* block);
+    void lowerDecl(Decl* decl);
+    void lowerIf(If* i);
+    void lowerFor(For* forLoop);
+    void lowerWhile(While* whileLoop);
+    void lowerSet(Set* set);
+    void lowerDefer(Defer* defer, bool direct);
+
+    IRValue* lowerExpr(Expr* expr);
+    IRValue* lowerCall(Call* call);
+    IROp toIROp(OP op);
+    ImprovedType binaryType(IROp op, IRValue* left, IRValue* right);
+};
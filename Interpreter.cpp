@@ -6,6 +6,10 @@
 #include "Stmt.h"
 #include "Expr.h"
 #include "Parser.h"
+#include "Resolver.h"
+#include "LoopOptimizer.h"
+#include "CSE.h"
+#include "Jit.h"
 #include "error.h"
 
 using std::cout, std::endl, std::string, std::vector;
@@ -20,14 +24,29 @@ Interpreter::Interpreter(Parser &p) : parser(p) {
     functions[name] = printf;
 }
 
-void Interpreter::run()
+// Everything that has to happen before main can run or be compiled
+void Interpreter::prepare()
 {
-    cout << "Running: " << endl;
-
     setUpTables(new Block(parser.statements));
 
     inferTypes(parser.declarations);
 
+    Resolver resolver(structs, enums, functions);
+    resolver.resolve(parser.statements);
+
+    LoopOptimizer loopOptimizer(functions);
+    loopOptimizer.optimize(parser.statements);
+
+    CSE cse(functions);
+    cse.optimize(parser.statements);
+}
+
+void Interpreter::run()
+{
+    cout << "Running: " << endl;
+
+    prepare();
+
     callFunction(main);
 }
 
@@ -42,6 +61,26 @@ void Interpreter::inferTypes(vector<Decl*> decls)
 
         }
     }
+
+    // The Structs copied their member types while parsing, so they still say TO_INFER
+    for (auto& [name, s] : structs) {
+        int i = 0;
+        for (auto stmt : s->body->stmts) {
+            if (isDecl(stmt)) {
+                Decl* decl = asDecl(stmt);
+                if (!decl->isConstant()) s->memberTypes[i++] = decl->type;
+            }
+        }
+    }
+}
+
+void Interpreter::measureMemory()
+{
+    Memory::measured(MemoryKind::MAPS, "Interpreter::variables", variables.size(), mapBytes(variables));
+    Memory::measured(MemoryKind::MAPS, "Interpreter::constants", constants.size(), mapBytes(constants));
+    Memory::measured(MemoryKind::MAPS, "Interpreter::structs", structs.size(), mapBytes(structs));
+    Memory::measured(MemoryKind::MAPS, "Interpreter::enums", enums.size(), mapBytes(enums));
+    Memory::measured(MemoryKind::MAPS, "Interpreter::functions", functions.size(), mapBytes(functions));
 }
 
 void Interpreter::setUpTables(Block* block)
@@ -59,7 +98,7 @@ void Interpreter::setUpTables(Block* block)
                 Any any;
                 any.type.base = Type::ENUM;
                 any.value.Ptr = (void*) e;
-                variables[e->name] = any;
+                variables[e->name] = std::move(any);
             } break;
             case (ST::FUNC): {
                 Func* f = asFunc(stmt);
@@ -102,13 +141,11 @@ void Interpreter::setUpTables(Stmt* stmt)
     if (isBlock(stmt)) setUpTables(asBlock(stmt));
 }
 
-void Interpreter::callPrintf(Func* func)
+void Interpreter::callPrintf(Any& any)
 {
-    Any any = variables[func->params[0]->name];
-
     ASSERT(any.type.base == Type::STRING);
 
-    string text = *any.value.String;
+    const string& text = any.value.String->text;
 
     cout << "> " << text << endl;
 }
@@ -116,10 +153,14 @@ void Interpreter::callPrintf(Func* func)
 Any Interpreter::callFunction(Func* func)
 {
     if (func->name == "printf") {
-        callPrintf(func);
+        callPrintf(variables[func->params[0]->name]);
         Any any;
         return any;
     }
+
+    size_t pendingBase = pendingOps.size();
+    const string* caller = Memory::function;
+    Memory::function = &func->name;
  
     pushDefers();
 
@@ -127,9 +168,61 @@ Any Interpreter::callFunction(Func* func)
 
     executeDefers();
 
+    while (shouldTailCall) {
+        shouldTailCall = false;
+        shouldReturn = false;
+
+        for (int i = 0; i < tailCallArgs.size(); i++) {
+            variables[func->params[i]->name] = std::move(tailCallArgs[i]);
+        }
+
+        // A tail call is a back edge too, once it's hot the Jit runs the rest of the recursion
+        if (jit && ++func->calls >= jit->threshold) {
+            if (func->calls == jit->threshold) jit->compile(func);
+            if (jit->call(func, *this, returnValue)) break;
+        }
+
+        pushDefers();
+        runBlock(func->body);
+        executeDefers();
+    }
+
     shouldReturn = false;
+    // The pendingOps are the caller's Binarys, what they make is the caller's
+    Memory::function = caller;
+
+    if (pendingOps.size() == pendingBase) return std::move(returnValue);
+
+    Any result = std::move(returnValue);
+    while (pendingOps.size() > pendingBase) {
+        auto& [op, left] = pendingOps.back();
+        result = applyBinary(op, left, result);
+        pendingOps.pop_back();
+    }
+    return result;
+}
+
+// A recursive call from the body runs the same loop again while this one still needs its invariants,
+// so whatever the names were bound to before goes into saved and dropInvariants puts it back
+void Interpreter::setInvariants(vector<Decl*>& invariants, SavedVariables& saved)
+{
+    for (auto decl : invariants) {
+        auto found = variables.find(decl->name);
+        if (found == variables.end()) saved.push_back({ false, Any() });
+        else saved.push_back({ true, std::move(found->second) });
+
+        variables[decl->name] = evaluateExpr(decl->expr);
+    }
+}
 
-    return returnValue;
+void Interpreter::dropInvariants(vector<Decl*>& invariants, SavedVariables& saved)
+{
+    for (int i = 0; i < invariants.size(); i++) {
+        auto& [bound, any] = saved[i];
+        if (bound) variables[invariants[i]->name] = std::move(any);
+        else variables.erase(invariants[i]->name);
+    }
+    saved.clear();
 }
 
 void Interpreter::pushDefers()
@@ -195,7 +288,7 @@ void Interpreter::runDecl(Stmt* stmt)
         if (!structs.contains(*name)) error("Struct not defined");
 
         Struct* defn  = structs[*name];
-        any.value.Ptr = new MyStruct(defn);
+        any.value.Ptr = MyStruct::make(defn);
 
     }
     else if (decl->type.base == Type::ENUM)
@@ -210,9 +303,10 @@ void Interpreter::runDecl(Stmt* stmt)
         
     }
     
-    if (decl->expr) any = evaluateExpr(decl->expr);
+    // For arrays the expr is the size
+    if (decl->expr && !(decl->type.flags & Flags::ARRAY)) any = evaluateExpr(decl->expr);
     
-    variables[decl->name] = any;
+    variables[decl->name] = std::move(any);
 }
 
 void Interpreter::runBlock(Stmt* stmt)
@@ -226,7 +320,6 @@ void Interpreter::runBlock(Stmt* stmt)
         if (shouldReturn || shouldContinue || shouldBreak) break;
     }
 
-    shouldContinue = false;
     executeDefers();
 }
 
@@ -248,8 +341,29 @@ void Interpreter::runFunc(Stmt* stmt)
 void Interpreter::runReturn(Stmt* stmt)
 {
     Return* r = asReturn(stmt);
-    returnValue = evaluateExpr(r->expr);
     shouldReturn = true;
+
+    if (!r->tailCall) {
+        returnValue = evaluateExpr(r->expr);
+        return;
+    }
+
+    Expr* expr = r->expr;
+    while (isBinary(expr)) {
+        Binary* binary = asBinary(expr);
+        pendingOps.push_back({binary->op, evaluateExpr(binary->left)});
+        expr = binary->right;
+    }
+
+    Call* call = asCall(expr);
+
+    vector<Any> args;
+    args.reserve(call->args.size());
+    for (auto arg : call->args) args.push_back(evaluateExpr(arg));
+
+    // Only the callFunction we're in looks at these, after the blocks are unwound
+    tailCallArgs = std::move(args);
+    shouldTailCall = true;
 }
 
 void Interpreter::runIf(Stmt* stmt)
@@ -284,23 +398,34 @@ void Interpreter::runFor(Stmt* stmt)
     pushDefers();
 
     For* forLoop = asFor(stmt);
-    
-    Any one;
-    one.type.base = Type::INT;
-    one.value.Int = 1;
 
     Any index = evaluateExpr(forLoop->start);
     Any end = evaluateExpr(forLoop->end);
 
-    variables[forLoop->it] = index;
-
-    while( isTruthy( index.less(end) ) ) {
-        runStmt(forLoop->body);
-        
-        if (shouldReturn || shouldBreak) break;
+    if (isIntegerType(index.type.base) && isIntegerType(end.type.base)) {
+        runCountedFor(forLoop, index, end);
+    } else {
+        Any one;
+        one.type.base = Type::INT;
+        one.value.Int = 1;
 
-        index = index.add(one);
         variables[forLoop->it] = index;
+
+        SavedVariables saved;
+        bool first = true;
+        while( isTruthy( index.less(end) ) ) {
+            if (first) setInvariants(forLoop->invariants, saved);
+            first = false;
+
+            runStmt(forLoop->body);
+            shouldContinue = false;
+            
+            if (shouldReturn || shouldBreak) break;
+
+            index = index.add(one);
+            variables[forLoop->it] = index;
+        }
+        if (!first) dropInvariants(forLoop->invariants, saved);
     }
     
     variables.erase(forLoop->it);
@@ -308,18 +433,58 @@ void Interpreter::runFor(Stmt* stmt)
     executeDefers();
 }
 
+// Start and end are both integers, so we can count with a native int
+// instead of going through Any::less and Any::add every iteration.
+void Interpreter::runCountedFor(For* forLoop, Any& index, Any& end)
+{
+    long long int first = index.value.Int;
+    long long int last  = end.value.Int;
+
+    variables[forLoop->it] = index;
+
+    SavedVariables saved;
+    if (first < last) setInvariants(forLoop->invariants, saved);
+
+    for (long long int i = first; i < last; i++) {
+        index.value.Int = i;
+        variables[forLoop->it] = index;
+
+        runStmt(forLoop->body);
+        shouldContinue = false;
+
+        if (shouldReturn || shouldBreak) break;
+    }
+
+    if (first < last) dropInvariants(forLoop->invariants, saved);
+}
+
 void Interpreter::runWhile(Stmt* stmt)
 {
     pushDefers();
 
     While* whileLoop = asWhile(stmt);
 
+    SavedVariables savedCondition;
+    setInvariants(whileLoop->conditionInvariants, savedCondition);
+
+    SavedVariables saved;
+    bool first = true;
     while( isTruthy( evaluateExpr(whileLoop->condition) ) ) {
+        if (first) setInvariants(whileLoop->invariants, saved);
+        first = false;
+
         runStmt(whileLoop->body);
+        shouldContinue = false;
         
         if (shouldReturn || shouldBreak) break;
+
+        // On-stack replacement, the Jit runs the rest of the loop with the variables as they are now
+        if (jit && ++whileLoop->backEdges >= jit->threshold && jit->runLoop(whileLoop, *this)) break;
     }
 
+    if (!first) dropInvariants(whileLoop->invariants, saved);
+    dropInvariants(whileLoop->conditionInvariants, savedCondition);
+
     shouldBreak = false;
     executeDefers();
 }
@@ -340,16 +505,36 @@ void Interpreter::runSet(Stmt* stmt)
     Set* set = asSet(stmt);
 
     Any any     = evaluateExpr(set->expr);
+
+    if (set->defn && any.type.base == Type::STRUCT) {
+        MyStruct* st = (MyStruct*) any.value.Ptr;
+        if (st->defn == set->defn) {
+            st->set(set->index, evaluateExpr(set->value));
+            return;
+        }
+    }
+
+    // Member names are constants, no need to copy them before we know it's a struct
+    if (any.type.base == Type::STRUCT && !(any.type.flags & Flags::ARRAY) && isConst(set->access) && asConst(set->access)->any.type.base == Type::STRING) {
+        any.setStructMember(asConst(set->access)->any.value.String->text, evaluateExpr(set->value), &set->cache);
+        return;
+    }
+
     Any access  = evaluateExpr(set->access);
     Any value   = evaluateExpr(set->value);
 
+    setAccess(any, access, std::move(value), &set->cache);
+}
+
+void Interpreter::setAccess(Any& any, Any& access, Any value, MemberCache* cache)
+{
     if (any.type.flags & Flags::ARRAY) {
 
-        any.setArrayMember(access.value.Int, value);
+        any.setArrayMember(access.value.Int, std::move(value));
 
     } else if (any.type.base == Type::STRUCT) {
 
-        any.setStructMember(*access.value.String, value);
+        any.setStructMember(access.value.String->text, std::move(value), cache);
 
     } else if (any.type.base == Type::ENUM) {
 
@@ -370,7 +555,7 @@ void Interpreter::runBreak(Stmt* stmt)
     shouldBreak = true;
 }
 
-bool Interpreter::isTruthy(Any any)
+bool Interpreter::isTruthy(const Any& any)
 {
     switch(any.type.base) {
         case(Type::FLOAT):
@@ -402,6 +587,9 @@ Any Interpreter::evaluateExpr(Expr* expr)
         case(ET::IDENT):    return evaluateIdent(expr);
         case(ET::CALL):     return evaluateCall(expr);
         case(ET::GET):      return evaluateGet(expr);
+        case(ET::MEMBER):   return evaluateMember(expr);
+        case(ET::SHARED):   return evaluateShared(expr);
+        case(ET::SHARED_SCOPE): return evaluateSharedScope(expr);
     }
 
     INTERNAL_ERROR("NO EXPR MATCHED THIS SWITCH");
@@ -420,11 +608,114 @@ Any Interpreter::evaluateBinary(Expr* expr)
 {
     Binary* binary = asBinary(expr);
 
+    if (binary->quick == Quick::NONE) {
+        binary->parts = concatParts(binary);
+        if (!binary->parts.empty()) binary->quick = Quick::CONCAT;
+    }
+    if (binary->quick == Quick::CONCAT) return evaluateConcat(binary->parts);
+
     Any left = evaluateExpr(binary->left);
     Any right = evaluateExpr(binary->right);
 
+    if (binary->quick > Quick::GENERIC && left.type.base == binary->quickLeft && right.type.base == binary->quickRight) {
+        return applyQuick(binary->quick, left, right);
+    }
+
+    if (binary->quick != Quick::GENERIC) quicken(binary, left, right);
+
+    // left is ours, so a string can grow right in it
+    if (binary->op == OP::PLUS && left.type.base == Type::STRING) return left.append(right);
+
+    return applyBinary(binary->op, left, right);
+}
+
+Any Interpreter::evaluateConcat(vector<Expr*>& parts)
+{
+    vector<Any> values;
+    values.reserve(parts.size());
+    for (auto part : parts) values.push_back(evaluateExpr(part));
+
+    return Any::concat(values.data(), values.size());
+}
+
+// Rewrites the Binary for the types it just saw. One that keeps seeing different types stays generic
+void Interpreter::quicken(Binary* binary, Any& left, Any& right)
+{
+    if (binary->quick != Quick::NONE && ++binary->misses > 4) {
+        binary->quick = Quick::GENERIC;
+        return;
+    }
+
+    Type l = left.type.base;
+    Type r = right.type.base;
+    bool ints = isIntegerType(l) && isIntegerType(r);
+    bool floats = (l == Type::FLOAT || l == Type::DOUBLE) && (r == Type::FLOAT || r == Type::DOUBLE);
+
+    Quick quick = Quick::GENERIC;
+    if (ints || floats) {
+        switch(binary->op) {
+            case(OP::PLUS):             quick = ints ? Quick::INT_ADD : Quick::FLOAT_ADD; break;
+            case(OP::MINUS):            quick = ints ? Quick::INT_SUB : Quick::FLOAT_SUB; break;
+            case(OP::MULTIPLY):         quick = ints ? Quick::INT_MUL : Quick::FLOAT_MUL; break;
+            case(OP::DIVIDE):           quick = ints ? Quick::INT_DIV : Quick::FLOAT_DIV; break;
+            case(OP::EQUAL):            quick = ints ? Quick::INT_EQ : Quick::FLOAT_EQ; break;
+            case(OP::NOT_EQUAL):        quick = ints ? Quick::INT_NE : Quick::FLOAT_NE; break;
+            case(OP::LESS):             quick = ints ? Quick::INT_LT : Quick::FLOAT_LT; break;
+            case(OP::LESS_EQUAL):       quick = ints ? Quick::INT_LE : Quick::FLOAT_LE; break;
+            case(OP::GREATER):          quick = ints ? Quick::INT_GT : Quick::FLOAT_GT; break;
+            case(OP::GREATER_EQUAL):    quick = ints ? Quick::INT_GE : Quick::FLOAT_GE; break;
+            default: break;
+        }
+    }
+
+    binary->quick = quick;
+    binary->quickLeft = l;
+    binary->quickRight = r;
+}
+
+// Does the same as the Any operations, the guard in evaluateBinary already checked the types
+Any Interpreter::applyQuick(Quick quick, Any& left, Any& right)
+{
     Any result;
-    switch(binary->op) {
+    result.type.base = Type::BOOL;
+
+    long long a = left.value.Int;
+    long long b = right.value.Int;
+    double x = left.value.Float;
+    double y = right.value.Float;
+
+    switch(quick) {
+        case(Quick::INT_ADD):   result.type = left.type; result.value.Int = wrapAdd(a, b); break;
+        case(Quick::INT_SUB):   result.type = left.type; result.value.Int = wrapSub(a, b); break;
+        case(Quick::INT_MUL):   result.type = left.type; result.value.Int = wrapMul(a, b); break;
+        case(Quick::INT_DIV):   result.type = left.type; result.value.Int = a / b; break;
+        case(Quick::INT_EQ):    result.value.Bool = a == b; break;
+        case(Quick::INT_NE):    result.value.Bool = a != b; break;
+        case(Quick::INT_LT):    result.value.Bool = a < b; break;
+        case(Quick::INT_LE):    result.value.Bool = a <= b; break;
+        case(Quick::INT_GT):    result.value.Bool = a > b; break;
+        case(Quick::INT_GE):    result.value.Bool = a >= b; break;
+
+        case(Quick::FLOAT_ADD): result.type = left.type; result.value.Float = x + y; break;
+        case(Quick::FLOAT_SUB): result.type = left.type; result.value.Float = x - y; break;
+        case(Quick::FLOAT_MUL): result.type = left.type; result.value.Float = x * y; break;
+        case(Quick::FLOAT_DIV): result.type = left.type; result.value.Float = x / y; break;
+        case(Quick::FLOAT_EQ):  result.value.Bool = x == y; break;
+        case(Quick::FLOAT_NE):  result.value.Bool = x != y; break;
+        case(Quick::FLOAT_LT):  result.value.Bool = x < y; break;
+        case(Quick::FLOAT_LE):  result.value.Bool = x <= y; break;
+        case(Quick::FLOAT_GT):  result.value.Bool = x > y; break;
+        case(Quick::FLOAT_GE):  result.value.Bool = x >= y; break;
+
+        default: INTERNAL_ERROR("Binary wasn't quickened");
+    }
+    return result;
+}
+
+Any Interpreter::applyBinary(OP op, Any& left, Any& right)
+{
+    Any result;
+    switch(op) {
         case(OP::EQUAL): return left.equal(right); 
         case(OP::NOT_EQUAL):        return left.notEqual(right);
     
@@ -465,9 +756,11 @@ Any Interpreter::evaluateIdent(Expr* expr)
 {
     Ident* ident = asIdent(expr);
 
-    if (variables.contains(ident->name)) return variables[ident->name];
+    auto found = variables.find(ident->name);
+    if (found != variables.end()) return found->second;
 
-    if (constants.contains(ident->name)) return constants[ident->name];
+    found = constants.find(ident->name);
+    if (found != constants.end()) return found->second;
 
     error("Undefined Variable");
     
@@ -488,14 +781,19 @@ Any Interpreter::evaluateCall(Expr* expr)
 
     if (defn->params.size() != call->args.size()) error("Wrong number of arguments");
 
-    // Putting the arguments into the variables for the function
-    for (int i = 0; i < call->args.size(); i++) {
-        auto arg = call->args[i];
-        Any value = evaluateExpr(arg);
-        variables[defn->params[i]->name] = value;
+    // All the arguments first and then the parameters, like a tail call does it,
+    // otherwise f(n - 1, acc + n) would see the new n in acc + n
+    vector<Any> args;
+    args.reserve(call->args.size());
+    for (auto arg : call->args) args.push_back(evaluateExpr(arg));
+
+    for (int i = 0; i < args.size(); i++) {
+        variables[defn->params[i]->name] = std::move(args[i]);
     }
 
-    Any result = callFunction(defn);
+    Any result;
+    if (jit && ++defn->calls == jit->threshold) jit->compile(defn);
+    if (!jit || !jit->call(defn, *this, result)) result = callFunction(defn);
 
     // Removing the arguments after the function is done;
     for (auto param : defn->params) {
@@ -516,8 +814,18 @@ Any Interpreter::evaluateGet(Expr* expr)
     Get* get = asGet(expr);
 
     Any any = evaluateExpr(get->expr);
+
+    if (any.type.base == Type::STRUCT && !(any.type.flags & Flags::ARRAY) && isConst(get->access) && asConst(get->access)->any.type.base == Type::STRING) {
+        return any.getStructMember(asConst(get->access)->any.value.String->text, &get->cache);
+    }
+
     Any access = evaluateExpr(get->access);
 
+    return getAccess(any, access, &get->cache);
+}
+
+Any Interpreter::getAccess(Any& any, Any& access, MemberCache* cache)
+{
     if (any.type.flags & Flags::ARRAY) {
 
         return any.getArrayMember(access.value.Int);
@@ -528,15 +836,69 @@ Any Interpreter::evaluateGet(Expr* expr)
         // even though we don't know if it's a struct or an enum
         // so we have to check first what it is bevore we access it.
 
-        return any.getStructMember(*access.value.String);
+        return any.getStructMember(access.value.String->text, cache);
 
     } else if (any.type.base == Type::ENUM) {
 
-        return any.getEnumValue(*access.value.String);
+        return any.getEnumValue(access.value.String->text);
 
     } else {
         error("Get should only be called from arrays or structs or enums");
     }
 
     return any;
+}
+
+Any Interpreter::evaluateMember(Expr* expr)
+{
+    Member* member = asMember(expr);
+
+    Any any = evaluateExpr(member->expr);
+
+    return getMember(any, member);
+}
+
+Any Interpreter::getMember(Any& any, Member* member)
+{
+    if (any.type.base != Type::STRUCT) error("tried to index something that isn't a Struct (reading)");
+
+    MyStruct* st = (MyStruct*) any.value.Ptr;
+
+    // The Resolver only knows the declared type, so we still check what we actually got
+    if (st->defn != member->defn) return st->get(member->name, &member->cache);
+
+    return st->get(member->index);
+}
+
+Any Interpreter::evaluateShared(Expr* expr)
+{
+    Shared* shared = asShared(expr);
+    int index = sharedBase + shared->slot;
+
+    if (sharedDone[index]) return sharedValues[index];
+
+    // Calls in here can grow sharedValues, so we can't hold on to a reference
+    Any value = evaluateExpr(shared->expr);
+    sharedValues[index] = value;
+    sharedDone[index] = true;
+
+    return value;
+}
+
+Any Interpreter::evaluateSharedScope(Expr* expr)
+{
+    SharedScope* scope = asSharedScope(expr);
+
+    int outerBase = sharedBase;
+    sharedBase = sharedValues.size();
+    sharedValues.resize(sharedBase + scope->slots);
+    sharedDone.resize(sharedBase + scope->slots, false);
+
+    Any result = evaluateExpr(scope->expr);
+
+    sharedValues.resize(sharedBase);
+    sharedDone.resize(sharedBase);
+    sharedBase = outerBase;
+
+    return result;
 }
\ No newline at end of file
@@ -11,6 +11,8 @@
 
 using std::string, std::cout, std::endl, std::unordered_map, std::vector;
 
+struct Jit;
+
 struct Interpreter {
     Parser parser;
     unordered_map<string, Any> variables{0};
@@ -26,22 +28,44 @@ struct Interpreter {
     bool shouldBreak = false;
     Func* main = nullptr;
 
+    // Self recursive tail calls jump back to the start of the function instead of recursing.
+    // pendingOps holds the left sides of Binarys the call was nested in, like the x in x * factorial(x - 1).
+    bool shouldTailCall = false;
+    vector<Any> tailCallArgs;
+    vector<pair<OP, Any>> pendingOps;
+
+    // Values of the Shared expressions, every SharedScope gets its own slots starting at sharedBase
+    vector<Any> sharedValues;
+    vector<bool> sharedDone;
+    int sharedBase = 0;
+
+    // Calls to functions the Jit compiled run natively, so do hot while loops
+    Jit* jit = nullptr;
+
     Interpreter(Parser &p);
 
+    void prepare();
     void run();
+    // Tells Memory how big the tables are right now
+    void measureMemory();
 
     void setUpTables(Block* st);
     void setUpTables(Stmt* stmt);
 
     void inferTypes(vector<Decl*> decls);
 
-    void callPrintf(Func* func);
+    void callPrintf(Any& text);
     Any callFunction(Func* func);
 
+    // What a loop's invariants hid, a bool for whether there was a variable at all
+    typedef vector<pair<bool, Any>> SavedVariables;
+    void setInvariants(vector<Decl*>& invariants, SavedVariables& saved);
+    void dropInvariants(vector<Decl*>& invariants, SavedVariables& saved);
+
     void pushDefers();
     void executeDefers();
 
-    bool isTruthy(Any any);
+    bool isTruthy(const Any& any);
 
     void runStmt(Stmt* stmt);
     void runDecl(Stmt* stmt);
@@ -55,18 +79,29 @@ struct Interpreter {
     void runExprStmt(Stmt* stmt);
     void runDefer(Stmt* stmt);
     void runFor(Stmt* stmt);
+    void runCountedFor(For* forLoop, Any& index, Any& end);
     void runWhile(Stmt* stmt);
     void runAssign(Stmt* stmt);
     void runSet(Stmt* stmt);
+    void setAccess(Any& any, Any& access, Any value, MemberCache* cache = nullptr);
     void runContinue(Stmt* stmt);
     void runBreak(Stmt* stmt);
 
     Any evaluateExpr(Expr* expr);
     Any evaluateConst(Expr* expr);
     Any evaluateBinary(Expr* expr);
+    Any evaluateConcat(vector<Expr*>& parts);
+    Any applyBinary(OP op, Any& left, Any& right);
+    Any applyQuick(Quick quick, Any& left, Any& right);
+    void quicken(Binary* binary, Any& left, Any& right);
     Any evaluateUnary(Expr* expr);
     Any evaluateIdent(Expr* expr);
     Any evaluateCall(Expr* expr);
     Any evaluateArray(Expr* expr);
     Any evaluateGet(Expr* expr);
+    Any getAccess(Any& any, Any& access, MemberCache* cache = nullptr);
+    Any evaluateMember(Expr* expr);
+    Any getMember(Any& any, Member* member);
+    Any evaluateShared(Expr* expr);
+    Any evaluateSharedScope(Expr* expr);
 };
\ No newline at end of file
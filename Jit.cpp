@@ -0,0 +1,1311 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include "Jit.h"
+#include "Interpreter.h"
+#include "error.h"
+
+#if defined(__linux__) && defined(__x86_64__)
+#define JIT_X64
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+// Decides which functions only ever work with ints. Calls count if the callee makes it too,
+// so Jit::compileAll keeps dropping functions until all the ones left only call each other.
+// For a loop the variables the Interpreter has right now count as locals too, whether they hold ints gets checked every time it's entered.
+struct JitChecker {
+    unordered_map<string, Any>& constants;
+    unordered_set<Func*>& candidates;
+    unordered_set<string> locals;
+    unordered_map<string, Any>* variables = nullptr;
+    bool returns = true;
+
+    // What the last check ran into
+    unordered_set<string> used;
+    unordered_set<Func*> callees;
+
+    JitChecker(unordered_map<string, Any>& c, unordered_set<Func*>& f) : constants(c), candidates(f) {}
+
+    bool check(Func* func);
+    bool checkLoop(While* loop, unordered_map<string, Any>& variables);
+    bool isLocal(const string& name);
+    void collectLocals(Stmt* stmt);
+    bool isInt(const string& name);
+    bool intExpr(Expr* expr);
+    bool condition(Expr* expr);
+    bool stmt(Stmt* stmt);
+    bool alwaysReturns(Stmt* stmt);
+};
+
+bool JitChecker::check(Func* func)
+{
+    if (!func->body || func->params.size() > 6) return false;
+    if (func->returnType.base != Type::INT || func->returnType.flags) return false;
+
+    locals.clear();
+    used.clear();
+    callees.clear();
+    variables = nullptr;
+    returns = true;
+
+    for (auto param : func->params) {
+        if (param->type.base != Type::INT || param->type.flags) return false;
+        locals.insert(param->name);
+    }
+    collectLocals(func->body);
+
+    // Falling off the end would return nothing, which isn't an int
+    return stmt(func->body) && alwaysReturns(func->body);
+}
+
+bool JitChecker::checkLoop(While* loop, unordered_map<string, Any>& vars)
+{
+    locals.clear();
+    used.clear();
+    callees.clear();
+    variables = &vars;
+    returns = false;
+
+    collectLocals(loop);
+    return stmt(loop);
+}
+
+void JitChecker::collectLocals(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (!decl->isConstant()) locals.insert(decl->name);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectLocals(s);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectLocals(i->ifBody);
+            collectLocals(i->elseBody);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            locals.insert(forLoop->it);
+            for (auto decl : forLoop->invariants) locals.insert(decl->name);
+            collectLocals(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) locals.insert(decl->name);
+            for (auto decl : whileLoop->invariants) locals.insert(decl->name);
+            collectLocals(whileLoop->body);
+        } break;
+        default: break;
+    }
+}
+
+bool JitChecker::isLocal(const string& name)
+{
+    used.insert(name);
+    return locals.contains(name) || (variables && variables->contains(name));
+}
+
+bool JitChecker::isInt(const string& name)
+{
+    if (isLocal(name)) return true;
+    return constants.contains(name) && constants[name].type.base == Type::INT;
+}
+
+bool JitChecker::intExpr(Expr* expr)
+{
+    switch(expr->kind) {
+        case (ET::CONST):           return asConst(expr)->any.type.base == Type::INT;
+        case (ET::IDENT):           return isInt(asIdent(expr)->name);
+        case (ET::SHARED):          return intExpr(asShared(expr)->expr);
+        case (ET::SHARED_SCOPE):    return intExpr(asSharedScope(expr)->expr);
+
+        case (ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            switch(binary->op) {
+                case (OP::PLUS):
+                case (OP::MINUS):
+                case (OP::MULTIPLY):
+                case (OP::DIVIDE):  return intExpr(binary->left) && intExpr(binary->right);
+                default:            return false;
+            }
+        }
+
+        case (ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            return unary->op == OP::NEGATE && intExpr(unary->expr);
+        }
+
+        case (ET::CALL): {
+            Call* call = asCall(expr);
+            if (!isIdent(call->name)) return false;
+
+            Func* callee = nullptr;
+            for (auto candidate : candidates) if (candidate->name == asIdent(call->name)->name) callee = candidate;
+            if (!callee || callee->params.size() != call->args.size()) return false;
+
+            callees.insert(callee);
+            for (auto arg : call->args) if (!intExpr(arg)) return false;
+            return true;
+        }
+
+        default: return false;
+    }
+}
+
+bool JitChecker::condition(Expr* expr)
+{
+    if (isSharedScope(expr)) return condition(asSharedScope(expr)->expr);
+    if (isUnary(expr) && asUnary(expr)->op == OP::NOT) return condition(asUnary(expr)->expr);
+
+    if (isBinary(expr)) {
+        Binary* binary = asBinary(expr);
+        switch(binary->op) {
+            case (OP::EQUAL):
+            case (OP::NOT_EQUAL):
+            case (OP::LESS):
+            case (OP::LESS_EQUAL):
+            case (OP::GREATER):
+            case (OP::GREATER_EQUAL):   return intExpr(binary->left) && intExpr(binary->right);
+            default: break;
+        }
+    }
+
+    return intExpr(expr);
+}
+
+bool JitChecker::stmt(Stmt* stmt)
+{
+    if (!stmt) return true;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->isConstant()) return true;
+            if (decl->type.flags) return false;
+            if (decl->type.base == Type::INT) return !decl->expr || intExpr(decl->expr);
+            return decl->type.base == Type::UNKNOWN && decl->expr && intExpr(decl->expr);
+        }
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) if (!this->stmt(s)) return false;
+            return true;
+        }
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            return condition(i->condition) && this->stmt(i->ifBody) && this->stmt(i->elseBody);
+        }
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            if (!forLoop->end || !intExpr(forLoop->start) || !intExpr(forLoop->end)) return false;
+            for (auto decl : forLoop->invariants) if (!this->stmt(decl)) return false;
+            return this->stmt(forLoop->body);
+        }
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) if (!this->stmt(decl)) return false;
+            for (auto decl : whileLoop->invariants) if (!this->stmt(decl)) return false;
+            return condition(whileLoop->condition) && this->stmt(whileLoop->body);
+        }
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            return isIdent(assign->left) && isLocal(asIdent(assign->left)->name) && intExpr(assign->right);
+        }
+        case (ST::RETURN): {
+            Return* ret = asReturn(stmt);
+            return returns && ret->expr && intExpr(ret->expr);
+        }
+        case (ST::EXPRSTMT):    return isCall(asExprStmt(stmt)->expr) && intExpr(asExprStmt(stmt)->expr);
+
+        case (ST::CONTINUE):
+        case (ST::BREAK):
+        case (ST::STRUCT):
+        case (ST::ENUM):
+        case (ST::FUNC):        return true;
+
+        default: return false;
+    }
+}
+
+bool JitChecker::alwaysReturns(Stmt* stmt)
+{
+    if (!stmt) return false;
+
+    switch(stmt->kind) {
+        case (ST::RETURN):  return true;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) {
+                if (alwaysReturns(s)) return true;
+                if (isBreak(s) || isContinue(s)) return false;
+            }
+            return false;
+        }
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            return alwaysReturns(i->ifBody) && alwaysReturns(i->elseBody);
+        }
+        default: return false;
+    }
+}
+
+#ifdef JIT_X64
+
+enum Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Condition codes of jcc
+enum CC {
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+};
+
+static CC invert(CC cc)
+{
+    return (CC) (cc ^ 1);
+}
+
+// Where a value is: a register, a constant or a slot below rbp
+struct Operand {
+    enum Kind { REG, IMM, MEM, NONE } kind = NONE;
+    int reg = 0;
+    long long imm = 0;
+    int disp = 0;
+
+    static Operand inReg(int r) { Operand o; o.kind = REG; o.reg = r; return o; }
+    static Operand constant(long long i) { Operand o; o.kind = IMM; o.imm = i; return o; }
+    static Operand inMemory(int d) { Operand o; o.kind = MEM; o.disp = d; return o; }
+};
+
+struct Label {
+    int pos = -1;
+    vector<int> fixups;
+};
+
+static bool fitsInt32(long long i)
+{
+    return i >= INT32_MIN && i <= INT32_MAX;
+}
+
+// Just the instructions we need, all of them 64 bit
+struct X64Emitter {
+    vector<unsigned char> code;
+
+    void byte(int b) { code.push_back((unsigned char) b); }
+    void int32(int i) { for (int k = 0; k < 4; k++) byte((i >> (8 * k)) & 0xff); }
+    void int64(long long i) { for (int k = 0; k < 8; k++) byte((i >> (8 * k)) & 0xff); }
+
+    void rex(int reg, int rm) { byte(0x48 | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0)); }
+    void modrm(int mod, int reg, int rm) { byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+    // op reg, r/m where r/m is a register or [rbp + disp]
+    void withRM(int opcode, int reg, Operand& rm)
+    {
+        if (rm.kind == Operand::REG) {
+            rex(reg, rm.reg);
+            if (opcode > 0xff) byte(opcode >> 8);
+            byte(opcode & 0xff);
+            modrm(3, reg, rm.reg);
+        } else {
+            rex(reg, RBP);
+            if (opcode > 0xff) byte(opcode >> 8);
+            byte(opcode & 0xff);
+            modrm(2, reg, RBP);
+            int32(rm.disp);
+        }
+    }
+
+    void movRR(int dst, int src)
+    {
+        if (dst == src) return;
+        rex(src, dst);
+        byte(0x89);
+        modrm(3, src, dst);
+    }
+
+    void movRI(int dst, long long imm)
+    {
+        if (fitsInt32(imm)) {
+            rex(0, dst);
+            byte(0xC7);
+            modrm(3, 0, dst);
+            int32((int) imm);
+        } else {
+            byte(0x48 | ((dst & 8) ? 1 : 0));
+            byte(0xB8 + (dst & 7));
+            int64(imm);
+        }
+    }
+
+    void mov(int dst, Operand src)
+    {
+        switch (src.kind) {
+            case (Operand::REG):    movRR(dst, src.reg); break;
+            case (Operand::IMM):    movRI(dst, src.imm); break;
+            case (Operand::MEM):    withRM(0x8B, dst, src); break;
+            default: INTERNAL_ERROR("Moving from nowhere");
+        }
+    }
+
+    // mov dst, [base + disp] and back, base can't be rsp or r12
+    void load(int dst, int base, int disp) { rex(dst, base); byte(0x8B); modrm(2, dst, base); int32(disp); }
+    void storeAt(int base, int disp, int src) { rex(src, base); byte(0x89); modrm(2, src, base); int32(disp); }
+
+    void store(Operand dst, int src)
+    {
+        if (dst.kind == Operand::REG) movRR(dst.reg, src);
+        else withRM(0x89, src, dst);
+    }
+
+    // add, sub and cmp share their encoding, ext is the /digit of the immediate form
+    void alu(int opcode, int ext, int dst, Operand src)
+    {
+        if (src.kind == Operand::IMM && !fitsInt32(src.imm)) {
+            movRI(RAX, src.imm);
+            src = Operand::inReg(RAX);
+        }
+
+        if (src.kind == Operand::IMM) {
+            rex(0, dst);
+            byte(0x81);
+            modrm(3, ext, dst);
+            int32((int) src.imm);
+        } else {
+            if (src.kind == Operand::REG) {
+                rex(src.reg, dst);
+                byte(opcode);
+                modrm(3, src.reg, dst);
+            } else {
+                withRM(opcode + 2, dst, src);
+            }
+        }
+    }
+
+    void add(int dst, Operand src) { alu(0x01, 0, dst, src); }
+    void sub(int dst, Operand src) { alu(0x29, 5, dst, src); }
+    void cmp(int dst, Operand src) { alu(0x39, 7, dst, src); }
+
+    void imul(int dst, Operand src)
+    {
+        if (src.kind == Operand::IMM && !fitsInt32(src.imm)) {
+            movRI(RAX, src.imm);
+            src = Operand::inReg(RAX);
+        }
+
+        if (src.kind == Operand::IMM) {
+            rex(dst, dst);
+            byte(0x69);
+            modrm(3, dst, dst);
+            int32((int) src.imm);
+        } else {
+            withRM(0x0FAF, dst, src);
+        }
+    }
+
+    void idiv(Operand src) { withRM(0xF7, 7, src); }
+    void neg(int dst) { rex(0, dst); byte(0xF7); modrm(3, 3, dst); }
+    void cqo() { byte(0x48); byte(0x99); }
+    void test(int r) { rex(r, r); byte(0x85); modrm(3, r, r); }
+
+    void push(int r) { if (r & 8) byte(0x41); byte(0x50 + (r & 7)); }
+    void pop(int r) { if (r & 8) byte(0x41); byte(0x58 + (r & 7)); }
+    void ret() { byte(0xC3); }
+
+    void subRsp(int bytes) { if (bytes) { rex(0, RSP); byte(0x81); modrm(3, 5, RSP); int32(bytes); } }
+    void addRsp(int bytes) { if (bytes) { rex(0, RSP); byte(0x81); modrm(3, 0, RSP); int32(bytes); } }
+
+    // lea rsp, [rbp + disp]
+    void rspFromRbp(int disp) { rex(RSP, RBP); byte(0x8D); modrm(2, RSP, RBP); int32(disp); }
+
+    // call [address], the callee might not be in executable memory yet
+    void callThrough(void** address)
+    {
+        movRI(RAX, (long long) address);
+        byte(0xFF);
+        modrm(0, 2, RAX);
+    }
+
+    void target(Label& label)
+    {
+        if (label.pos >= 0) {
+            int32(label.pos - ((int) code.size() + 4));
+        } else {
+            label.fixups.push_back(code.size());
+            int32(0);
+        }
+    }
+
+    void jmp(Label& label) { byte(0xE9); target(label); }
+    void jcc(CC cc, Label& label) { byte(0x0F); byte(0x80 + cc); target(label); }
+
+    void bind(Label& label)
+    {
+        label.pos = code.size();
+        for (int at : label.fixups) {
+            int rel = label.pos - (at + 4);
+            memcpy(&code[at], &rel, 4);
+        }
+        label.fixups.clear();
+    }
+};
+
+// Temps for evaluating expressions, rax and rdx are kept free for idiv and call results
+static const int temps[] = { RCX, RSI, RDI, R8, R9, R10, R11 };
+static const int tempCount = 7;
+
+// Locals that get used the most live here, the callee saves them so they survive calls
+static const int homes[] = { RBX, R12, R13, R14, R15 };
+static const int homeCount = 5;
+
+static const int argRegs[] = { RDI, RSI, RDX, RCX, R8, R9 };
+
+// Compiles one function or while loop the JitChecker said yes to.
+// Self tail calls, even the ones inside a chain of +, - and * like n + sum(n - 1), become a jump back to the start:
+// the chain is kept as result = mul * value + add in two hidden locals.
+struct JitCompiler {
+    X64Emitter& e;
+    unordered_map<string, Any>& constants;
+    unordered_map<Func*, JitFunction*>& compiled;
+    unordered_map<string, Func*>& functions;
+    Func* func = nullptr;
+
+    // The params, or for a loop the variables it gets from the Interpreter
+    vector<string> inputs;
+    Stmt* body = nullptr;
+
+    unordered_map<string, Operand> locals;
+    unordered_map<string, long long> weights;
+    unordered_map<Shared*, string> sharedNames;
+    unordered_map<For*, int> forIds;
+    unordered_set<Shared*> sharedDone;
+
+    Label start;
+    Label finish;
+    bool accumulates = false;
+    int spills = 0;
+    int pushed = 0;
+    bool failed = false;
+
+    struct LoopLabels {
+        Label* breaks;
+        Label* continues;
+    };
+    vector<LoopLabels> loops;
+
+    JitCompiler(X64Emitter& em, unordered_map<string, Any>& c, unordered_map<Func*, JitFunction*>& comp, unordered_map<string, Func*>& f)
+        : e(em), constants(c), compiled(comp), functions(f) {}
+
+    int temp(int depth)
+    {
+        if (depth >= tempCount) {
+            failed = true;
+            return temps[tempCount - 1];
+        }
+        return temps[depth];
+    }
+
+    void weigh(const string& name, long long weight) { weights[name] += weight; }
+    void weighExpr(Expr* expr, long long weight);
+    void weighStmt(Stmt* stmt, long long weight);
+    void allocate();
+
+    bool isAccumulatingTailCall(Return* ret);
+
+    Operand simple(Expr* expr);
+    void expr(Expr* expr, int depth);
+    void call(Call* call, int depth);
+    void jumpIf(Expr* condition, bool when, Label& target, int depth);
+    void stmt(Stmt* stmt);
+    void decl(Decl* decl);
+    void tailCall(Return* ret);
+    void whileLoop(While* whileLoop, bool invariants);
+
+    void prologue();
+    void epilogue();
+    void compile(Func* func);
+    void compileLoop(While* loop, vector<string>& names);
+};
+
+bool JitCompiler::isAccumulatingTailCall(Return* ret)
+{
+    if (!ret->tailCall) return false;
+
+    Expr* expr = ret->expr;
+    while (isBinary(expr)) {
+        OP op = asBinary(expr)->op;
+        if (op != OP::PLUS && op != OP::MINUS && op != OP::MULTIPLY) return false;
+        expr = asBinary(expr)->right;
+    }
+    return isCall(expr);
+}
+
+// Uses inside loops count ten times as much, so the loop variables get the registers
+void JitCompiler::weighExpr(Expr* expr, long long weight)
+{
+    switch(expr->kind) {
+        case (ET::IDENT):   weigh(asIdent(expr)->name, weight); break;
+        case (ET::BINARY): {
+            weighExpr(asBinary(expr)->left, weight);
+            weighExpr(asBinary(expr)->right, weight);
+        } break;
+        case (ET::UNARY):   weighExpr(asUnary(expr)->expr, weight); break;
+        case (ET::CALL):    for (auto arg : asCall(expr)->args) weighExpr(arg, weight); break;
+        case (ET::SHARED): {
+            Shared* shared = asShared(expr);
+            if (!sharedNames.contains(shared)) sharedNames[shared] = "$shared" + to_string(sharedNames.size());
+            weigh(sharedNames[shared], weight);
+            weighExpr(shared->expr, weight);
+        } break;
+        case (ET::SHARED_SCOPE): weighExpr(asSharedScope(expr)->expr, weight); break;
+        default: break;
+    }
+}
+
+void JitCompiler::weighStmt(Stmt* stmt, long long weight)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->isConstant()) return;
+            weigh(decl->name, weight);
+            if (decl->expr) weighExpr(decl->expr, weight);
+        } break;
+        case (ST::BLOCK):   for (auto s : asBlock(stmt)->stmts) weighStmt(s, weight); break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            weighExpr(i->condition, weight);
+            weighStmt(i->ifBody, weight);
+            weighStmt(i->elseBody, weight);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            int id = forIds.size();
+            forIds[forLoop] = id;
+
+            weighExpr(forLoop->start, weight);
+            weighExpr(forLoop->end, weight);
+            for (auto decl : forLoop->invariants) weighStmt(decl, weight);
+            weigh("$index" + to_string(id), weight * 10);
+            weigh("$end" + to_string(id), weight * 10);
+            weigh(forLoop->it, weight * 10);
+            weighStmt(forLoop->body, weight * 10);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) weighStmt(decl, weight);
+            for (auto decl : whileLoop->invariants) weighStmt(decl, weight);
+            weighExpr(whileLoop->condition, weight * 10);
+            weighStmt(whileLoop->body, weight * 10);
+        } break;
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            weigh(asIdent(assign->left)->name, weight);
+            weighExpr(assign->right, weight);
+        } break;
+        case (ST::RETURN): {
+            Return* ret = asReturn(stmt);
+            weighExpr(ret->expr, weight);
+            if (isAccumulatingTailCall(ret)) accumulates = true;
+        } break;
+        case (ST::EXPRSTMT): weighExpr(asExprStmt(stmt)->expr, weight); break;
+        default: break;
+    }
+}
+
+// The heaviest locals get the registers, the rest a slot below the saved registers
+void JitCompiler::allocate()
+{
+    for (auto& name : inputs) weigh(name, 1);
+    weighStmt(body, 1);
+
+    if (accumulates) {
+        weigh("$mul", 1);
+        weigh("$add", 1);
+    }
+
+    // Idents that aren't declared in here are constants
+    unordered_set<Func*> none;
+    JitChecker checker(constants, none);
+    for (auto& name : inputs) checker.locals.insert(name);
+    checker.collectLocals(body);
+
+    vector<pair<string, long long>> sorted;
+    for (auto& [name, weight] : weights) {
+        if (name[0] == '$' || checker.locals.contains(name)) sorted.push_back({ name, weight });
+    }
+    sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second > b.second || (a.second == b.second && a.first < b.first); });
+
+    int used = 0;
+    for (auto& [name, weight] : sorted) {
+        if (used < homeCount) locals[name] = Operand::inReg(homes[used++]);
+        else locals[name] = Operand::inMemory(-48 - 8 * spills++);
+    }
+}
+
+// Something an instruction can use directly, without evaluating into a temp first
+Operand JitCompiler::simple(Expr* expr)
+{
+    if (isConst(expr)) return Operand::constant(asConst(expr)->any.value.Int);
+
+    if (isIdent(expr)) {
+        const string& name = asIdent(expr)->name;
+        if (locals.contains(name)) return locals[name];
+        return Operand::constant(constants[name].value.Int);
+    }
+
+    if (isShared(expr) && sharedDone.contains(asShared(expr))) return locals[sharedNames[asShared(expr)]];
+
+    return Operand();
+}
+
+// Evaluates into temp(depth), the temps below it are in use
+void JitCompiler::expr(Expr* expr, int depth)
+{
+    int t = temp(depth);
+
+    Operand operand = simple(expr);
+    if (operand.kind != Operand::NONE) {
+        e.mov(t, operand);
+        return;
+    }
+
+    switch(expr->kind) {
+        case (ET::BINARY): {
+            Binary* binary = asBinary(expr);
+
+            // a + (b + (c + ...)) would take a temp per level, turned around it only takes one
+            bool commutes = binary->op == OP::PLUS || binary->op == OP::MULTIPLY;
+            Operand left = simple(binary->left);
+            if (commutes && left.kind != Operand::NONE && simple(binary->right).kind == Operand::NONE) {
+                this->expr(binary->right, depth);
+                if (binary->op == OP::PLUS) e.add(t, left);
+                else e.imul(t, left);
+                break;
+            }
+
+            this->expr(binary->left, depth);
+
+            Operand right = simple(binary->right);
+            if (right.kind == Operand::NONE) {
+                this->expr(binary->right, depth + 1);
+                right = Operand::inReg(temp(depth + 1));
+            }
+
+            switch(binary->op) {
+                case (OP::PLUS):        e.add(t, right); break;
+                case (OP::MINUS):       e.sub(t, right); break;
+                case (OP::MULTIPLY):    e.imul(t, right); break;
+                case (OP::DIVIDE): {
+                    if (right.kind == Operand::IMM) {
+                        e.movRI(temp(depth + 1), right.imm);
+                        right = Operand::inReg(temp(depth + 1));
+                    }
+                    e.movRR(RAX, t);
+                    e.cqo();
+                    e.idiv(right);
+                    e.movRR(t, RAX);
+                } break;
+                default: INTERNAL_ERROR("The JitChecker let a Binary through it can't do");
+            }
+        } break;
+
+        case (ET::UNARY): {
+            this->expr(asUnary(expr)->expr, depth);
+            e.neg(t);
+        } break;
+
+        case (ET::CALL): call(asCall(expr), depth); break;
+
+        case (ET::SHARED): {
+            Shared* shared = asShared(expr);
+            this->expr(shared->expr, depth);
+            e.store(locals[sharedNames[shared]], t);
+            sharedDone.insert(shared);
+        } break;
+
+        case (ET::SHARED_SCOPE): {
+            sharedDone.clear();
+            this->expr(asSharedScope(expr)->expr, depth);
+            sharedDone.clear();
+        } break;
+
+        default: INTERNAL_ERROR("The JitChecker let an Expr through it can't do");
+    }
+}
+
+// The temps in use get saved around the call, the args go through the stack into their registers
+void JitCompiler::call(Call* call, int depth)
+{
+    Func* callee = functions[asIdent(call->name)->name];
+    int args = call->args.size();
+
+    for (int i = 0; i < depth; i++) e.push(temp(i));
+    pushed += depth;
+
+    // Every temp is saved now, so the args can start over at the first one
+    for (int i = 0; i < args; i++) {
+        expr(call->args[i], 0);
+        e.push(temp(0));
+        pushed++;
+    }
+    for (int i = args - 1; i >= 0; i--) e.pop(argRegs[i]);
+    pushed -= args;
+
+    bool align = pushed % 2;
+    if (align) e.subRsp(8);
+    e.callThrough(&compiled[callee]->entry);
+    if (align) e.addRsp(8);
+
+    e.movRR(temp(depth), RAX);
+
+    for (int i = depth - 1; i >= 0; i--) e.pop(temp(i));
+    pushed -= depth;
+}
+
+void JitCompiler::jumpIf(Expr* condition, bool when, Label& target, int depth)
+{
+    if (isSharedScope(condition)) {
+        sharedDone.clear();
+        jumpIf(asSharedScope(condition)->expr, when, target, depth);
+        sharedDone.clear();
+        return;
+    }
+
+    if (isUnary(condition) && asUnary(condition)->op == OP::NOT) {
+        jumpIf(asUnary(condition)->expr, !when, target, depth);
+        return;
+    }
+
+    if (isBinary(condition)) {
+        Binary* binary = asBinary(condition);
+
+        CC cc;
+        bool compare = true;
+        switch(binary->op) {
+            case (OP::EQUAL):           cc = CC_E; break;
+            case (OP::NOT_EQUAL):       cc = CC_NE; break;
+            case (OP::LESS):            cc = CC_L; break;
+            case (OP::LESS_EQUAL):      cc = CC_LE; break;
+            case (OP::GREATER):         cc = CC_G; break;
+            case (OP::GREATER_EQUAL):   cc = CC_GE; break;
+            default: compare = false; break;
+        }
+
+        if (compare) {
+            int left;
+            int next = depth;
+            Operand operand = simple(binary->left);
+            if (operand.kind == Operand::REG) {
+                left = operand.reg;
+            } else {
+                expr(binary->left, depth);
+                left = temp(depth);
+                next = depth + 1;
+            }
+
+            Operand right = simple(binary->right);
+            if (right.kind == Operand::NONE) {
+                expr(binary->right, next);
+                right = Operand::inReg(temp(next));
+            }
+
+            e.cmp(left, right);
+            e.jcc(when ? cc : invert(cc), target);
+            return;
+        }
+    }
+
+    expr(condition, depth);
+    e.test(temp(depth));
+    e.jcc(when ? CC_NE : CC_E, target);
+}
+
+void JitCompiler::decl(Decl* decl)
+{
+    if (decl->isConstant()) return;
+
+    if (decl->expr) {
+        expr(decl->expr, 0);
+        e.store(locals[decl->name], temp(0));
+    } else {
+        e.movRI(temp(0), 0);
+        e.store(locals[decl->name], temp(0));
+    }
+}
+
+// Folds the chain around the call into mul and add, then rebinds the params and starts over
+void JitCompiler::tailCall(Return* ret)
+{
+    Expr* expr = ret->expr;
+    while (isBinary(expr)) {
+        Binary* binary = asBinary(expr);
+        this->expr(binary->left, 0);
+        int t = temp(0);
+
+        if (binary->op == OP::MULTIPLY) {
+            e.imul(t, locals["$mul"]);
+            e.store(locals["$mul"], t);
+        } else {
+            // add += mul * left, and for a minus the call gets subtracted, so mul = -mul
+            e.imul(t, locals["$mul"]);
+            e.mov(temp(1), locals["$add"]);
+            e.add(temp(1), Operand::inReg(t));
+            e.store(locals["$add"], temp(1));
+
+            if (binary->op == OP::MINUS) {
+                e.mov(t, locals["$mul"]);
+                e.neg(t);
+                e.store(locals["$mul"], t);
+            }
+        }
+        expr = binary->right;
+    }
+
+    Call* call = asCall(expr);
+    for (int i = 0; i < call->args.size(); i++) this->expr(call->args[i], i);
+    for (int i = 0; i < call->args.size(); i++) e.store(locals[func->params[i]->name], temp(i));
+
+    e.jmp(start);
+}
+
+void JitCompiler::stmt(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): decl(asDecl(stmt)); break;
+
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) {
+                this->stmt(s);
+                if (isReturn(s) || isBreak(s) || isContinue(s)) break;
+            }
+        } break;
+
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            Label otherwise, done;
+
+            jumpIf(i->condition, false, otherwise, 0);
+            this->stmt(i->ifBody);
+
+            if (i->elseBody) {
+                e.jmp(done);
+                e.bind(otherwise);
+                this->stmt(i->elseBody);
+                e.bind(done);
+            } else {
+                e.bind(otherwise);
+            }
+        } break;
+
+        // Rotated like in the VM, the hidden index counts so the body can change it freely
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            int id = forIds[forLoop];
+            Operand index = locals["$index" + to_string(id)];
+            Operand end = locals["$end" + to_string(id)];
+            Label body, next, done;
+
+            expr(forLoop->start, 0);
+            e.store(index, temp(0));
+            expr(forLoop->end, 0);
+            e.store(end, temp(0));
+
+            e.mov(temp(0), index);
+            e.cmp(temp(0), end);
+            e.jcc(CC_GE, done);
+
+            for (auto decl : forLoop->invariants) this->decl(decl);
+
+            e.bind(body);
+            e.mov(temp(0), index);
+            e.store(locals[forLoop->it], temp(0));
+
+            loops.push_back({ &done, &next });
+            this->stmt(forLoop->body);
+            loops.pop_back();
+
+            e.bind(next);
+            e.mov(temp(0), index);
+            e.add(temp(0), Operand::constant(1));
+            e.store(index, temp(0));
+            e.cmp(temp(0), end);
+            e.jcc(CC_L, body);
+            e.bind(done);
+        } break;
+
+        case (ST::WHILE): whileLoop(asWhile(stmt), true); break;
+
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            expr(assign->right, 0);
+            e.store(locals[asIdent(assign->left)->name], temp(0));
+        } break;
+
+        case (ST::RETURN): {
+            Return* ret = asReturn(stmt);
+            if (isAccumulatingTailCall(ret)) {
+                tailCall(ret);
+                break;
+            }
+
+            expr(ret->expr, 0);
+            if (accumulates) {
+                e.imul(temp(0), locals["$mul"]);
+                e.add(temp(0), locals["$add"]);
+            }
+            e.movRR(RAX, temp(0));
+            e.jmp(finish);
+        } break;
+
+        case (ST::EXPRSTMT): expr(asExprStmt(stmt)->expr, 0); break;
+
+        case (ST::CONTINUE): e.jmp(*loops.back().continues); break;
+        case (ST::BREAK):    e.jmp(*loops.back().breaks); break;
+
+        default: break;
+    }
+}
+
+// A loop that gets taken over from the Interpreter already has its invariants
+void JitCompiler::whileLoop(While* whileLoop, bool invariants)
+{
+    Label body, next, done;
+
+    if (invariants) for (auto decl : whileLoop->conditionInvariants) this->decl(decl);
+
+    jumpIf(whileLoop->condition, false, done, 0);
+    if (invariants) for (auto decl : whileLoop->invariants) this->decl(decl);
+
+    e.bind(body);
+    loops.push_back({ &done, &next });
+    stmt(whileLoop->body);
+    loops.pop_back();
+
+    e.bind(next);
+    jumpIf(whileLoop->condition, true, body, 0);
+    e.bind(done);
+}
+
+void JitCompiler::prologue()
+{
+    allocate();
+
+    // rbp and the five saved registers, then the spills, rsp has to stay 16 byte aligned for calls
+    int frame = spills * 8;
+    if (frame % 16 == 0) frame += 8;
+
+    e.push(RBP);
+    e.movRR(RBP, RSP);
+    for (int i = 0; i < homeCount; i++) e.push(homes[i]);
+    e.subRsp(frame);
+}
+
+void JitCompiler::epilogue()
+{
+    e.bind(finish);
+    e.rspFromRbp(-8 * homeCount);
+    for (int i = homeCount - 1; i >= 0; i--) e.pop(homes[i]);
+    e.pop(RBP);
+    e.ret();
+}
+
+void JitCompiler::compile(Func* f)
+{
+    func = f;
+    body = func->body;
+    for (auto param : func->params) inputs.push_back(param->name);
+
+    prologue();
+
+    for (int i = 0; i < inputs.size(); i++) e.store(locals[inputs[i]], argRegs[i]);
+
+    if (accumulates) {
+        e.movRI(temp(0), 1);
+        e.store(locals["$mul"], temp(0));
+        e.movRI(temp(0), 0);
+        e.store(locals["$add"], temp(0));
+    }
+
+    e.bind(start);
+    stmt(body);
+
+    epilogue();
+}
+
+// Gets a pointer to the values of names, starts with checking the condition and writes them all back at the end
+void JitCompiler::compileLoop(While* loop, vector<string>& names)
+{
+    body = loop;
+    inputs = names;
+    inputs.push_back("$vars");
+
+    prologue();
+
+    e.store(locals["$vars"], RDI);
+    for (int i = 0; i < names.size(); i++) {
+        e.load(temp(0), RDI, 8 * i);
+        e.store(locals[names[i]], temp(0));
+    }
+
+    whileLoop(loop, false);
+
+    e.mov(RAX, locals["$vars"]);
+    for (int i = 0; i < names.size(); i++) {
+        e.mov(temp(0), locals[names[i]]);
+        e.storeAt(RAX, 8 * i, temp(0));
+    }
+
+    epilogue();
+}
+
+#endif
+
+Jit::Jit(unordered_map<string, Func*>& f, unordered_map<string, Any>& c) : functions(f), constants(c) {}
+
+Jit::~Jit()
+{
+#ifdef JIT_X64
+    for (auto& [code, size] : memory) munmap(code, size);
+#endif
+    for (auto& [func, fn] : compiled) delete fn;
+    for (auto& [loop, jitLoop] : loops) delete jitLoop;
+}
+
+bool Jit::available()
+{
+#ifdef JIT_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+// A function that calls one we can't compile can't be compiled either.
+// Neither can one that needs more temps than we have, that only shows when compiling it, so everything gets compiled once for nothing.
+void Jit::findEligible()
+{
+    if (checked) return;
+    checked = true;
+
+#ifdef JIT_X64
+    for (auto& [name, func] : functions) if (func->body) eligible.insert(func);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        JitChecker checker(constants, eligible);
+        for (auto func : vector<Func*>(eligible.begin(), eligible.end())) {
+            if (!checker.check(func)) {
+                eligible.erase(func);
+                changed = true;
+            }
+        }
+        if (changed) continue;
+
+        unordered_map<Func*, JitFunction*> scratch;
+        vector<JitFunction> entries(eligible.size());
+        int i = 0;
+        for (auto func : eligible) scratch[func] = &entries[i++];
+
+        for (auto func : eligible) {
+            X64Emitter e;
+            JitCompiler compiler(e, constants, scratch, functions);
+            compiler.compile(func);
+
+            if (compiler.failed) {
+                eligible.erase(func);
+                changed = true;
+                break;
+            }
+        }
+    }
+#endif
+}
+
+void* Jit::place(vector<unsigned char>& code)
+{
+#ifdef JIT_X64
+    if (code.empty()) return nullptr;
+
+    void* mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return nullptr;
+
+    memcpy(mem, code.data(), code.size());
+    mprotect(mem, code.size(), PROT_READ | PROT_EXEC);
+    memory.push_back({ mem, code.size() });
+    return mem;
+#else
+    return nullptr;
+#endif
+}
+
+// Everything in the batch goes into one piece of memory, calls go through the entries so the order doesn't matter
+void Jit::compileBatch(vector<Func*>& batch)
+{
+#ifdef JIT_X64
+    for (auto func : batch) {
+        JitFunction* fn = new JitFunction();
+        fn->func = func;
+        fn->params = func->params.size();
+        compiled[func] = fn;
+    }
+
+    X64Emitter e;
+    vector<int> offsets;
+    for (auto func : batch) {
+        offsets.push_back(e.code.size());
+        JitCompiler compiler(e, constants, compiled, functions);
+        compiler.compile(func);
+    }
+
+    char* code = (char*) place(e.code);
+    if (!code) return;
+
+    for (int i = 0; i < batch.size(); i++) compiled[batch[i]]->entry = code + offsets[i];
+#endif
+}
+
+void Jit::compileAll()
+{
+    findEligible();
+
+    vector<Func*> batch;
+    for (auto func : eligible) if (!compiled.contains(func)) batch.push_back(func);
+    compileBatch(batch);
+}
+
+bool Jit::compile(Func* func)
+{
+    findEligible();
+    if (!eligible.contains(func)) return false;
+    if (compiled.contains(func)) return true;
+
+    // The functions it calls have to be there before it can run
+    vector<Func*> batch = { func };
+    unordered_set<Func*> seen = { func };
+    JitChecker checker(constants, eligible);
+    for (int i = 0; i < batch.size(); i++) {
+        checker.check(batch[i]);
+        for (auto callee : checker.callees) {
+            if (compiled.contains(callee) || seen.contains(callee)) continue;
+            seen.insert(callee);
+            batch.push_back(callee);
+        }
+    }
+
+    compileBatch(batch);
+    return true;
+}
+
+bool Jit::runLoop(While* loop, Interpreter& interp)
+{
+#ifdef JIT_X64
+    JitLoop* jitLoop = loops[loop];
+
+    if (!jitLoop) {
+        jitLoop = new JitLoop();
+        jitLoop->loop = loop;
+        loops[loop] = jitLoop;
+
+        findEligible();
+        JitChecker checker(constants, eligible);
+        if (!checker.checkLoop(loop, interp.variables)) return false;
+
+        jitLoop->declared = checker.locals;
+        for (auto& name : checker.used) {
+            if (checker.locals.contains(name) || interp.variables.contains(name)) jitLoop->names.push_back(name);
+            else jitLoop->others.push_back(name);
+        }
+        for (auto& name : checker.locals) {
+            if (!checker.used.contains(name)) jitLoop->names.push_back(name);
+        }
+        sort(jitLoop->names.begin(), jitLoop->names.end());
+
+        for (auto callee : checker.callees) compile(callee);
+
+        X64Emitter e;
+        JitCompiler compiler(e, constants, compiled, functions);
+        compiler.compileLoop(loop, jitLoop->names);
+        if (compiler.failed) return false;
+
+        jitLoop->entry = place(e.code);
+    }
+
+    if (!jitLoop->entry) return false;
+
+    // Only when every name still means what it meant when the loop got compiled
+    for (auto& name : jitLoop->others) if (interp.variables.contains(name)) return false;
+
+    vector<long long> values(jitLoop->names.size());
+    for (int i = 0; i < jitLoop->names.size(); i++) {
+        auto it = interp.variables.find(jitLoop->names[i]);
+
+        if (it != interp.variables.end()) {
+            if (it->second.type.base != Type::INT || (it->second.type.flags & (Flags::POINTER | Flags::ARRAY))) return false;
+            values[i] = it->second.value.Int;
+        } else if (jitLoop->declared.contains(jitLoop->names[i])) {
+            values[i] = 0;
+        } else {
+            return false;
+        }
+    }
+
+    ((long long (*)(long long*)) jitLoop->entry)(values.data());
+
+    for (int i = 0; i < jitLoop->names.size(); i++) {
+        Any& any = interp.variables[jitLoop->names[i]];
+        any.type.base = Type::INT;
+        any.value.Int = values[i];
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Jit::call(Func* func, Interpreter& interp, Any& result)
+{
+    auto it = compiled.find(func);
+    if (it == compiled.end() || !it->second->entry) return false;
+
+    JitFunction* fn = it->second;
+
+    long long args[6];
+    for (int i = 0; i < fn->params; i++) {
+        Any& arg = interp.variables[func->params[i]->name];
+        if (arg.type.base != Type::INT) return false;
+        args[i] = arg.value.Int;
+    }
+
+    typedef long long I;
+    I value;
+    switch (fn->params) {
+        case (0): value = ((I (*)()) fn->entry)(); break;
+        case (1): value = ((I (*)(I)) fn->entry)(args[0]); break;
+        case (2): value = ((I (*)(I, I)) fn->entry)(args[0], args[1]); break;
+        case (3): value = ((I (*)(I, I, I)) fn->entry)(args[0], args[1], args[2]); break;
+        case (4): value = ((I (*)(I, I, I, I)) fn->entry)(args[0], args[1], args[2], args[3]); break;
+        case (5): value = ((I (*)(I, I, I, I, I)) fn->entry)(args[0], args[1], args[2], args[3], args[4]); break;
+        default:  value = ((I (*)(I, I, I, I, I, I)) fn->entry)(args[0], args[1], args[2], args[3], args[4], args[5]); break;
+    }
+
+    result = Any();
+    result.type.base = Type::INT;
+    result.value.Int = value;
+    return true;
+}
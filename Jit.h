@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Any.h"
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+struct Interpreter;
+
+struct JitFunction {
+    Func* func;
+    void* entry = nullptr;      // set once the code is in executable memory
+    int params = 0;
+};
+
+// A while loop the Interpreter was already running, compiled to take over on the next iteration.
+// The code gets the values of the variables in an array, in the order of names, and writes them back when it's done.
+struct JitLoop {
+    While* loop;
+    void* entry = nullptr;      // stays null if the loop can't be compiled
+    vector<string> names;
+    unordered_set<string> declared;     // names the loop declares itself, they don't have to exist yet
+    vector<string> others;              // names that were constants when it got compiled
+};
+
+// Compiles the functions that only ever see ints to x86-64 machine code, like
+// factorial :: (x: int) -> int. Locals live in the callee saved registers as long as there are enough.
+// Only on Linux x86-64, everywhere else nothing gets compiled and everything runs in the Interpreter.
+//
+// Either everything gets compiled up front with compileAll, or the Interpreter counts calls and
+// loop iterations and asks for a function once it got called threshold times and
+// for a while loop once it ran threshold iterations (on-stack replacement).
+struct Jit {
+    unordered_map<string, Func*>& functions;
+    unordered_map<string, Any>& constants;
+
+    long long threshold = 0;
+
+    unordered_map<Func*, JitFunction*> compiled;
+    unordered_map<While*, JitLoop*> loops;
+    vector<pair<void*, size_t>> memory;
+
+    // The functions that can be compiled, figured out the first time something is hot
+    unordered_set<Func*> eligible;
+    bool checked = false;
+
+    Jit(unordered_map<string, Func*>& f, unordered_map<string, Any>& c);
+    ~Jit();
+
+    static bool available();
+
+    // Compiles every function it can, the ones it can't stay with the Interpreter
+    void compileAll();
+
+    // Compiles func and the functions it calls, false if it has to stay with the Interpreter
+    bool compile(Func* func);
+
+    // Runs func natively if it got compiled and the Interpreter put ints into its params
+    bool call(Func* func, Interpreter& interp, Any& result);
+
+    // Runs the rest of a while loop natively, false if the Interpreter has to keep going
+    bool runLoop(While* loop, Interpreter& interp);
+
+    void findEligible();
+    void compileBatch(vector<Func*>& batch);
+    void* place(vector<unsigned char>& code);
+};
@@ -0,0 +1,396 @@
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "LoopOptimizer.h"
+#include "Stmt.h"
+#include "Expr.h"
+#include "error.h"
+
+using namespace std;
+
+LoopOptimizer::LoopOptimizer(unordered_map<string, Func*>& f) : functions(f) {}
+
+void LoopOptimizer::optimize(vector<Stmt*>& stmts)
+{
+    for (auto stmt : stmts) optimizeStmt(stmt);
+}
+
+void LoopOptimizer::optimizeStmt(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->expr) decl->expr = fold(decl->expr);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) optimizeStmt(s);
+        } break;
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (func->body) optimizeStmt(func->body);
+        } break;
+        case (ST::RETURN): {
+            Return* r = asReturn(stmt);
+            r->expr = fold(r->expr);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            i->condition = fold(i->condition);
+            optimizeStmt(i->ifBody);
+            optimizeStmt(i->elseBody);
+        } break;
+        case (ST::EXPRSTMT): {
+            ExprStmt* exprStmt = asExprStmt(stmt);
+            exprStmt->expr = fold(exprStmt->expr);
+        } break;
+        case (ST::DEFER): {
+            optimizeStmt(asDefer(stmt)->block);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            forLoop->start = fold(forLoop->start);
+            if (forLoop->end) forLoop->end = fold(forLoop->end);
+
+            // Inner loops first, so the outer loop can hoist their invariants even further
+            optimizeStmt(forLoop->body);
+
+            written.clear();
+            hasCalls = false;
+            written.insert(forLoop->it);
+            collectWrites(forLoop->body);
+
+            optimizeLoop(forLoop->body, forLoop->invariants);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            whileLoop->condition = fold(whileLoop->condition);
+
+            optimizeStmt(whileLoop->body);
+
+            written.clear();
+            hasCalls = false;
+            collectWrites(whileLoop->condition);
+            collectWrites(whileLoop->body);
+
+            whileLoop->condition = hoist(whileLoop->condition, whileLoop->conditionInvariants);
+            optimizeLoop(whileLoop->body, whileLoop->invariants);
+        } break;
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            assign->right = fold(assign->right);
+        } break;
+        case (ST::SET): {
+            Set* set = asSet(stmt);
+            set->access = fold(set->access);
+            set->value  = fold(set->value);
+        } break;
+        default: break;
+    }
+}
+
+void LoopOptimizer::optimizeLoop(Stmt* body, vector<Decl*>& invariants)
+{
+    hoistStmt(body, invariants);
+}
+
+void LoopOptimizer::collectWrites(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            written.insert(decl->name);
+            if (decl->expr) collectWrites(decl->expr);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectWrites(s);
+        } break;
+        case (ST::RETURN): collectWrites(asReturn(stmt)->expr); break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectWrites(i->condition);
+            collectWrites(i->ifBody);
+            collectWrites(i->elseBody);
+        } break;
+        case (ST::EXPRSTMT): collectWrites(asExprStmt(stmt)->expr); break;
+        case (ST::DEFER): collectWrites(asDefer(stmt)->block); break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            written.insert(forLoop->it);
+            for (auto decl : forLoop->invariants) collectWrites(decl);
+            collectWrites(forLoop->start);
+            if (forLoop->end) collectWrites(forLoop->end);
+            collectWrites(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) collectWrites(decl);
+            for (auto decl : whileLoop->invariants) collectWrites(decl);
+            collectWrites(whileLoop->condition);
+            collectWrites(whileLoop->body);
+        } break;
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            written.insert(asIdent(assign->left)->name);
+            collectWrites(assign->right);
+        } break;
+        case (ST::SET): {
+            Set* set = asSet(stmt);
+            collectWrites(set->expr);
+            collectWrites(set->access);
+            collectWrites(set->value);
+        } break;
+        default: break;
+    }
+}
+
+void LoopOptimizer::collectWrites(Expr* expr)
+{
+    switch(expr->kind) {
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            collectWrites(binary->left);
+            collectWrites(binary->right);
+        } break;
+        case(ET::UNARY):    collectWrites(asUnary(expr)->expr); break;
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            collectWrites(get->expr);
+            collectWrites(get->access);
+        } break;
+        case(ET::MEMBER):   collectWrites(asMember(expr)->expr); break;
+        case(ET::CALL): {
+            Call* call = asCall(expr);
+            for (auto arg : call->args) collectWrites(arg);
+
+            // Functions see all the variables of their callers, so anything with a body
+            // could write anything. Builtins like printf only write their parameters.
+            Func* defn = nullptr;
+            if (isIdent(call->name) && functions.contains(asIdent(call->name)->name)) defn = functions[asIdent(call->name)->name];
+
+            if (!defn || defn->body) hasCalls = true;
+            else for (auto param : defn->params) written.insert(param->name);
+        } break;
+        default: break;
+    }
+}
+
+// Integer division by zero would crash us, so we only move divisions we know are fine.
+bool LoopOptimizer::canTrap(Binary* binary)
+{
+    if (binary->op != OP::DIVIDE) return false;
+    if (!isConst(binary->right)) return true;
+
+    Any& right = asConst(binary->right)->any;
+    return isIntegerType(right.type.base) && right.value.Int == 0;
+}
+
+bool LoopOptimizer::isInvariant(Expr* expr)
+{
+    switch(expr->kind) {
+        case(ET::CONST):    return true;
+        case(ET::IDENT):    return !hasCalls && !written.contains(asIdent(expr)->name);
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            return !canTrap(binary) && isInvariant(binary->left) && isInvariant(binary->right);
+        }
+        case(ET::UNARY):    return isInvariant(asUnary(expr)->expr);
+
+        // Arrays and structs can be changed through Set, and calls can do anything
+        default:            return false;
+    }
+}
+
+Expr* LoopOptimizer::fold(Expr* expr)
+{
+    switch(expr->kind) {
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            binary->left  = fold(binary->left);
+            binary->right = fold(binary->right);
+
+            if (!isConst(binary->left) || !isConst(binary->right) || canTrap(binary)) return expr;
+
+            Any& left  = asConst(binary->left)->any;
+            Any& right = asConst(binary->right)->any;
+
+            bool numeric = (isIntegerType(left.type.base) && isIntegerType(right.type.base)) ||
+                           (left.type.base == Type::FLOAT && right.type.base == Type::FLOAT);
+            bool logic   = left.type.base == Type::BOOL && right.type.base == Type::BOOL;
+
+            Any result;
+            switch(binary->op) {
+                case(OP::PLUS):             if (!numeric) return expr; result = left.add(right);          break;
+                case(OP::MINUS):            if (!numeric) return expr; result = left.sub(right);          break;
+                case(OP::MULTIPLY):         if (!numeric) return expr; result = left.mul(right);          break;
+                case(OP::DIVIDE):           if (!numeric) return expr; result = left.div(right);          break;
+                case(OP::GREATER):          if (!numeric) return expr; result = left.greater(right);      break;
+                case(OP::GREATER_EQUAL):    if (!numeric) return expr; result = left.greaterEqual(right); break;
+                case(OP::LESS):             if (!numeric) return expr; result = left.less(right);         break;
+                case(OP::LESS_EQUAL):       if (!numeric) return expr; result = left.lessEqual(right);    break;
+                case(OP::AND):              if (!logic)   return expr; result = left.And(right);          break;
+                case(OP::OR):               if (!logic)   return expr; result = left.Or(right);           break;
+                default: return expr;
+            }
+
+            Const* c = new Const();
+            c->any = result;
+            c->any.type.flags |= Flags::CONSTANT;
+            c->type = result.type.base;
+            return c;
+        }
+        case(ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            unary->expr = fold(unary->expr);
+
+            if (!isConst(unary->expr)) return expr;
+            Any& operand = asConst(unary->expr)->any;
+
+            Any result;
+            if (unary->op == OP::NEGATE && (isIntegerType(operand.type.base) || operand.type.base == Type::FLOAT)) result = operand.neg();
+            else if (unary->op == OP::NOT && operand.type.base == Type::BOOL) result = operand.Not();
+            else return expr;
+
+            Const* c = new Const();
+            c->any = result;
+            c->any.type.flags |= Flags::CONSTANT;
+            c->type = result.type.base;
+            return c;
+        }
+        case(ET::CALL): {
+            Call* call = asCall(expr);
+            for (auto& arg : call->args) arg = fold(arg);
+            return expr;
+        }
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            get->expr   = fold(get->expr);
+            get->access = fold(get->access);
+            return expr;
+        }
+        case(ET::MEMBER): {
+            Member* member = asMember(expr);
+            member->expr = fold(member->expr);
+            return expr;
+        }
+        default: return expr;
+    }
+}
+
+// Replaces the biggest invariant sub-expressions with hidden variables.
+// Constants and plain identifiers are already as cheap as it gets, so those stay where they are.
+Expr* LoopOptimizer::hoist(Expr* expr, vector<Decl*>& invariants)
+{
+    bool worthIt = isBinary(expr) || isUnary(expr);
+    if (worthIt && isInvariant(expr)) {
+        string name = "$inv" + to_string(tempCount++);
+        invariants.push_back(new Decl(name, ImprovedType(Type::UNKNOWN), expr));
+        return new Ident(name);
+    }
+
+    switch(expr->kind) {
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            binary->left  = hoist(binary->left, invariants);
+            binary->right = hoist(binary->right, invariants);
+        } break;
+        case(ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            unary->expr = hoist(unary->expr, invariants);
+        } break;
+        case(ET::CALL): {
+            Call* call = asCall(expr);
+            for (auto& arg : call->args) arg = hoist(arg, invariants);
+        } break;
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            get->expr   = hoist(get->expr, invariants);
+            get->access = hoist(get->access, invariants);
+        } break;
+        case(ET::MEMBER): {
+            Member* member = asMember(expr);
+            member->expr = hoist(member->expr, invariants);
+        } break;
+        default: break;
+    }
+    return expr;
+}
+
+void LoopOptimizer::hoistStmt(Stmt* stmt, vector<Decl*>& invariants)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->expr && !decl->isConstant()) decl->expr = hoist(decl->expr, invariants);
+        } break;
+        case (ST::BLOCK): {
+            // After a break, continue or return the rest of the block doesn't always run
+            for (auto s : asBlock(stmt)->stmts) {
+                hoistStmt(s, invariants);
+                if (canJump(s)) break;
+            }
+        } break;
+        case (ST::RETURN): {
+            Return* r = asReturn(stmt);
+            r->expr = hoist(r->expr, invariants);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            i->condition = hoist(i->condition, invariants);
+        } break;
+        case (ST::EXPRSTMT): {
+            ExprStmt* exprStmt = asExprStmt(stmt);
+            exprStmt->expr = hoist(exprStmt->expr, invariants);
+        } break;
+        case (ST::DEFER): hoistStmt(asDefer(stmt)->block, invariants); break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            forLoop->start = hoist(forLoop->start, invariants);
+            if (forLoop->end) forLoop->end = hoist(forLoop->end, invariants);
+        } break;
+        case (ST::WHILE): {
+            // The body and its invariants might not run at all, the condition always does
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) decl->expr = hoist(decl->expr, invariants);
+            whileLoop->condition = hoist(whileLoop->condition, invariants);
+        } break;
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            assign->right = hoist(assign->right, invariants);
+        } break;
+        case (ST::SET): {
+            Set* set = asSet(stmt);
+            set->expr   = hoist(set->expr, invariants);
+            set->access = hoist(set->access, invariants);
+            set->value  = hoist(set->value, invariants);
+        } break;
+        default: break;
+    }
+}
+
+// Could leave the block before its end, a loop counts too because of a return in it
+bool LoopOptimizer::canJump(Stmt* stmt)
+{
+    if (!stmt) return false;
+
+    switch(stmt->kind) {
+        case (ST::RETURN):
+        case (ST::BREAK):
+        case (ST::CONTINUE): return true;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) if (canJump(s)) return true;
+            return false;
+        }
+        case (ST::IF):      return canJump(asIf(stmt)->ifBody) || canJump(asIf(stmt)->elseBody);
+        case (ST::FOR):     return canJump(asFor(stmt)->body);
+        case (ST::WHILE):   return canJump(asWhile(stmt)->body);
+        default:            return false;
+    }
+}
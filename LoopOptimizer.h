@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Folds constant arithmetic and hoists loop invariant expressions out of For and While loops.
+// Hoisted expressions get stored in hidden variables ($inv0, $inv1, ...) that
+// the Interpreter sets up before the first iteration of the loop.
+struct LoopOptimizer {
+    unordered_map<string, Func*>& functions;
+    int tempCount = 0;
+
+    // What the loop we're currently looking at writes to
+    unordered_set<string> written;
+    bool hasCalls = false;
+
+    LoopOptimizer(unordered_map<string, Func*>& f);
+
+    void optimize(vector<Stmt*>& stmts);
+
+    void optimizeStmt(Stmt* stmt);
+    void optimizeLoop(Stmt* body, vector<Decl*>& invariants);
+
+    void collectWrites(Stmt* stmt);
+    void collectWrites(Expr* expr);
+
+    bool isInvariant(Expr* expr);
+    bool canTrap(Binary* binary);
+
+    Expr* fold(Expr* expr);
+    Expr* hoist(Expr* expr, vector<Decl*>& invariants);
+    // Only what runs every time the body does gets hoisted, the invariants run before the loop
+    // and "b + 1" with a bool b fails there even if it sits in an if that's never true
+    void hoistStmt(Stmt* stmt, vector<Decl*>& invariants);
+    bool canJump(Stmt* stmt);
+};
@@ -0,0 +1,203 @@
+#include <algorithm>
+
+#include "Memory.h"
+
+using std::vector, std::string, std::endl;
+
+bool Memory::tracking = false;
+MemoryCount Memory::kinds[(int) MemoryKind::COUNT];
+vector<Memory::Site> Memory::sites = { { MemoryKind::COUNT, nullptr, "", {} } };
+const string* Memory::function = nullptr;
+long long Memory::anys = 0;
+long long Memory::copies = 0;
+long long Memory::moves = 0;
+long long Memory::reused = 0;
+
+const char* MemoryKindToString(MemoryKind kind)
+{
+    switch (kind) {
+        case(MemoryKind::STRINGS):  return "strings";
+        case(MemoryKind::STRUCTS):  return "structs";
+        case(MemoryKind::ARRAYS):   return "arrays";
+        case(MemoryKind::AST):      return "ast";
+        case(MemoryKind::MAPS):     return "maps";
+        default:                    return "unknown";
+    }
+}
+
+void MemoryCount::add(long long count, size_t size)
+{
+    objects += count;
+    live += count;
+    peak = std::max(peak, live);
+    bytes += size;
+    liveBytes += size;
+    peakBytes = std::max(peakBytes, liveBytes);
+}
+
+void MemoryCount::remove(long long count, size_t size)
+{
+    live -= count;
+    liveBytes -= size;
+}
+
+// A function's name pointer stays the same for the whole run, so that's compared first,
+// the text only when it's one we haven't seen yet
+unsigned short Memory::site(MemoryKind kind)
+{
+    if (!tracking) return 0;
+
+    static unsigned short last = 0;
+    if (sites[last].key == function && sites[last].kind == kind) return last;
+
+    for (size_t i = 1; i < sites.size(); i++) {
+        if (sites[i].key == function && sites[i].kind == kind) return last = i;
+    }
+    string name = function ? *function : "(top level)";
+    for (size_t i = 1; i < sites.size(); i++) {
+        if (sites[i].kind == kind && sites[i].function == name) {
+            sites[i].key = function;
+            return last = i;
+        }
+    }
+    if (sites.size() == 0xffff) return 0;
+
+    sites.push_back({ kind, function, name, {} });
+    return last = sites.size() - 1;
+}
+
+void Memory::allocated(unsigned short site, size_t bytes)
+{
+    if (!site) return;
+    sites[site].count.add(1, bytes);
+    kinds[(int) sites[site].kind].add(1, bytes);
+}
+
+void Memory::freed(unsigned short site, size_t bytes)
+{
+    if (!site) return;
+    sites[site].count.remove(1, bytes);
+    kinds[(int) sites[site].kind].remove(1, bytes);
+}
+
+void Memory::resized(unsigned short site, size_t before, size_t after)
+{
+    if (!site || before == after) return;
+
+    MemoryCount& count = sites[site].count;
+    MemoryCount& total = kinds[(int) sites[site].kind];
+    if (after > before) {
+        count.add(0, after - before);
+        total.add(0, after - before);
+    } else {
+        count.remove(0, before - after);
+        total.remove(0, before - after);
+    }
+}
+
+void Memory::measured(MemoryKind kind, const char* name, long long objects, size_t bytes)
+{
+    if (!tracking) return;
+
+    auto found = std::find_if(sites.begin() + 1, sites.end(), [&](const Site& site) {
+        return site.kind == kind && site.function == name;
+    });
+    if (found == sites.end()) {
+        sites.push_back({ kind, nullptr, name, {} });
+        found = sites.end() - 1;
+    }
+    // Nothing saw it in between, so there's no peak or total to keep
+    MemoryCount& count = found->count;
+    MemoryCount& total = kinds[(int) kind];
+    total.live += objects - count.live;
+    total.liveBytes += bytes - count.liveBytes;
+    count.live = objects;
+    count.liveBytes = bytes;
+}
+
+static void printCount(std::ostream& out, MemoryKind kind, const MemoryCount& count)
+{
+    out << count.live << " live (" << count.liveBytes / 1024 << " kb)";
+    if (Memory::onlyMeasured(kind)) {
+        out << endl;
+        return;
+    }
+    out << ", peak " << count.peak << " (" << count.peakBytes / 1024 << " kb), ";
+    out << count.objects << " made (" << count.bytes / 1024 << " kb)" << endl;
+}
+
+// The biggest first
+static vector<const Memory::Site*> sitesOf(MemoryKind kind)
+{
+    vector<const Memory::Site*> result;
+    for (size_t i = 1; i < Memory::sites.size(); i++) {
+        if (Memory::sites[i].kind == kind) result.push_back(&Memory::sites[i]);
+    }
+    bool live = Memory::onlyMeasured(kind);
+    std::stable_sort(result.begin(), result.end(), [live](const Memory::Site* a, const Memory::Site* b) {
+        if (live) return a->count.liveBytes > b->count.liveBytes;
+        return a->count.peakBytes > b->count.peakBytes;
+    });
+    return result;
+}
+
+void Memory::print(std::ostream& out)
+{
+    out << "Memory:" << endl;
+    out << "anys: " << anys << " made, " << copies << " copied, " << moves << " moved" << endl;
+    for (int i = 0; i < (int) MemoryKind::COUNT; i++) {
+        MemoryKind kind = (MemoryKind) i;
+        out << MemoryKindToString(kind) << ": ";
+        printCount(out, kind, kinds[i]);
+
+        for (auto site : sitesOf(kind)) {
+            out << "    " << site->function << ": ";
+            printCount(out, kind, site->count);
+        }
+        if (kind == MemoryKind::STRINGS) out << "    " << reused << " of them reused from the spares" << endl;
+    }
+}
+
+static void printJsonString(std::ostream& out, const string& text)
+{
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if ((unsigned char) c < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+static void printJsonCount(std::ostream& out, MemoryKind kind, const MemoryCount& count)
+{
+    out << "\"live\": " << count.live << ", \"liveBytes\": " << count.liveBytes;
+    if (Memory::onlyMeasured(kind)) return;
+    out << ", \"peak\": " << count.peak << ", \"peakBytes\": " << count.peakBytes;
+    out << ", \"objects\": " << count.objects << ", \"bytes\": " << count.bytes;
+}
+
+void Memory::printJson(std::ostream& out)
+{
+    out << "{" << endl;
+    out << "  \"anys\": { \"made\": " << anys << ", \"copied\": " << copies << ", \"moved\": " << moves << " }," << endl;
+    out << "  \"reusedStrings\": " << reused << "," << endl;
+    for (int i = 0; i < (int) MemoryKind::COUNT; i++) {
+        MemoryKind kind = (MemoryKind) i;
+        out << "  \"" << MemoryKindToString(kind) << "\": { ";
+        printJsonCount(out, kind, kinds[i]);
+        out << ", \"sites\": [";
+
+        bool first = true;
+        for (auto site : sitesOf(kind)) {
+            out << (first ? "" : ",") << endl << "    { \"function\": ";
+            printJsonString(out, site->function);
+            out << ", ";
+            printJsonCount(out, kind, site->count);
+            out << " }";
+            first = false;
+        }
+        out << (first ? "" : "\n  ") << "] }" << (i + 1 < (int) MemoryKind::COUNT ? "," : "") << endl;
+    }
+    out << "}" << endl;
+}
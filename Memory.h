@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+
+// What the program holds on to, -memory prints it when it's done (-memory=json for a JSON object).
+enum class MemoryKind : unsigned char {
+    STRINGS,    // runtime strings, interned ones included
+    STRUCTS,
+    ARRAYS,
+    AST,        // Expr and Stmt nodes, they live as long as the program
+    MAPS,       // the Interpreter's tables, only measured when the report is made so only live is known
+    COUNT
+};
+
+const char* MemoryKindToString(MemoryKind kind);
+
+// live goes down again when something is freed, peak is the most live ever was
+struct MemoryCount {
+    long long objects = 0;      // made in total
+    long long live = 0;
+    long long peak = 0;
+    size_t bytes = 0;           // allocated in total
+    size_t liveBytes = 0;
+    size_t peakBytes = 0;
+
+    void add(long long count, size_t size);
+    void remove(long long count, size_t size);
+};
+
+// Every allocation is counted under its kind and under the Jai function that was running (a site).
+// The objects remember their site, so freeing them takes them off the same one.
+// Site 0 is for everything made while tracking is off, which only -memory turns on.
+struct Memory {
+    struct Site {
+        MemoryKind kind;
+        const std::string* key;     // the name the engine handed in, so we don't compare the text every time
+        std::string function;
+        MemoryCount count;
+    };
+
+    static bool tracking;
+    static MemoryCount kinds[(int) MemoryKind::COUNT];
+    static std::vector<Site> sites;
+    // The engines point this at the name of the function they're running, nullptr outside of them
+    static const std::string* function;
+
+    // Counted all the time, they're too cheap to have sites
+    static long long anys;      // made from scratch
+    static long long copies;    // copy constructions and assignments
+    static long long moves;     // move constructions and assignments, those just take the value
+    static long long reused;    // strings handed out again from the spares instead of allocated
+
+    static unsigned short site(MemoryKind kind);
+    static void allocated(unsigned short site, size_t bytes);
+    static void freed(unsigned short site, size_t bytes);
+    // When something that's already counted grows or shrinks
+    static void resized(unsigned short site, size_t before, size_t after);
+    // For what's only looked at when reporting, it replaces what the site had live before
+    static void measured(MemoryKind kind, const char* name, long long objects, size_t bytes);
+    static bool onlyMeasured(MemoryKind kind) { return kind == MemoryKind::MAPS; }
+
+    static void print(std::ostream& out);
+    static void printJson(std::ostream& out);
+};
+
+// Roughly what an unordered_map takes itself: the buckets and a node per entry, not what the entries point at
+template<typename Map>
+size_t mapBytes(const Map& map)
+{
+    return map.bucket_count() * sizeof(void*) + map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+}
@@ -256,7 +256,8 @@ Expr *Parser::unary()
     {
         Token op = prevTk;
         Expr *right = unary();
-        return new Unary(toOperand(op), right);
+        // toOperand gives a MINUS, that's the Binary one
+        return new Unary(op.type == MINUS ? OP::NEGATE : toOperand(op), right);
     }
 
     return call();
@@ -0,0 +1,828 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <unordered_map>
+
+#include "RegisterCode.h"
+#include "error.h"
+
+using namespace std;
+
+std::string ROPtoString(ROP op)
+{
+    switch (op)
+    {
+#define ROP_STRING(name) case (ROP::name): return #name;
+        REGISTER_OPCODES(ROP_STRING)
+#undef ROP_STRING
+    }
+
+    return "UNKNOWN";
+}
+
+RegisterFunction::RegisterFunction(Func* f) : name(f->name), func(f) {}
+
+static void printOperand(ostream& out, const RegisterFunction* fn, int operand)
+{
+    if (operand >= 0) {
+        out << " r" << operand;
+        return;
+    }
+
+    const Any& any = fn->constants[-1 - operand];
+    if (any.type.base == Type::STRING) out << " \"" << any.value.String->text << "\"";
+    else if (any.type.base == Type::UNKNOWN) out << " <nothing>";
+    else out << " " << any.toString();
+}
+
+ostream& operator<<(ostream& out, const RegisterFunction* fn)
+{
+    out << "func " << fn->name << " (" << fn->params << " params, " << fn->locals << " slots, " << fn->frameSize << " registers)" << endl;
+
+    for (int i = 0; i < fn->code.size(); i++) {
+        const RInstruction& inst = fn->code[i];
+        out << "    " << i << ": " << ROPtoString(inst.op);
+
+        switch (inst.op) {
+            case (ROP::LOAD_NAME):  out << " r" << inst.a << " " << fn->names[inst.b]; break;
+            case (ROP::STORE_NAME): out << " " << fn->names[inst.a]; printOperand(out, fn, inst.b); break;
+            case (ROP::JUMP):       out << " " << inst.a; break;
+            case (ROP::JUMP_IF_FALSE):
+            case (ROP::JUMP_IF_TRUE): out << " " << inst.a; printOperand(out, fn, inst.b); break;
+            case (ROP::JUMP_IF_EQ):
+            case (ROP::JUMP_IF_NE):
+            case (ROP::JUMP_IF_LT):
+            case (ROP::JUMP_IF_LE):
+            case (ROP::JUMP_IF_GT):
+            case (ROP::JUMP_IF_GE):
+            case (ROP::JUMP_UNLESS_EQ):
+            case (ROP::JUMP_UNLESS_NE):
+            case (ROP::JUMP_UNLESS_LT):
+            case (ROP::JUMP_UNLESS_LE):
+            case (ROP::JUMP_UNLESS_GT):
+            case (ROP::JUMP_UNLESS_GE): {
+                out << " " << inst.a;
+                printOperand(out, fn, inst.b);
+                printOperand(out, fn, inst.c);
+            } break;
+            case (ROP::CALL):       out << " r" << inst.a << " #" << inst.b << " r" << inst.c; break;
+            case (ROP::TAIL_CALL):  out << " r" << inst.a; break;
+            case (ROP::RETURN):     printOperand(out, fn, inst.a); break;
+            case (ROP::NEW_STRUCT): out << " r" << inst.a << " " << fn->structs[inst.b]->name; break;
+            case (ROP::GET_MEMBER): {
+                const RMemberRef& ref = fn->members[inst.c];
+                out << " r" << inst.a;
+                printOperand(out, fn, inst.b);
+                out << " " << ref.defn->name << "." << ref.name << "[" << ref.index << "]";
+            } break;
+            case (ROP::SET_MEMBER): {
+                const RMemberRef& ref = fn->members[inst.b];
+                printOperand(out, fn, inst.a);
+                out << " " << ref.defn->name << "." << ref.name << "[" << ref.index << "]";
+                printOperand(out, fn, inst.c);
+            } break;
+            case (ROP::SET): {
+                printOperand(out, fn, inst.a);
+                printOperand(out, fn, inst.b);
+                printOperand(out, fn, inst.c);
+            } break;
+            case (ROP::FOR_CHECK):
+            case (ROP::FOR_NEXT):   out << " r" << inst.a << " " << inst.b; break;
+            case (ROP::CLEAR_DEFERS): out << " r" << inst.a; break;
+            case (ROP::MARK_DEFER): out << " r" << inst.a << " " << inst.b; break;
+            case (ROP::SKIP_DEFER): out << " " << inst.a << " r" << inst.b << " " << inst.c; break;
+            case (ROP::NEG):
+            case (ROP::NOT):
+            case (ROP::MOVE):
+            case (ROP::PRINTF): {
+                out << " r" << inst.a;
+                printOperand(out, fn, inst.b);
+            } break;
+            case (ROP::NEW_ARRAY): {
+                out << " r" << inst.a;
+                printOperand(out, fn, inst.b);
+            } break;
+            case (ROP::CONCAT): out << " r" << inst.a << " r" << inst.b << " " << inst.c; break;
+            default: {
+                out << " r" << inst.a;
+                printOperand(out, fn, inst.b);
+                printOperand(out, fn, inst.c);
+            } break;
+        }
+        out << endl;
+    }
+
+    return out;
+}
+
+ostream& operator<<(ostream& out, const RegisterProgram* program)
+{
+    for (int i = 0; i < program->functions.size(); i++) {
+        out << "#" << i << " " << program->functions[i] << endl;
+    }
+    return out;
+}
+
+RegisterCompiler::RegisterCompiler(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s)
+    : functions(f), constants(c), structs(s) {}
+
+RegisterProgram* RegisterCompiler::compile(vector<Stmt*>& stmts)
+{
+    program = new RegisterProgram();
+
+    vector<Func*> funcs;
+    for (auto stmt : stmts) collectFunctions(stmt, funcs);
+
+    for (auto func : funcs) {
+        program->indexOf[func] = program->functions.size();
+        program->functions.push_back(new RegisterFunction(func));
+    }
+
+    for (auto function : program->functions) {
+        compileFunction(function);
+        if (function->name == "main") program->main = function;
+    }
+
+    if (!program->main) error("No main function");
+
+    return program;
+}
+
+void RegisterCompiler::collectFunctions(Stmt* stmt, vector<Func*>& funcs)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (!func->body) return;
+            funcs.push_back(func);
+            collectFunctions(func->body, funcs);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectFunctions(s, funcs);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectFunctions(i->ifBody, funcs);
+            collectFunctions(i->elseBody, funcs);
+        } break;
+        case (ST::FOR):     collectFunctions(asFor(stmt)->body, funcs); break;
+        case (ST::WHILE):   collectFunctions(asWhile(stmt)->body, funcs); break;
+        case (ST::DEFER):   collectFunctions(asDefer(stmt)->block, funcs); break;
+        default: break;
+    }
+}
+
+void RegisterCompiler::collectLocals(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (!decl->isConstant()) addSlot(decl->name);
+        } break;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) collectLocals(s);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            collectLocals(i->ifBody);
+            collectLocals(i->elseBody);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            addSlot(forLoop->it);
+            for (auto decl : forLoop->invariants) addSlot(decl->name);
+            collectLocals(forLoop->body);
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            for (auto decl : whileLoop->conditionInvariants) addSlot(decl->name);
+            for (auto decl : whileLoop->invariants) addSlot(decl->name);
+            collectLocals(whileLoop->body);
+        } break;
+        case (ST::DEFER):   collectLocals(asDefer(stmt)->block); break;
+        default: break;
+    }
+}
+
+int RegisterCompiler::addSlot(const string& name)
+{
+    if (fn->slotOf.contains(name)) return fn->slotOf[name];
+    return fn->slotOf[name] = namedSlots++;
+}
+
+// Slots for loop counters and the like, they go right after the named ones
+int RegisterCompiler::hiddenSlot()
+{
+    return namedSlots + hiddenSlots++;
+}
+
+int RegisterCompiler::newTemp()
+{
+    int temp = nextTemp++;
+    if (nextTemp > fn->frameSize) fn->frameSize = nextTemp;
+    return temp;
+}
+
+// The temps have to go after the hidden slots, but we only know how many of those
+// there are once the function is compiled, so it gets compiled twice.
+void RegisterCompiler::compileFunction(RegisterFunction* function)
+{
+    fn = function;
+
+    Func* func = fn->func;
+    fn->params = func->params.size();
+    namedSlots = 0;
+    clearsDefers.clear();
+    for (auto param : func->params) addSlot(param->name);
+    collectLocals(func->body);
+
+    tempBase = namedSlots;
+    compileBody();
+
+    tempBase = namedSlots + hiddenSlots;
+    compileBody();
+
+    fn->locals = tempBase;
+    if (fn->frameSize < fn->locals) fn->frameSize = fn->locals;
+}
+
+void RegisterCompiler::compileBody()
+{
+    fn->code.clear();
+    fn->constants.clear();
+    fn->names.clear();
+    fn->structs.clear();
+    fn->types.clear();
+    fn->members.clear();
+    fn->frameSize = 0;
+
+    hiddenSlots = 0;
+    nextTemp = tempBase;
+    returnSlot = -1;
+    scopeCount = 0;
+    deferScopes.clear();
+    loops.clear();
+    sharedSlots.clear();
+
+    compileBlock(fn->func->body);
+
+    // Falling off the end returns nothing
+    Any nothing;
+    emit(ROP::RETURN, constant(nothing));
+}
+
+int RegisterCompiler::emit(ROP op, int a, int b, int c)
+{
+    fn->code.push_back({ op, a, b, c });
+    return fn->code.size() - 1;
+}
+
+int RegisterCompiler::here()
+{
+    return fn->code.size();
+}
+
+int RegisterCompiler::constant(Any& any)
+{
+    fn->constants.push_back(any);
+    return -(int) fn->constants.size();
+}
+
+int RegisterCompiler::name(const string& name)
+{
+    fn->names.push_back(name);
+    return fn->names.size() - 1;
+}
+
+// Named slots can be changed by a callee through the dynamic scope
+bool RegisterCompiler::isNamedSlot(int operand)
+{
+    return operand >= 0 && operand < namedSlots;
+}
+
+bool RegisterCompiler::containsCall(Expr* expr)
+{
+    switch(expr->kind) {
+        case (ET::CALL):            return true;
+        case (ET::BINARY):          return containsCall(asBinary(expr)->left) || containsCall(asBinary(expr)->right);
+        case (ET::UNARY):           return containsCall(asUnary(expr)->expr);
+        case (ET::GET):             return containsCall(asGet(expr)->expr) || containsCall(asGet(expr)->access);
+        case (ET::MEMBER):          return containsCall(asMember(expr)->expr);
+        case (ET::SHARED):          return containsCall(asShared(expr)->expr);
+        case (ET::SHARED_SCOPE):    return containsCall(asSharedScope(expr)->expr);
+        default:                    return false;
+    }
+}
+
+// The first pass found out which scopes have conditional defers, only those need their flags cleared
+void RegisterCompiler::pushDeferScope()
+{
+    DeferScope scope;
+    scope.id = scopeCount++;
+
+    if (scope.id < clearsDefers.size() && clearsDefers[scope.id]) {
+        scope.slot = hiddenSlot();
+        emit(ROP::CLEAR_DEFERS, scope.slot);
+    }
+
+    deferScopes.push_back(scope);
+}
+
+void RegisterCompiler::popDeferScope()
+{
+    deferScopes.pop_back();
+}
+
+void RegisterCompiler::emitDefers(int downTo)
+{
+    for (int i = deferScopes.size() - 1; i >= downTo; i--) emitScopeDefers(i);
+}
+
+void RegisterCompiler::emitScopeDefers(int scope)
+{
+    // Copy, a deferred statement could add to the scope while we compile it
+    vector<DeferEntry> defers = deferScopes[scope].defers;
+    int slot = deferScopes[scope].slot;
+
+    for (auto& entry : defers) {
+        if (entry.bit < 0) {
+            compileStmt(entry.stmt, true);
+            continue;
+        }
+
+        int skip = emit(ROP::SKIP_DEFER, 0, slot, entry.bit);
+        compileStmt(entry.stmt, true);
+        fn->code[skip].a = here();
+    }
+}
+
+void RegisterCompiler::compileStmt(Stmt* stmt, bool direct)
+{
+    switch(stmt->kind) {
+        case (ST::DECL):    compileDecl(asDecl(stmt)); break;
+        case (ST::BLOCK):   compileBlock(asBlock(stmt)); break;
+        case (ST::IF):      compileIf(asIf(stmt)); break;
+        case (ST::FOR):     compileFor(asFor(stmt)); break;
+        case (ST::WHILE):   compileWhile(asWhile(stmt)); break;
+        case (ST::RETURN):  compileReturn(asReturn(stmt)); break;
+        case (ST::SET):     compileSet(asSet(stmt)); break;
+        case (ST::DEFER):   compileDefer(asDefer(stmt), direct); break;
+
+        // Declared at the top level, they don't run
+        case (ST::STRUCT):
+        case (ST::ENUM):
+        case (ST::FUNC):    break;
+
+        case (ST::EXPRSTMT): compileExpr(asExprStmt(stmt)->expr); break;
+
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            string& left = asIdent(assign->left)->name;
+
+            if (fn->slotOf.contains(left)) {
+                compileInto(assign->right, fn->slotOf[left]);
+            } else {
+                int value = compileExpr(assign->right);
+                emit(ROP::STORE_NAME, name(left), value);
+            }
+        } break;
+
+        case (ST::CONTINUE): {
+            if (loops.empty()) error("continue outside of a loop", stmt->tk);
+            emitDefers(loops.back().deferDepth);
+            loops.back().continues.push_back(emit(ROP::JUMP));
+        } break;
+
+        case (ST::BREAK): {
+            if (loops.empty()) error("break outside of a loop", stmt->tk);
+            emitDefers(loops.back().deferDepth);
+            loops.back().breaks.push_back(emit(ROP::JUMP));
+        } break;
+
+        default: INTERNAL_ERROR("Stmt not supported by the RegisterCompiler");
+    }
+
+    // Nothing in a temp outlives its statement
+    nextTemp = tempBase;
+}
+
+void RegisterCompiler::compileBlock(Block* block)
+{
+    pushDeferScope();
+
+    for (auto stmt : block->stmts) {
+        compileStmt(stmt, true);
+
+        // Everything after these is dead
+        if (isReturn(stmt) || isBreak(stmt) || isContinue(stmt)) {
+            popDeferScope();
+            return;
+        }
+    }
+
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void RegisterCompiler::compileDecl(Decl* decl)
+{
+    if (decl->isConstant()) return;
+
+    int slot = fn->slotOf[decl->name];
+
+    if (decl->isDeclArray()) {
+        int size = compileExpr(decl->expr);
+        fn->types.push_back(decl->type);
+        emit(ROP::NEW_ARRAY, slot, size, fn->types.size() - 1);
+    } else if (decl->expr) {
+        compileInto(decl->expr, slot);
+    } else if (decl->type.base == Type::STRUCT) {
+        string* name = (string*) decl->type.info;
+        if (!structs.contains(*name)) error("Struct not defined");
+
+        fn->structs.push_back(structs[*name]);
+        fn->types.push_back(decl->type);
+        emit(ROP::NEW_STRUCT, slot, fn->structs.size() - 1, fn->types.size() - 1);
+    } else {
+        Any any;
+        any.type = decl->type;
+        if (decl->type.base == Type::ENUM) any.type = Type::INT;
+        if (decl->type.base == Type::STRING) any.value.String = JaiString::intern("");
+        emit(ROP::MOVE, slot, constant(any));
+    }
+}
+
+// Emits a jump that is taken when the condition is jumpIf and returns it, so the target can be patched.
+// Comparisons jump directly instead of going through a bool first.
+int RegisterCompiler::compileCondition(Expr* condition, bool jumpIf)
+{
+    Expr* expr = condition;
+    if (isSharedScope(expr)) {
+        sharedSlots.clear();
+        expr = asSharedScope(expr)->expr;
+    }
+
+    if (isBinary(expr)) {
+        Binary* binary = asBinary(expr);
+
+        ROP op = ROP::JUMP;
+        switch(binary->op) {
+            case (OP::EQUAL):           op = jumpIf ? ROP::JUMP_IF_EQ : ROP::JUMP_UNLESS_EQ; break;
+            case (OP::NOT_EQUAL):       op = jumpIf ? ROP::JUMP_IF_NE : ROP::JUMP_UNLESS_NE; break;
+            case (OP::LESS):            op = jumpIf ? ROP::JUMP_IF_LT : ROP::JUMP_UNLESS_LT; break;
+            case (OP::LESS_EQUAL):      op = jumpIf ? ROP::JUMP_IF_LE : ROP::JUMP_UNLESS_LE; break;
+            case (OP::GREATER):         op = jumpIf ? ROP::JUMP_IF_GT : ROP::JUMP_UNLESS_GT; break;
+            case (OP::GREATER_EQUAL):   op = jumpIf ? ROP::JUMP_IF_GE : ROP::JUMP_UNLESS_GE; break;
+            default: break;
+        }
+
+        if (op != ROP::JUMP) {
+            int left = keepOperand(compileExpr(binary->left), containsCall(binary->right));
+            int right = compileExpr(binary->right);
+            int jump = emit(op, 0, left, right);
+            sharedSlots.clear();
+            nextTemp = tempBase;
+            return jump;
+        }
+    }
+
+    int value = compileExpr(expr);
+    int jump = emit(jumpIf ? ROP::JUMP_IF_TRUE : ROP::JUMP_IF_FALSE, 0, value);
+    sharedSlots.clear();
+    nextTemp = tempBase;
+    return jump;
+}
+
+void RegisterCompiler::compileIf(If* i)
+{
+    int skipThen = compileCondition(i->condition, false);
+
+    compileStmt(i->ifBody, false);
+
+    if (i->elseBody) {
+        int skipElse = emit(ROP::JUMP);
+        fn->code[skipThen].a = here();
+        compileStmt(i->elseBody, false);
+        fn->code[skipElse].a = here();
+    } else {
+        fn->code[skipThen].a = here();
+    }
+}
+
+// Loops are rotated, the check before the first iteration skips the invariants as well.
+void RegisterCompiler::compileFor(For* forLoop)
+{
+    if (!forLoop->end) {
+        unsupported = "for over arrays";
+        return;
+    }
+
+    pushDeferScope();
+    int deferDepth = deferScopes.size();
+
+    // The Interpreter counts with its own copy of the index, the body can change it without affecting the loop
+    int index = hiddenSlot();
+    int end = hiddenSlot();
+
+    compileInto(forLoop->start, index);
+    compileInto(forLoop->end, end);
+    nextTemp = tempBase;
+
+    int check = emit(ROP::FOR_CHECK, index);
+
+    for (auto decl : forLoop->invariants) {
+        compileDecl(decl);
+        nextTemp = tempBase;
+    }
+
+    int body = here();
+    emit(ROP::MOVE, fn->slotOf[forLoop->it], index);
+
+    loops.push_back({ {}, {}, deferDepth });
+    compileStmt(forLoop->body, false);
+    LoopTargets targets = loops.back();
+    loops.pop_back();
+
+    for (auto at : targets.continues) fn->code[at].a = here();
+    emit(ROP::FOR_NEXT, index, body);
+
+    fn->code[check].b = here();
+    for (auto at : targets.breaks) fn->code[at].a = here();
+
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+void RegisterCompiler::compileWhile(While* whileLoop)
+{
+    pushDeferScope();
+    int deferDepth = deferScopes.size();
+
+    for (auto decl : whileLoop->conditionInvariants) {
+        compileDecl(decl);
+        nextTemp = tempBase;
+    }
+
+    int check = compileCondition(whileLoop->condition, false);
+
+    for (auto decl : whileLoop->invariants) {
+        compileDecl(decl);
+        nextTemp = tempBase;
+    }
+
+    int body = here();
+    loops.push_back({ {}, {}, deferDepth });
+    compileStmt(whileLoop->body, false);
+    LoopTargets targets = loops.back();
+    loops.pop_back();
+
+    for (auto at : targets.continues) fn->code[at].a = here();
+    int again = compileCondition(whileLoop->condition, true);
+    fn->code[again].a = body;
+
+    fn->code[check].a = here();
+    for (auto at : targets.breaks) fn->code[at].a = here();
+
+    emitScopeDefers(deferScopes.size() - 1);
+    popDeferScope();
+}
+
+// Puts the args into consecutive temps, that's where the frame of the callee starts
+int RegisterCompiler::compileArgs(vector<Expr*>& args)
+{
+    int first = nextTemp;
+    for (int i = 0; i < args.size(); i++) {
+        nextTemp = first + i;
+        int temp = newTemp();
+        compileInto(args[i], temp);
+    }
+    nextTemp = first + args.size();
+    if (nextTemp > fn->frameSize) fn->frameSize = nextTemp;
+    return first;
+}
+
+void RegisterCompiler::compileReturn(Return* ret)
+{
+    // Only a call that is the whole return value can reuse the frame,
+    // for the ones nested in Binarys the VM just keeps calling, its frames live on the heap.
+    if (ret->tailCall && isCall(ret->expr)) {
+        emit(ROP::TAIL_CALL, compileArgs(asCall(ret->expr)->args));
+        return;
+    }
+
+    int value;
+    if (ret->expr) {
+        value = compileExpr(ret->expr);
+    } else {
+        Any nothing;
+        value = constant(nothing);
+    }
+
+    bool hasDefers = false;
+    for (auto& scope : deferScopes) hasDefers = hasDefers || !scope.defers.empty();
+
+    // The defers could change the variable we return or reuse the temp it is in
+    if (hasDefers && value >= 0) {
+        if (returnSlot < 0) returnSlot = hiddenSlot();
+        emit(ROP::MOVE, returnSlot, value);
+        value = returnSlot;
+    }
+
+    emitDefers(0);
+    emit(ROP::RETURN, value);
+}
+
+void RegisterCompiler::compileSet(Set* set)
+{
+    if (set->defn) {
+        int object = keepOperand(compileExpr(set->expr), containsCall(set->value));
+        int value = compileExpr(set->value);
+        fn->members.push_back({ set->defn, set->index, asConst(set->access)->any.value.String->text, nullptr });
+        emit(ROP::SET_MEMBER, object, fn->members.size() - 1, value);
+        return;
+    }
+
+    int object = keepOperand(compileExpr(set->expr), containsCall(set->access) || containsCall(set->value));
+    int access = keepOperand(compileExpr(set->access), containsCall(set->value));
+    int value = compileExpr(set->value);
+    emit(ROP::SET, object, access, value);
+}
+
+// A defer we always go through is just remembered, one we might skip sets
+// a bit in its scope's slot that decides if it runs at the end.
+void RegisterCompiler::compileDefer(Defer* defer, bool direct)
+{
+    DeferScope& scope = deferScopes.back();
+
+    if (direct) {
+        scope.defers.push_back({ defer->block, -1 });
+        return;
+    }
+
+    if (scope.slot < 0) {
+        scope.slot = hiddenSlot();
+        if (clearsDefers.size() <= scope.id) clearsDefers.resize(scope.id + 1);
+        clearsDefers[scope.id] = true;
+    }
+
+    int bit = 0;
+    for (auto& entry : scope.defers) if (entry.bit >= 0) bit++;
+    if (bit >= 64) {
+        unsupported = "more than 64 conditional defers in one scope";
+        return;
+    }
+
+    emit(ROP::MARK_DEFER, scope.slot, bit);
+    scope.defers.push_back({ defer->block, bit });
+}
+
+// The Interpreter has the value of the left side before it evaluates the right one.
+// A call on the right could change a variable we only hold the slot of, so it gets copied first.
+int RegisterCompiler::keepOperand(int operand, bool callsLater)
+{
+    if (!isNamedSlot(operand) || !callsLater) return operand;
+
+    int temp = newTemp();
+    emit(ROP::MOVE, temp, operand);
+    return temp;
+}
+
+void RegisterCompiler::compileInto(Expr* expr, int target)
+{
+    int result = compileExpr(expr, target);
+    if (result != target) emit(ROP::MOVE, target, result);
+}
+
+// Returns the operand that holds the value, which is target if the expression had to compute something
+int RegisterCompiler::compileExpr(Expr* expr, int target)
+{
+    switch(expr->kind) {
+        case (ET::CONST): return constant(asConst(expr)->any);
+
+        case (ET::IDENT): {
+            string& ident = asIdent(expr)->name;
+
+            if (fn->slotOf.contains(ident)) return fn->slotOf[ident];
+            if (constants.contains(ident)) return constant(constants[ident]);
+
+            int result = target >= 0 ? target : newTemp();
+            emit(ROP::LOAD_NAME, result, name(ident));
+            return result;
+        }
+
+        case (ET::BINARY): {
+            Binary* binary = asBinary(expr);
+
+            vector<Expr*> parts = concatParts(binary);
+            if (!parts.empty()) {
+                int first = compileArgs(parts);
+                int result = target >= 0 ? target : first;
+                emit(ROP::CONCAT, result, first, parts.size());
+                return result;
+            }
+
+            int left = keepOperand(compileExpr(binary->left), containsCall(binary->right));
+            int right = compileExpr(binary->right);
+            int result = target >= 0 ? target : newTemp();
+
+            switch(binary->op) {
+                case (OP::EQUAL):           emit(ROP::EQ, result, left, right); break;
+                case (OP::NOT_EQUAL):       emit(ROP::NE, result, left, right); break;
+                case (OP::AND):             emit(ROP::AND, result, left, right); break;
+                case (OP::OR):              emit(ROP::OR, result, left, right); break;
+                case (OP::GREATER):         emit(ROP::GT, result, left, right); break;
+                case (OP::GREATER_EQUAL):   emit(ROP::GE, result, left, right); break;
+                case (OP::LESS):            emit(ROP::LT, result, left, right); break;
+                case (OP::LESS_EQUAL):      emit(ROP::LE, result, left, right); break;
+                case (OP::MINUS):           emit(ROP::SUB, result, left, right); break;
+                case (OP::PLUS):            emit(ROP::ADD, result, left, right); break;
+                case (OP::MULTIPLY):        emit(ROP::MUL, result, left, right); break;
+                case (OP::DIVIDE):          emit(ROP::DIV, result, left, right); break;
+                default: INTERNAL_ERROR("Wrong Binary Operators shouldn't get parsed");
+            }
+            return result;
+        }
+
+        case (ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            int value = compileExpr(unary->expr);
+            int result = target >= 0 ? target : newTemp();
+
+            switch(unary->op) {
+                case (OP::NOT):     emit(ROP::NOT, result, value); break;
+                case (OP::NEGATE):  emit(ROP::NEG, result, value); break;
+                default: INTERNAL_ERROR("Wrong Unary Operators shouldn't get parsed");
+            }
+            return result;
+        }
+
+        case (ET::CALL): {
+            Call* call = asCall(expr);
+            Ident* ident = asIdent(call->name);
+
+            if (!functions.contains(ident->name)) error("Fucntion not defined");
+            Func* defn = functions[ident->name];
+
+            if (defn->params.size() != call->args.size()) error("Wrong number of arguments");
+
+            if (!defn->body) {
+                int text = compileExpr(call->args[0]);
+                int result = target >= 0 ? target : newTemp();
+                emit(ROP::PRINTF, result, text);
+                return result;
+            }
+
+            int first = compileArgs(call->args);
+            int result = target >= 0 ? target : first;
+            if (result == first && call->args.empty()) result = newTemp();
+
+            emit(ROP::CALL, result, program->indexOf[defn], first);
+            return result;
+        }
+
+        case (ET::GET): {
+            Get* get = asGet(expr);
+            int object = keepOperand(compileExpr(get->expr), containsCall(get->access));
+            int access = compileExpr(get->access);
+            int result = target >= 0 ? target : newTemp();
+            emit(ROP::GET, result, object, access);
+            return result;
+        }
+
+        case (ET::MEMBER): {
+            Member* member = asMember(expr);
+            int object = compileExpr(member->expr);
+            int result = target >= 0 ? target : newTemp();
+            fn->members.push_back({ member->defn, member->index, member->name, member });
+            emit(ROP::GET_MEMBER, result, object, fn->members.size() - 1);
+            return result;
+        }
+
+        // There is no control flow inside an expression, so the first Shared we compile is the one that runs first
+        case (ET::SHARED): {
+            Shared* shared = asShared(expr);
+            if (sharedSlots.contains(shared)) return sharedSlots[shared];
+
+            int slot = hiddenSlot();
+            compileInto(shared->expr, slot);
+            sharedSlots[shared] = slot;
+            return slot;
+        }
+
+        case (ET::SHARED_SCOPE): {
+            sharedSlots.clear();
+            int result = compileExpr(asSharedScope(expr)->expr, target);
+            sharedSlots.clear();
+            return result;
+        }
+
+        default: break;
+    }
+
+    INTERNAL_ERROR("Expr not supported by the RegisterCompiler");
+    return 0;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <unordered_map>
+
+#include "Any.h"
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Instructions for the RegisterVM. Operands name slots of the frame directly,
+// so a += b * 2 is a single MUL into a temp and an ADD into a's slot.
+// Operands written as RK can also be a constant: negative numbers are indices into the constants, -1 is the first one.
+#define REGISTER_OPCODES(X) \
+    X(MOVE)             /* a = RK(b) */ \
+    X(LOAD_NAME)        /* a = variable of a caller named names[b] */ \
+    X(STORE_NAME)       /* variable of a caller named names[a] = RK(b) */ \
+    X(ADD)              /* a = RK(b) + RK(c) */ \
+    X(SUB) \
+    X(MUL) \
+    X(DIV) \
+    X(EQ) \
+    X(NE) \
+    X(LT) \
+    X(LE) \
+    X(GT) \
+    X(GE) \
+    X(AND) \
+    X(OR) \
+    X(NEG)              /* a = -RK(b) */ \
+    X(NOT) \
+    X(CONCAT)           /* a = the c slots starting at b joined into one string (see concatParts) */ \
+    X(JUMP)             /* to a */ \
+    X(JUMP_IF_FALSE)    /* to a if RK(b) isn't truthy */ \
+    X(JUMP_IF_TRUE) \
+    X(JUMP_IF_EQ)       /* to a if RK(b) == RK(c) */ \
+    X(JUMP_IF_NE) \
+    X(JUMP_IF_LT) \
+    X(JUMP_IF_LE) \
+    X(JUMP_IF_GT) \
+    X(JUMP_IF_GE) \
+    X(JUMP_UNLESS_EQ)   /* to a unless RK(b) == RK(c) */ \
+    X(JUMP_UNLESS_NE) \
+    X(JUMP_UNLESS_LT) \
+    X(JUMP_UNLESS_LE) \
+    X(JUMP_UNLESS_GT) \
+    X(JUMP_UNLESS_GE) \
+    X(CALL)             /* a = functions[b](the args starting at slot c), the callee's frame starts at c */ \
+    X(TAIL_CALL)        /* the args start at slot a, they become the params and we start over */ \
+    X(PRINTF)           /* printf(RK(b)), a = nothing */ \
+    X(RETURN)           /* RK(a) */ \
+    X(NEW_STRUCT)       /* a = new structs[b] of types[c] */ \
+    X(NEW_ARRAY)        /* a = new array of types[c] with RK(b) elements */ \
+    X(GET)              /* a = RK(b)[RK(c)] */ \
+    X(SET)              /* RK(a)[RK(b)] = RK(c) */ \
+    X(GET_MEMBER)       /* a = RK(b).members[c] */ \
+    X(SET_MEMBER)       /* RK(a).members[b] = RK(c) */ \
+    X(FOR_CHECK)        /* to b if the loop with the index in a and the end in a + 1 is done */ \
+    X(FOR_NEXT)         /* count a up and go to b if the loop isn't done */ \
+    X(CLEAR_DEFERS)     /* no conditional defer of the scope with the flags in a ran yet */ \
+    X(MARK_DEFER)       /* set bit b of a */ \
+    X(SKIP_DEFER)       /* to a unless bit c of b is set */
+
+enum class ROP {
+#define ROP_ENUM(name) name,
+    REGISTER_OPCODES(ROP_ENUM)
+#undef ROP_ENUM
+};
+
+std::string ROPtoString(ROP op);
+
+struct RInstruction {
+    ROP op;
+    int a = 0;
+    int b = 0;
+    int c = 0;
+};
+
+struct RMemberRef {
+    Struct* defn;
+    int index;
+    string name;
+    Member* member;
+    MemberCache cache;      // for the structs that aren't defn
+};
+
+struct RegisterFunction {
+    string name;
+    Func* func;
+    int params = 0;
+    int locals = 0;     // named slots and the hidden ones, the temps come after them
+    int frameSize = 0;
+
+    vector<RInstruction> code;
+    vector<Any> constants;
+    vector<string> names;
+    vector<Struct*> structs;
+    vector<ImprovedType> types;
+    vector<RMemberRef> members;
+
+    unordered_map<string, int> slotOf;
+
+    RegisterFunction(Func* f);
+};
+
+struct RegisterProgram {
+    vector<RegisterFunction*> functions;
+    unordered_map<Func*, int> indexOf;
+    RegisterFunction* main = nullptr;
+};
+
+ostream& operator<<(ostream& out, const RegisterFunction* fn);
+ostream& operator<<(ostream& out, const RegisterProgram* program);
+
+// Compiles every function for the RegisterVM, the same way the BytecodeCompiler does for the stack VM.
+// Temps live above the slots of the function and are given back after every statement.
+struct RegisterCompiler {
+    unordered_map<string, Func*>& functions;
+    unordered_map<string, Any>& constants;
+    unordered_map<string, Struct*>& structs;
+
+    RegisterProgram* program = nullptr;
+    RegisterFunction* fn = nullptr;
+    string unsupported;
+
+    int namedSlots = 0;
+    int hiddenSlots = 0;
+    int tempBase = 0;
+    int nextTemp = 0;
+    int returnSlot = -1;
+
+    struct DeferEntry {
+        Stmt* stmt;
+        int bit;
+    };
+    struct DeferScope {
+        vector<DeferEntry> defers;
+        int id = 0;
+        int slot = -1;
+    };
+    vector<DeferScope> deferScopes;
+    vector<bool> clearsDefers;
+    int scopeCount = 0;
+
+    struct LoopTargets {
+        vector<int> breaks;
+        vector<int> continues;
+        int deferDepth;
+    };
+    vector<LoopTargets> loops;
+
+    unordered_map<Shared*, int> sharedSlots;
+
+    RegisterCompiler(unordered_map<string, Func*>& f, unordered_map<string, Any>& c, unordered_map<string, Struct*>& s);
+
+    RegisterProgram* compile(vector<Stmt*>& stmts);
+
+    void collectFunctions(Stmt* stmt, vector<Func*>& funcs);
+    void collectLocals(Stmt* stmt);
+    int  addSlot(const string& name);
+    int  hiddenSlot();
+    int  newTemp();
+    void compileFunction(RegisterFunction* function);
+    void compileBody();
+
+    int  emit(ROP op, int a = 0, int b = 0, int c = 0);
+    int  here();
+    int  constant(Any& any);
+    int  name(const string& name);
+    bool isNamedSlot(int operand);
+    bool containsCall(Expr* expr);
+
+    void pushDeferScope();
+    void popDeferScope();
+    void emitDefers(int downTo);
+    void emitScopeDefers(int scope);
+
+    void compileStmt(Stmt* stmt, bool direct);
+    void compileBlock(Block* block);
+    void compileDecl(Decl* decl);
+    void compileIf(If* i);
+    void compileFor(For* forLoop);
+    void compileWhile(While* whileLoop);
+    void compileReturn(Return* ret);
+    void compileSet(Set* set);
+    void compileDefer(Defer* defer, bool direct);
+    int  compileCondition(Expr* condition, bool jumpIf);
+    int  compileArgs(vector<Expr*>& args);
+
+    int  compileExpr(Expr* expr, int target = -1);
+    void compileInto(Expr* expr, int target);
+    int  keepOperand(int operand, bool callsLater);
+};
@@ -0,0 +1,357 @@
+#include <vector>
+#include <string>
+
+#include "RegisterVM.h"
+#include "error.h"
+
+using namespace std;
+
+// Define SWITCH_DISPATCH to get the portable loop with GCC and Clang as well, to compare the two
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SWITCH_DISPATCH)
+#define COMPUTED_GOTO
+#endif
+
+// goto * out of a handler skips the destructors of its locals,
+// so the handlers move the Anys they made into registers instead of copying them
+
+RegisterVM::RegisterVM(Interpreter& i, RegisterProgram* p) : interp(i), program(p) {}
+
+// Variables of the callers, the newest one wins like in the Interpreter's variables
+Any* RegisterVM::findName(const string& name)
+{
+    for (int i = frames.size() - 2; i >= 0; i--) {
+        auto& slotOf = frames[i].fn->slotOf;
+        auto it = slotOf.find(name);
+        if (it != slotOf.end()) return &registers[frames[i].base + it->second];
+    }
+
+    if (interp.variables.contains(name)) return &interp.variables[name];
+
+    return nullptr;
+}
+
+#define R(x)  (regs[x])
+#define RK(x) ((x) >= 0 ? regs[x] : constants[-1 - (x)])
+
+#define MATH(intOp, anyOp) { \
+    Any& left = RK(inst->b); \
+    Any& right = RK(inst->c); \
+    if (left.type.base == Type::INT && right.type.base == Type::INT) { \
+        long long int result = intOp(left.value.Int, right.value.Int); \
+        Any& dest = R(inst->a); \
+        if (dest.type.base == Type::STRING || dest.object()) dest = Any(); \
+        dest.type = left.type; \
+        dest.value.Int = result; \
+    } else { \
+        Any result = interp.applyBinary(anyOp, left, right); \
+        R(inst->a) = std::move(result); \
+    } \
+}
+
+#define COMPARE(op, anyOp) { \
+    Any& left = RK(inst->b); \
+    Any& right = RK(inst->c); \
+    if (left.type.base == Type::INT && right.type.base == Type::INT) { \
+        bool result = left.value.Int op right.value.Int; \
+        Any& dest = R(inst->a); \
+        if (dest.type.base == Type::STRING || dest.object()) dest = Any(); \
+        dest.type = Type::BOOL; \
+        dest.value.Bool = result; \
+    } else { \
+        Any result = interp.applyBinary(anyOp, left, right); \
+        R(inst->a) = std::move(result); \
+    } \
+}
+
+#define TEST(op, anyOp, result) \
+    Any& left = RK(inst->b); \
+    Any& right = RK(inst->c); \
+    bool result; \
+    if (left.type.base == Type::INT && right.type.base == Type::INT) result = left.value.Int op right.value.Int; \
+    else result = interp.isTruthy(interp.applyBinary(anyOp, left, right));
+
+#define JUMP_IF(op, anyOp) { \
+    TEST(op, anyOp, taken) \
+    if (taken) ip = code + inst->a; \
+}
+
+#define JUMP_UNLESS(op, anyOp) { \
+    TEST(op, anyOp, taken) \
+    if (!taken) ip = code + inst->a; \
+}
+
+#ifdef COMPUTED_GOTO
+    #define HANDLER(name)   L_##name:
+    #define NEXT()          inst = ip++; goto *labels[(int) inst->op]
+#else
+    #define HANDLER(name)   case (ROP::name):
+    #define NEXT()          break
+#endif
+
+void RegisterVM::run()
+{
+#ifdef COMPUTED_GOTO
+    static void* labels[] = {
+#define ROP_LABEL(name) &&L_##name,
+        REGISTER_OPCODES(ROP_LABEL)
+#undef ROP_LABEL
+    };
+#endif
+
+    RegisterFunction* fn = program->main;
+    registers.resize(fn->frameSize);
+    frames.push_back({ fn, nullptr, 0, -1 });
+    Memory::function = &fn->name;
+
+    int base = 0;
+    Any* regs = registers.data();
+    Any* constants = fn->constants.data();
+    RInstruction* code = fn->code.data();
+    RInstruction* ip = code;
+    RInstruction* inst;
+
+#ifdef COMPUTED_GOTO
+    NEXT();
+#else
+    while (true) {
+        inst = ip++;
+        switch (inst->op) {
+#endif
+
+    HANDLER(MOVE) {
+        R(inst->a) = RK(inst->b);
+        NEXT();
+    }
+    HANDLER(LOAD_NAME) {
+        const string& name = fn->names[inst->b];
+        Any* any = findName(name);
+        if (any) R(inst->a) = *any;
+        else if (interp.constants.contains(name)) R(inst->a) = interp.constants[name];
+        else error("Undefined Variable");
+        NEXT();
+    }
+    HANDLER(STORE_NAME) {
+        Any* any = findName(fn->names[inst->a]);
+        if (!any) error("Undefined Variable");
+        *any = RK(inst->b);
+        NEXT();
+    }
+
+    HANDLER(ADD) { MATH(wrapAdd, OP::PLUS)       NEXT(); }
+    HANDLER(SUB) { MATH(wrapSub, OP::MINUS)      NEXT(); }
+    HANDLER(MUL) { MATH(wrapMul, OP::MULTIPLY)   NEXT(); }
+    HANDLER(DIV) {
+        Any result = interp.applyBinary(OP::DIVIDE, RK(inst->b), RK(inst->c));
+        R(inst->a) = std::move(result);
+        NEXT();
+    }
+    HANDLER(EQ) { COMPARE(==, OP::EQUAL)         NEXT(); }
+    HANDLER(NE) { COMPARE(!=, OP::NOT_EQUAL)     NEXT(); }
+    HANDLER(LT) { COMPARE(<,  OP::LESS)          NEXT(); }
+    HANDLER(LE) { COMPARE(<=, OP::LESS_EQUAL)    NEXT(); }
+    HANDLER(GT) { COMPARE(>,  OP::GREATER)       NEXT(); }
+    HANDLER(GE) { COMPARE(>=, OP::GREATER_EQUAL) NEXT(); }
+    HANDLER(AND) {
+        Any result = interp.applyBinary(OP::AND, RK(inst->b), RK(inst->c));
+        R(inst->a) = std::move(result);
+        NEXT();
+    }
+    HANDLER(OR) {
+        Any result = interp.applyBinary(OP::OR, RK(inst->b), RK(inst->c));
+        R(inst->a) = std::move(result);
+        NEXT();
+    }
+    HANDLER(NEG) {
+        Any result = RK(inst->b).neg();
+        R(inst->a) = std::move(result);
+        NEXT();
+    }
+    HANDLER(NOT) {
+        Any result = RK(inst->b).Not();
+        R(inst->a) = std::move(result);
+        NEXT();
+    }
+    HANDLER(CONCAT) {
+        Any result = Any::concat(&R(inst->b), inst->c);
+        R(inst->a) = std::move(result);
+        NEXT();
+    }
+
+    HANDLER(JUMP) {
+        ip = code + inst->a;
+        NEXT();
+    }
+    HANDLER(JUMP_IF_FALSE) {
+        if (!interp.isTruthy(RK(inst->b))) ip = code + inst->a;
+        NEXT();
+    }
+    HANDLER(JUMP_IF_TRUE) {
+        if (interp.isTruthy(RK(inst->b))) ip = code + inst->a;
+        NEXT();
+    }
+    HANDLER(JUMP_IF_EQ) { JUMP_IF(==, OP::EQUAL)         NEXT(); }
+    HANDLER(JUMP_IF_NE) { JUMP_IF(!=, OP::NOT_EQUAL)     NEXT(); }
+    HANDLER(JUMP_IF_LT) { JUMP_IF(<,  OP::LESS)          NEXT(); }
+    HANDLER(JUMP_IF_LE) { JUMP_IF(<=, OP::LESS_EQUAL)    NEXT(); }
+    HANDLER(JUMP_IF_GT) { JUMP_IF(>,  OP::GREATER)       NEXT(); }
+    HANDLER(JUMP_IF_GE) { JUMP_IF(>=, OP::GREATER_EQUAL) NEXT(); }
+    HANDLER(JUMP_UNLESS_EQ) { JUMP_UNLESS(==, OP::EQUAL)         NEXT(); }
+    HANDLER(JUMP_UNLESS_NE) { JUMP_UNLESS(!=, OP::NOT_EQUAL)     NEXT(); }
+    HANDLER(JUMP_UNLESS_LT) { JUMP_UNLESS(<,  OP::LESS)          NEXT(); }
+    HANDLER(JUMP_UNLESS_LE) { JUMP_UNLESS(<=, OP::LESS_EQUAL)    NEXT(); }
+    HANDLER(JUMP_UNLESS_GT) { JUMP_UNLESS(>,  OP::GREATER)       NEXT(); }
+    HANDLER(JUMP_UNLESS_GE) { JUMP_UNLESS(>=, OP::GREATER_EQUAL) NEXT(); }
+
+    HANDLER(CALL) {
+        frames.back().ip = ip;
+
+        fn = program->functions[inst->b];
+        base += inst->c;
+        frames.push_back({ fn, nullptr, base, inst->a });
+        Memory::function = &fn->name;
+
+        if (registers.size() < base + fn->frameSize) registers.resize(base + fn->frameSize);
+
+        regs = registers.data() + base;
+        constants = fn->constants.data();
+        code = fn->code.data();
+        ip = code;
+        NEXT();
+    }
+    HANDLER(TAIL_CALL) {
+        for (int i = 0; i < fn->params; i++) R(i) = R(inst->a + i);
+        ip = code;
+        NEXT();
+    }
+    HANDLER(PRINTF) {
+        interp.callPrintf(RK(inst->b));
+        R(inst->a) = Any();
+        NEXT();
+    }
+    HANDLER(RETURN) {
+        Any result = RK(inst->a);
+        int into = frames.back().result;
+        frames.pop_back();
+
+        if (frames.empty()) {
+            Memory::function = nullptr;
+            return;
+        }
+
+        Frame& frame = frames.back();
+        fn = frame.fn;
+        base = frame.base;
+        Memory::function = &fn->name;
+
+        regs = registers.data() + base;
+        constants = fn->constants.data();
+        code = fn->code.data();
+        ip = frame.ip;
+
+        R(into) = std::move(result);
+        NEXT();
+    }
+
+    HANDLER(NEW_STRUCT) {
+        Any any;
+        any.type = fn->types[inst->c];
+        any.value.Ptr = MyStruct::make(fn->structs[inst->b]);
+        R(inst->a) = std::move(any);
+        NEXT();
+    }
+    HANDLER(NEW_ARRAY) {
+        Any any;
+        any.type = fn->types[inst->c];
+        any.value.Ptr = new MyArray(ImprovedType(any.type.base, 0), RK(inst->b).value.Int);
+        R(inst->a) = std::move(any);
+        NEXT();
+    }
+    HANDLER(GET) {
+        Any result = interp.getAccess(RK(inst->b), RK(inst->c));
+        R(inst->a) = std::move(result);
+        NEXT();
+    }
+    HANDLER(SET) {
+        interp.setAccess(RK(inst->a), RK(inst->b), RK(inst->c));
+        NEXT();
+    }
+    HANDLER(GET_MEMBER) {
+        Any& object = RK(inst->b);
+        RMemberRef& ref = fn->members[inst->c];
+
+        if (object.type.base == Type::STRUCT && ((MyStruct*) object.value.Ptr)->defn == ref.defn) {
+            R(inst->a) = ((MyStruct*) object.value.Ptr)->get(ref.index);
+        } else {
+            Any result = interp.getMember(object, ref.member);
+            R(inst->a) = std::move(result);
+        }
+        NEXT();
+    }
+    HANDLER(SET_MEMBER) {
+        Any& object = RK(inst->a);
+        RMemberRef& ref = fn->members[inst->b];
+
+        if (object.type.base == Type::STRUCT && ((MyStruct*) object.value.Ptr)->defn == ref.defn) {
+            ((MyStruct*) object.value.Ptr)->set(ref.index, RK(inst->c));
+        } else if (object.type.base == Type::STRUCT && !(object.type.flags & Flags::ARRAY)) {
+            object.setStructMember(ref.name, RK(inst->c), &ref.cache);
+        } else {
+            Any access;
+            access.type.base = Type::STRING;
+            access.value.String = JaiString::intern(ref.name);
+            interp.setAccess(object, access, RK(inst->c));
+        }
+        NEXT();
+    }
+
+    HANDLER(FOR_CHECK) {
+        Any& index = R(inst->a);
+        Any& end = R(inst->a + 1);
+
+        bool more;
+        if (isIntegerType(index.type.base) && isIntegerType(end.type.base)) more = index.value.Int < end.value.Int;
+        else more = interp.isTruthy(index.less(end));
+
+        if (!more) ip = code + inst->b;
+        NEXT();
+    }
+    HANDLER(FOR_NEXT) {
+        Any& index = R(inst->a);
+        Any& end = R(inst->a + 1);
+
+        bool more;
+        if (isIntegerType(index.type.base) && isIntegerType(end.type.base)) {
+            more = ++index.value.Int < end.value.Int;
+        } else {
+            Any one;
+            one.type.base = Type::INT;
+            one.value.Int = 1;
+            index = index.add(one);
+            more = interp.isTruthy(index.less(end));
+        }
+
+        if (more) ip = code + inst->b;
+        NEXT();
+    }
+
+    HANDLER(CLEAR_DEFERS) {
+        Any& flags = R(inst->a);
+        if (flags.type.base == Type::STRING || flags.object()) flags = Any();
+        flags.type.base = Type::INT;
+        flags.value.Int = 0;
+        NEXT();
+    }
+    HANDLER(MARK_DEFER) {
+        R(inst->a).value.Int |= 1LL << inst->b;
+        NEXT();
+    }
+    HANDLER(SKIP_DEFER) {
+        if (!(R(inst->b).value.Int & (1LL << inst->c))) ip = code + inst->a;
+        NEXT();
+    }
+
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+}
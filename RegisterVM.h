@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "RegisterCode.h"
+#include "Interpreter.h"
+
+using namespace std;
+
+// Runs the code from the RegisterCompiler. The frames of all calls sit in one vector of registers,
+// a callee's frame starts where the caller put the arguments.
+// With GCC and Clang the dispatch jumps straight from one handler to the next (computed goto),
+// everywhere else it's a switch in a loop.
+struct RegisterVM {
+    struct Frame {
+        RegisterFunction* fn;
+        RInstruction* ip;
+        int base;
+        int result;     // register in the caller's frame that gets the return value
+    };
+
+    Interpreter& interp;
+    RegisterProgram* program;
+    vector<Any> registers;
+    vector<Frame> frames;
+
+    RegisterVM(Interpreter& i, RegisterProgram* p);
+
+    void run();
+
+    Any* findName(const string& name);
+};
@@ -0,0 +1,280 @@
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "Resolver.h"
+#include "Stmt.h"
+#include "Expr.h"
+#include "error.h"
+
+using namespace std;
+
+Resolver::Resolver(unordered_map<string, Struct*>& s, unordered_map<string, Enum*>& e, unordered_map<string, Func*>& f)
+    : structs(s), enums(e), functions(f) {}
+
+void Resolver::resolve(vector<Stmt*>& stmts)
+{
+    pushScope();
+    for (auto stmt : stmts) resolveStmt(stmt);
+    popScope();
+}
+
+void Resolver::pushScope()
+{
+    scopes.push_back({});
+}
+
+void Resolver::popScope()
+{
+    scopes.pop_back();
+}
+
+void Resolver::declare(string& name, ImprovedType type)
+{
+    scopes.back().insert_or_assign(name, type);
+}
+
+ImprovedType* Resolver::lookup(string& name)
+{
+    for (int i = scopes.size() - 1; i >= 0; i--) {
+        auto found = scopes[i].find(name);
+        if (found != scopes[i].end()) return &found->second;
+    }
+    return nullptr;
+}
+
+Struct* Resolver::structOf(ImprovedType& type)
+{
+    if (type.base != Type::STRUCT || (type.flags & Flags::ARRAY) || !type.info) return nullptr;
+
+    auto found = structs.find(*(string*) type.info);
+    if (found == structs.end()) return nullptr;
+
+    return found->second;
+}
+
+// Returns the Struct definition the expression evaluates to, if we can know it before running.
+Struct* Resolver::structOf(Expr* expr)
+{
+    if (isIdent(expr)) {
+        ImprovedType* type = lookup(asIdent(expr)->name);
+        return type ? structOf(*type) : nullptr;
+    }
+
+    if (isMember(expr)) {
+        Member* member = asMember(expr);
+        return structOf(member->defn->memberTypes[member->index]);
+    }
+
+    return nullptr;
+}
+
+// The parser stores the name after a '.' as a string constant in the access Expr.
+const string* Resolver::memberName(Expr* access)
+{
+    if (!isConst(access)) return nullptr;
+
+    Const* c = asConst(access);
+    if (c->any.type.base != Type::STRING) return nullptr;
+
+    return &c->any.value.String->text;
+}
+
+bool Resolver::isSelfTailCall(Expr* expr)
+{
+    if (!currentFunc || loopDepth > 0) return false;
+
+    // Everything left of the call gets evaluated before it, so we can keep those values around
+    // and apply the operators after the last call returned.
+    while (isBinary(expr)) expr = asBinary(expr)->right;
+
+    if (!isCall(expr)) return false;
+    Call* call = asCall(expr);
+
+    if (!isIdent(call->name)) return false;
+    string& name = asIdent(call->name)->name;
+
+    auto found = functions.find(name);
+    if (found == functions.end() || found->second != currentFunc) return false;
+
+    return call->args.size() == currentFunc->params.size();
+}
+
+// Jumping back to the start of a function would run its defers at the wrong time
+bool Resolver::containsDefer(Stmt* stmt)
+{
+    if (!stmt) return false;
+
+    switch(stmt->kind) {
+        case (ST::DEFER): return true;
+        case (ST::BLOCK): {
+            for (auto s : asBlock(stmt)->stmts) if (containsDefer(s)) return true;
+            return false;
+        }
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            return containsDefer(i->ifBody) || containsDefer(i->elseBody);
+        }
+        case (ST::FOR):     return containsDefer(asFor(stmt)->body);
+        case (ST::WHILE):   return containsDefer(asWhile(stmt)->body);
+        default:            return false;
+    }
+}
+
+void Resolver::resolveStmt(Stmt* stmt)
+{
+    if (!stmt) return;
+
+    switch(stmt->kind) {
+        case (ST::STMT): INTERNAL_ERROR("We shouldn't have wild normal Stmts running around but here we are.");
+        case (ST::DECL): {
+            Decl* decl = asDecl(stmt);
+            if (decl->expr) decl->expr = resolveExpr(decl->expr);
+            declare(decl->name, decl->type);
+        } break;
+        case (ST::BLOCK): {
+            pushScope();
+            for (auto s : asBlock(stmt)->stmts) resolveStmt(s);
+            popScope();
+        } break;
+        case (ST::STRUCT):
+        case (ST::ENUM):
+        case (ST::CONTINUE):
+        case (ST::BREAK): break;
+        case (ST::FUNC): {
+            Func* func = asFunc(stmt);
+            if (!func->body) break;
+
+            Func* outerFunc = currentFunc;
+            int outerLoopDepth = loopDepth;
+            vector<Return*> outerTailCalls;
+            swap(outerTailCalls, tailCalls);
+
+            currentFunc = func;
+            loopDepth = 0;
+
+            pushScope();
+            for (auto param : func->params) declare(param->name, param->type);
+            resolveStmt(func->body);
+            popScope();
+
+            if (!containsDefer(func->body)) {
+                for (auto r : tailCalls) r->tailCall = true;
+            }
+
+            currentFunc = outerFunc;
+            loopDepth = outerLoopDepth;
+            swap(outerTailCalls, tailCalls);
+        } break;
+        case (ST::RETURN): {
+            Return* r = asReturn(stmt);
+            r->expr = resolveExpr(r->expr);
+            if (isSelfTailCall(r->expr)) tailCalls.push_back(r);
+        } break;
+        case (ST::IF): {
+            If* i = asIf(stmt);
+            i->condition = resolveExpr(i->condition);
+            resolveStmt(i->ifBody);
+            resolveStmt(i->elseBody);
+        } break;
+        case (ST::EXPRSTMT): {
+            ExprStmt* exprStmt = asExprStmt(stmt);
+            exprStmt->expr = resolveExpr(exprStmt->expr);
+        } break;
+        case (ST::DEFER): {
+            resolveStmt(asDefer(stmt)->block);
+        } break;
+        case (ST::FOR): {
+            For* forLoop = asFor(stmt);
+            forLoop->start = resolveExpr(forLoop->start);
+            if (forLoop->end) forLoop->end = resolveExpr(forLoop->end);
+
+            pushScope();
+            loopDepth++;
+            declare(forLoop->it, ImprovedType(Type::INT));
+            resolveStmt(forLoop->body);
+            loopDepth--;
+            popScope();
+        } break;
+        case (ST::WHILE): {
+            While* whileLoop = asWhile(stmt);
+            whileLoop->condition = resolveExpr(whileLoop->condition);
+            loopDepth++;
+            resolveStmt(whileLoop->body);
+            loopDepth--;
+        } break;
+        case (ST::ASSIGN): {
+            Assign* assign = asAssign(stmt);
+            assign->right = resolveExpr(assign->right);
+        } break;
+        case (ST::SET): {
+            Set* set = asSet(stmt);
+            set->expr  = resolveExpr(set->expr);
+            set->value = resolveExpr(set->value);
+
+            const string* name = memberName(set->access);
+            Struct* defn = structOf(set->expr);
+            if (name && defn && defn->memberPositions.contains(*name)) {
+                set->defn  = defn;
+                set->index = defn->memberPositions[*name];
+            }
+        } break;
+    }
+}
+
+Expr* Resolver::resolveExpr(Expr* expr)
+{
+    switch(expr->kind) {
+        case(ET::EXPR):     INTERNAL_ERROR("We shouldn't have wild normal Exprs running around but here we are.");
+        case(ET::CONST):
+        case(ET::IDENT):
+        case(ET::MEMBER):
+        case(ET::SHARED):
+        case(ET::SHARED_SCOPE): return expr;
+        case(ET::BINARY): {
+            Binary* binary = asBinary(expr);
+            binary->left  = resolveExpr(binary->left);
+            binary->right = resolveExpr(binary->right);
+            return expr;
+        }
+        case(ET::UNARY): {
+            Unary* unary = asUnary(expr);
+            unary->expr = resolveExpr(unary->expr);
+            return expr;
+        }
+        case(ET::CALL): {
+            Call* call = asCall(expr);
+            for (auto& arg : call->args) arg = resolveExpr(arg);
+            return expr;
+        }
+        case(ET::GET): {
+            Get* get = asGet(expr);
+            get->expr   = resolveExpr(get->expr);
+            get->access = resolveExpr(get->access);
+
+            const string* name = memberName(get->access);
+            if (!name) return expr;
+
+            // Color.BLUE -> 3, unless Color got shadowed by a variable
+            if (isIdent(get->expr)) {
+                string& enumName = asIdent(get->expr)->name;
+                if (!lookup(enumName) && enums.contains(enumName)) {
+                    Enum* en = enums[enumName];
+                    if (!en->values.contains(*name)) error("Enum " + enumName + " has no value " + *name);
+
+                    long long int value = en->values[*name];
+                    return new Const(value);
+                }
+            }
+
+            Struct* defn = structOf(get->expr);
+            if (defn && defn->memberPositions.contains(*name)) {
+                return new Member(get->expr, *name, defn, defn->memberPositions[*name]);
+            }
+            return expr;
+        }
+    }
+
+    INTERNAL_ERROR("NO EXPR MATCHED THIS SWITCH");
+    return expr;
+}
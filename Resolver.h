@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "Stmt.h"
+#include "Expr.h"
+
+using namespace std;
+
+// Semantic pass that runs after the Interpreter has set up its tables.
+// It turns Enum.VALUE into integer constants and struct.member into Member nodes
+// so the hot path doesn't have to hash any strings for them.
+struct Resolver {
+    unordered_map<string, Struct*>& structs;
+    unordered_map<string, Enum*>& enums;
+    unordered_map<string, Func*>& functions;
+
+    vector<unordered_map<string, ImprovedType>> scopes;
+
+    // For finding self recursive tail calls
+    Func* currentFunc = nullptr;
+    int loopDepth = 0;
+    vector<Return*> tailCalls;
+
+    Resolver(unordered_map<string, Struct*>& s, unordered_map<string, Enum*>& e, unordered_map<string, Func*>& f);
+
+    void resolve(vector<Stmt*>& stmts);
+
+    void pushScope();
+    void popScope();
+    void declare(string& name, ImprovedType type);
+    ImprovedType* lookup(string& name);
+
+    Struct* structOf(ImprovedType& type);
+    Struct* structOf(Expr* expr);
+    const string* memberName(Expr* access);
+
+    bool isSelfTailCall(Expr* expr);
+    bool containsDefer(Stmt* stmt);
+
+    void resolveStmt(Stmt* stmt);
+    Expr* resolveExpr(Expr* expr);
+};
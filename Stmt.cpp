@@ -2,6 +2,7 @@
 #include <vector>
 #include <sstream>
 #include <tuple>
+#include <algorithm>
 
 #include "Stmt.h"
 #include "Token.h"
@@ -79,6 +80,17 @@ ostream &operator<<(ostream &out, const Stmt *stmt)
     return out << "UNKNOWN STMT: ";
 }
 
+void* Stmt::operator new(size_t size)
+{
+    Memory::allocated(Memory::site(MemoryKind::AST), size);
+    return ::operator new(size);
+}
+
+void Stmt::operator delete(void* memory)
+{
+    ::operator delete(memory);
+}
+
 
 /*
 Decl::Decl(string n, Type t, TypeFlags f) : name(n), type(t, f) {
@@ -172,6 +184,31 @@ Struct::Struct(string n, Block *b) : name(n), body(b)
     }
 }
 
+void Struct::layOut()
+{
+    int count = memberTypes.size();
+    memberOffsets.resize(count);
+    memberWidths.resize(count);
+    boxedMembers.clear();
+
+    int offset = 0;
+    int align = 1;
+    for (int i = 0; i < count; i++) {
+        int width = packedWidth(memberTypes[i].base);
+        int bytes = width ? width : sizeof(Any);
+        int alignment = width ? width : alignof(Any);
+
+        offset = (offset + alignment - 1) / alignment * alignment;
+        memberOffsets[i] = offset;
+        memberWidths[i] = width;
+        if (!width) boxedMembers.push_back(i);
+
+        offset += bytes;
+        align = std::max(align, alignment);
+    }
+    size = (offset + align - 1) / align * align;
+}
+
 ostream &operator<<(ostream &out, const Struct *stmt)
 {
     return out << stmt->name << " :: Struct" << stmt->body << endl;
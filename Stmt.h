@@ -38,6 +38,10 @@ ostream& operator<<(ostream& out, const StmtType kind);
 struct Stmt {
     StmtType kind = ST::STMT;
     Token tk; // For Debug purposes
+
+    // Counted like Expr
+    static void* operator new(size_t size);
+    static void operator delete(void* memory);
 };
 
 ostream& operator<<(ostream& out, const Stmt* stmt);
@@ -72,10 +76,20 @@ struct Struct : Stmt {
     string name;
     Block* body;
 
-    // The Position in the vector represents where the value will be saved in MyStruct
+    // The position is the index of the member in memberTypes and the other vectors below
     unordered_map<string, int> memberPositions;
     vector<ImprovedType> memberTypes;
+
+    // Where the members sit behind a MyStruct, like a C compiler would put them: each one at a multiple
+    // of its own size, numbers unboxed (memberWidths, 0 if it's an Any) and the rest as Anys.
+    // layOut works it out the first time one gets made, memberTypes are final by then.
+    vector<int> memberOffsets;
+    vector<int> memberWidths;
+    vector<int> boxedMembers;   // the indices of the Anys
+    int size = -1;              // bytes behind the MyStruct, -1 until laid out
+
     Struct(string n, Block* b);
+    void layOut();
 };
 
 ostream& operator<<(ostream& out, const Struct* stmt);
@@ -95,6 +109,9 @@ struct Func : Stmt {
     Block* body;
     ImprovedType returnType;
 
+    // Counted by the Interpreter when it has a Jit to hand hot functions to
+    long long calls = 0;
+
     Func(string n, vector<Decl*> p, ImprovedType t, Block* b);
 };
 
@@ -103,6 +120,10 @@ ostream& operator<<(ostream& out, const Func* func);
 struct Return : Stmt {
     Expr* expr;
 
+    // Set by the Resolver when expr ends in a call to the function we are in.
+    // The call can sit at the end of a chain of Binarys, like x * factorial(x - 1).
+    bool tailCall = false;
+
     Return (Expr* e);
 };
 
@@ -141,6 +162,9 @@ struct For : Stmt {
     Expr* end;
     Stmt* body;
 
+    // Hoisted out of the body by the LoopOptimizer, evaluated before the first iteration
+    vector<Decl*> invariants;
+
     For(string i, Expr* s, Expr* e, Stmt* b);
     For(string i, Expr* array, Stmt* b);
 };
@@ -151,6 +175,14 @@ struct While : Stmt {
     Expr* condition;
     Stmt* body;
 
+    // Hoisted out by the LoopOptimizer. The condition always runs at least once,
+    // so its invariants get evaluated before the loop, the body ones before the first iteration.
+    vector<Decl*> conditionInvariants;
+    vector<Decl*> invariants;
+
+    // Iterations the Interpreter ran, once there are enough the Jit takes over the rest of the loop
+    long long backEdges = 0;
+
     While(Expr* c, Stmt* b);
 };
 
@@ -170,6 +202,13 @@ struct Set : Stmt {
     Expr* access;
     Expr* value;
 
+    // Filled in by the Resolver when expr is known to be a struct
+    Struct* defn = nullptr;
+    int index = -1;
+
+    // For everything the Resolver couldn't figure out
+    MemberCache cache;
+
     Set(Expr* e, Expr* access, Expr* v);
 };
 
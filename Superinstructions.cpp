@@ -0,0 +1,330 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "Superinstructions.h"
+#include "error.h"
+
+using namespace std;
+
+struct Pattern {
+    OPCODE op;
+    vector<OPCODE> parts;
+};
+
+#define UNPAREN(...) __VA_ARGS__
+static vector<Pattern> patterns = {
+#define SUPERINSTRUCTION(name, ops, body) { OPCODE::name, { UNPAREN ops } },
+#include "Superinstructions.inc"
+#undef SUPERINSTRUCTION
+};
+#undef UNPAREN
+
+static bool isJump(OPCODE op)
+{
+    return jumpOperand(op) >= 0;
+}
+
+// Calls and returns switch frames, they always stay on their own
+static bool staysAlone(OPCODE op)
+{
+    return op == OPCODE::CALL || op == OPCODE::TAIL_CALL || op == OPCODE::RETURN;
+}
+
+static vector<bool> jumpTargets(vector<Instruction>& code)
+{
+    vector<bool> isTarget(code.size() + 1, false);
+    for (auto& inst : code) {
+        switch (jumpOperand(inst.op)) {
+            case (0): isTarget[inst.a] = true; break;
+            case (1): isTarget[inst.b] = true; break;
+            default: break;
+        }
+    }
+    return isTarget;
+}
+
+void OpcodeProfile::collect()
+{
+    for (auto& [fn, counts] : executed) {
+        vector<Instruction>& code = fn->code;
+
+        vector<bool> isTarget = jumpTargets(code);
+
+        // A block ends at a jump, a call or where something jumps to. NOPs don't survive fusing anyway.
+        vector<OPCODE> block;
+        long long count = 0;
+        auto finish = [&]() {
+            if (block.size() > 1 && count > 0) blocks[block] += count;
+            block.clear();
+        };
+
+        for (int i = 0; i < code.size(); i++) {
+            OPCODE op = code[i].op;
+            if (isTarget[i]) finish();
+
+            if (staysAlone(op)) {
+                finish();
+                continue;
+            }
+            if (op == OPCODE::NOP) continue;
+
+            if (block.empty()) count = counts[i];
+            block.push_back(op);
+
+            if (isJump(op)) finish();
+        }
+        finish();
+    }
+    executed.clear();
+}
+
+// A line is how often the block ran and its instructions, like "1200 LOAD CONST ADD STORE"
+bool OpcodeProfile::load(const string& path)
+{
+    ifstream file(path);
+    if (!file) return false;
+
+    unordered_map<string, OPCODE> byName;
+    for (int i = 0; i <= (int) OPCODE::NOP; i++) byName[OPCODEtoString((OPCODE) i)] = (OPCODE) i;
+
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        stringstream words(line);
+        long long count;
+        words >> count;
+
+        vector<OPCODE> block;
+        string name;
+        while (words >> name) {
+            if (!byName.contains(name)) error("Unknown instruction " + name + " in " + path);
+            block.push_back(byName[name]);
+        }
+
+        blocks[block] += count;
+    }
+    return true;
+}
+
+void OpcodeProfile::save(const string& path)
+{
+    collect();
+
+    vector<pair<vector<OPCODE>, long long>> sorted(blocks.begin(), blocks.end());
+    sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.second > b.second; });
+
+    ofstream file(path);
+    if (!file) error("Can't write the profile to " + path);
+
+    file << "# How often these blocks of instructions ran, see Superinstructions.h" << endl;
+    for (auto& [block, count] : sorted) {
+        file << count;
+        for (auto op : block) file << " " << OPCODEtoString(op);
+        file << endl;
+    }
+}
+
+// A jump can only be the last part, since it decides where we go next
+static bool canFuse(const vector<OPCODE>& ops)
+{
+    int operands = 0;
+    for (int i = 0; i < ops.size(); i++) {
+        if (staysAlone(ops[i]) || ops[i] == OPCODE::NOP) return false;
+        if (isJump(ops[i]) && i != ops.size() - 1) return false;
+        operands += operandCount(ops[i]);
+    }
+    return operands <= 3;
+}
+
+// How many dispatches the block takes when fused the way fuseSuperinstructions does it
+static int dispatches(const vector<OPCODE>& block, const vector<vector<OPCODE>>& chosen)
+{
+    int count = 0;
+    for (int i = 0; i < block.size(); count++) {
+        int longest = 1;
+        for (auto& ops : chosen) {
+            if (ops.size() <= longest || i + ops.size() > block.size()) continue;
+            if (equal(ops.begin(), ops.end(), block.begin() + i)) longest = ops.size();
+        }
+        i += longest;
+    }
+    return count;
+}
+
+void generateSuperinstructions(OpcodeProfile& profile, ostream& out, int limit)
+{
+    const int longest = 4;
+
+    // Every piece of a block could be one, it remembers the blocks it's in
+    map<vector<OPCODE>, vector<int>> candidates;
+    vector<pair<vector<OPCODE>, long long>> blocks(profile.blocks.begin(), profile.blocks.end());
+
+    for (int b = 0; b < blocks.size(); b++) {
+        auto& block = blocks[b].first;
+        for (int start = 0; start < block.size(); start++) {
+            for (int length = 2; length <= longest && start + length <= block.size(); length++) {
+                vector<OPCODE> ops(block.begin() + start, block.begin() + start + length);
+                if (!canFuse(ops)) continue;
+
+                auto& in = candidates[ops];
+                if (in.empty() || in.back() != b) in.push_back(b);
+            }
+        }
+    }
+
+    // Greedy, the one that saves the most on top of the ones we already have wins.
+    // Overlapping ones don't add up, a loop body shows up once for every place it could start.
+    // The ones that barely ran aren't worth a case in the VM
+    long long total = 0;
+    for (auto& [block, count] : blocks) total += count * block.size();
+
+    vector<vector<OPCODE>> chosen;
+    vector<long long> saved;
+
+    while (chosen.size() < limit) {
+        const vector<OPCODE>* best = nullptr;
+        long long bestSaved = 0;
+
+        for (auto& [ops, in] : candidates) {
+            auto with = chosen;
+            with.push_back(ops);
+
+            long long savings = 0;
+            for (int b : in) {
+                savings += blocks[b].second * (dispatches(blocks[b].first, chosen) - dispatches(blocks[b].first, with));
+            }
+            if (savings > bestSaved) {
+                best = &ops;
+                bestSaved = savings;
+            }
+        }
+
+        if (!best || bestSaved * 1000 < total) break;
+        chosen.push_back(*best);
+        saved.push_back(bestSaved);
+        candidates.erase(*best);
+    }
+
+    out << "// Generated by JaiCompiler -superinstructions from a training profile, see Superinstructions.h" << endl;
+    out << "// SUPERINSTRUCTION(name, (parts), body)    dispatches it saved in training" << endl;
+
+    const char* fields[] = { "inst.a", "inst.b", "inst.c" };
+    for (int i = 0; i < chosen.size(); i++) {
+        string name = "S";
+        string parts;
+        string body;
+        int next = 0;
+
+        for (auto op : chosen[i]) {
+            string opName = OPCODEtoString(op);
+            name += "_" + opName;
+            if (!parts.empty()) parts += ", ";
+            parts += "OPCODE::" + opName;
+
+            body += " DO_" + opName + "(";
+            for (int n = 0; n < operandCount(op); n++) {
+                if (n > 0) body += ", ";
+                body += fields[next++];
+            }
+            body += ")";
+        }
+
+        out << "SUPERINSTRUCTION(" << name << ", (" << parts << ")," << body << ")    // " << saved[i] << endl;
+    }
+}
+
+static bool matches(vector<Instruction>& code, int at, Pattern& pattern, vector<bool>& isTarget)
+{
+    if (at + pattern.parts.size() > code.size()) return false;
+
+    for (int i = 0; i < pattern.parts.size(); i++) {
+        if (code[at + i].op != pattern.parts[i]) return false;
+        if (i > 0 && isTarget[at + i]) return false;
+    }
+    return true;
+}
+
+static void retarget(Instruction& inst, vector<int>& newIndex)
+{
+    switch (jumpOperand(inst.op)) {
+        case (0): inst.a = newIndex[inst.a]; break;
+        case (1): inst.b = newIndex[inst.b]; break;
+        default: break;
+    }
+}
+
+void fuseSuperinstructions(BytecodeFunction* fn)
+{
+    vector<Instruction>& code = fn->code;
+
+    vector<bool> isTarget = jumpTargets(code);
+
+    // First decide where every instruction ends up, the longest pattern wins.
+    // NOPs go away, jumps to them go to whatever comes next.
+    vector<int> newIndex(code.size() + 1);
+    vector<int> matched(code.size(), -1);
+    int count = 0;
+
+    for (int i = 0; i < code.size();) {
+        newIndex[i] = count;
+
+        if (code[i].op == OPCODE::NOP) {
+            i++;
+            continue;
+        }
+
+        int best = -1;
+        for (int p = 0; p < patterns.size(); p++) {
+            if (best >= 0 && patterns[p].parts.size() <= patterns[best].parts.size()) continue;
+            if (matches(code, i, patterns[p], isTarget)) best = p;
+        }
+
+        if (best < 0) {
+            i++;
+        } else {
+            matched[i] = best;
+            int length = patterns[best].parts.size();
+            for (int k = 1; k < length; k++) newIndex[i + k] = count;
+            i += length;
+        }
+        count++;
+    }
+    newIndex[code.size()] = count;
+
+    vector<Instruction> fused;
+    for (int i = 0; i < code.size();) {
+        if (code[i].op == OPCODE::NOP) {
+            i++;
+            continue;
+        }
+
+        if (matched[i] < 0) {
+            Instruction inst = code[i++];
+            retarget(inst, newIndex);
+            fused.push_back(inst);
+            continue;
+        }
+
+        Pattern& pattern = patterns[matched[i]];
+        Instruction super = { pattern.op };
+        int* fields[] = { &super.a, &super.b, &super.c };
+        int next = 0;
+
+        for (int k = 0; k < pattern.parts.size(); k++) {
+            Instruction part = code[i + k];
+            retarget(part, newIndex);
+
+            int operands[] = { part.a, part.b };
+            for (int n = 0; n < operandCount(part.op); n++) *fields[next++] = operands[n];
+        }
+
+        fused.push_back(super);
+        i += pattern.parts.size();
+    }
+
+    code = fused;
+}
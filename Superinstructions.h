@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+
+#include "Bytecode.h"
+
+using namespace std;
+
+// Superinstructions are sequences of instructions that run one after the other a lot,
+// like LOAD CONST ADD STORE in a loop body or LOAD CONST LT JUMP_IF_TRUE at the end of a while loop.
+// The VM runs a whole sequence in one dispatch.
+//
+// Which ones we have comes from training runs:
+//     JaiCompiler -profile=ops.profile program.jai
+//     JaiCompiler -superinstructions=ops.profile > Superinstructions.inc
+// and a rebuild. The profile adds up over runs, so several programs can train it.
+
+// Counts how often every instruction ran, then turns that into the straight runs of
+// instructions nothing jumps into and how often each ran
+struct OpcodeProfile {
+    map<vector<OPCODE>, long long> blocks;
+    unordered_map<BytecodeFunction*, vector<long long>> executed;
+
+    BytecodeFunction* lastFn = nullptr;
+    vector<long long>* lastCounts = nullptr;
+
+    void record(BytecodeFunction* fn, int ip)
+    {
+        if (fn != lastFn) {
+            lastFn = fn;
+            lastCounts = &executed[fn];
+            lastCounts->resize(fn->code.size());
+        }
+        (*lastCounts)[ip]++;
+    }
+
+    void collect();
+
+    bool load(const string& path);
+    void save(const string& path);
+};
+
+// Picks the sequences that save the most dispatches over the blocks of the profile and writes them as Superinstructions.inc
+void generateSuperinstructions(OpcodeProfile& profile, ostream& out, int limit = 32);
+
+// Replaces the sequences in the code of fn that have a superinstruction, unless something jumps into the middle of them
+void fuseSuperinstructions(BytecodeFunction* fn);
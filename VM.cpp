@@ -0,0 +1,316 @@
+#include <vector>
+#include <string>
+
+#include "VM.h"
+#include "error.h"
+
+using namespace std;
+
+VM::VM(Interpreter& i, BytecodeProgram* p) : interp(i), program(p) {}
+
+// Variables of the callers, the newest one wins like in the Interpreter's variables
+Any* VM::findName(const string& name)
+{
+    for (int i = frames.size() - 2; i >= 0; i--) {
+        auto& slotOf = frames[i].fn->slotOf;
+        auto it = slotOf.find(name);
+        if (it != slotOf.end()) return &stack[frames[i].base + it->second];
+    }
+
+    if (interp.variables.contains(name)) return &interp.variables[name];
+
+    return nullptr;
+}
+
+void VM::binary(OP op)
+{
+    // The operands are temporaries, a string on the left can grow in place
+    Any& left = stack[stack.size() - 2];
+    Any result = op == OP::PLUS && left.type.base == Type::STRING ? left.append(stack.back()) : interp.applyBinary(op, left, stack.back());
+    stack.pop_back();
+    stack.back() = std::move(result);
+}
+
+// What every instruction does, one macro each, so superinstructions can string them together.
+// They can use fn, base, ip and stack of run and take their operands as arguments.
+#define DO_CONST(x)         { stack.push_back(fn->constants[x]); }
+#define DO_LOAD(x)          { stack.push_back(stack[base + (x)]); }
+#define DO_STORE(x) { \
+    stack[base + (x)] = stack.back(); \
+    stack.pop_back(); \
+}
+#define DO_LOAD_NAME(x) { \
+    const string& name = fn->names[x]; \
+    Any* any = findName(name); \
+    if (any) { \
+        stack.push_back(*any); \
+    } else if (interp.constants.contains(name)) { \
+        stack.push_back(interp.constants[name]); \
+    } else { \
+        error("Undefined Variable"); \
+    } \
+}
+#define DO_STORE_NAME(x) { \
+    Any* any = findName(fn->names[x]); \
+    if (!any) error("Undefined Variable"); \
+    *any = stack.back(); \
+    stack.pop_back(); \
+}
+#define DO_POP()            { stack.pop_back(); }
+#define DO_DUP()            { stack.push_back(stack.back()); }
+
+#define INT_MATH(intOp, slow) { \
+    Any& left = stack[stack.size() - 2]; \
+    Any& right = stack.back(); \
+    if (left.type.base == Type::INT && right.type.base == Type::INT) { \
+        left.value.Int = intOp(left.value.Int, right.value.Int); \
+        stack.pop_back(); \
+    } else { \
+        binary(slow); \
+    } \
+}
+
+#define INT_COMPARE(op, slow) { \
+    Any& left = stack[stack.size() - 2]; \
+    Any& right = stack.back(); \
+    if (left.type.base == Type::INT && right.type.base == Type::INT) { \
+        bool result = left.value.Int op right.value.Int; \
+        left.type = Type::BOOL; \
+        left.value.Bool = result; \
+        stack.pop_back(); \
+    } else { \
+        binary(slow); \
+    } \
+}
+
+#define DO_ADD()            INT_MATH(wrapAdd, OP::PLUS)
+#define DO_SUB()            INT_MATH(wrapSub, OP::MINUS)
+#define DO_MUL()            INT_MATH(wrapMul, OP::MULTIPLY)
+#define DO_DIV()            { binary(OP::DIVIDE); }
+#define DO_EQ()             INT_COMPARE(==, OP::EQUAL)
+#define DO_NE()             INT_COMPARE(!=, OP::NOT_EQUAL)
+#define DO_LT()             INT_COMPARE(<, OP::LESS)
+#define DO_LE()             INT_COMPARE(<=, OP::LESS_EQUAL)
+#define DO_GT()             INT_COMPARE(>, OP::GREATER)
+#define DO_GE()             INT_COMPARE(>=, OP::GREATER_EQUAL)
+#define DO_AND()            { binary(OP::AND); }
+#define DO_OR()             { binary(OP::OR); }
+#define DO_NEG()            { stack.back() = stack.back().neg(); }
+#define DO_NOT()            { stack.back() = stack.back().Not(); }
+#define DO_CONCAT(x) { \
+    Any result = Any::concat(&stack[stack.size() - (x)], (x)); \
+    stack.resize(stack.size() - (x) + 1); \
+    stack.back() = std::move(result); \
+}
+
+#define DO_JUMP(x)          { ip = (x); }
+#define DO_JUMP_IF_FALSE(x) { \
+    bool truthy = interp.isTruthy(stack.back()); \
+    stack.pop_back(); \
+    if (!truthy) ip = (x); \
+}
+#define DO_JUMP_IF_TRUE(x) { \
+    bool truthy = interp.isTruthy(stack.back()); \
+    stack.pop_back(); \
+    if (truthy) ip = (x); \
+}
+
+#define DO_PRINTF() { \
+    interp.callPrintf(stack.back()); \
+    stack.back() = Any(); \
+}
+
+#define DO_NEW_STRUCT(x, y) { \
+    Any any; \
+    any.type = fn->types[y]; \
+    any.value.Ptr = MyStruct::make(fn->structs[x]); \
+    stack.push_back(any); \
+}
+#define DO_NEW_ARRAY(x) { \
+    Any any; \
+    any.type = fn->types[x]; \
+    any.value.Ptr = new MyArray(ImprovedType(any.type.base, 0), stack.back().value.Int); \
+    stack.back() = any; \
+}
+#define DO_GET() { \
+    Any result = interp.getAccess(stack[stack.size() - 2], stack.back()); \
+    stack.pop_back(); \
+    stack.back() = std::move(result); \
+}
+#define DO_SET() { \
+    int top = stack.size(); \
+    interp.setAccess(stack[top - 3], stack[top - 2], std::move(stack[top - 1])); \
+    stack.resize(top - 3); \
+}
+#define DO_GET_MEMBER(x) { \
+    Any result = interp.getMember(stack.back(), fn->members[x].member); \
+    stack.back() = std::move(result); \
+}
+#define DO_SET_MEMBER(x) { \
+    MemberRef& ref = fn->members[x]; \
+    Any& object = stack[stack.size() - 2]; \
+    \
+    if (object.type.base == Type::STRUCT && ((MyStruct*) object.value.Ptr)->defn == ref.defn) { \
+        ((MyStruct*) object.value.Ptr)->set(ref.index, std::move(stack.back())); \
+    } else if (object.type.base == Type::STRUCT && !(object.type.flags & Flags::ARRAY)) { \
+        object.setStructMember(ref.name, std::move(stack.back()), &ref.cache); \
+    } else { \
+        Any access; \
+        access.type.base = Type::STRING; \
+        access.value.String = JaiString::intern(ref.name); \
+        interp.setAccess(object, access, std::move(stack.back())); \
+    } \
+    stack.resize(stack.size() - 2); \
+}
+
+#define DO_FOR_CHECK(x, y) { \
+    Any& index = stack[base + (x)]; \
+    Any& end = stack[base + (x) + 1]; \
+    \
+    bool more; \
+    if (isIntegerType(index.type.base) && isIntegerType(end.type.base)) more = index.value.Int < end.value.Int; \
+    else more = interp.isTruthy(index.less(end)); \
+    \
+    if (!more) ip = (y); \
+}
+#define DO_FOR_NEXT(x, y) { \
+    Any& index = stack[base + (x)]; \
+    Any& end = stack[base + (x) + 1]; \
+    \
+    bool more; \
+    if (isIntegerType(index.type.base) && isIntegerType(end.type.base)) { \
+        more = ++index.value.Int < end.value.Int; \
+    } else { \
+        Any one; \
+        one.type.base = Type::INT; \
+        one.value.Int = 1; \
+        index = index.add(one); \
+        more = interp.isTruthy(index.less(end)); \
+    } \
+    \
+    if (more) ip = (y); \
+}
+
+#define DO_CLEAR_DEFERS(x) { \
+    Any& flags = stack[base + (x)]; \
+    flags.type.base = Type::INT; \
+    flags.value.Int = 0; \
+}
+#define DO_MARK_DEFER(x, y) { stack[base + (x)].value.Int |= 1LL << (y); }
+#define DO_TEST_DEFER(x, y) { \
+    Any any; \
+    any.type.base = Type::BOOL; \
+    any.value.Bool = stack[base + (x)].value.Int & (1LL << (y)); \
+    stack.push_back(any); \
+}
+
+void VM::run()
+{
+    if (profile) execute<true>();
+    else execute<false>();
+}
+
+// With profiling on, every instruction is counted, see OpcodeProfile
+template <bool profiling>
+void VM::execute()
+{
+    BytecodeFunction* fn = program->main;
+    int base = 0;
+    int ip = 0;
+
+    stack.resize(fn->slots);
+    frames.push_back({ fn, 0, 0 });
+    Memory::function = &fn->name;
+
+    while (true) {
+        if constexpr (profiling) profile->record(fn, ip);
+
+        Instruction& inst = fn->code[ip++];
+
+        switch (inst.op) {
+            case (OPCODE::CONST):           DO_CONST(inst.a) break;
+            case (OPCODE::LOAD):            DO_LOAD(inst.a) break;
+            case (OPCODE::STORE):           DO_STORE(inst.a) break;
+            case (OPCODE::LOAD_NAME):       DO_LOAD_NAME(inst.a) break;
+            case (OPCODE::STORE_NAME):      DO_STORE_NAME(inst.a) break;
+            case (OPCODE::POP):             DO_POP() break;
+            case (OPCODE::DUP):             DO_DUP() break;
+
+            case (OPCODE::ADD):             DO_ADD() break;
+            case (OPCODE::SUB):             DO_SUB() break;
+            case (OPCODE::MUL):             DO_MUL() break;
+            case (OPCODE::DIV):             DO_DIV() break;
+            case (OPCODE::EQ):              DO_EQ() break;
+            case (OPCODE::NE):              DO_NE() break;
+            case (OPCODE::LT):              DO_LT() break;
+            case (OPCODE::LE):              DO_LE() break;
+            case (OPCODE::GT):              DO_GT() break;
+            case (OPCODE::GE):              DO_GE() break;
+            case (OPCODE::AND):             DO_AND() break;
+            case (OPCODE::OR):              DO_OR() break;
+            case (OPCODE::NEG):             DO_NEG() break;
+            case (OPCODE::NOT):             DO_NOT() break;
+            case (OPCODE::CONCAT):          DO_CONCAT(inst.a) break;
+
+            case (OPCODE::JUMP):            DO_JUMP(inst.a) break;
+            case (OPCODE::JUMP_IF_FALSE):   DO_JUMP_IF_FALSE(inst.a) break;
+            case (OPCODE::JUMP_IF_TRUE):    DO_JUMP_IF_TRUE(inst.a) break;
+
+            case (OPCODE::CALL): {
+                frames.back().ip = ip;
+
+                fn = program->functions[inst.a];
+                base = stack.size() - inst.b;
+                ip = 0;
+
+                stack.resize(base + fn->slots);
+                frames.push_back({ fn, 0, base });
+                Memory::function = &fn->name;
+            } break;
+            case (OPCODE::TAIL_CALL): {
+                int args = stack.size() - inst.a;
+                for (int i = 0; i < inst.a; i++) stack[base + i] = stack[args + i];
+                stack.resize(args);
+                ip = 0;
+            } break;
+            case (OPCODE::PRINTF):          DO_PRINTF() break;
+            case (OPCODE::RETURN): {
+                Any result = stack.back();
+                stack.resize(base);
+                frames.pop_back();
+
+                if (frames.empty()) {
+                    Memory::function = nullptr;
+                    return;
+                }
+
+                Frame& frame = frames.back();
+                fn = frame.fn;
+                ip = frame.ip;
+                base = frame.base;
+                stack.push_back(result);
+                Memory::function = &fn->name;
+            } break;
+
+            case (OPCODE::NEW_STRUCT):      DO_NEW_STRUCT(inst.a, inst.b) break;
+            case (OPCODE::NEW_ARRAY):       DO_NEW_ARRAY(inst.a) break;
+            case (OPCODE::GET):             DO_GET() break;
+            case (OPCODE::SET):             DO_SET() break;
+            case (OPCODE::GET_MEMBER):      DO_GET_MEMBER(inst.a) break;
+            case (OPCODE::SET_MEMBER):      DO_SET_MEMBER(inst.a) break;
+
+            case (OPCODE::FOR_CHECK):       DO_FOR_CHECK(inst.a, inst.b) break;
+            case (OPCODE::FOR_NEXT):        DO_FOR_NEXT(inst.a, inst.b) break;
+
+            case (OPCODE::CLEAR_DEFERS):    DO_CLEAR_DEFERS(inst.a) break;
+            case (OPCODE::MARK_DEFER):      DO_MARK_DEFER(inst.a, inst.b) break;
+            case (OPCODE::TEST_DEFER):      DO_TEST_DEFER(inst.a, inst.b) break;
+
+            case (OPCODE::NOP): break;
+
+#define SUPERINSTRUCTION(name, ops, body) case (OPCODE::name): body break;
+#include "Superinstructions.inc"
+#undef SUPERINSTRUCTION
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "Bytecode.h"
+#include "Interpreter.h"
+#include "Superinstructions.h"
+
+using namespace std;
+
+// Runs the bytecode from the BytecodeCompiler on a value stack.
+// Every frame keeps its slots at the bottom of its part of the stack, the operands go on top.
+// The Interpreter is only used for the operations both engines share, so they behave the same.
+struct VM {
+    struct Frame {
+        BytecodeFunction* fn;
+        int ip;
+        int base;
+    };
+
+    Interpreter& interp;
+    BytecodeProgram* program;
+    vector<Any> stack;
+    vector<Frame> frames;
+    OpcodeProfile* profile = nullptr;
+
+    VM(Interpreter& i, BytecodeProgram* p);
+
+    void run();
+    template <bool profiling> void execute();
+
+    Any* findName(const string& name);
+    void binary(OP op);
+};
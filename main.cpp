@@ -1,13 +1,25 @@
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
 
 #include "Parser.h"
 #include "Expr.h"
 #include "Interpreter.h"
+#include "IRBuilder.h"
+#include "Bytecode.h"
+#include "VM.h"
+#include "Superinstructions.h"
+#include "RegisterCode.h"
+#include "RegisterVM.h"
+#include "Closure.h"
+#include "Jit.h"
+#include "CBackend.h"
+#include "AsmBackend.h"
 
 using namespace std;
 
-int Any::anyCount = 0;
 
 void anyTest()
 {
@@ -17,18 +29,269 @@ void anyTest()
 
     Any any;
     any.type = Type::STRING;
-    any.value.String = new string("Hello World");
+    any.value.String = JaiString::intern("Hello World");
 
     Any other = any;
 
     Any foo = any.add(other);
 
-    cout << "AnyCount = " << Any::anyCount << endl;
+    Memory::print(cout);
 }
 
-int main()
+// Prints the IR of every function and checks it instead of running the program
+void dumpIR(Interpreter& interp)
+{
+    interp.prepare();
+
+    IRBuilder builder(interp.functions, interp.constants, interp.structs);
+    IRModule* module = builder.build(interp.parser.statements);
+
+    cout << module;
+
+    for (auto fn : module->functions) {
+        for (auto& problem : verifyIR(fn)) cout << "IR error in " << fn->name << ": " << problem << endl;
+    }
+}
+
+// Compiles to bytecode and runs it on the VM, anything the compiler can't handle goes to the Interpreter.
+// With a profile the instructions aren't fused and their sequences get added to the profile.
+void runStackVM(Interpreter& interp, bool dump, bool fuse, const string& profile)
+{
+    cout << "Running: " << endl;
+
+    interp.prepare();
+
+    BytecodeCompiler compiler(interp.functions, interp.constants, interp.structs);
+    compiler.fuse = fuse && profile.empty();
+    BytecodeProgram* program = compiler.compile(interp.parser.statements);
+
+    if (dump) {
+        cout << program;
+        return;
+    }
+
+    if (!compiler.unsupported.empty()) {
+        cerr << "Bytecode doesn't support " << compiler.unsupported << ", using the Interpreter" << endl;
+        interp.callFunction(interp.main);
+        return;
+    }
+
+    OpcodeProfile counts;
+    if (!profile.empty()) counts.load(profile);
+
+    VM vm(interp, program);
+    if (!profile.empty()) vm.profile = &counts;
+    vm.run();
+
+    if (!profile.empty()) counts.save(profile);
+}
+
+void runRegisterVM(Interpreter& interp, bool dump)
+{
+    cout << "Running: " << endl;
+
+    interp.prepare();
+
+    RegisterCompiler compiler(interp.functions, interp.constants, interp.structs);
+    RegisterProgram* program = compiler.compile(interp.parser.statements);
+
+    if (dump) {
+        cout << program;
+        return;
+    }
+
+    if (!compiler.unsupported.empty()) {
+        cerr << "Bytecode doesn't support " << compiler.unsupported << ", using the Interpreter" << endl;
+        interp.callFunction(interp.main);
+        return;
+    }
+
+    RegisterVM vm(interp, program);
+    vm.run();
+}
+
+// Compiles every Stmt and Expr into a closure and runs those, there's nothing to dump
+void runClosures(Interpreter& interp)
+{
+    cout << "Running: " << endl;
+
+    interp.prepare();
+
+    ClosureRuntime runtime(interp);
+    ClosureCompiler compiler(interp.functions, interp.constants, interp.structs, &runtime);
+    ClosureFunction* main = compiler.compile(interp.parser.statements);
+
+    if (!compiler.unsupported.empty()) {
+        cerr << "Closures don't support " << compiler.unsupported << ", using the Interpreter" << endl;
+        interp.callFunction(interp.main);
+        return;
+    }
+
+    runtime.stack.resize(main->slots);
+    runtime.call(main, 0);
+}
+
+// jit compiles everything it can before running, tiered only what got hot in the Interpreter
+void runJit(Interpreter& interp, bool tiered, long long threshold)
+{
+    cout << "Running: " << endl;
+
+    interp.prepare();
+
+    if (!Jit::available()) cerr << "The Jit only runs on Linux x86-64, using the Interpreter" << endl;
+
+    Jit jit(interp.functions, interp.constants);
+    if (tiered) jit.threshold = threshold;
+    else jit.compileAll();
+
+    interp.jit = &jit;
+    interp.callFunction(interp.main);
+    interp.jit = nullptr;
+}
+
+// Writes the program as C to cPath, and builds exePath out of it unless that's empty
+void emitC(Interpreter& interp, const string& cPath, const string& exePath)
+{
+    interp.prepare();
+
+    CBackend backend(interp.functions, interp.constants, interp.structs, interp.enums);
+    string source = backend.compile(interp.main);
+    if (!backend.unsupported.empty()) error("C doesn't support " + backend.unsupported);
+
+    if (exePath.empty()) {
+        ofstream out(cPath);
+        if (!out) error("Can't write " + cPath);
+        out << source;
+    }
+    else if (!buildNative(source, cPath, exePath)) error("cc couldn't build " + exePath);
+}
+
+// Builds a native binary in the temp directory and runs that, the time includes cc
+void runC(Interpreter& interp)
+{
+    interp.prepare();
+
+    CBackend backend(interp.functions, interp.constants, interp.structs, interp.enums);
+    string source = backend.compile(interp.main);
+
+    filesystem::path dir = filesystem::temp_directory_path();
+    string exe = (dir / "jai_native").string();
+
+    if (!backend.unsupported.empty()) {
+        cerr << "C doesn't support " << backend.unsupported << ", using the Interpreter" << endl;
+        cout << "Running: " << endl;
+        interp.callFunction(interp.main);
+        return;
+    }
+
+    if (!buildNative(source, (dir / "jai_native.c").string(), exe)) error("cc couldn't build " + exe);
+
+    cout << "Running: " << endl << flush;
+    system(("\"" + exe + "\"").c_str());
+}
+
+// Writes the program as x86-64 assembly to asmPath, and links a static exePath out of it unless that's empty
+void emitAsm(Interpreter& interp, const string& asmPath, const string& exePath)
+{
+    interp.prepare();
+
+    IRBuilder builder(interp.functions, interp.constants, interp.structs);
+    IRModule* module = builder.build(interp.parser.statements);
+
+    AsmBackend backend(module, interp.structs, interp.enums);
+    string source = backend.compile(module->find(interp.main));
+    if (!backend.unsupported.empty()) error("The assembler backend doesn't support " + backend.unsupported);
+
+    if (exePath.empty()) {
+        ofstream out(asmPath);
+        if (!out) error("Can't write " + asmPath);
+        out << source;
+    }
+    else if (!buildStatic(source, asmPath, exePath)) error("as and ld couldn't build " + exePath);
+}
+
+// Like runC, but with as and ld, the time includes those
+void runAsm(Interpreter& interp)
+{
+    interp.prepare();
+
+    IRBuilder builder(interp.functions, interp.constants, interp.structs);
+    IRModule* module = builder.build(interp.parser.statements);
+
+    AsmBackend backend(module, interp.structs, interp.enums);
+    string source = backend.compile(module->find(interp.main));
+
+    filesystem::path dir = filesystem::temp_directory_path();
+    string exe = (dir / "jai_static").string();
+
+    if (!backend.unsupported.empty()) {
+        cerr << "The assembler backend doesn't support " << backend.unsupported << ", using the Interpreter" << endl;
+        cout << "Running: " << endl;
+        interp.callFunction(interp.main);
+        return;
+    }
+
+    if (!buildStatic(source, (dir / "jai_static.s").string(), exe)) error("as and ld couldn't build " + exe);
+
+    cout << "Running: " << endl << flush;
+    system(("\"" + exe + "\"").c_str());
+}
+
+// Usage: JaiCompiler [-ir] [-bytecode] [-engine=tree|closure|stack|register|jit|tiered|c|asm] [-threshold=n] [-time] [-nofuse] [-profile=file] [file]
+//        JaiCompiler -c=out.c [file]           only writes the C
+//        JaiCompiler -native=out [file]        builds a binary with cc, the C goes to out.c
+//        JaiCompiler -asm=out.s [file]         only writes the assembly
+//        JaiCompiler -static=out [file]        builds a static binary with as and ld, the assembly goes to out.s
+//        JaiCompiler -superinstructions=profile > Superinstructions.inc
+int main(int argc, char** argv)
 {
     const char* file = "jai_syntax.jai";
+    string engine = "tree";
+    string profile;
+    string cPath;
+    string nativePath;
+    string asmPath;
+    string staticPath;
+    bool ir = false;
+    bool bytecode = false;
+    bool time = false;
+    string memory;
+    bool fuse = true;
+    long long threshold = 1000;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-ir") ir = true;
+        else if (arg == "-bytecode") bytecode = true;
+        else if (arg == "-time") time = true;
+        else if (arg == "-memory" || arg == "-memory=json") memory = arg;
+        else if (arg == "-nofuse") fuse = false;
+        else if (arg.starts_with("-engine=")) engine = arg.substr(8);
+        else if (arg.starts_with("-profile=")) profile = arg.substr(9);
+        else if (arg.starts_with("-threshold=")) threshold = stoll(arg.substr(11));
+        else if (arg.starts_with("-gc=")) Heap::minimum = Heap::limit = stoll(arg.substr(4)) * 1024;
+        else if (arg.starts_with("-c=")) cPath = arg.substr(3);
+        else if (arg.starts_with("-native=")) nativePath = arg.substr(8);
+        else if (arg.starts_with("-asm=")) asmPath = arg.substr(5);
+        else if (arg.starts_with("-static=")) staticPath = arg.substr(8);
+        else if (arg.starts_with("-superinstructions=")) {
+            OpcodeProfile counts;
+            if (!counts.load(arg.substr(19))) error("Can't read the profile " + arg.substr(19));
+            generateSuperinstructions(counts, cout);
+            return 0;
+        }
+        else file = argv[i];
+    }
+
+    if (!profile.empty()) engine = "stack";
+
+    if (bytecode && engine == "tree") engine = "stack";
+    if (engine != "tree" && engine != "closure" && engine != "stack" && engine != "register" && engine != "jit" && engine != "tiered" && engine != "c" && engine != "asm") {
+        error("Unknown engine: " + engine + ", expected tree, closure, stack, register, jit, tiered, c or asm");
+    }
+
+    // Before anything gets made, so every allocation has a site
+    Memory::tracking = !memory.empty();
 
     cout << "Compiling: " << file << endl;
 
@@ -38,7 +301,33 @@ int main()
 
     Interpreter interp(parser);
 
-    interp.run();
+    auto start = chrono::steady_clock::now();
+
+    if (ir) dumpIR(interp);
+    else if (!cPath.empty()) emitC(interp, cPath, "");
+    else if (!nativePath.empty()) emitC(interp, nativePath + ".c", nativePath);
+    else if (!asmPath.empty()) emitAsm(interp, asmPath, "");
+    else if (!staticPath.empty()) emitAsm(interp, staticPath + ".s", staticPath);
+    else if (engine == "stack") runStackVM(interp, bytecode, fuse, profile);
+    else if (engine == "register") runRegisterVM(interp, bytecode);
+    else if (engine == "closure") runClosures(interp);
+    else if (engine == "jit" || engine == "tiered") runJit(interp, engine == "tiered", threshold);
+    else if (engine == "c") runC(interp);
+    else if (engine == "asm") runAsm(interp);
+    else interp.run();
+
+    // On stderr, so the output of the engines can still be compared
+    if (time) {
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        cerr << engine << ": " << elapsed.count() << " ms" << endl;
+    }
 
-    cout << "AnyCount = " << Any::anyCount << endl;
+    if (!memory.empty()) {
+        interp.measureMemory();
+        if (memory == "-memory=json") Memory::printJson(cerr);
+        else {
+            Memory::print(cerr);
+            Heap::print(cerr);
+        }
+    }
 }
\ No newline at end of file